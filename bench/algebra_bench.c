@@ -0,0 +1,220 @@
+// checks that every rewrite simplifyAlgebra() makes by default gives exactly
+// the same bits as the code it replaces, for operands from the corners of
+// the double range: zeros of both signs, subnormals, the largest number,
+// infinities and nans of both signs, and the ends of the integer range,
+// which have to stay integers. Then shows that the --fast-math ones
+// don't, and what the default ones save on an expression full of them
+// build and run with: make bench && ./bench/algebra_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "optimize.h"
+#include "vm.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TERMS 1000
+#define RUNS 20000
+
+// the operands, as clox source. clox has no way to write a nan or an
+// infinity, so those are computed. On x86 0/0 is a nan with the sign bit set
+static const char *specials[] = {
+    "(0 / 0)",
+    "(-(0 / 0))",
+    // more digits than fit in a double round to infinity
+    "(1" "0000000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000000000"
+    ")",
+    "(-1" "000000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000000000"
+    ")",
+    // integers, the last two overflow when negated or multiplied
+    "(0)", "(3)", "(-(7))", "(9223372036854775807)",
+    "(-(9223372036854775807) - 1)",
+};
+
+// and these are written out in full, which printf can do exactly
+static const double ordinary[] = {
+    0, -0.0, 1, -1, 0.1, -2.5, 3, 1e300,
+    DBL_MAX, -DBL_MAX, DBL_MIN, -DBL_MIN,
+    // the smallest subnormal and one that halving rounds
+    4.9406564584124654e-324, 1.4821969375237396e-323,
+};
+
+#define FINITE_COUNT (int)(sizeof(ordinary) / sizeof(ordinary[0]))
+#define SPECIAL_COUNT (int)(sizeof(specials) / sizeof(specials[0]))
+#define OPERAND_COUNT (FINITE_COUNT + SPECIAL_COUNT)
+
+// X is where the operand goes
+static const char *exact[] = {
+    "X * 1",       "1 * X",        "X / 1",          "X - 0",
+    "-(-(X))",     "-(-(-(X)))",   "X / 2",          "X / 4",
+    "X / 0.5",     "X / -(8)",     "X / 0.0009765625",
+    "(X / 2) * 1 - 0",
+};
+
+static const char *fastMath[] = {
+    "X + 0",  "0 + X",     "X * 0.0",      "0 - X",      "X * -(1)",
+    "X / 3",  "2 - -(X)",  "2 + -(X)",   "-(X) * -(2)",
+};
+
+static char operands[OPERAND_COUNT][1200];
+
+static void writeOperands() {
+  for (int i = 0; i < FINITE_COUNT; i++) {
+    char *out = operands[i];
+    double value = fabs(ordinary[i]);
+    out += sprintf(out, signbit(ordinary[i]) ? "(-(" : "((");
+    // %f with enough digits is exact, the zeros at the end are just noise.
+    // One has to stay after the point, or the literal is an integer
+    int length = sprintf(out, "%.1080f", value);
+    while (out[length - 1] == '0' && out[length - 2] != '.')
+      length--;
+    strcpy(out + length, "))");
+  }
+  for (int i = 0; i < SPECIAL_COUNT; i++) {
+    strcpy(operands[FINITE_COUNT + i], specials[i]);
+  }
+}
+
+// replaces every X in pattern with the operand
+static void fill(char *out, const char *pattern, const char *operand) {
+  for (; *pattern != '\0'; pattern++) {
+    if (*pattern == 'X') {
+      out += sprintf(out, "%s", operand);
+    } else {
+      *out++ = *pattern;
+    }
+  }
+  *out = '\0';
+}
+
+typedef struct {
+  // the value's type and bits
+  ValueType type;
+  uint64_t bits;
+  int code;
+  uint8_t bytes[4096];
+} Result;
+
+static Result run(const char *source, bool algebra, bool fast) {
+  optimizeOptions.algebra = algebra;
+  optimizeOptions.fastMath = fast;
+  Result r;
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk))
+    exit(65);
+  Value value;
+  interpretChunk(&chunk, &value);
+  r.type = value.type;
+  memcpy(&r.bits, &value.as, sizeof(r.bits));
+  r.code = chunk.count;
+  memcpy(r.bytes, chunk.code, chunk.count < 4096 ? chunk.count : 4096);
+  freeChunk(&chunk);
+  return r;
+}
+
+static double runTime(const char *source, bool algebra, int *code) {
+  optimizeOptions.algebra = algebra;
+  optimizeOptions.fastMath = false;
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk))
+    exit(65);
+  *code = chunk.count;
+  Value result;
+  interpretChunk(&chunk, &result);
+  double start = now();
+  for (int i = 0; i < RUNS; i++) {
+    interpretChunk(&chunk, &result);
+  }
+  double us = (now() - start) / RUNS / 1e3;
+  freeChunk(&chunk);
+  return us;
+}
+
+int main() {
+  initVM();
+  writeOperands();
+  // CSE would get in the way of telling which rewrites happened
+  optimizeOptions.cse = false;
+  static char source[8192];
+  bool failed = false;
+
+  printf("default rewrites, %d operands each\n", OPERAND_COUNT);
+  for (int p = 0; p < (int)(sizeof(exact) / sizeof(exact[0])); p++) {
+    int same = 0;
+    int rewritten = 0;
+    for (int i = 0; i < OPERAND_COUNT; i++) {
+      fill(source, exact[p], operands[i]);
+      Result off = run(source, false, false);
+      Result on = run(source, true, false);
+      if (off.type == on.type && off.bits == on.bits) {
+        same++;
+      } else {
+        printf("  %s: %016llx instead of %016llx\n", source,
+               (unsigned long long)on.bits, (unsigned long long)off.bits);
+      }
+      if (off.code != on.code || memcmp(off.bytes, on.bytes, on.code) != 0)
+        rewritten++;
+    }
+    // X / 1 and friends can't be rewritten for the integers
+    printf("%-22s %2d/%d bit-exact, %2d rewritten\n", exact[p], same,
+           OPERAND_COUNT, rewritten);
+    failed |= same != OPERAND_COUNT || rewritten == 0;
+  }
+
+  // the default rewrites still happen in these, X * 0.0 with X = 1.0 is
+  // 1.0 * 0.0. But only --fast-math may change the result
+  printf("\n--fast-math rewrites\n");
+  for (int p = 0; p < (int)(sizeof(fastMath) / sizeof(fastMath[0])); p++) {
+    int same = 0;
+    bool rewritten = false;
+    bool exactWithout = true;
+    for (int i = 0; i < OPERAND_COUNT; i++) {
+      fill(source, fastMath[p], operands[i]);
+      Result off = run(source, false, false);
+      Result safe = run(source, true, false);
+      Result on = run(source, true, true);
+      if (off.type == on.type && off.bits == on.bits)
+        same++;
+      if (safe.type != off.type || safe.bits != off.bits)
+        exactWithout = false;
+      if (on.code != safe.code || memcmp(on.bytes, safe.bytes, on.code) != 0)
+        rewritten = true;
+    }
+    printf("%-22s %2d/%d bit-exact%s%s\n", fastMath[p], same, OPERAND_COUNT,
+           rewritten ? "" : ", NOT REWRITTEN",
+           exactWithout ? "" : ", CHANGED WITHOUT --fast-math");
+    failed |= !rewritten || !exactWithout;
+  }
+
+  // an expression made of the rewrites, to see what they're worth
+  char *big = malloc((size_t)TERMS * 64);
+  size_t used = 0;
+  for (int i = 0; i < TERMS; i++) {
+    used += sprintf(big + used, "%s(%d.5 / 4 * 1 - -(-%d) / 8)",
+                    i == 0 ? "" : i % 2 == 0 ? " + " : " - ", i, i % 100);
+  }
+  int offCode, onCode;
+  double offUs = runTime(big, false, &offCode);
+  double onUs = runTime(big, true, &onCode);
+  printf("\n%d terms: %d bytes, %.2f us without, %d bytes, %.2f us with, "
+         "%.2fx faster\n",
+         TERMS, offCode, offUs, onCode, onUs, offUs / onUs);
+  free(big);
+
+  optimizeOptions = (OptimizeOptions){true, false, true};
+  freeVM();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+#ifndef clox_bench_h
+#define clox_bench_h
+
+// what the benchmarks have in common. Each one is a single file built with
+// everything but main.c (see the Makefile), so this is all in the header
+#include "chunk.h"
+#include "compiler.h"
+#include "dtoa.h"
+#include "object.h"
+#include "vm.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// nanoseconds on a clock that only goes forward
+static inline double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// a script and what running it has to give
+typedef struct {
+  const char *source;
+  InterpretResult result;
+  // for the ones that run, the type of the result and the result the way
+  // clox prints it
+  ValueType type;
+  const char *printed;
+} Check;
+
+static inline const char *typeName(ValueType type) {
+  switch (type) {
+  case VAL_NUMBER:
+    return "double";
+  case VAL_BOOL:
+    return "bool";
+  case VAL_NIL:
+    return "nil";
+  case VAL_INT:
+    return "integer";
+  case VAL_OBJ:
+    return "string";
+  }
+  return "other";
+}
+
+// compiles and runs the check's script, twice so that the second run takes
+// the quickened instructions, with whatever vm.useJit and optimizeOptions
+// are. Prints what is wrong if anything is
+static inline bool check(const Check *c) {
+  Chunk chunk;
+  initChunk(&chunk);
+  bool compiled = compile(c->source, &chunk);
+  bool ok = true;
+  for (int run = 0; run < 2; run++) {
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
+    Value value = NIL_VAL;
+    if (compiled) {
+      result = interpretChunk(&chunk, &value);
+    }
+    char printed[NUMBER_BUFFER_SIZE] = "";
+    const char *text = printed;
+    if (result != INTERPRET_OK) {
+      value = NIL_VAL;
+    } else if (IS_STRING(value)) {
+      text = AS_CSTRING(value);
+    } else if (IS_BOOL(value)) {
+      text = AS_BOOL(value) ? "true" : "false";
+    } else if (IS_NIL(value)) {
+      text = "nil";
+    } else if (IS_INT(value)) {
+      printed[formatInteger(AS_INT(value), printed)] = '\0';
+    } else {
+      printed[formatNumber(AS_NUMBER(value), printed)] = '\0';
+    }
+    if (result != c->result ||
+        (result == INTERPRET_OK &&
+         (value.type != c->type || strcmp(text, c->printed) != 0))) {
+      printf("  %s%s: result %d %s %s instead of %d %s %s\n", c->source,
+             vm.useJit ? " (jit)" : "", result, typeName(value.type), text,
+             c->result, typeName(c->type),
+             c->printed != NULL ? c->printed : "");
+      ok = false;
+    }
+    // an error is the same the second time, it would only be printed twice
+    if (result != INTERPRET_OK)
+      break;
+  }
+  freeChunk(&chunk);
+  return ok;
+}
+
+#endif
@@ -0,0 +1,114 @@
+// compile time and memory for large expressions. heap is the most memory the
+// compiler had allocated at once (through reallocate(), so the source text
+// isn't included), rss the peak resident memory of the process after the
+// first compile, the way clox compiles a script once. Each case runs in a
+// child process of its own so that rss belongs to that case alone. Later
+// compiles in the same process only go into the timing: the allocator keeps
+// memory around between them, which says more about malloc than the compiler
+// build and run with: make bench && ./bench/compile_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define RUNS 5
+
+typedef struct {
+  const char *name;
+  // writes term number i of the expression, without the operator before it
+  int (*term)(char *out, int i);
+  int terms;
+} Case;
+
+// small integers, the most common literals
+static int integerTerm(char *out, int i) { return sprintf(out, "%d", i % 500); }
+
+// decimals, which all end up in the constant pool
+static int decimalTerm(char *out, int i) { return sprintf(out, "%d.25", i); }
+
+// a small nested expression per term
+static int nestedTerm(char *out, int i) {
+  return sprintf(out, "(-(%d.5 * 2) - (3 + %d) / 4)", i % 1000, i % 7);
+}
+
+static const Case cases[] = {
+    {"integers", integerTerm, 1000000},
+    {"decimals", decimalTerm, 1000000},
+    {"nested", nestedTerm, 300000},
+};
+
+// the terms joined with alternating + and -, ten terms to a line
+static char *buildSource(const Case *c, size_t *length) {
+  size_t capacity = (size_t)c->terms * 48 + 1;
+  char *source = malloc(capacity);
+  size_t used = 0;
+  for (int i = 0; i < c->terms; i++) {
+    if (i > 0) {
+      used += sprintf(source + used, i % 10 == 0 ? "\n%c " : " %c ",
+                      i % 2 == 0 ? '+' : '-');
+    }
+    used += c->term(source + used, i);
+  }
+  source[used] = '\0';
+  *length = used;
+  return source;
+}
+
+static void runCase(const Case *c) {
+  size_t length;
+  char *source = buildSource(c, &length);
+
+  struct rusage usage;
+  double best = 0;
+  int code = 0;
+  int constants = 0;
+  size_t heap = 0;
+  for (int run = 0; run < RUNS; run++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    size_t before = bytesAllocated;
+    peakBytesAllocated = bytesAllocated;
+    double start = now();
+    if (!compile(source, &chunk))
+      exit(65);
+    double elapsed = now() - start;
+    heap = peakBytesAllocated - before;
+    if (run == 0) {
+      getrusage(RUSAGE_SELF, &usage);
+    }
+    if (run == 0 || elapsed < best)
+      best = elapsed;
+    code = chunk.count;
+    constants = chunk.constants.count;
+    freeChunk(&chunk);
+  }
+
+  printf("%-10s %9zu %9d %9d %8.1f %7.1f %8.1f %8.1f\n", c->name, length, code,
+         constants, best / 1e6, length / best * 1e3, heap / 1e6,
+         usage.ru_maxrss / 1024.0);
+  free(source);
+}
+
+int main() {
+  printf("%-10s %9s %9s %9s %8s %7s %8s %8s\n", "case", "bytes", "code",
+         "constants", "ms", "MB/s", "heap MB", "rss MB");
+  fflush(stdout);
+  int caseCount = sizeof(cases) / sizeof(cases[0]);
+  for (int i = 0; i < caseCount; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      runCase(&cases[i]);
+      fflush(stdout);
+      _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+  }
+  return 0;
+}
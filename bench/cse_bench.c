@@ -0,0 +1,129 @@
+// bytecode size, compile time and run time of expressions that repeat the
+// same subexpressions over and over, the way generated ones do, compiled with
+// and without common subexpression elimination (see optimize.h). The last
+// case has no repeats at all and shows what the pass costs when it finds
+// nothing
+// build and run with: make bench && ./bench/cse_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "optimize.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TERMS 1000
+#define RUNS 20000
+#define COMPILES 200
+
+typedef struct {
+  const char *name;
+  // writes term number i of the expression, without the operator before it
+  int (*term)(char *out, int i);
+} Case;
+
+// one subexpression in every term, scaled by a few different factors
+static int sharedTerm(char *out, int i) {
+  return sprintf(out, "(1.5 * 2.25 + 3.75) * %d", i % 7 + 2);
+}
+
+// a polynomial in a subexpression, so it repeats inside every term as well
+static int polynomialTerm(char *out, int i) {
+  return sprintf(out,
+                 "((2.5 - 0.5 * 3) * (2.5 - 0.5 * 3) * %d.5 + "
+                 "(2.5 - 0.5 * 3) / %d)",
+                 i % 5, i % 3 + 1);
+}
+
+// repeats inside repeats
+static int nestedTerm(char *out, int i) {
+  const char *inner = "((1.25 + 2) * (3 - 0.5) - 4 / 7)";
+  return sprintf(out, "(%s * %s - -%s) / (%s + %d)", inner, inner, inner,
+                 inner, i % 11);
+}
+
+static int uniqueTerm(char *out, int i) {
+  return sprintf(out, "(%d.5 * 2 - %d)", i, i % 1000 + 1000);
+}
+
+static const Case cases[] = {
+    {"shared", sharedTerm},
+    {"polynomial", polynomialTerm},
+    {"nested", nestedTerm},
+    {"unique", uniqueTerm},
+};
+
+static char *buildSource(const Case *c) {
+  char *source = malloc((size_t)TERMS * 256);
+  size_t used = 0;
+  for (int i = 0; i < TERMS; i++) {
+    if (i > 0) {
+      used += sprintf(source + used, i % 2 == 0 ? " + " : " - ");
+    }
+    used += c->term(source + used, i);
+  }
+  source[used] = '\0';
+  return source;
+}
+
+typedef struct {
+  int code;
+  int maxStack;
+  double compileUs;
+  double runUs;
+  double result;
+} Measurement;
+
+static Measurement measure(const char *source, bool cse) {
+  optimizeOptions.cse = cse;
+  Measurement m;
+
+  double start = now();
+  for (int i = 0; i < COMPILES; i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compile(source, &chunk))
+      exit(65);
+    freeChunk(&chunk);
+  }
+  m.compileUs = (now() - start) / COMPILES / 1e3;
+
+  Chunk chunk;
+  initChunk(&chunk);
+  compile(source, &chunk);
+  m.code = chunk.count;
+  m.maxStack = chunk.maxStack;
+  Value result;
+  interpretChunk(&chunk, &result);
+  start = now();
+  for (int i = 0; i < RUNS; i++) {
+    interpretChunk(&chunk, &result);
+  }
+  m.runUs = (now() - start) / RUNS / 1e3;
+  m.result = TO_NUMBER(result);
+  freeChunk(&chunk);
+  return m;
+}
+
+int main() {
+  initVM();
+  printf("%d terms per expression\n", TERMS);
+  printf("%-11s %-4s %7s %6s %11s %8s\n", "case", "cse", "code", "stack",
+         "compile us", "run us");
+  int caseCount = sizeof(cases) / sizeof(cases[0]);
+  for (int i = 0; i < caseCount; i++) {
+    char *source = buildSource(&cases[i]);
+    Measurement off = measure(source, false);
+    Measurement on = measure(source, true);
+    printf("%-11s %-4s %7d %6d %11.1f %8.2f\n", cases[i].name, "off",
+           off.code, off.maxStack, off.compileUs, off.runUs);
+    printf("%-11s %-4s %7d %6d %11.1f %8.2f", "", "on", on.code, on.maxStack,
+           on.compileUs, on.runUs);
+    printf("   %.2fx smaller, %.2fx faster%s\n", (double)off.code / on.code,
+           off.runUs / on.runUs, off.result == on.result ? "" : ", DIFFERENT");
+    free(source);
+  }
+  optimizeOptions.cse = true;
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,130 @@
+// compares chunks translated to C by --emit-c (and compiled with cc -O2)
+// against running the same chunks in the VM
+// build and run with: make bench && ./bench/emitc_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "emitc.h"
+#include "vm.h"
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define ITERATIONS 2000000
+
+// the part of the emitted clox_value that matters here, see emitc.c
+typedef struct {
+  int type;
+  union {
+    double number;
+    long long integer;
+  };
+} EmittedValue;
+
+// the emitted type tags
+#define EMITTED_NUMBER 2
+#define EMITTED_INT 3
+
+typedef int (*EmittedFn)(EmittedValue *result, const EmittedValue *globals);
+
+// the globals the last expression reads
+static const char *declarations = "var x = 1.5; var y = 2; 0";
+
+static const char *expressions[] = {
+    "1 + 2",
+    "(1 + 2) * 3 - 4 / 5",
+    "-(1.5 * 2.5) + (3.25 - 4.125) * (5 / 6) - -7",
+    "1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10 + 11 + 12 + 13 + 14 + 15 + 16",
+    "((1 * 2 + 3) * (4 * 5 + 6) - (7 * 8 + 9) / (10 * 11 + 12)) * 13 / 14",
+    "(x * y + 1) * (x * y + 1) - x / y",
+};
+
+// translate the chunk, compile it into a shared library and load it back
+static EmittedFn build(Chunk *chunk, int index) {
+  char source[64], library[64], command[256];
+  snprintf(source, sizeof(source), "/tmp/clox-emitc-%d-%d.c", getpid(), index);
+  snprintf(library, sizeof(library), "/tmp/clox-emitc-%d-%d.so", getpid(),
+           index);
+
+  FILE *out = fopen(source, "w");
+  if (out == NULL || !emitC(chunk, "expression", out))
+    return NULL;
+  fclose(out);
+
+  snprintf(command, sizeof(command), "cc -O2 -shared -fPIC -o %s %s", library,
+           source);
+  int status = system(command);
+  remove(source);
+  if (status != 0)
+    return NULL;
+
+  void *handle = dlopen(library, RTLD_NOW);
+  remove(library);
+  if (handle == NULL)
+    return NULL;
+  return (EmittedFn)dlsym(handle, "expression");
+}
+
+int main() {
+  initVM();
+  Chunk declared;
+  initChunk(&declared);
+  Value value;
+  if (!compile(declarations, &declared) ||
+      interpretChunk(&declared, &value) != INTERPRET_OK)
+    return 1;
+  freeChunk(&declared);
+  // the VM's globals the way the emitted code takes them, all numbers here
+  EmittedValue globals[2];
+  for (int i = 0; i < vm.globals.count; i++) {
+    Value global = vm.globals.values[i];
+    globals[i].type = IS_INT(global) ? EMITTED_INT : EMITTED_NUMBER;
+    if (IS_INT(global)) {
+      globals[i].integer = AS_INT(global);
+    } else {
+      globals[i].number = AS_NUMBER(global);
+    }
+  }
+
+  printf("%-70s %10s %10s %8s\n", "expression", "vm ns", "emitted ns",
+         "speedup");
+  for (size_t i = 0; i < sizeof(expressions) / sizeof(expressions[0]); i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compile(expressions[i], &chunk))
+      return 1;
+    EmittedFn emitted = build(&chunk, (int)i);
+    if (emitted == NULL) {
+      fprintf(stderr, "Could not build the emitted code.\n");
+      return 1;
+    }
+
+    double start = now();
+    for (int n = 0; n < ITERATIONS; n++) {
+      interpretChunk(&chunk, &value);
+    }
+    double interpreted = (now() - start) / ITERATIONS;
+
+    EmittedValue emittedValue;
+    start = now();
+    for (int n = 0; n < ITERATIONS; n++) {
+      emitted(&emittedValue, globals);
+    }
+    double native = (now() - start) / ITERATIONS;
+
+    double result = emittedValue.type == EMITTED_INT
+                        ? (double)emittedValue.integer
+                        : emittedValue.number;
+    if (result != TO_NUMBER(value)) {
+      fprintf(stderr, "Results differ for %s: %g vs %g.\n", expressions[i],
+              TO_NUMBER(value), result);
+      return 1;
+    }
+    printf("%-70s %10.1f %10.1f %7.1fx\n", expressions[i], interpreted, native,
+           interpreted / native);
+    freeChunk(&chunk);
+  }
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,66 @@
+// disassembleChunk() against exportChunk() on a chunk with millions of
+// instructions. Everything is written to /dev/null, the timings go to stderr
+// build and run with: make bench && ./bench/export_bench
+#include "bench.h"
+#include "chunk.h"
+#include "debug.h"
+#include <stdio.h>
+
+// instructions in the chunk
+#define COUNT 4000000
+// how many distinct constants it loads, enough to need OP_CONSTANT_LONG
+#define CONSTANTS 100000
+
+// loads followed by adds, three instructions to a line
+static void fillChunk(Chunk *chunk) {
+  for (int i = 0; i < CONSTANTS; i++) {
+    addConstant(chunk, NUMBER_VAL(i * 0.5));
+  }
+  for (int i = 0; i < COUNT - 1; i++) {
+    int line = i / 3 + 1;
+    if (i % 2 == 1) {
+      writeChunk(chunk, OP_ADD, line);
+      continue;
+    }
+    int index = (i / 2) % CONSTANTS;
+    if (index < 256) {
+      writeChunk(chunk, OP_CONSTANT, line);
+      writeChunk(chunk, (uint8_t)index, line);
+    } else {
+      writeChunk(chunk, OP_CONSTANT_LONG, line);
+      writeChunk(chunk, index & 0xff, line);
+      writeChunk(chunk, (index >> 8) & 0xff, line);
+      writeChunk(chunk, (index >> 16) & 0xff, line);
+    }
+  }
+  writeChunk(chunk, OP_RETURN, COUNT / 3 + 1);
+}
+
+static void report(const char *name, double elapsed) {
+  fprintf(stderr, "%-18s %8.1f ms %8.1f ns/instruction\n", name, elapsed / 1e6,
+          elapsed / COUNT);
+}
+
+int main() {
+  if (freopen("/dev/null", "w", stdout) == NULL)
+    return 1;
+  Chunk chunk;
+  initChunk(&chunk);
+  fillChunk(&chunk);
+
+  double start = now();
+  disassembleChunk(&chunk, "bench");
+  fflush(stdout);
+  report("disassembleChunk", now() - start);
+
+  start = now();
+  exportChunk(&chunk, EXPORT_JSON, stdout);
+  report("export json", now() - start);
+
+  start = now();
+  exportChunk(&chunk, EXPORT_BINARY, stdout);
+  report("export binary", now() - start);
+
+  freeChunk(&chunk);
+  return 0;
+}
@@ -0,0 +1,147 @@
+// checks what global variables do, then measures what a global costs: a sum
+// that reads globals is timed against the same sum over literals, and the
+// difference per read is set next to what looking the name up in a hash
+// table would cost instead. Assignments are timed the same way
+// build and run with: make bench && ./bench/global_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// how many globals the scripts declare, how many reads or assignments each
+// one has, and how often each one runs
+#define GLOBALS 64
+#define ACCESSES 4000
+#define RUNS 5000
+#define LOOKUPS 10000000
+
+static const Check checks[] = {
+    {"var a = 2; a * 3", INTERPRET_OK, VAL_INT, "6"},
+    {"var a = 2; var b = a + 1; a * b", INTERPRET_OK, VAL_INT, "6"},
+    {"var a = 1; a = a + 1; a = a * 10; a", INTERPRET_OK, VAL_INT, "20"},
+    // an assignment is an expression
+    {"var a = 1; var b = 1; a = b = 5; a + b", INTERPRET_OK, VAL_INT, "10"},
+    {"var a = 1; var a = a + 1; a", INTERPRET_OK, VAL_INT, "2"},
+    // reads are shared only in a statement that doesn't assign the global
+    {"var a = 2; (a + 1) * (a + 1)", INTERPRET_OK, VAL_INT, "9"},
+    {"var a = 2; (a * 3) + (a = 5) + (a * 3)", INTERPRET_OK, VAL_INT, "26"},
+    {"var s = \"ab\"; s = s + s; s", INTERPRET_OK, VAL_OBJ, "abab"},
+    // declared in an earlier run, see main()
+    {"earlier + 1", INTERPRET_OK, VAL_INT, "42"},
+    {"undefined + 1", INTERPRET_RUNTIME_ERROR, VAL_NIL, NULL},
+    {"undefined = 1; 2", INTERPRET_RUNTIME_ERROR, VAL_NIL, NULL},
+    {"var a = 1; 1 + a = 2", INTERPRET_COMPILE_ERROR, VAL_NIL, NULL},
+    {"var a = 1;", INTERPRET_COMPILE_ERROR, VAL_NIL, NULL},
+};
+
+// declares g0 to g63, then a sum of ACCESSES terms. With globals set each term
+// reads one of them, otherwise it is a literal with the same value. With
+// assign set, each term is a statement instead: gN = gN + 1;
+static char *buildSource(bool globals, bool assign) {
+  char *source = malloc((size_t)(GLOBALS + ACCESSES) * 32);
+  size_t used = 0;
+  for (int i = 0; i < GLOBALS; i++) {
+    used += sprintf(source + used, "var g%d = %d;\n", i, i);
+  }
+  for (int i = 0; i < ACCESSES; i++) {
+    int slot = (i * 7) % GLOBALS;
+    if (assign) {
+      used += sprintf(source + used, "g%d = g%d + 1;\n", slot, slot);
+    } else if (globals) {
+      used += sprintf(source + used, "%sg%d", i == 0 ? "" : " + ", slot);
+    } else {
+      used += sprintf(source + used, "%s%d", i == 0 ? "" : " + ", slot);
+    }
+  }
+  if (assign) {
+    used += sprintf(source + used, "g0");
+  }
+  return source;
+}
+
+// microseconds per run
+static double runTime(const char *source) {
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk))
+    exit(65);
+  Value result;
+  if (interpretChunk(&chunk, &result) != INTERPRET_OK)
+    exit(70);
+  double start = now();
+  for (int i = 0; i < RUNS; i++) {
+    interpretChunk(&chunk, &result);
+  }
+  double us = (now() - start) / RUNS / 1e3;
+  freeChunk(&chunk);
+  return us;
+}
+
+// ns per lookup of a global's value by its name, in a table like the one
+// that interns strings. That is what each read would cost if the names
+// weren't resolved to slots when compiling
+static double lookupTime() {
+  Table table;
+  initTable(&table);
+  ObjString *names[GLOBALS];
+  for (int i = 0; i < GLOBALS; i++) {
+    char name[16];
+    int length = sprintf(name, "g%d", i);
+    names[i] = copyString(name, length);
+    tableSet(&table, names[i], INT_VAL(i));
+  }
+  int64_t sum = 0;
+  double start = now();
+  for (int i = 0; i < LOOKUPS; i++) {
+    Value value;
+    tableGet(&table, names[(i * 7) % GLOBALS], &value);
+    sum += AS_INT(value);
+  }
+  double ns = (now() - start) / LOOKUPS;
+  // so the loop isn't optimized away
+  if (sum == 42)
+    printf("\n");
+  freeTable(&table);
+  return ns;
+}
+
+int main() {
+  initVM();
+  interpret("var earlier = 41; 0");
+  printf("(runtime and compile errors below are expected)\n");
+  fflush(stdout);
+  int checkCount = sizeof(checks) / sizeof(checks[0]);
+  int passed = 0;
+  for (int i = 0; i < checkCount; i++) {
+    passed += check(&checks[i]);
+  }
+  printf("%d/%d checks pass\n", passed, checkCount);
+
+  char *literals = buildSource(false, false);
+  char *reads = buildSource(true, false);
+  char *assignments = buildSource(true, true);
+  double literalUs = runTime(literals);
+  double readUs = runTime(reads);
+  double assignUs = runTime(assignments);
+  printf("\n%d globals, %d accesses %12s %12s\n", GLOBALS, ACCESSES,
+         "us per run", "ns per access");
+  printf("%-26s %12.2f\n", "sum of literals", literalUs);
+  printf("%-26s %12.2f %12.2f\n", "sum of globals", readUs,
+         (readUs - literalUs) * 1e3 / ACCESSES);
+  // a read, an add, a set and a pop per access
+  printf("%-26s %12.2f %12.2f\n", "g = g + 1 statements", assignUs,
+         assignUs * 1e3 / ACCESSES);
+  printf("%-26s %12s %12.2f\n", "lookup by name (table)", "",
+         lookupTime());
+  free(literals);
+  free(reads);
+  free(assignments);
+
+  freeVM();
+  return passed == checkCount ? 0 : 1;
+}
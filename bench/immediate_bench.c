@@ -0,0 +1,48 @@
+// how big the constant pool and the code of typical expressions are and how
+// long one interpreter run takes. Small integer literals are pushed by
+// immediate instructions (OP_ZERO, OP_ONE, OP_SMALL_INT...) and stay out of
+// the pool, other numbers still go through it
+// build and run with: make bench && ./bench/immediate_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "vm.h"
+#include <stdio.h>
+
+#define ITERATIONS 5000000
+
+static const char *expressions[] = {
+    "1 + 2",
+    "(1 + 2) * 3 - 4 / 5",
+    "100 * 0 + 1 - 250 / 1000",
+    "-(1.5 * 2.5) + (3.25 - 4.125) * (5 / 6) - -7",
+    "1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10 + 11 + 12 + 13 + 14 + 15 + 16",
+    "((1 * 2 + 3) * (4 * 5 + 6) - (7 * 8 + 9) / (10 * 11 + 12)) * 13 / 14",
+};
+
+int main() {
+  initVM();
+  printf("%-70s %9s %6s %9s\n", "expression", "constants", "code",
+         "ns/run");
+  int expressionCount = sizeof(expressions) / sizeof(expressions[0]);
+  for (int i = 0; i < expressionCount; i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compile(expressions[i], &chunk))
+      return 65;
+
+    Value result;
+    interpretChunk(&chunk, &result);
+    double start = now();
+    for (int j = 0; j < ITERATIONS; j++) {
+      interpretChunk(&chunk, &result);
+    }
+    double elapsed = (now() - start) / ITERATIONS;
+
+    printf("%-70s %9d %6d %9.1f\n", expressions[i], chunk.constants.count,
+           chunk.count, elapsed);
+    freeChunk(&chunk);
+  }
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,116 @@
+// checks what integer arithmetic gives, in the interpreter and in the JIT:
+// integers past 2^53 stay exact, overflows turn into doubles instead of
+// wrapping around, dividing and mixing with a double give a double. Then
+// times the same expression written with integer literals and with double
+// ones
+// build and run with: make bench && ./bench/int_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "optimize.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TERMS 1000
+#define RUNS 20000
+
+static const Check checks[] = {
+    {"1 + 2", INTERPRET_OK, VAL_INT, "3"},
+    {"7 - 10", INTERPRET_OK, VAL_INT, "-3"},
+    {"6 * 7", INTERPRET_OK, VAL_INT, "42"},
+    {"-(5)", INTERPRET_OK, VAL_INT, "-5"},
+    // 2^53 + 1, which a double can't hold
+    {"9007199254740993", INTERPRET_OK, VAL_INT, "9007199254740993"},
+    {"9007199254740992 + 1", INTERPRET_OK, VAL_INT, "9007199254740993"},
+    {"9223372036854775807 - 1", INTERPRET_OK, VAL_INT, "9223372036854775806"},
+    // the overflows, each done in doubles instead
+    {"9223372036854775807 + 1", INTERPRET_OK, VAL_NUMBER,
+     "9223372036854776000"},
+    {"-(9223372036854775807) - 2", INTERPRET_OK, VAL_NUMBER,
+     "-9223372036854776000"},
+    {"3037000500 * 3037000500", INTERPRET_OK, VAL_NUMBER,
+     "9223372037000250000"},
+    {"-(-(9223372036854775807) - 1)", INTERPRET_OK, VAL_NUMBER,
+     "9223372036854776000"},
+    {"-(9223372036854775807) - 1", INTERPRET_OK, VAL_INT,
+     "-9223372036854775808"},
+    // too big for an integer literal, so it's a double literal
+    {"9223372036854775808", INTERPRET_OK, VAL_NUMBER, "9223372036854776000"},
+    {"7 / 2", INTERPRET_OK, VAL_NUMBER, "3.5"},
+    {"4 / 2", INTERPRET_OK, VAL_NUMBER, "2"},
+    {"1 / 0", INTERPRET_OK, VAL_NUMBER, "inf"},
+    {"2 * 3.5", INTERPRET_OK, VAL_NUMBER, "7"},
+    {"1 - 0.5", INTERPRET_OK, VAL_NUMBER, "0.5"},
+    {"2 * 1.0", INTERPRET_OK, VAL_NUMBER, "2"},
+    {"9007199254740993 + 0.0", INTERPRET_OK, VAL_NUMBER, "9007199254740992"},
+    // there is no integer -0
+    {"-(0)", INTERPRET_OK, VAL_INT, "0"},
+    {"-(0.0)", INTERPRET_OK, VAL_NUMBER, "-0"},
+    {"(1 + 2) * (1 + 2) - 3", INTERPRET_OK, VAL_INT, "6"},
+};
+
+// a sum of small products, with ".0" after every literal when doubles is set
+static char *buildSource(bool doubles) {
+  const char *suffix = doubles ? ".0" : "";
+  char *source = malloc((size_t)TERMS * 64);
+  size_t used = 0;
+  for (int i = 0; i < TERMS; i++) {
+    used += sprintf(source + used, "%s%d%s * %d%s - %d%s",
+                    i == 0 ? "" : " + ", i % 97 + 2, suffix, i % 13 + 3,
+                    suffix, i % 7 + 1, suffix);
+  }
+  return source;
+}
+
+static double runTime(const char *source, bool useJit) {
+  vm.useJit = useJit;
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk))
+    exit(65);
+  Value result;
+  interpretChunk(&chunk, &result);
+  double start = now();
+  for (int i = 0; i < RUNS; i++) {
+    interpretChunk(&chunk, &result);
+  }
+  double us = (now() - start) / RUNS / 1e3;
+  freeChunk(&chunk);
+  return us;
+}
+
+int main() {
+  initVM();
+  // the checks are about what the VM does, not about which rewrites the
+  // optimizer manages to make first
+  optimizeOptions.algebra = false;
+  optimizeOptions.cse = false;
+  int checkCount = sizeof(checks) / sizeof(checks[0]);
+  int passed = 0;
+  for (int i = 0; i < checkCount; i++) {
+    vm.useJit = false;
+    bool interpreted = check(&checks[i]);
+    vm.useJit = true;
+    bool jitted = check(&checks[i]);
+    passed += interpreted && jitted;
+  }
+  printf("%d/%d checks pass in the interpreter and the JIT\n", passed,
+         checkCount);
+  optimizeOptions = (OptimizeOptions){true, false, true};
+
+  char *integers = buildSource(false);
+  char *doubles = buildSource(true);
+  printf("\n%d terms %12s %12s\n", TERMS, "interp us", "jit us");
+  printf("%-9s %12.2f %12.2f\n", "integers", runTime(integers, false),
+         runTime(integers, true));
+  printf("%-9s %12.2f %12.2f\n", "doubles", runTime(doubles, false),
+         runTime(doubles, true));
+  free(integers);
+  free(doubles);
+
+  vm.useJit = false;
+  freeVM();
+  return passed == checkCount ? 0 : 1;
+}
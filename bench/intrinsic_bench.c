@@ -0,0 +1,147 @@
+// what the intrinsics (sqrt, abs, floor, exp, min, max and pow, see OP_SQRT
+// in chunk.h) cost in the VM next to calling the same function from C. Each
+// case is run once per input with the inputs in globals, so nothing folds,
+// and x + y is there for what the dispatch and the global loads alone cost.
+// Every result is compared bit for bit with the C call's
+// build and run with: make bench && ./bench/intrinsic_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "object.h"
+#include "vm.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUTS 1000000
+#define RUNS 3
+
+static const char *declarations = "var x = 0; var y = 0; 0";
+
+typedef struct {
+  const char *source;
+  double (*function)(double, double);
+} Case;
+
+static double add(double x, double y) { return x + y; }
+static double squareRoot(double x, double y) { return sqrt(x); }
+static double absolute(double x, double y) { return fabs(x); }
+static double floorOf(double x, double y) { return floor(x); }
+static double exponential(double x, double y) { return exp(x); }
+static double power(double x, double y) { return pow(x, y); }
+static double hypotenuse(double x, double y) { return sqrt(x * x + y * y); }
+
+static const Case cases[] = {
+    {"x + y", add},
+    {"sqrt(x)", squareRoot},
+    {"abs(x)", absolute},
+    {"floor(x)", floorOf},
+    {"exp(x)", exponential},
+    {"min(x, y)", minNumber},
+    {"max(x, y)", maxNumber},
+    {"pow(x, y)", power},
+    {"sqrt(x * x + y * y)", hypotenuse},
+};
+
+static int xSlot;
+static int ySlot;
+static double *xs;
+static double *ys;
+
+static uint64_t rngState = 88172645463325252ull;
+
+static double uniform() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return (rngState >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// ns per input for the C function, the best of RUNS runs. The sum keeps the
+// calls from being optimized away
+static double timeC(const Case *c, double *sum) {
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now();
+    double total = 0;
+    for (int i = 0; i < INPUTS; i++) {
+      total += c->function(xs[i], ys[i]);
+    }
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < best)
+      best = elapsed;
+    *sum = total;
+  }
+  return best / INPUTS;
+}
+
+// ns per input in the VM. Counts the results that aren't the bits the C
+// function gives
+static double timeVm(const Case *c, Chunk *chunk, int *wrong) {
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now();
+    for (int i = 0; i < INPUTS; i++) {
+      vm.globals.values[xSlot] = NUMBER_VAL(xs[i]);
+      vm.globals.values[ySlot] = NUMBER_VAL(ys[i]);
+      Value value;
+      if (interpretChunk(chunk, &value) != INTERPRET_OK)
+        exit(70);
+      if (run == 0) {
+        double expected = c->function(xs[i], ys[i]);
+        if (!IS_NUMBER(value) ||
+            memcmp(&value.as.number, &expected, sizeof(expected)) != 0)
+          (*wrong)++;
+      }
+    }
+    double elapsed = now() - start;
+    // the first run checks every result, which isn't what is being timed
+    if (run == 1 || (run > 1 && elapsed < best))
+      best = elapsed;
+  }
+  return best / INPUTS;
+}
+
+int main() {
+  initVM();
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(declarations, &chunk))
+    exit(65);
+  Value value;
+  interpretChunk(&chunk, &value);
+  freeChunk(&chunk);
+  xSlot = globalSlot(copyString("x", 1));
+  ySlot = globalSlot(copyString("y", 1));
+
+  // x from -50 to 50 and y from -4 to 4, so pow() gets negative bases and
+  // fractional exponents, and some nans with them
+  xs = malloc(sizeof(double) * INPUTS);
+  ys = malloc(sizeof(double) * INPUTS);
+  for (int i = 0; i < INPUTS; i++) {
+    xs[i] = (uniform() - 0.5) * 100;
+    ys[i] = (uniform() - 0.5) * 8;
+  }
+
+  printf("%-20s %8s %8s %9s %7s\n", "case", "C ns", "VM ns", "VM - C", "wrong");
+  bool ok = true;
+  int caseCount = sizeof(cases) / sizeof(cases[0]);
+  for (int i = 0; i < caseCount; i++) {
+    initChunk(&chunk);
+    if (!compile(cases[i].source, &chunk))
+      exit(65);
+    double sum;
+    double c = timeC(&cases[i], &sum);
+    int wrong = 0;
+    double interpreted = timeVm(&cases[i], &chunk, &wrong);
+    printf("%-20s %8.2f %8.2f %9.2f %7d\n", cases[i].source, c, interpreted,
+           interpreted - c, wrong);
+    ok &= wrong == 0;
+    freeChunk(&chunk);
+  }
+  free(xs);
+  free(ys);
+  freeVM();
+  return ok ? 0 : 1;
+}
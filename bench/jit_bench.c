@@ -0,0 +1,52 @@
+// compares the JIT against the interpreter on the same compiled chunks
+// build and run with: make bench && ./bench/jit_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "vm.h"
+#include <stdio.h>
+
+#define ITERATIONS 2000000
+
+static const char *expressions[] = {
+    "1 + 2",
+    "(1 + 2) * 3 - 4 / 5",
+    "-(1.5 * 2.5) + (3.25 - 4.125) * (5 / 6) - -7",
+    "1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10 + 11 + 12 + 13 + 14 + 15 + 16",
+    "((1 * 2 + 3) * (4 * 5 + 6) - (7 * 8 + 9) / (10 * 11 + 12)) * 13 / 14",
+};
+
+// run the chunk over and over and return nanoseconds per run
+static double measure(Chunk *chunk, bool useJit) {
+  vm.useJit = useJit;
+  Value result;
+  // the first run is the one that translates the chunk
+  interpretChunk(chunk, &result);
+
+  double start = now();
+  for (int i = 0; i < ITERATIONS; i++) {
+    interpretChunk(chunk, &result);
+  }
+  return (now() - start) / ITERATIONS;
+}
+
+int main() {
+  initVM();
+  printf("%-70s %10s %10s %8s\n", "expression", "interp ns", "jit ns",
+         "speedup");
+  for (size_t i = 0; i < sizeof(expressions) / sizeof(expressions[0]); i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compile(expressions[i], &chunk)) {
+      return 1;
+    }
+
+    double interpreted = measure(&chunk, false);
+    double jitted = measure(&chunk, true);
+    printf("%-70s %10.1f %10.1f %7.1fx\n", expressions[i], interpreted, jitted,
+           interpreted / jitted);
+    freeChunk(&chunk);
+  }
+  freeVM();
+  return 0;
+}
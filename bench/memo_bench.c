@@ -0,0 +1,275 @@
+// what memoizing pure chunks buys when the same expression is evaluated over
+// and over for inputs that repeat: a pricing rule run once per order, the
+// orders drawn from a catalog of distinct ones with a Zipf distribution, so a
+// few come up all the time and most of them rarely. The inputs are put
+// straight into the globals the way an embedder would, and every result is
+// checked against the same evaluation without memoization. Then the rule is
+// run over the orders with --rows, where each worker thread memoizes its own
+// copy of the chunk, and has to print what it prints without memoization
+// build and run with: make bench && ./bench/memo_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memo.h"
+#include "object.h"
+#include "output.h"
+#include "rows.h"
+#include "vm.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// evaluations per run, and runs
+#define EVALUATIONS 1000000
+#define RUNS 3
+// the Zipf exponent. Around 1 is what order and request logs tend to show
+#define ZIPF 1.0
+// the orders run with --rows, and the worker threads they run on
+#define ROWS 200000
+#define ROW_THREADS 4
+
+static const char *csvPath = "/tmp/clox_memo_bench.csv";
+static const char *outputPath = "/tmp/clox_memo_bench.out";
+static const char *expectedPath = "/tmp/clox_memo_bench.expected";
+
+static const char *declarations =
+    "var price = 0; var quantity = 0; var discount = 0; var rate = 0; 0";
+static const char *names[] = {"price", "quantity", "discount", "rate"};
+#define INPUTS 4
+
+// a rule with some arithmetic in it, and one that is barely anything, where
+// looking the result up costs about as much as computing it
+#define RULE                                                                   \
+  "(price * quantity - price * quantity * discount) * (1 + rate) + "          \
+  "(quantity - 1) * 0.25 * price / (quantity + 1) - "                         \
+  "discount * discount * 3.5 + rate * price / 7 - "                           \
+  "(price - discount) * (price + discount) / (quantity * quantity + 1)"
+#define TINY "price + 1"
+
+typedef struct {
+  const char *name;
+  const char *source;
+  // distinct orders in the catalog
+  int catalog;
+  // entries in the chunk's table
+  int entries;
+} Case;
+
+static const Case cases[] = {
+    {"rule", RULE, 64, 256},
+    {"rule", RULE, 4096, 256},
+    {"rule", RULE, 4096, 4096},
+    {"rule", RULE, 262144, 4096},
+    {"tiny", TINY, 4096, 4096},
+};
+
+static int slots[INPUTS];
+// the catalog's inputs, and which order each evaluation is for
+static Value *catalog;
+static int *orders;
+
+static uint64_t rngState = 88172645463325252ull;
+
+static double uniform() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return (rngState >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// the orders, their inputs made up, and EVALUATIONS draws from them where
+// order k comes up in proportion to 1 / (k + 1)^ZIPF
+static void makeWorkload(int size) {
+  catalog = malloc(sizeof(Value) * size * INPUTS);
+  for (int i = 0; i < size; i++) {
+    catalog[i * INPUTS] = NUMBER_VAL(1 + (int)(uniform() * 10000) / 100.0);
+    catalog[i * INPUTS + 1] = INT_VAL(1 + (int)(uniform() * 20));
+    catalog[i * INPUTS + 2] = NUMBER_VAL((int)(uniform() * 30) / 100.0);
+    catalog[i * INPUTS + 3] = NUMBER_VAL((int)(uniform() * 4) * 0.05);
+  }
+
+  double *cumulative = malloc(sizeof(double) * size);
+  double total = 0;
+  for (int i = 0; i < size; i++) {
+    total += 1 / pow(i + 1, ZIPF);
+    cumulative[i] = total;
+  }
+  orders = malloc(sizeof(int) * EVALUATIONS);
+  for (int i = 0; i < EVALUATIONS; i++) {
+    double target = uniform() * total;
+    int low = 0;
+    int high = size - 1;
+    while (low < high) {
+      int mid = (low + high) / 2;
+      if (cumulative[mid] < target) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    orders[i] = low;
+  }
+  free(cumulative);
+}
+
+static void setInputs(int order) {
+  for (int i = 0; i < INPUTS; i++) {
+    vm.globals.values[slots[i]] = catalog[order * INPUTS + i];
+  }
+}
+
+// ns per evaluation. With results not NULL, each one is stored there, and
+// with expected not NULL each one is compared with it instead
+static double evaluate(Chunk *chunk, Value *results, const Value *expected,
+                       int *wrong) {
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now();
+    for (int i = 0; i < EVALUATIONS; i++) {
+      setInputs(orders[i]);
+      Value value;
+      if (interpretChunk(chunk, &value) != INTERPRET_OK)
+        exit(70);
+      if (results != NULL) {
+        results[i] = value;
+      } else if (expected != NULL && !valuesEqual(value, expected[i])) {
+        (*wrong)++;
+      }
+    }
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < best)
+      best = elapsed;
+    // each run of a case starts from an empty table
+    freeMemo(chunk->memo);
+    chunk->memo = NULL;
+  }
+  return best / EVALUATIONS;
+}
+
+static bool runCase(const Case *c) {
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(c->source, &chunk))
+    exit(65);
+  makeWorkload(c->catalog);
+
+  Value *expected = malloc(sizeof(Value) * EVALUATIONS);
+  memoOptions.enabled = false;
+  double plain = evaluate(&chunk, expected, NULL, NULL);
+
+  memoOptions.enabled = true;
+  memoOptions.entries = c->entries;
+  memoStats = (MemoStats){0};
+  int wrong = 0;
+  // the table as it is at the end of a run, before evaluate() frees it
+  size_t bytes = (size_t)c->entries * (1 + INPUTS) * sizeof(Value) +
+                 c->entries * sizeof(bool);
+  double memoized = evaluate(&chunk, NULL, expected, &wrong);
+  memoOptions.enabled = false;
+  uint64_t lookups = memoStats.hits + memoStats.misses;
+
+  printf("%-5s %8d %8d %9.1f %9.1f %8.2f %7.1f%% %8.1f %7d\n", c->name,
+         c->catalog, c->entries, plain, memoized, plain / memoized,
+         100.0 * memoStats.hits / lookups, bytes / 1024.0, wrong);
+  free(expected);
+  free(catalog);
+  free(orders);
+  freeChunk(&chunk);
+  return wrong == 0;
+}
+
+static bool sameFiles(const char *a, const char *b) {
+  FILE *fa = fopen(a, "rb");
+  FILE *fb = fopen(b, "rb");
+  bool same = fa != NULL && fb != NULL;
+  static char bufferA[1 << 16], bufferB[1 << 16];
+  while (same) {
+    size_t na = fread(bufferA, 1, sizeof(bufferA), fa);
+    size_t nb = fread(bufferB, 1, sizeof(bufferB), fb);
+    same = na == nb && memcmp(bufferA, bufferB, na) == 0;
+    if (na == 0)
+      break;
+  }
+  if (fa != NULL)
+    fclose(fa);
+  if (fb != NULL)
+    fclose(fb);
+  return same;
+}
+
+// runs the rule over the rows in csvPath with the results going to path
+static int runRule(int threads, const char *path) {
+  if (freopen(path, "w", stdout) == NULL)
+    exit(74);
+  RowOptions options = {ROWS_CSV, NULL, threads};
+  int status = runRows(RULE, csvPath, &options);
+  flushOutput();
+  return status;
+}
+
+// the first ROWS orders of a catalog of 4096 as CSV, run without memoizing
+// on the main thread, then memoized on ROW_THREADS workers and on the main
+// thread. maxBytes only leaves room for a table or so, and it holds for
+// each thread on its own. The main thread's tables are all gone afterwards
+static bool checkRows() {
+  makeWorkload(4096);
+  FILE *csv = fopen(csvPath, "w");
+  if (csv == NULL)
+    exit(74);
+  fprintf(csv, "%s,%s,%s,%s\n", names[0], names[1], names[2], names[3]);
+  for (int i = 0; i < ROWS; i++) {
+    Value *order = &catalog[orders[i] * INPUTS];
+    fprintf(csv, "%.2f,%d,%.2f,%.2f\n", AS_NUMBER(order[0]),
+            (int)AS_INT(order[1]), AS_NUMBER(order[2]), AS_NUMBER(order[3]));
+  }
+  fclose(csv);
+  free(catalog);
+  free(orders);
+
+  memoOptions.enabled = false;
+  bool ok = runRule(1, expectedPath) == 0;
+  memoOptions.enabled = true;
+  memoOptions.entries = 256;
+  memoOptions.maxBytes = 32 * 1024;
+  size_t bytes = memoStats.bytes;
+  ok &= runRule(ROW_THREADS, outputPath) == 0 &&
+        sameFiles(outputPath, expectedPath);
+  ok &= runRule(1, outputPath) == 0 && sameFiles(outputPath, expectedPath);
+  ok &= memoStats.bytes == bytes;
+  memoOptions.enabled = false;
+  remove(csvPath);
+  remove(outputPath);
+  remove(expectedPath);
+  fprintf(stderr, "%d rows memoized on %d threads and on 1: %s\n", ROWS,
+          ROW_THREADS, ok ? "same" : "DIFFERENT");
+  return ok;
+}
+
+int main() {
+  initVM();
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(declarations, &chunk))
+    exit(65);
+  Value value;
+  interpretChunk(&chunk, &value);
+  freeChunk(&chunk);
+  for (int i = 0; i < INPUTS; i++) {
+    slots[i] = globalSlot(copyString(names[i], (int)strlen(names[i])));
+  }
+
+  printf("%-5s %8s %8s %9s %9s %8s %8s %8s %7s\n", "case", "catalog",
+         "entries", "plain ns", "memo ns", "speedup", "hits", "table KB",
+         "wrong");
+  fflush(stdout);
+  bool ok = true;
+  int caseCount = sizeof(cases) / sizeof(cases[0]);
+  for (int i = 0; i < caseCount; i++) {
+    ok &= runCase(&cases[i]);
+  }
+  fflush(stdout);
+  ok &= checkRows();
+  freeVM();
+  return ok ? 0 : 1;
+}
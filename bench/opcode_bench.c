@@ -0,0 +1,108 @@
+// measures what one arithmetic instruction costs in the VM in its three forms:
+// the generic checked instruction, the quickened number-only one and the
+// unchecked one the compiler emits when it proved the operand types
+// it counts instructions retired with perf_event_open where the kernel lets
+// us, and reports nanoseconds either way
+// build and run with: make bench && ./bench/opcode_bench
+#include "bench.h"
+#include "chunk.h"
+#include "vm.h"
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define OPERATIONS 100000
+#define RUNS 200
+
+static int counter = -1;
+
+static void openCounter() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  counter = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// 1 op 1 op 1 op ... as a chunk, the same shape "1 + 1 + 1 ..." compiles to
+static void makeChunk(Chunk *chunk, OpCode op) {
+  initChunk(chunk);
+  int one = addConstant(chunk, NUMBER_VAL(1));
+  writeChunk(chunk, OP_CONSTANT, 1);
+  writeChunk(chunk, (uint8_t)one, 1);
+  for (int i = 0; i < OPERATIONS; i++) {
+    writeChunk(chunk, OP_CONSTANT, 1);
+    writeChunk(chunk, (uint8_t)one, 1);
+    writeChunk(chunk, op, 1);
+  }
+  writeChunk(chunk, OP_RETURN, 1);
+  chunk->maxStack = 2;
+}
+
+// if pristine isn't NULL the chunk's code is reset to it before every run so
+// that the VM never gets to run the quickened instructions
+static void measure(const char *name, Chunk *chunk, uint8_t *pristine) {
+  Value result;
+  long long instructions = 0;
+  double elapsed = 0;
+  for (int run = 0; run < RUNS; run++) {
+    if (pristine != NULL) {
+      memcpy(chunk->code, pristine, chunk->count);
+    }
+    if (counter >= 0) {
+      ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    double start = now();
+    interpretChunk(chunk, &result);
+    elapsed += now() - start;
+    if (counter >= 0) {
+      ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+      long long count = 0;
+      if (read(counter, &count, sizeof(count)) == sizeof(count)) {
+        instructions += count;
+      }
+    }
+  }
+
+  double operations = (double)OPERATIONS * RUNS;
+  if (counter >= 0) {
+    printf("%-12s %8.2f ns/op %8.2f instructions/op\n", name,
+           elapsed / operations, instructions / operations);
+  } else {
+    printf("%-12s %8.2f ns/op\n", name, elapsed / operations);
+  }
+}
+
+int main() {
+  initVM();
+  openCounter();
+  if (counter < 0) {
+    printf("(no hardware counters available, reporting time only)\n");
+  }
+
+  Chunk checked, unchecked;
+  makeChunk(&checked, OP_ADD);
+  makeChunk(&unchecked, OP_ADD_UNCHECKED);
+  // keep the original bytes around to undo the quickening with
+  uint8_t *pristine = malloc(checked.count);
+  memcpy(pristine, checked.code, checked.count);
+
+  measure("generic", &checked, pristine);
+  measure("quickened", &checked, NULL);
+  measure("unchecked", &unchecked, NULL);
+
+  free(pristine);
+  freeChunk(&checked);
+  freeChunk(&unchecked);
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,165 @@
+// output throughput: printing results with printf("%g\n") (what the VM used
+// to do, and which loses precision), printf("%.17g\n") (which doesn't, but
+// prints too many digits) and the output layer
+// before that formatNumber() is checked against the digits printf gives at
+// the shortest precision that reads back, which are the shortest correctly
+// rounded ones: it has to print the same digits with the same exponent
+// stdout goes to /dev/null, the timings go to stderr
+// build and run with: make bench && ./bench/output_bench
+#include "bench.h"
+#include "dtoa.h"
+#include "output.h"
+#include "value.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COUNT 5000000
+#define CHECKED 2000000
+
+static double numbers[COUNT];
+
+static uint64_t state = 88172645463325252ull;
+static uint64_t next() {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+// a mix of what expressions tend to produce: integers, short decimals and
+// doubles that need all 17 digits
+static void fillNumbers() {
+  for (int i = 0; i < COUNT; i++) {
+    switch (i % 3) {
+    case 0:
+      numbers[i] = (double)(next() % 100000);
+      break;
+    case 1:
+      numbers[i] = (double)(next() % 100000) / 100;
+      break;
+    default:
+      numbers[i] = (double)(next() >> 11) / (double)(1ull << 53) * 1000;
+      break;
+    }
+  }
+}
+
+// the significant digits of text, a number either formatNumber() or printf
+// wrote, and the power of ten of the first of them
+static void splitDigits(const char *text, char *digits, int *exponent) {
+  int length = 0;
+  int point = -1;
+  int first = -1;
+  int position = 0;
+  const char *c = text;
+  for (; *c != '\0' && *c != 'e'; c++) {
+    if (*c == '.') {
+      point = position;
+    } else {
+      if (*c != '0' && first < 0)
+        first = position;
+      if (first >= 0)
+        digits[length++] = *c;
+      position++;
+    }
+  }
+  if (point < 0)
+    point = position;
+  while (length > 0 && digits[length - 1] == '0') {
+    length--;
+  }
+  digits[length] = '\0';
+  *exponent = point - first - 1 + (*c == 'e' ? atoi(c + 1) : 0);
+}
+
+// counts the values formatNumber() prints differently from the shortest
+// correctly rounded digits, and shows the first few
+static bool checkValue(double value, int *wrong) {
+  char buffer[NUMBER_BUFFER_SIZE + 1];
+  buffer[formatNumber(value, buffer)] = '\0';
+  char expected[32];
+  for (int precision = 1; precision <= 17; precision++) {
+    snprintf(expected, sizeof(expected), "%.*e", precision - 1, value);
+    if (strtod(expected, NULL) == value)
+      break;
+  }
+
+  char digits[32], expectedDigits[32];
+  int exponent, expectedExponent;
+  splitDigits(buffer, digits, &exponent);
+  splitDigits(expected, expectedDigits, &expectedExponent);
+  if (strcmp(digits, expectedDigits) == 0 && exponent == expectedExponent)
+    return true;
+  if ((*wrong)++ < 10)
+    fprintf(stderr, "%s should be %s\n", buffer, expected);
+  return false;
+}
+
+// random bit patterns cover every exponent, and scaled 53-bit fractions the
+// numbers in between that people actually print. The edge cases go first
+static bool checkDigits() {
+  static const double edges[] = {0.1 + 0.2, 1.4142135623730951,
+                                 5e-324,    2.2250738585072014e-308,
+                                 1e21,      1.7976931348623157e308,
+                                 1e23,      9007199254740993.0};
+  int wrong = 0;
+  for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+    checkValue(edges[i], &wrong);
+  }
+  for (int i = 0; i < CHECKED; i++) {
+    double value;
+    if (i % 2 == 0) {
+      uint64_t bits = next();
+      memcpy(&value, &bits, sizeof(value));
+      value = fabs(value);
+    } else {
+      value = (double)(next() >> 11) / (double)(1ull << 53) *
+              pow(10, (int)(next() % 40) - 20);
+    }
+    if (isfinite(value) && value != 0)
+      checkValue(value, &wrong);
+  }
+  fprintf(stderr, "%d of %d values not the shortest closest digits\n", wrong,
+          CHECKED);
+  return wrong == 0;
+}
+
+static void report(const char *name, double elapsed) {
+  fprintf(stderr, "%-14s %8.1f ns/value %8.2f M values/s\n", name,
+          elapsed / COUNT, COUNT / elapsed * 1e3);
+}
+
+int main() {
+  if (freopen("/dev/null", "w", stdout) == NULL)
+    return 1;
+  if (!checkDigits())
+    return 1;
+  fillNumbers();
+
+  double start = now();
+  for (int i = 0; i < COUNT; i++) {
+    printf("%g\n", numbers[i]);
+  }
+  fflush(stdout);
+  report("printf %g", now() - start);
+
+  start = now();
+  for (int i = 0; i < COUNT; i++) {
+    printf("%.17g\n", numbers[i]);
+  }
+  fflush(stdout);
+  report("printf %.17g", now() - start);
+
+  start = now();
+  for (int i = 0; i < COUNT; i++) {
+    writeValue(NUMBER_VAL(numbers[i]));
+    writeOutput("\n", 1);
+  }
+  flushOutput();
+  report("writeValue", now() - start);
+  return 0;
+}
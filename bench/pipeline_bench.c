@@ -0,0 +1,137 @@
+// compile time for multi-megabyte scripts with and without the scanner on a
+// thread of its own (see pipeline.h). scan is the time scanToken() alone
+// takes over the source and parse the rest of a plain compile, so the slower
+// of the two is about as fast as a pipelined compile can get, given a second
+// core to run the scanner on. Each case also checks that both ways give the
+// same chunk
+// build and run with: make bench && ./bench/pipeline_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "object.h"
+#include "pipeline.h"
+#include "scanner.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RUNS 5
+
+typedef struct {
+  const char *name;
+  // writes statement number i of the script
+  int (*statement)(char *out, int i);
+  int statements;
+} Case;
+
+// short arithmetic statements on a few globals, the scanner's share is big
+static int globalStatement(char *out, int i) {
+  return sprintf(out, "g%d = g%d + %d * 2 - g%d;\n", i % 8, (i + 1) % 8,
+                 i % 100, (i + 3) % 8);
+}
+
+// long literals and long names, which the scanner has to walk and the parser
+// only looks at once
+static int longStatement(char *out, int i) {
+  return sprintf(out,
+                 "g%d = \"a string literal that goes on for quite a while\" "
+                 "== \"another %d\";\n"
+                 "g%d = 123456.789012 + 98765.4321 * 0.000125 - %d.5;\n",
+                 i % 8, i % 16, (i + 1) % 8, i % 1000);
+}
+
+static const Case cases[] = {
+    {"globals", globalStatement, 160000},
+    {"long", longStatement, 40000},
+};
+
+// the declarations, the statements and a final expression
+static char *buildSource(const Case *c, size_t *length) {
+  size_t capacity = (size_t)c->statements * 160 + 256;
+  char *source = malloc(capacity);
+  size_t used = 0;
+  for (int i = 0; i < 8; i++) {
+    used += sprintf(source + used, "var g%d = %d;\n", i, i);
+  }
+  for (int i = 0; i < c->statements; i++) {
+    used += c->statement(source + used, i);
+  }
+  used += sprintf(source + used, "g0");
+  *length = used;
+  return source;
+}
+
+static double scanTime(const char *source) {
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now();
+    initScanner(source);
+    while (scanToken().type != TOKEN_EOF) {
+    }
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+static double compileTime(const char *source, bool pipelined, Chunk *chunk) {
+  pipelineCompile = pipelined;
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    if (run > 0)
+      freeChunk(chunk);
+    initChunk(chunk);
+    double start = now();
+    if (!compile(source, chunk))
+      exit(65);
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < best)
+      best = elapsed;
+  }
+  pipelineCompile = false;
+  return best;
+}
+
+static bool sameChunk(const Chunk *a, const Chunk *b) {
+  return a->count == b->count && memcmp(a->code, b->code, a->count) == 0 &&
+         a->constants.count == b->constants.count;
+}
+
+static bool runCase(const Case *c) {
+  size_t length;
+  char *source = buildSource(c, &length);
+
+  double scan = scanTime(source);
+  Chunk plain;
+  Chunk pipelined;
+  double plainTime = compileTime(source, false, &plain);
+  double pipelinedTime = compileTime(source, true, &pipelined);
+  bool same = sameChunk(&plain, &pipelined);
+
+  printf("%-8s %6.2f %8.1f %8.1f %8.1f %10.1f %8.2f %5s\n", c->name,
+         length / 1e6, scan / 1e6, (plainTime - scan) / 1e6, plainTime / 1e6,
+         pipelinedTime / 1e6, plainTime / pipelinedTime, same ? "yes" : "NO");
+  freeChunk(&plain);
+  freeChunk(&pipelined);
+  freeGlobals();
+  freeObjects();
+  free(source);
+  return same;
+}
+
+int main() {
+  initVM();
+  printf("%ld cores\n", sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-8s %6s %8s %8s %8s %10s %8s %5s\n", "case", "MB", "scan ms",
+         "parse ms", "plain ms", "pipelined", "speedup", "same");
+  int caseCount = sizeof(cases) / sizeof(cases[0]);
+  bool same = true;
+  for (int i = 0; i < caseCount; i++) {
+    same &= runCase(&cases[i]);
+  }
+  freeVM();
+  return same ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+// clox --rows over a few million rows (see rows.h): the rows per second for
+// CSV and for raw doubles with different numbers of worker threads, and the
+// most memory the process ever had, which stays the same however big the
+// input gets. Every run's output is checked against the one on the main
+// thread alone, and rows with too few fields have to be reported without
+// reading past them
+// build and run with: make bench && ./bench/rows_bench [rows]
+#include "bench.h"
+#include "output.h"
+#include "rows.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define DEFAULT_ROWS 2000000
+#define RUNS 3
+
+static const char *csvPath = "/tmp/clox_rows_bench.csv";
+static const char *f64Path = "/tmp/clox_rows_bench.f64";
+static const char *outputPath = "/tmp/clox_rows_bench.out";
+static const char *expectedPath = "/tmp/clox_rows_bench.expected";
+static const char *shortPath = "/tmp/clox_rows_bench_short.csv";
+
+static const char *script =
+    "(price * quantity - price * quantity * discount) * (1 + rate)";
+static const char *columns = "price,quantity,discount,rate";
+
+static uint64_t rngState = 88172645463325252ull;
+
+static uint64_t next() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return rngState;
+}
+
+// the same rows in both formats
+static void writeInputs(int rows) {
+  FILE *csv = fopen(csvPath, "w");
+  FILE *f64 = fopen(f64Path, "wb");
+  if (csv == NULL || f64 == NULL)
+    exit(74);
+  fprintf(csv, "%s\n", columns);
+  for (int i = 0; i < rows; i++) {
+    double row[4] = {1 + (double)(next() % 10000) / 100,
+                     (double)(1 + next() % 20), (double)(next() % 30) / 100,
+                     (double)(next() % 4) * 0.05};
+    fprintf(csv, "%.2f,%g,%.2f,%.2f\n", row[0], row[1], row[2], row[3]);
+    // the CSV has the numbers rounded to what it shows, the doubles have to
+    // be the same numbers
+    for (int j = 0; j < 4; j++) {
+      char text[32];
+      snprintf(text, sizeof(text), "%.2f", row[j]);
+      row[j] = strtod(text, NULL);
+    }
+    fwrite(row, sizeof(double), 4, f64);
+  }
+  fclose(csv);
+  fclose(f64);
+}
+
+static bool sameFiles(const char *a, const char *b) {
+  FILE *fa = fopen(a, "rb");
+  FILE *fb = fopen(b, "rb");
+  bool same = fa != NULL && fb != NULL;
+  static char bufferA[1 << 16], bufferB[1 << 16];
+  while (same) {
+    size_t na = fread(bufferA, 1, sizeof(bufferA), fa);
+    size_t nb = fread(bufferB, 1, sizeof(bufferB), fb);
+    same = na == nb && memcmp(bufferA, bufferB, na) == 0;
+    if (na == 0)
+      break;
+  }
+  if (fa != NULL)
+    fclose(fa);
+  if (fb != NULL)
+    fclose(fb);
+  return same;
+}
+
+// rows that are cut short, the last one without its newline even. Each has
+// to be reported as the bad row it is, without the parser reading on into
+// the rows after it. The rows before it are printed
+static const char *shortRows[][2] = {
+    {"a,b\n1,2\n3\n", "2\n"},
+    {"a,b\n1,2\n3\n4,5\n", "2\n"},
+    {"a,b\n1,\n4,5\n", ""},
+    {"a,b\n1,\v\n4,5\n", ""},
+    {"a,b\n1,2\n3", "2\n"},
+};
+
+static bool checkShortRows() {
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(shortRows) / sizeof(shortRows[0]); i++) {
+    FILE *csv = fopen(shortPath, "w");
+    if (csv == NULL)
+      exit(74);
+    fputs(shortRows[i][0], csv);
+    fclose(csv);
+    if (freopen(outputPath, "w", stdout) == NULL)
+      exit(74);
+    RowOptions options = {ROWS_CSV, NULL, 1};
+    int status = runRows("a * b", shortPath, &options);
+    flushOutput();
+
+    char printed[64] = "";
+    FILE *output = fopen(outputPath, "r");
+    if (output != NULL) {
+      size_t length = fread(printed, 1, sizeof(printed) - 1, output);
+      printed[length] = '\0';
+      fclose(output);
+    }
+    if (status != 65 || strcmp(printed, shortRows[i][1]) != 0) {
+      fprintf(stderr, "short row %zu: exit %d, printed \"%s\"\n", i, status,
+              printed);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// the best time of RUNS runs with the results going to path
+static double run(const RowOptions *options, const char *input,
+                  const char *path) {
+  double best = 0;
+  for (int i = 0; i < RUNS; i++) {
+    if (freopen(path, "w", stdout) == NULL)
+      exit(74);
+    double start = now();
+    int status = runRows(script, input, options);
+    flushOutput();
+    double elapsed = now() - start;
+    if (status != 0)
+      exit(status);
+    if (i == 0 || elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+int main(int argc, const char *argv[]) {
+  int rows = argc > 1 ? atoi(argv[1]) : DEFAULT_ROWS;
+  writeInputs(rows);
+  initVM();
+
+  // runs print to stdout, so the table goes to stderr
+  fprintf(stderr, "%d rows, %ld cores\n", rows,
+          sysconf(_SC_NPROCESSORS_ONLN));
+  bool ok = checkShortRows();
+  fprintf(stderr, "%-6s %8s %10s %10s %8s\n", "format", "threads", "ms",
+          "Mrows/s", "same");
+  static const int threadCounts[] = {1, 2, 4, 8};
+  for (int format = ROWS_CSV; format <= ROWS_F64; format++) {
+    const char *input = format == ROWS_CSV ? csvPath : f64Path;
+    for (int i = 0; i < 4; i++) {
+      RowOptions options = {(RowFormat)format,
+                            format == ROWS_CSV ? NULL : columns,
+                            threadCounts[i]};
+      double elapsed = run(&options, input, outputPath);
+      // the CSV on the main thread is what everything else has to print
+      bool same = true;
+      if (format == ROWS_CSV && i == 0) {
+        rename(outputPath, expectedPath);
+      } else {
+        same = sameFiles(outputPath, expectedPath);
+      }
+      ok &= same;
+      fprintf(stderr, "%-6s %8d %10.1f %10.2f %8s\n",
+              format == ROWS_CSV ? "csv" : "f64", threadCounts[i],
+              elapsed / 1e6, rows / (elapsed / 1e3), same ? "yes" : "NO");
+    }
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(stderr, "max resident %.1f MB\n", usage.ru_maxrss / 1024.0);
+  remove(csvPath);
+  remove(f64Path);
+  remove(outputPath);
+  remove(expectedPath);
+  remove(shortPath);
+  freeVM();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+// load generator for clox --serve (see server.h for the protocol)
+// each connection is its own thread that sends a request, waits for the
+// response and sends the next one (a closed loop), and records how long every
+// round trip took
+// build and run with:
+//   make bench clox-release
+//   ./clox-release --serve /tmp/clox.sock &
+//   ./bench/serve_load /tmp/clox.sock [connections] [requests] [expression]
+#include "bench.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct {
+  const char *socketPath;
+  const char *source;
+  int requests;
+  // nanoseconds per request
+  uint64_t *latencies;
+  int failures;
+} Worker;
+
+static int connectTo(const char *socketPath) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int readFully(int fd, uint8_t *bytes, size_t length) {
+  while (length > 0) {
+    ssize_t received = recv(fd, bytes, length, 0);
+    if (received <= 0)
+      return -1;
+    bytes += received;
+    length -= received;
+  }
+  return 0;
+}
+
+static void *work(void *argument) {
+  Worker *worker = argument;
+  int fd = connectTo(worker->socketPath);
+  if (fd < 0) {
+    perror("connect");
+    worker->failures = worker->requests;
+    return NULL;
+  }
+
+  // the request never changes, so it is framed once
+  size_t length = strlen(worker->source);
+  uint8_t *request = malloc(4 + length);
+  request[0] = length & 0xff;
+  request[1] = (length >> 8) & 0xff;
+  request[2] = (length >> 16) & 0xff;
+  request[3] = (length >> 24) & 0xff;
+  memcpy(request + 4, worker->source, length);
+
+  uint8_t response[256];
+  for (int i = 0; i < worker->requests; i++) {
+    double start = now();
+    if (send(fd, request, 4 + length, 0) != (ssize_t)(4 + length) ||
+        readFully(fd, response, 4) < 0) {
+      worker->failures += worker->requests - i;
+      break;
+    }
+    uint32_t payload = response[0] | response[1] << 8 | response[2] << 16 |
+                       (uint32_t)response[3] << 24;
+    if (payload == 0 || payload > sizeof(response) ||
+        readFully(fd, response, payload) < 0) {
+      worker->failures += worker->requests - i;
+      break;
+    }
+    worker->latencies[i] = now() - start;
+    // the first byte is the InterpretResult, anything but INTERPRET_OK counts
+    // as a failure
+    if (response[0] != 0) {
+      worker->failures++;
+    }
+  }
+
+  free(request);
+  close(fd);
+  return NULL;
+}
+
+static int compareLatencies(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(uint64_t *sorted, size_t count, double p) {
+  size_t index = (size_t)(p * (count - 1));
+  return sorted[index] / 1e3;
+}
+
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: serve_load socket [connections] [requests] "
+                    "[expression]\n");
+    return 64;
+  }
+  const char *socketPath = argv[1];
+  int connections = argc > 2 ? atoi(argv[2]) : 8;
+  int requests = argc > 3 ? atoi(argv[3]) : 100000;
+  const char *source = argc > 4 ? argv[4] : "(1.5 + 2) * -3 - 4 / 8";
+  if (connections < 1 || requests < 1) {
+    fprintf(stderr, "Connections and requests must be positive.\n");
+    return 64;
+  }
+
+  size_t total = (size_t)connections * requests;
+  uint64_t *latencies = calloc(total, sizeof(uint64_t));
+  Worker *workers = calloc(connections, sizeof(Worker));
+  pthread_t *threads = calloc(connections, sizeof(pthread_t));
+
+  double start = now();
+  for (int i = 0; i < connections; i++) {
+    workers[i] = (Worker){socketPath, source, requests,
+                          latencies + (size_t)i * requests, 0};
+    pthread_create(&threads[i], NULL, work, &workers[i]);
+  }
+  int failures = 0;
+  for (int i = 0; i < connections; i++) {
+    pthread_join(threads[i], NULL);
+    failures += workers[i].failures;
+  }
+  double elapsed = (now() - start) / 1e9;
+
+  // requests that never completed left a zero behind, which sorts to the
+  // front. Leave those out
+  qsort(latencies, total, sizeof(uint64_t), compareLatencies);
+  size_t skipped = 0;
+  while (skipped < total && latencies[skipped] == 0) {
+    skipped++;
+  }
+  size_t completed = total - skipped;
+  if (completed == 0) {
+    fprintf(stderr, "No request completed.\n");
+    return 1;
+  }
+
+  printf("connections: %d, requests: %zu, failures: %d\n", connections,
+         completed, failures);
+  printf("throughput:  %.0f requests/s\n", completed / elapsed);
+  printf("latency:     p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+         percentile(latencies + skipped, completed, 0.50),
+         percentile(latencies + skipped, completed, 0.99),
+         percentile(latencies + skipped, completed, 0.999),
+         latencies[total - 1] / 1e3);
+
+  free(threads);
+  free(workers);
+  free(latencies);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+// checks what strings and equality give, then measures what interning buys:
+// the memory the literals of a script take when they are all the same and
+// when they are all different, and what comparing two long strings costs
+// next to comparing two numbers, and next to comparing the characters
+// build and run with: make bench && ./bench/string_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "optimize.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// literals in the memory test, and their length
+#define LITERALS 10000
+#define LITERAL_LENGTH 32
+// comparisons per run in the timing test, the length of the strings compared
+// and the number of runs
+#define TERMS 1000
+#define LONG_LENGTH 4096
+#define RUNS 2000
+#define COMPARES 1000000
+
+static const Check checks[] = {
+    {"\"abc\"", INTERPRET_OK, VAL_OBJ, "abc"},
+    {"\"ab\" + \"c\"", INTERPRET_OK, VAL_OBJ, "abc"},
+    {"\"\" + \"\"", INTERPRET_OK, VAL_OBJ, ""},
+    {"\"ab\" + \"c\" == \"abc\"", INTERPRET_OK, VAL_BOOL, "true"},
+    {"\"a\" + \"bc\" == \"ab\" + \"c\"", INTERPRET_OK, VAL_BOOL, "true"},
+    {"\"abc\" == \"abd\"", INTERPRET_OK, VAL_BOOL, "false"},
+    {"\"abc\" != \"ab\"", INTERPRET_OK, VAL_BOOL, "true"},
+    {"\"1\" == 1", INTERPRET_OK, VAL_BOOL, "false"},
+    {"1 == 1.0", INTERPRET_OK, VAL_BOOL, "true"},
+    {"9007199254740993 == 9007199254740992.0", INTERPRET_OK, VAL_BOOL, "false"},
+    {"0.0 == -0.0", INTERPRET_OK, VAL_BOOL, "true"},
+    {"2 != 3 - 1", INTERPRET_OK, VAL_BOOL, "false"},
+    // only nil and false are falsey
+    {"!\"\"", INTERPRET_OK, VAL_BOOL, "false"},
+    {"!0", INTERPRET_OK, VAL_BOOL, "false"},
+    {"!(1 == 2)", INTERPRET_OK, VAL_BOOL, "true"},
+};
+
+// LITERALS string literals of LITERAL_LENGTH characters joined with ==. They
+// are all the same one, or each one ends in its own number
+static char *buildLiterals(bool distinct) {
+  char *source = malloc((size_t)LITERALS * (LITERAL_LENGTH + 8));
+  size_t used = 0;
+  for (int i = 0; i < LITERALS; i++) {
+    char literal[LITERAL_LENGTH + 1];
+    memset(literal, 'x', LITERAL_LENGTH);
+    literal[LITERAL_LENGTH] = '\0';
+    if (distinct) {
+      char number[16];
+      int length = sprintf(number, "%d", i);
+      memcpy(literal + LITERAL_LENGTH - length, number, length);
+    }
+    used += sprintf(source + used, "%s\"%s\"", i == 0 ? "" : " == ", literal);
+  }
+  return source;
+}
+
+// what the strings and the intern table take once the chunk is gone
+static size_t literalBytes(const char *source) {
+  size_t before = bytesAllocated;
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk))
+    exit(65);
+  freeChunk(&chunk);
+  size_t bytes = bytesAllocated - before;
+  freeObjects();
+  return bytes;
+}
+
+// TERMS comparisons (a == b), joined with !=. With strings, a and b are two
+// literals of LONG_LENGTH characters that only differ in the last one, or are
+// the same. With numbers they are integers
+static char *buildComparisons(bool strings, bool same) {
+  char *source = malloc((size_t)TERMS * (2 * LONG_LENGTH + 16));
+  size_t used = 0;
+  for (int i = 0; i < TERMS; i++) {
+    used += sprintf(source + used, "%s(", i == 0 ? "" : " != ");
+    for (int side = 0; side < 2; side++) {
+      if (!strings) {
+        used += sprintf(source + used, "%s%d", side ? " == " : "",
+                        same ? 7 : 7 + side);
+        continue;
+      }
+      used += sprintf(source + used, "%s\"", side ? " == " : "");
+      memset(source + used, 'x', LONG_LENGTH - 1);
+      used += LONG_LENGTH - 1;
+      used += sprintf(source + used, "%c\"", same || !side ? 'x' : 'y');
+    }
+    used += sprintf(source + used, ")");
+  }
+  return source;
+}
+
+static double runTime(const char *source) {
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk))
+    exit(65);
+  Value result;
+  interpretChunk(&chunk, &result);
+  double start = now();
+  for (int i = 0; i < RUNS; i++) {
+    interpretChunk(&chunk, &result);
+  }
+  double us = (now() - start) / RUNS / 1e3;
+  freeChunk(&chunk);
+  return us;
+}
+
+// ns per comparison of two equal strings of LONG_LENGTH characters, once as
+// a pointer compare and once with memcmp() over their characters, which is
+// what every comparison would cost without interning
+static void compareTimes(double *interned, double *characters) {
+  char *chars = malloc(LONG_LENGTH);
+  memset(chars, 'x', LONG_LENGTH);
+  ObjString *string = copyString(chars, LONG_LENGTH);
+  // a second copy outside the VM, so memcmp() has two buffers to walk
+  char *copy = malloc(LONG_LENGTH);
+  memcpy(copy, chars, LONG_LENGTH);
+  Value a = OBJ_VAL(string);
+  // volatile, so the compiler doesn't hoist the comparison out of the loop
+  volatile Value b = a;
+  volatile int equal = 0;
+
+  double start = now();
+  for (int i = 0; i < COMPARES; i++) {
+    equal += valuesEqual(a, b);
+  }
+  *interned = (now() - start) / COMPARES;
+
+  start = now();
+  for (int i = 0; i < COMPARES; i++) {
+    char *volatile left = chars;
+    equal += memcmp(left, copy, LONG_LENGTH) == 0;
+  }
+  *characters = (now() - start) / COMPARES;
+
+  free(chars);
+  free(copy);
+  freeObjects();
+}
+
+int main() {
+  initVM();
+  int checkCount = sizeof(checks) / sizeof(checks[0]);
+  int passed = 0;
+  for (int i = 0; i < checkCount; i++) {
+    passed += check(&checks[i]);
+  }
+  printf("%d/%d checks pass\n", passed, checkCount);
+  freeObjects();
+
+  char *same = buildLiterals(false);
+  char *distinct = buildLiterals(true);
+  size_t sameBytes = literalBytes(same);
+  size_t distinctBytes = literalBytes(distinct);
+  printf("\n%d literals of %d characters\n", LITERALS, LITERAL_LENGTH);
+  printf("%-9s %12zu bytes %8.2f per literal\n", "same", sameBytes,
+         (double)sameBytes / LITERALS);
+  printf("%-9s %12zu bytes %8.2f per literal\n", "distinct", distinctBytes,
+         (double)distinctBytes / LITERALS);
+  free(same);
+  free(distinct);
+
+  // every comparison has to be done, not once and then picked
+  optimizeOptions.cse = false;
+  printf("\n%d comparisons %12s\n", TERMS, "interp us");
+  const char *names[] = {"numbers", "strings equal", "strings differ"};
+  for (int i = 0; i < 3; i++) {
+    char *source = buildComparisons(i > 0, i < 2);
+    printf("%-14s %14.2f\n", names[i], runTime(source));
+    free(source);
+    freeObjects();
+  }
+  optimizeOptions.cse = true;
+
+  double interned;
+  double characters;
+  compareTimes(&interned, &characters);
+  printf("\n%d characters equal %12s\n", LONG_LENGTH, "ns");
+  printf("%-18s %12.2f\n", "pointer compare", interned);
+  printf("%-18s %12.2f\n", "memcmp", characters);
+
+  freeVM();
+  return passed == checkCount ? 0 : 1;
+}
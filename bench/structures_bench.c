@@ -0,0 +1,241 @@
+// the data structures under the compiler and the VM, each on its own:
+// writing code into a chunk with and without a new line table entry, the
+// constant pool, looking lines up, the VM stack and how GROW_CAPACITY grows
+// arrays. Changes to chunk.c, value.c and memory.c show up here directly
+// instead of only as a little less time on a whole compile
+// how big the chunks and pools get is drawn from a log-uniform distribution:
+// most are small, a few are big, like the scripts people write. allocs/op is
+// the calls reallocate() made for a block or a new size (see allocationCount),
+// the frees at the end of each chunk or array included in the time but not
+// counted
+// build and run with: make bench && ./bench/structures_bench
+#include "bench.h"
+#include "chunk.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RUNS 5
+// chunks per case and the range their sizes come from, in bytes
+#define CHUNKS 200
+#define CHUNK_MIN 16
+#define CHUNK_MAX 65536
+// constant pools per case and the range their sizes come from
+#define POOLS 2000
+#define POOL_MIN 1
+#define POOL_MAX 4096
+// the average number of bytes on a line. The compiler emits a few
+// instructions per line of a typical script
+#define BYTES_PER_LINE 6
+#define LOOKUPS 1000000
+// push/pop pairs, and the deepest the stack gets
+#define STACK_OPS 2000000
+#define STACK_DEPTH 16
+
+typedef struct {
+  const char *name;
+  // does the work and returns how many operations that was
+  long (*run)();
+} Case;
+
+// xorshift, started from the same seed for every run, so every run of a case
+// does exactly the same work
+static uint64_t rngState;
+
+static uint64_t next() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return rngState;
+}
+
+// a size from min to max that is as likely to be in any power of two as in
+// any other. min and max are powers of two
+static int logUniform(int min, int max) {
+  int lowBits = __builtin_ctz(min);
+  int highBits = __builtin_ctz(max);
+  int bits = lowBits + (int)(next() % (highBits - lowBits));
+  return (1 << bits) + (int)(next() % (1u << bits));
+}
+
+// writeChunk() calls with a new line every bytesPerLine bytes, or all on one
+// line for 0
+static long writeChunks(int bytesPerLine) {
+  long ops = 0;
+  for (int i = 0; i < CHUNKS; i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    int size = logUniform(CHUNK_MIN, CHUNK_MAX);
+    int line = 1;
+    int left = bytesPerLine;
+    for (int j = 0; j < size; j++) {
+      if (bytesPerLine > 0 && --left == 0) {
+        line++;
+        left = bytesPerLine;
+      }
+      writeChunk(&chunk, (uint8_t)j, line);
+    }
+    ops += size;
+    freeChunk(&chunk);
+  }
+  return ops;
+}
+
+static long writeChunkOneLine() { return writeChunks(0); }
+static long writeChunkSomeLines() { return writeChunks(BYTES_PER_LINE); }
+static long writeChunkEveryLine() { return writeChunks(1); }
+
+static long writeValueArrays() {
+  long ops = 0;
+  for (int i = 0; i < POOLS; i++) {
+    ValueArray array;
+    initValueArray(&array);
+    int size = logUniform(POOL_MIN, POOL_MAX);
+    for (int j = 0; j < size; j++) {
+      writeValueArray(&array, NUMBER_VAL(j));
+    }
+    ops += size;
+    freeValueArray(&array);
+  }
+  return ops;
+}
+
+static long addConstants() {
+  long ops = 0;
+  for (int i = 0; i < POOLS; i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    int size = logUniform(POOL_MIN, POOL_MAX);
+    for (int j = 0; j < size; j++) {
+      addConstant(&chunk, NUMBER_VAL(j));
+    }
+    ops += size;
+    freeChunk(&chunk);
+  }
+  return ops;
+}
+
+// the pools that get past 256 constants switch to OP_CONSTANT_LONG
+static long writeConstants() {
+  long ops = 0;
+  for (int i = 0; i < POOLS; i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    int size = logUniform(POOL_MIN, POOL_MAX);
+    for (int j = 0; j < size; j++) {
+      writeConstant(&chunk, NUMBER_VAL(j), 1 + j / BYTES_PER_LINE);
+    }
+    ops += size;
+    freeChunk(&chunk);
+  }
+  return ops;
+}
+
+// made once, outside the timing
+static Chunk lineChunk;
+
+static long getLines() {
+  volatile int lines = 0;
+  for (int i = 0; i < LOOKUPS; i++) {
+    lines += getLine(&lineChunk, (int)(next() % lineChunk.count));
+  }
+  return LOOKUPS;
+}
+
+// every push is popped again, so the stack never gets deeper than
+// STACK_DEPTH. A push and a pop are one operation each
+static long pushPops() {
+  long ops = 0;
+  while (ops < STACK_OPS) {
+    int depth = 1 + (int)(next() % STACK_DEPTH);
+    for (int i = 0; i < depth; i++) {
+      push(NUMBER_VAL(i));
+    }
+    for (int i = 0; i < depth; i++) {
+      pop();
+    }
+    ops += 2 * depth;
+  }
+  return ops;
+}
+
+static const Case cases[] = {
+    {"writeChunk one line", writeChunkOneLine},
+    {"writeChunk some new", writeChunkSomeLines},
+    {"writeChunk all new", writeChunkEveryLine},
+    {"writeValueArray", writeValueArrays},
+    {"addConstant", addConstants},
+    {"writeConstant", writeConstants},
+    {"getLine", getLines},
+    {"push/pop", pushPops},
+};
+
+static void measure(const Case *c) {
+  double best = 0;
+  long ops = 0;
+  size_t allocations = 0;
+  for (int run = 0; run < RUNS; run++) {
+    rngState = 88172645463325252ull;
+    size_t before = allocationCount;
+    double start = now();
+    ops = c->run();
+    double elapsed = now() - start;
+    allocations = allocationCount - before;
+    if (run == 0 || elapsed < best)
+      best = elapsed;
+  }
+  printf("%-20s %10ld %8.2f %10.4f\n", c->name, ops, best / ops,
+         (double)allocations / ops);
+}
+
+// what GROW_CAPACITY does to an array that ends up with count elements: how
+// often it grew, how much of the capacity is never used and how many
+// elements were copied along the way, if every grow had to copy
+static void growthRow(int count) {
+  int capacity = 0;
+  int grows = 0;
+  long copied = 0;
+  for (int i = 0; i < count; i++) {
+    if (capacity < i + 1) {
+      copied += i;
+      capacity = GROW_CAPACITY(capacity);
+      grows++;
+    }
+  }
+  printf("%10d %10d %6d %8.2f%% %10.2f\n", count, capacity, grows,
+         100.0 * (capacity - count) / capacity, (double)copied / count);
+}
+
+int main() {
+  initVM();
+  // push() doesn't check for room, interpretChunk() makes it before a chunk
+  // runs. Here it has to be made by hand
+  vm.stack = GROW_ARRAY(Value, vm.stack, vm.stackCapacity, STACK_DEPTH);
+  vm.stackCapacity = STACK_DEPTH;
+  vm.stackTop = vm.stack;
+
+  initChunk(&lineChunk);
+  for (int i = 0; i < CHUNK_MAX; i++) {
+    writeChunk(&lineChunk, (uint8_t)i, 1 + i / BYTES_PER_LINE);
+  }
+
+  printf("%-20s %10s %8s %10s\n", "operation", "ops", "ns/op", "allocs/op");
+  int caseCount = sizeof(cases) / sizeof(cases[0]);
+  for (int i = 0; i < caseCount; i++) {
+    measure(&cases[i]);
+  }
+
+  printf("\nGROW_CAPACITY\n%10s %10s %6s %9s %10s\n", "count", "capacity",
+         "grows", "unused", "copied/el");
+  for (int count = 1; count <= 1000000; count *= 10) {
+    growthRow(count);
+  }
+  growthRow(CHUNK_MAX + 1);
+
+  freeChunk(&lineChunk);
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,215 @@
+// checks that UTF-8 names and strings work and that the vector validator
+// agrees with the scalar one, then measures what checking the encoding costs
+// next to scanning on multi-megabyte scripts: one that is all ASCII and one
+// full of names and strings in other scripts, where no block can be skipped
+// build and run with: make bench && ./bench/utf8_bench
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "object.h"
+#include "scanner.h"
+#include "utf8.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RUNS 5
+// statements in each of the big scripts
+#define STATEMENTS 200000
+// random byte strings the two validators have to agree on, and how long
+// they get
+#define FUZZ 200000
+#define FUZZ_LENGTH 256
+
+static const Check checks[] = {
+    {"var π = 3.5; π * 2", INTERPRET_OK, VAL_NUMBER, "7"},
+    {"var größe = 2; var 名前 = größe * 3; "
+     "名前 + größe",
+     INTERPRET_OK, VAL_INT, "8"},
+    {"\"日本\" + \"語\" == \"日本語\"", INTERPRET_OK, VAL_BOOL, "true"},
+    {"\"héllo\" != \"hello\"", INTERPRET_OK, VAL_BOOL, "true"},
+    {"var 🎉 = \"🎉\"; 🎉 + 🎉", INTERPRET_OK, VAL_OBJ, "🎉🎉"},
+    {"var µ = 0.25; µ * 2", INTERPRET_OK, VAL_NUMBER, "0.5"},
+    // spaces, dashes and operators that look like ASCII aren't names
+    {"var a = 3; var b = 1; a − b", INTERPRET_COMPILE_ERROR, VAL_NIL, NULL},
+    {"var a = 3; var b = 1; a × b", INTERPRET_COMPILE_ERROR, VAL_NIL, NULL},
+    {"var a = 3; a\u00a0+ 1", INTERPRET_COMPILE_ERROR, VAL_NIL, NULL},
+    {"var a = 3;\u2028a", INTERPRET_COMPILE_ERROR, VAL_NIL, NULL},
+    {"“a”", INTERPRET_COMPILE_ERROR, VAL_NIL, NULL},
+    // but they can be in strings
+    {"\"a − b\"", INTERPRET_OK, VAL_OBJ, "a − b"},
+};
+
+// byte strings that are not UTF-8, and the first byte that is wrong
+typedef struct {
+  const char *bytes;
+  size_t invalid;
+} Invalid;
+
+static const Invalid invalids[] = {
+    {"abc\xff", 3},
+    // a continuation with no lead
+    {"a\x80", 1},
+    // cut off at the end
+    {"\"\xe6\x97", 1},
+    // an overlong '/'
+    {"\xc0\xaf", 0},
+    // a surrogate, U+D800
+    {"xx\xed\xa0\x80", 2},
+    // past U+10FFFF
+    {"\xf4\x90\x80\x80", 0},
+    // a three byte character cut off by ASCII, across a block of 16
+    {"0123456789abcd\xe6\x97" "x", 14},
+};
+
+static bool checkInvalid(const Invalid *c) {
+  size_t invalid = 0;
+  bool ok = !validateUtf8(c->bytes, strlen(c->bytes), &invalid) &&
+            invalid == c->invalid;
+  if (!ok) {
+    printf("  invalid string %zu: offset %zu instead of %zu\n",
+           (size_t)(c - invalids), invalid, c->invalid);
+  }
+  return ok;
+}
+
+// xorshift, so the fuzzing is the same every time
+static uint64_t rngState = 88172645463325252ull;
+
+static uint64_t next() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return rngState;
+}
+
+// bytes that are mostly valid UTF-8: pieces of real characters, and now and
+// then a random byte
+static size_t fuzzBytes(char *out) {
+  static const char *pieces[] = {"a", "\xc3\xa9", "\xe6\x97\xa5",
+                                 "\xf0\x9f\x8e\x89", "\xed\x9f\xbf"};
+  size_t length = 0;
+  size_t target = next() % FUZZ_LENGTH;
+  while (length < target) {
+    if (next() % 16 == 0) {
+      out[length++] = (char)next();
+    } else {
+      const char *piece = pieces[next() % 5];
+      memcpy(out + length, piece, strlen(piece));
+      length += strlen(piece);
+    }
+  }
+  return length;
+}
+
+static int fuzzDisagreements() {
+  char bytes[FUZZ_LENGTH + 8];
+  int disagreements = 0;
+  for (int i = 0; i < FUZZ; i++) {
+    size_t length = fuzzBytes(bytes);
+    size_t vector = 0;
+    size_t scalar = 0;
+    bool a = validateUtf8(bytes, length, &vector);
+    bool b = validateUtf8Scalar(bytes, length, &scalar);
+    if (a != b || (!a && vector != scalar))
+      disagreements++;
+  }
+  return disagreements;
+}
+
+// a statement that is all ASCII, or one with names and strings in Greek,
+// Japanese and emoji
+static int asciiStatement(char *out, int i) {
+  return sprintf(out, "total = total + %d * 2; name = \"item number %d\";\n",
+                 i % 100, i);
+}
+
+static int unicodeStatement(char *out, int i) {
+  return sprintf(out,
+                 "合計 = 合計 + %d * 2; "
+                 "名前 = \"品目 番号 %d 🎉\"; "
+                 "π = π * 1.0;\n",
+                 i % 100, i);
+}
+
+static char *buildSource(int (*statement)(char *, int), size_t *length) {
+  char *source = malloc((size_t)STATEMENTS * 96 + 1);
+  size_t used = 0;
+  for (int i = 0; i < STATEMENTS; i++) {
+    used += statement(source + used, i);
+  }
+  source[used] = '\0';
+  *length = used;
+  return source;
+}
+
+static double best(double times[RUNS]) {
+  double min = times[0];
+  for (int i = 1; i < RUNS; i++) {
+    if (times[i] < min)
+      min = times[i];
+  }
+  return min;
+}
+
+static void measure(const char *name, int (*statement)(char *, int)) {
+  size_t length;
+  char *source = buildSource(statement, &length);
+  double vector[RUNS], scalar[RUNS], scan[RUNS];
+  size_t invalid;
+  for (int run = 0; run < RUNS; run++) {
+    double start = now();
+    if (!validateUtf8(source, length, &invalid))
+      exit(1);
+    vector[run] = now() - start;
+
+    start = now();
+    if (!validateUtf8Scalar(source, length, &invalid))
+      exit(1);
+    scalar[run] = now() - start;
+
+    start = now();
+    initScanner(source);
+    while (scanToken().type != TOKEN_EOF) {
+    }
+    scan[run] = now() - start;
+  }
+
+  double v = best(vector), s = best(scalar), sc = best(scan);
+  printf("%-8s %6.2f %8.2f %8.2f %8.2f %8.2f %9.2f%% %9.2f%%\n", name,
+         length / 1e6, length / v, length / s, sc / 1e6, length / sc,
+         100 * v / sc, 100 * s / sc);
+  free(source);
+}
+
+int main() {
+  initVM();
+  int checkCount = sizeof(checks) / sizeof(checks[0]);
+  int invalidCount = sizeof(invalids) / sizeof(invalids[0]);
+  int passed = 0;
+  printf("(compile errors below are expected)\n");
+  fflush(stdout);
+  for (int i = 0; i < checkCount; i++) {
+    passed += check(&checks[i]);
+  }
+  for (int i = 0; i < invalidCount; i++) {
+    passed += checkInvalid(&invalids[i]);
+  }
+  printf("%d/%d checks pass\n", passed, checkCount + invalidCount);
+  int disagreements = fuzzDisagreements();
+  printf("%d of %d random strings the validators disagree on\n",
+         disagreements, FUZZ);
+  freeGlobals();
+  freeObjects();
+
+  // vector, scalar and scan are GB/s. The last two columns are the time
+  // each validator takes as a share of the scan time
+  printf("\n%-8s %6s %8s %8s %8s %8s %10s %10s\n", "script", "MB", "vector",
+         "scalar", "scan ms", "scan", "vector %", "scalar %");
+  measure("ascii", asciiStatement);
+  measure("unicode", unicodeStatement);
+
+  freeVM();
+  return passed == checkCount + invalidCount && disagreements == 0 ? 0 : 1;
+}
@@ -2,8 +2,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
+#include "jit.h"
+#include "memo.h"
 #include "memory.h"
 #include "value.h"
 
@@ -14,15 +17,31 @@ void initChunk(Chunk *chunk) {
   chunk->lineCount = 0;
   chunk->lineCapacity = 0;
   chunk->lines = NULL;
+  chunk->maxStack = 0;
+  chunk->verified = false;
+  chunk->jit = NULL;
+  chunk->pure = false;
+  chunk->memo = NULL;
+  chunk->block = NULL;
+  chunk->blockSize = 0;
   // when we initialize a new chunk, also initialize its constant list too
   initValueArray(&chunk->constants);
 }
 
 void freeChunk(Chunk *chunk) {
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
-  // also free the constants when the chunk is freed
-  freeValueArray(&chunk->constants);
+  if (chunk->block != NULL) {
+    // the arrays are all inside the block
+    reallocate(chunk->block, chunk->blockSize, 0);
+  } else {
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    // also free the constants when the chunk is freed
+    freeValueArray(&chunk->constants);
+  }
+  // and any machine code the JIT made for it
+  freeJit(chunk->jit);
+  // and the results it remembered
+  freeMemo(chunk->memo);
   // call initChunk here to zero out the fields leaving the chunk in a
   // well-defined empty state
   initChunk(chunk);
@@ -70,6 +89,102 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line) {
   lineStart->line = line;
 }
 
+// rounds size up to the next multiple of type's alignment
+#define ALIGN_FOR(type, size)                                                  \
+  (((size) + _Alignof(type) - 1) & ~(_Alignof(type) - 1))
+
+// the layout of the block: constants, lines, code. Returns its size
+static size_t blockLayout(int constantCount, int lineCount, int codeCount,
+                          size_t *linesOffset, size_t *codeOffset) {
+  size_t constantsSize = sizeof(Value) * constantCount;
+  *linesOffset = ALIGN_FOR(LineStart, constantsSize);
+  *codeOffset = *linesOffset + sizeof(LineStart) * lineCount;
+  return *codeOffset + codeCount;
+}
+
+// point the chunk's arrays into the block, each with room for exactly what the
+// layout made room for
+static void useBlock(Chunk *chunk, uint8_t *block, size_t size,
+                     size_t linesOffset, size_t codeOffset, int constantCount,
+                     int lineCount, int codeCount) {
+  chunk->constants.values = (Value *)block;
+  chunk->constants.capacity = constantCount;
+  chunk->lines = (LineStart *)(block + linesOffset);
+  chunk->lineCapacity = lineCount;
+  chunk->code = block + codeOffset;
+  chunk->capacity = codeCount;
+  chunk->block = block;
+  chunk->blockSize = size;
+}
+
+void finalizeChunk(Chunk *chunk) {
+  if (chunk->block != NULL)
+    return;
+
+  size_t linesOffset, codeOffset;
+  size_t size = blockLayout(chunk->constants.count, chunk->lineCount,
+                            chunk->count, &linesOffset, &codeOffset);
+  if (size == 0)
+    return;
+
+  uint8_t *block = reallocate(NULL, 0, size);
+  // a chunk without constants never allocated their array
+  if (chunk->constants.count > 0) {
+    memcpy(block, chunk->constants.values,
+           sizeof(Value) * chunk->constants.count);
+  }
+  memcpy(block + linesOffset, chunk->lines,
+         sizeof(LineStart) * chunk->lineCount);
+  memcpy(block + codeOffset, chunk->code, chunk->count);
+
+  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+  FREE_ARRAY(Value, chunk->constants.values, chunk->constants.capacity);
+
+  // the capacities now say there is no room left. They are only used to free
+  // the arrays, which freeChunk() no longer does one by one
+  useBlock(chunk, block, size, linesOffset, codeOffset, chunk->constants.count,
+           chunk->lineCount, chunk->count);
+}
+
+void adoptChunk(Chunk *chunk, uint8_t *code, size_t codeCapacity,
+                int codeCount, LineStart *lines, int lineCount,
+                Value *constants, int constantCount) {
+  size_t linesOffset, codeOffset;
+  size_t size = blockLayout(constantCount, lineCount, codeCount, &linesOffset,
+                            &codeOffset);
+  // the code is already at the start of its allocation. Resizing that to the
+  // block's size and sliding the code to the end makes room for the rest
+  // without a second copy of the code existing at any point
+  uint8_t *block = reallocate(code, codeCapacity, size);
+  memmove(block + codeOffset, block, codeCount);
+  if (constantCount > 0) {
+    memcpy(block, constants, sizeof(Value) * constantCount);
+  }
+  memcpy(block + linesOffset, lines, sizeof(LineStart) * lineCount);
+  chunk->count = codeCount;
+  chunk->lineCount = lineCount;
+  chunk->constants.count = constantCount;
+  useBlock(chunk, block, size, linesOffset, codeOffset, constantCount,
+           lineCount, codeCount);
+}
+
+void copyChunk(Chunk *chunk, Chunk *from) {
+  finalizeChunk(from);
+  uint8_t *block = reallocate(NULL, 0, from->blockSize);
+  memcpy(block, from->block, from->blockSize);
+  chunk->count = from->count;
+  chunk->lineCount = from->lineCount;
+  chunk->constants.count = from->constants.count;
+  useBlock(chunk, block, from->blockSize,
+           (uint8_t *)from->lines - (uint8_t *)from->block,
+           from->code - (uint8_t *)from->block, from->constants.count,
+           from->lineCount, from->count);
+  chunk->maxStack = from->maxStack;
+  chunk->verified = from->verified;
+  chunk->pure = from->pure;
+}
+
 // write the constant value to the chunk's constant pool
 int addConstant(Chunk *chunk, Value value) {
   writeValueArray(&chunk->constants, value);
@@ -124,7 +239,6 @@ void writeConstant(Chunk *chunk, Value value, int line) {
   } else {
     // each writeChunk will write to the next index in chunk->code array
     writeChunk(chunk, OP_CONSTANT_LONG, line);
-    printf("chunk-count: %d", chunk->count);
     // lowest order byte gets written first -- because we & with 0xff (255),
     // we get the first lower order bytes want to & because we then mask all
     // the higher order bytes
@@ -133,10 +247,7 @@ void writeConstant(Chunk *chunk, Value value, int line) {
     // byte and then & with 255 to get the bits that are turned on there
     // and so on to the next byte
     writeChunk(chunk, (uint8_t)(index & 0xff), line);
-    printf("chunk-count: %d", chunk->count);
     writeChunk(chunk, (uint8_t)((index >> 8) & 0xff), line);
-    printf("chunk-count: %d", chunk->count);
     writeChunk(chunk, (uint8_t)((index >> 16) & 0xff), line);
-    printf("chunk-count: %d", chunk->count);
   }
 }
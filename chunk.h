@@ -14,6 +14,80 @@ typedef enum {
   OP_CONSTANT_LONG,
   OP_NEGATE,
   OP_RETURN,
+  // the compiler never emits these. Once an arithmetic instruction has run
+  // with numbers, the VM rewrites it in place to its number-only version which
+  // skips the full type checks ("quickening"). If the cheap guard in the
+  // number-only version ever fails, it is rewritten back
+  OP_ADD_NUMBER,
+  OP_SUBTRACT_NUMBER,
+  OP_MULTIPLY_NUMBER,
+  OP_DIVIDE_NUMBER,
+  OP_NEGATE_NUMBER,
+  // emitted by the compiler when it can prove that the operands are numbers.
+  // These don't check anything at all
+  OP_ADD_UNCHECKED,
+  OP_SUBTRACT_UNCHECKED,
+  OP_MULTIPLY_UNCHECKED,
+  OP_DIVIDE_UNCHECKED,
+  OP_NEGATE_UNCHECKED,
+  // push an integer that is written into the instruction itself, so it
+  // doesn't take a slot in the constant pool or a load from it. The compiler
+  // uses them for integer literals from 0 to 65535: OP_ZERO and OP_ONE have no
+  // operand, OP_SMALL_INT has a one byte operand and OP_SMALL_INT_LONG a two
+  // byte little-endian one
+  OP_ZERO,
+  OP_ONE,
+  OP_SMALL_INT,
+  OP_SMALL_INT_LONG,
+  // push a copy of a value that is already on the stack. OP_DUP copies the
+  // top, OP_PICK has a one byte operand that counts down from the top: 0 is
+  // the top itself, 1 the value under it and so on. The compiler uses them to
+  // reuse a value it computed once instead of computing it again (see
+  // optimize.h)
+  OP_DUP,
+  OP_PICK,
+  // the quickened versions for two integers (one for negation), like the
+  // _NUMBER ones above for doubles. The compiler emits them directly when it
+  // knows both operands are integers. There is no integer division, dividing
+  // gives a double
+  OP_ADD_INT,
+  OP_SUBTRACT_INT,
+  OP_MULTIPLY_INT,
+  OP_NEGATE_INT,
+  // pops two values and pushes whether they are equal (see valuesEqual()).
+  // a != b is OP_EQUAL followed by OP_NOT
+  OP_EQUAL,
+  // pushes true for nil and false and false for everything else
+  OP_NOT,
+  // global variables live in VM.globals, and the compiler has already turned
+  // the name into the index of the variable's slot there. That is the
+  // operand, 16 bits, lowest byte first
+  // pops the value into the slot, which declares the variable
+  OP_DEFINE_GLOBAL,
+  // pushes the variable's value, or fails if it was never declared
+  OP_GET_GLOBAL,
+  // stores the top of the stack in the variable and leaves it there, since an
+  // assignment is an expression. Fails if the variable was never declared
+  OP_SET_GLOBAL,
+  // drops the value of an expression statement
+  OP_POP,
+  // the intrinsics: each one is a single call to the libm function of the
+  // same name (fabs for OP_ABS), or to minNumber() and maxNumber() in
+  // value.h. They take numbers and, like OP_DIVIDE, always give a double.
+  // OP_SQRT, OP_ABS, OP_FLOOR and OP_EXP replace the top of the stack,
+  // OP_MIN, OP_MAX and OP_POW pop two values and push the result
+  OP_SQRT,
+  OP_ABS,
+  OP_FLOOR,
+  OP_EXP,
+  OP_MIN,
+  OP_MAX,
+  OP_POW,
+  // puts a copy of the top of the stack further down, under the values its
+  // one byte operand counts: 1 puts it right under the top. The compiler uses
+  // it to keep a value it computed in the middle of an expression for
+  // OP_PICK to copy later on (see optimize.h)
+  OP_TUCK,
 } OpCode;
 
 // used to mark the start of a new line in the source code
@@ -33,6 +107,25 @@ typedef struct {
                  // new line
   int lineCapacity;
   LineStart *lines;
+  // the most values this chunk ever has on the stack at once. The compiler
+  // works this out while it emits the code
+  int maxStack;
+  // set once verifyChunk() accepted the chunk, so that it is only checked the
+  // first time it runs
+  bool verified;
+  // machine code the JIT translated this chunk into. NULL until the JIT has
+  // looked at the chunk (see jit.h)
+  struct JitCode *jit;
+  // set by the compiler when the chunk doesn't assign or declare a global,
+  // so running it can't change anything and its result only depends on the
+  // globals it reads (see memo.h)
+  bool pure;
+  // the chunk's memoized results. NULL until it runs with memoization on
+  struct Memo *memo;
+  // once finalizeChunk() has run, code, lines and constants.values all point
+  // into this one allocation of blockSize bytes. NULL before that
+  void *block;
+  size_t blockSize;
 } Chunk;
 
 void initChunk(Chunk *chunk);
@@ -41,5 +134,23 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line);
 int addConstant(Chunk *chunk, Value value);
 int getLine(Chunk *chunk, int offset);
 void writeConstant(Chunk *chunk, Value value, int line);
+// packs the constants, the lines and the code into a single allocation that
+// is exactly as big as they are, dropping the slack GROW_CAPACITY leaves in
+// each array. The constants come first so they get the allocation's alignment.
+// Call it once the chunk is complete: a finalized chunk can still run (and be
+// quickened), but nothing can be written to it anymore
+void finalizeChunk(Chunk *chunk);
+// builds an already finalized chunk out of arrays the caller filled in on its
+// own (the compiler's backend does this). code is grown or shrunk in place
+// into the block, so the chunk takes it over; lines and constants are copied
+// and stay the caller's. chunk must be freshly initialized
+void adoptChunk(Chunk *chunk, uint8_t *code, size_t codeCapacity,
+                int codeCount, LineStart *lines, int lineCount,
+                Value *constants, int constantCount);
+// makes chunk, which must be freshly initialized, a copy of from for another
+// thread to run. Quickening rewrites the code as it runs, so two threads
+// can't share a chunk. The constants are copied as they are: strings in them
+// still belong to the thread that made from (see rows.c)
+void copyChunk(Chunk *chunk, Chunk *from);
 
 #endif
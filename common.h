@@ -5,7 +5,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// the diagnostic output is on while we work on the interpreter. Building with
+// -DNDEBUG (the benchmarks do this) turns it off so that it doesn't swamp
+// whatever we are trying to measure
+#ifndef NDEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
+
+// count what run() executes for clox --stats (see stats.h). It slows the
+// interpreter down, so it is off unless it is defined here or with -D, which is
+// what `make clox-stats` does. DEBUG_STATS_CYCLES also times every opcode
+// #define DEBUG_STATS
+// #define DEBUG_STATS_CYCLES
 
 #endif
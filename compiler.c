@@ -1,10 +1,22 @@
 #include "compiler.h"
 #include "chunk.h"
 #include "common.h"
+#include "dtoa.h"
+#include "ir.h"
+#include "memory.h"
+#include "object.h"
+#include "optimize.h"
+#include "phases.h"
+#include "pipeline.h"
 #include "scanner.h"
+#include "utf8.h"
 #include "value.h"
+#include "vm.h"
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
@@ -42,7 +54,10 @@ typedef enum {
 } Precedence;
 
 // function pointer type
-typedef void (*ParseFn)();
+// canAssign tells a parse function whether an = after it would assign to what
+// it parsed. Only a variable ever uses it, but at a + b = c the b is parsed
+// at a precedence higher than assignment and must not take the =
+typedef void (*ParseFn)(bool canAssign);
 
 typedef struct {
   ParseFn prefix;
@@ -50,8 +65,36 @@ typedef struct {
   Precedence precedence;
 } ParseRule;
 
+// what the compiler knows about the type of an expression's value
+typedef enum {
+  TYPE_UNKNOWN, // could be anything, the VM has to check
+  TYPE_NUMBER,  // always a double
+  TYPE_INTEGER, // always an integer
+} StaticType;
+
 Parser parser;
 Chunk *compilingChunk;
+// what the parser has built so far (see ir.h)
+Ir ir;
+
+// what the backend keeps track of while it lowers the IR to bytecode
+typedef struct {
+  // the code is written over the IR nodes as they are lowered (see lower())
+  uint8_t *code;
+  int codeCount;
+  LineStart *lines;
+  int lineCount;
+  Value *constants;
+  int constantCount;
+  // the backend's picture of the stack: the static type of every value the
+  // code emitted so far leaves on the stack. The deepest it ever gets is
+  // recorded in the chunk so that the VM can make room up front
+  StaticType *stackTypes;
+  int stackTypesCapacity;
+  int stackDepth;
+} Backend;
+
+Backend backend;
 
 static Chunk *currentChunk() { return compilingChunk; }
 
@@ -62,17 +105,17 @@ static void errorAt(Token *token, const char *message) {
   if (parser.panicMode)
     return;
   parser.panicMode = true;
-  fprintf(stderr, "[line %d] Error", token->line);
+  fprintf(vm.errors, "[line %d] Error", token->line);
 
   if (token->type == TOKEN_EOF) {
-    fprintf(stderr, " at end");
+    fprintf(vm.errors, " at end");
   } else if (token->type == TOKEN_ERROR) {
     // Nothing
   } else {
-    fprintf(stderr, " at '%.*s'", token->length, token->start);
+    fprintf(vm.errors, " at '%.*s'", token->length, token->start);
   }
 
-  fprintf(stderr, ": %s\n", message);
+  fprintf(vm.errors, ": %s\n", message);
   parser.hadError = true;
 }
 
@@ -82,6 +125,12 @@ static void errorAtCurrent(const char *message) {
   errorAt(&parser.current, message);
 }
 
+// set by compile() when the tokens come from the scanner thread (see
+// pipeline.h) instead of from calling the scanner here
+static bool pipelined;
+
+static Token nextToken() { return pipelined ? takeToken() : scanToken(); }
+
 static void advance() {
   parser.previous = parser.current;
 
@@ -89,7 +138,7 @@ static void advance() {
     // recall that clox's scanner doesn't report lexical errors. Instead it
     // creates sprecial error tokens and leaves it up to the parser to report
     // them
-    parser.current = scanToken();
+    parser.current = nextToken();
     if (parser.current.type != TOKEN_ERROR)
       break;
 
@@ -97,6 +146,16 @@ static void advance() {
   }
 }
 
+static bool check(TokenType type) { return parser.current.type == type; }
+
+// consumes the current token if it has the given type
+static bool match(TokenType type) {
+  if (!check(type))
+    return false;
+  advance();
+  return true;
+}
+
 static void consume(TokenType type, const char *message) {
   // like advance in that it reads the next token, but it also validates that
   // the token has an expected type, if not it reports an error
@@ -109,62 +168,210 @@ static void consume(TokenType type, const char *message) {
   errorAtCurrent(message);
 }
 
-static void emitByte(uint8_t byte) {
-  writeChunk(currentChunk(), byte, parser.previous.line);
-}
+static void expression();
+static ParseRule *getRule(TokenType type);
+static void parsePrecedence(Precedence precedence);
 
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-  emitByte(byte1);
-  emitByte(byte2);
+// the parse functions below don't emit any bytecode. Each one appends nodes
+// for what it parsed to the IR, operands first (see ir.h), and the backend
+// further down turns the whole IR into bytecode at the end
+
+static void grouping(bool canAssign) {
+  // recursively call back into expression() to comiple the expression between
+  // the parentheses, then parse the closing ) at the end
+  expression();
+  // consume any additional tokens
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void emitReturn() { emitByte(OP_RETURN); }
+// a literal without a decimal point is an integer, unless it is too big for
+// one. Then it is a double, like it would be with a decimal point
+static void number(bool canAssign) {
+  const char *start = parser.previous.start;
+  int length = parser.previous.length;
+  int64_t integer = 0;
+  bool isInteger = true;
+  for (int i = 0; i < length && isInteger; i++) {
+    isInteger = start[i] != '.' &&
+                !__builtin_mul_overflow(integer, 10, &integer) &&
+                !__builtin_add_overflow(integer, start[i] - '0', &integer);
+  }
+
+  bool added = isInteger
+                   ? addIntegerNode(&ir, integer, parser.previous.line)
+                   : addNumberNode(&ir, parseNumber(start, length),
+                                   parser.previous.line);
+  if (!added) {
+    error("Too many constants in one chunk.");
+  }
+}
 
-static uint8_t makeConstant(Value value) {
-  // add value to the constant table
-  int constant = addConstant(currentChunk(), value);
-  // make sure we do not have too many constants since OP_CONSTANT uses a single
-  // byte for the index operand. So we can store only up to 256 constants in a
-  // chunk
-  if (constant > UINT8_MAX) {
+// the string is interned right away, while the source is still around. The
+// lexeme includes the quotes, they are left out
+static void string(bool canAssign) {
+  ObjString *string =
+      copyString(parser.previous.start + 1, parser.previous.length - 2);
+  if (!addStringNode(&ir, string, parser.previous.line)) {
     error("Too many constants in one chunk.");
+  }
+}
+
+// the slot of the global named by the token. The name is interned like any
+// other string, so the lookup in vm.globalNames is by pointer
+static uint32_t identifierSlot(Token *name) {
+  int slot = globalSlot(copyString(name->start, name->length));
+  if (slot < 0) {
+    error("Too many global variables.");
     return 0;
   }
-  return (uint8_t)constant;
+  return (uint32_t)slot;
 }
 
-// emit OP_CONSTANT instruction that pushes it onto the stack at runtime
-static void emitConstant(Value value) {
-  emitBytes(OP_CONSTANT, makeConstant(value));
+// the language has no functions to call. These few math functions are built
+// in instead: sqrt(x), abs(x), floor(x), exp(x), min(a, b), max(a, b) and
+// pow(a, b). Each one is a node of its own and lowers to an opcode of its own
+// that calls libm straight from the VM's loop (see OP_SQRT in chunk.h), so
+// there is no call frame or argument passing to pay for
+typedef struct {
+  const char *name;
+  int length;
+  NodeKind kind;
+  int arity;
+} Intrinsic;
+
+static const Intrinsic intrinsics[] = {
+    {"sqrt", 4, NODE_SQRT, 1}, {"abs", 3, NODE_ABS, 1},
+    {"floor", 5, NODE_FLOOR, 1}, {"exp", 3, NODE_EXP, 1},
+    {"min", 3, NODE_MIN, 2},   {"max", 3, NODE_MAX, 2},
+    {"pow", 3, NODE_POW, 2},
+};
+
+// the intrinsic the name refers to if it is called, or NULL. Without the
+// parentheses it's just a global that happens to have the same name
+static const Intrinsic *findIntrinsic(Token *name) {
+  if (!check(TOKEN_LEFT_PAREN))
+    return NULL;
+  for (size_t i = 0; i < sizeof(intrinsics) / sizeof(intrinsics[0]); i++) {
+    if (intrinsics[i].length == name->length &&
+        memcmp(intrinsics[i].name, name->start, name->length) == 0)
+      return &intrinsics[i];
+  }
+  return NULL;
 }
 
-static void endCompiler() {
-  emitReturn();
-#ifdef DEBUG_PRINT_CODE
-  if (!parser.hadError) {
-    disassembleChunk(currentChunk(), "code");
+// what the VM computes for an intrinsic. Folding calls the same functions
+// the VM does, so a folded call gives exactly the bits it would at run time
+static double applyIntrinsic(NodeKind kind, double a, double b) {
+  switch (kind) {
+  case NODE_SQRT:
+    return sqrt(a);
+  case NODE_ABS:
+    return fabs(a);
+  case NODE_FLOOR:
+    return floor(a);
+  case NODE_EXP:
+    return exp(a);
+  case NODE_MIN:
+    return minNumber(a, b);
+  case NODE_MAX:
+    return maxNumber(a, b);
+  default:
+    return pow(a, b);
   }
-#endif
 }
 
-static void expression();
-static ParseRule *getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+// the root of the subtree that ends right before index, past the nodes
+// folding killed inside it
+static int previousRoot(int index) {
+  int root = index - 1;
+  while (root >= 0 && ir.nodes[root].kind == NODE_DEAD) {
+    root--;
+  }
+  return root;
+}
 
-static void grouping() {
-  // recursively call back into expression() to comiple the expression between
-  // the parentheses, then parse the closing ) at the end
+// whether the subtree with this root is a literal or a negated one, and if
+// so where it starts and the number it is. The parser has no negative
+// literals, -2 is a negated 2. Negating the integer 0 gives the integer 0,
+// which is the double 0 and not -0, so integers are negated as 0 - x
+static bool literalOperand(int root, int *start, double *value) {
+  if (root < 0)
+    return false;
+  Node node = ir.nodes[root];
+  bool negated = node.kind == NODE_NEGATE;
+  if (negated) {
+    root = previousRoot(root);
+    if (root < 0)
+      return false;
+    node = ir.nodes[root];
+  }
+  if (node.kind != NODE_NUMBER && node.kind != NODE_INTEGER &&
+      node.kind != NODE_LONG_INTEGER)
+    return false;
+  *start = root;
+  *value = numberValue(&ir, node);
+  if (negated) {
+    *value = node.kind == NODE_NUMBER ? -*value : 0.0 - *value;
+  }
+  return true;
+}
+
+// turns the intrinsic at index into the double it gives if its operands are
+// literals, so sqrt(2) costs as little as 1.4142135623730951. The operands
+// become NODE_DEAD. If there are too many literals it is just left alone
+static void foldIntrinsic(const Intrinsic *intrinsic, int index) {
+  int start;
+  double right;
+  if (!literalOperand(previousRoot(index), &start, &right))
+    return;
+  double left = right;
+  if (intrinsic->arity == 2 &&
+      !literalOperand(previousRoot(start), &start, &left))
+    return;
+  double result = intrinsic->arity == 2
+                      ? applyIntrinsic(intrinsic->kind, left, right)
+                      : applyIntrinsic(intrinsic->kind, right, 0);
+  if (!setNumberNode(&ir, index, result))
+    return;
+  for (int i = start; i < index; i++) {
+    ir.nodes[i].kind = NODE_DEAD;
+  }
+}
+
+// name(argument) or name(left, right). The arguments are full expressions,
+// like the one between the parentheses of a grouping
+static void intrinsicCall(const Intrinsic *intrinsic, Token *name) {
+  // the ( findIntrinsic() saw
+  advance();
   expression();
-  // consume any additional tokens
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+  if (intrinsic->arity == 2) {
+    consume(TOKEN_COMMA, "Expect ',' between arguments.");
+    expression();
+  }
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+  int index = addNode(&ir, intrinsic->kind, 0, name->line);
+  foldIntrinsic(intrinsic, index);
 }
 
-static void number() {
-  double value = strtod(parser.previous.start, NULL);
-  emitConstant(NUMBER_VAL(value));
+// a global variable, or an assignment to one
+static void variable(bool canAssign) {
+  Token name = parser.previous;
+  const Intrinsic *intrinsic = findIntrinsic(&name);
+  if (intrinsic != NULL) {
+    intrinsicCall(intrinsic, &name);
+    return;
+  }
+  uint32_t slot = identifierSlot(&name);
+  if (canAssign && match(TOKEN_EQUAL)) {
+    // the value is parsed first, its nodes go in front of the set
+    expression();
+    addNode(&ir, NODE_SET_GLOBAL, slot, name.line);
+  } else {
+    addNode(&ir, NODE_GET_GLOBAL, slot, name.line);
+  }
 }
 
-static void unary() {
+static void unary(bool canAssign) {
   // the leading "-" or "!"  token has been consumed and is sitting in
   // parser.previous
   TokenType operatorType = parser.previous.type;
@@ -172,19 +379,20 @@ static void unary() {
   // compile the operand
   parsePrecedence(PREC_UNARY);
 
-  // Emit the operator instruction
-  // we write the negate instruction after its operand's bytecode since "-"
-  // or
-  // "!" appears on the left. On the stack the operand is on top of the
-  // stack above the unary operator. We will evaluate the operand first and
-  // leave its value on the stack then we pop that value, negate it, and
-  // then push the result. So the OP_NEGATE instruction should be emitted
-  // last. Part of the compiler's job is to parse the program in the order
-  // it appears in the source code and rearrange it into the order that
-  // execution happens
+  // add the operator node
+  // the negate node goes after its operand's nodes since "-" or "!" appears
+  // on the left. On the stack the operand is on top of the stack above the
+  // unary operator. We will evaluate the operand first and leave its value on
+  // the stack then we pop that value, negate it, and then push the result. So
+  // the OP_NEGATE instruction should come last. Part of the compiler's job is
+  // to parse the program in the order it appears in the source code and
+  // rearrange it into the order that execution happens
   switch (operatorType) {
   case TOKEN_MINUS:
-    emitByte(OP_NEGATE);
+    addNode(&ir, NODE_NEGATE, 0, parser.previous.line);
+    break;
+  case TOKEN_BANG:
+    addNode(&ir, NODE_NOT, 0, parser.previous.line);
     break;
   default:
     return;
@@ -197,25 +405,34 @@ static void unary() {
 // with infix expressions, we don't know we're in the middle of a binary
 // operator until after we've parsed its left operand and then stumbled onto
 // the operator token in the middle
-static void binary() {
+static void binary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
   // when we parse the right operand of the * expression in 2*3+4, we need to
   // just capture 3, and not 3+4 because + is lower precedence than *
   ParseRule *rule = getRule(operatorType);
   parsePrecedence((Precedence)(rule->precedence + 1));
 
+  int line = parser.previous.line;
   switch (operatorType) {
   case TOKEN_PLUS:
-    emitByte(OP_ADD);
+    addNode(&ir, NODE_ADD, 0, line);
     break;
   case TOKEN_MINUS:
-    emitByte(OP_SUBTRACT);
+    addNode(&ir, NODE_SUBTRACT, 0, line);
     break;
   case TOKEN_STAR:
-    emitByte(OP_MULTIPLY);
+    addNode(&ir, NODE_MULTIPLY, 0, line);
     break;
   case TOKEN_SLASH:
-    emitByte(OP_DIVIDE);
+    addNode(&ir, NODE_DIVIDE, 0, line);
+    break;
+  case TOKEN_EQUAL_EQUAL:
+    addNode(&ir, NODE_EQUAL, 0, line);
+    break;
+  // a != b is !(a == b), there is no node of its own for it
+  case TOKEN_BANG_EQUAL:
+    addNode(&ir, NODE_EQUAL, 0, line);
+    addNode(&ir, NODE_NOT, 0, line);
     break;
   default:
     return;
@@ -238,16 +455,16 @@ ParseRule rules[] = {
     [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
     [TOKEN_SLASH] = {NULL, binary, PREC_FACTOR},
     [TOKEN_STAR] = {NULL, binary, PREC_FACTOR},
-    [TOKEN_BANG] = {NULL, NULL, PREC_NONE},
-    [TOKEN_BANG_EQUAL] = {NULL, NULL, PREC_NONE},
+    [TOKEN_BANG] = {unary, NULL, PREC_NONE},
+    [TOKEN_BANG_EQUAL] = {NULL, binary, PREC_EQUALITY},
     [TOKEN_EQUAL] = {NULL, NULL, PREC_NONE},
-    [TOKEN_EQUAL_EQUAL] = {NULL, NULL, PREC_NONE},
+    [TOKEN_EQUAL_EQUAL] = {NULL, binary, PREC_EQUALITY},
     [TOKEN_GREATER] = {NULL, NULL, PREC_NONE},
     [TOKEN_GREATER_EQUAL] = {NULL, NULL, PREC_NONE},
     [TOKEN_LESS] = {NULL, NULL, PREC_NONE},
     [TOKEN_LESS_EQUAL] = {NULL, NULL, PREC_NONE},
-    [TOKEN_IDENTIFIER] = {NULL, NULL, PREC_NONE},
-    [TOKEN_STRING] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
+    [TOKEN_STRING] = {string, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
     [TOKEN_AND] = {NULL, NULL, PREC_NONE},
     [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
@@ -294,7 +511,8 @@ static void parsePrecedence(Precedence precedence) {
     return;
   }
 
-  prefixRule();
+  bool canAssign = precedence <= PREC_ASSIGNMENT;
+  prefixRule(canAssign);
 
   while (precedence <= getRule(parser.current.type)->precedence) {
     advance();
@@ -302,19 +520,543 @@ static void parsePrecedence(Precedence precedence) {
     // parsed the left operand, for example 1+2. We already parsed 1 before we
     // got to the + operator
     ParseFn infixRule = getRule(parser.previous.type)->infix;
-    infixRule();
+    infixRule(canAssign);
+  }
+
+  // nothing took the =, so what's in front of it can't be assigned to
+  if (canAssign && match(TOKEN_EQUAL)) {
+    error("Invalid assignment target.");
   }
 }
 
-bool compile(const char *source, Chunk *chunk) {
+// var name = value; declares the global name. There is no nil to give a
+// variable declared without a value, so the value isn't optional
+static void varDeclaration() {
+  consume(TOKEN_IDENTIFIER, "Expect variable name.");
+  Token name = parser.previous;
+  uint32_t slot = identifierSlot(&name);
+  consume(TOKEN_EQUAL, "Expect '=' after variable name.");
+  expression();
+  consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+  addNode(&ir, NODE_DEFINE_GLOBAL, slot, name.line);
+}
+
+// after an error, skip ahead to where the next declaration likely starts so
+// that one mistake doesn't cause a cascade of errors
+static void synchronize() {
+  parser.panicMode = false;
+  while (parser.current.type != TOKEN_EOF) {
+    if (parser.previous.type == TOKEN_SEMICOLON)
+      return;
+    if (parser.current.type == TOKEN_VAR)
+      return;
+    advance();
+  }
+}
+
+// a program is declarations and expression statements, each ending in a
+// semicolon, and then the expression whose value is the result. Returns true
+// once that final expression has been parsed
+static bool declaration() {
+  bool last = false;
+  if (match(TOKEN_VAR)) {
+    varDeclaration();
+  } else {
+    expression();
+    if (match(TOKEN_SEMICOLON)) {
+      addNode(&ir, NODE_POP, 0, parser.previous.line);
+    } else {
+      consume(TOKEN_EOF, "Expect end of expression.");
+      last = true;
+    }
+  }
+  if (parser.panicMode)
+    synchronize();
+  return last;
+}
+
+// the backend. It walks the IR once to work out exactly how much code, how
+// many constants and how many line entries there are going to be and then
+// walks it again to emit the code
+
+static void emitByte(uint8_t byte) { backend.code[backend.codeCount++] = byte; }
+
+static void emitBytes(uint8_t byte1, uint8_t byte2) {
+  emitByte(byte1);
+  emitByte(byte2);
+}
+
+// the code emitted from here on comes from this line. Like writeChunk(), only
+// a change of line gets an entry
+static void emitLine(int line) {
+  if (backend.lineCount > 0 &&
+      backend.lines[backend.lineCount - 1].line == line)
+    return;
+  backend.lines[backend.lineCount].offset = backend.codeCount;
+  backend.lines[backend.lineCount].line = line;
+  backend.lineCount++;
+}
+
+static void pushType(StaticType type) {
+  if (backend.stackTypesCapacity < backend.stackDepth + 1) {
+    int oldCapacity = backend.stackTypesCapacity;
+    backend.stackTypesCapacity = GROW_CAPACITY(oldCapacity);
+    backend.stackTypes = GROW_ARRAY(StaticType, backend.stackTypes,
+                                    oldCapacity, backend.stackTypesCapacity);
+  }
+  backend.stackTypes[backend.stackDepth++] = type;
+  if (backend.stackDepth > currentChunk()->maxStack) {
+    currentChunk()->maxStack = backend.stackDepth;
+  }
+}
+
+// an integer from 0 to 65535 doesn't need the constant pool, it goes right
+// into the instruction
+static bool isImmediate(Node node) {
+  return node.kind == NODE_INTEGER && node.operand <= UINT16_MAX;
+}
+
+static bool needsConstant(Node node) {
+  return node.kind == NODE_NUMBER || node.kind == NODE_LONG_INTEGER ||
+         node.kind == NODE_STRING ||
+         (node.kind == NODE_INTEGER && !isImmediate(node));
+}
+
+// how many values a node leaves on the stack, minus the ones it takes off
+static int stackEffect(Node node) {
+  switch (node.kind) {
+  case NODE_NUMBER:
+  case NODE_INTEGER:
+  case NODE_LONG_INTEGER:
+  case NODE_STRING:
+  case NODE_PICK:
+  case NODE_TUCK:
+  case NODE_GET_GLOBAL:
+    return 1;
+  case NODE_ADD:
+  case NODE_SUBTRACT:
+  case NODE_MULTIPLY:
+  case NODE_DIVIDE:
+  case NODE_EQUAL:
+  case NODE_MIN:
+  case NODE_MAX:
+  case NODE_POW:
+  case NODE_DEFINE_GLOBAL:
+  case NODE_POP:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+// how many bytes of code a node turns into. constants is how many constants
+// the pool has at that point, which decides between OP_CONSTANT and
+// OP_CONSTANT_LONG, and depth how many values are on the stack, which decides
+// between OP_DUP and OP_PICK. Never more than sizeof(Node), which lower()
+// relies on
+static int nodeLength(Node node, int constants, int depth) {
+  if (node.kind == NODE_PICK) {
+    return depth - 1 - (int)node.operand == 0 ? 1 : 2;
+  }
+  if (node.kind == NODE_TUCK) {
+    return 2;
+  }
+  if (isImmediate(node)) {
+    return node.operand <= 1 ? 1 : node.operand <= UINT8_MAX ? 2 : 3;
+  }
+  if (needsConstant(node)) {
+    return constants <= UINT8_MAX ? 2 : 4;
+  }
+  if (node.kind == NODE_GET_GLOBAL || node.kind == NODE_SET_GLOBAL ||
+      node.kind == NODE_DEFINE_GLOBAL) {
+    return 3;
+  }
+  return node.kind == NODE_DEAD ? 0 : 1;
+}
+
+// push a literal. Small integers are immediates, OP_CONSTANT loads the first
+// 256 constants from the pool and OP_CONSTANT_LONG the ones after that
+static void emitLiteral(Node node) {
+  if (isImmediate(node)) {
+    if (node.operand == 0) {
+      emitByte(OP_ZERO);
+    } else if (node.operand == 1) {
+      emitByte(OP_ONE);
+    } else if (node.operand <= UINT8_MAX) {
+      emitBytes(OP_SMALL_INT, (uint8_t)node.operand);
+    } else {
+      emitByte(OP_SMALL_INT_LONG);
+      emitBytes(node.operand & 0xff, node.operand >> 8);
+    }
+  } else {
+    int constant = backend.constantCount++;
+    if (node.kind == NODE_STRING) {
+      backend.constants[constant] = OBJ_VAL(ir.strings[node.operand]);
+    } else if (node.kind == NODE_NUMBER) {
+      backend.constants[constant] = NUMBER_VAL(ir.numbers[node.operand]);
+    } else {
+      backend.constants[constant] = INT_VAL(integerValue(&ir, node));
+    }
+    if (constant <= UINT8_MAX) {
+      emitBytes(OP_CONSTANT, (uint8_t)constant);
+    } else {
+      emitByte(OP_CONSTANT_LONG);
+      emitBytes(constant & 0xff, (constant >> 8) & 0xff);
+      emitByte((constant >> 16) & 0xff);
+    }
+  }
+  if (node.kind == NODE_STRING) {
+    pushType(TYPE_UNKNOWN);
+  } else {
+    pushType(node.kind == NODE_NUMBER ? TYPE_NUMBER : TYPE_INTEGER);
+  }
+}
+
+// if the operand is known to be a double we can use the version of the
+// instruction that doesn't check, and if it is known to be an integer the
+// integer version, which saves the generic one quickening itself. The result
+// of negating a double is a double. An integer stays one unless it overflows,
+// so that isn't known
+static void emitUnary(uint8_t checked, uint8_t unchecked, uint8_t integer) {
+  StaticType *top = &backend.stackTypes[backend.stackDepth - 1];
+  if (*top == TYPE_NUMBER) {
+    emitByte(unchecked);
+  } else {
+    emitByte(*top == TYPE_INTEGER ? integer : checked);
+    *top = TYPE_UNKNOWN;
+  }
+}
+
+// pops two operands and pushes the result. integer is the integer version of
+// the instruction, or checked again if there is none
+// the result is a double as soon as one of the operands is one: if the other
+// one wasn't a number, the VM would have stopped with a runtime error.
+// Division always gives a double, the others give an integer for two integers
+// unless they overflow
+static void emitBinary(uint8_t checked, uint8_t unchecked, uint8_t integer) {
+  StaticType *top = &backend.stackTypes[backend.stackDepth - 1];
+  bool proven = top[0] == TYPE_NUMBER && top[-1] == TYPE_NUMBER;
+  bool integers = top[0] == TYPE_INTEGER && top[-1] == TYPE_INTEGER;
+  if (proven) {
+    emitByte(unchecked);
+  } else {
+    emitByte(integers ? integer : checked);
+  }
+  bool number =
+      integer == checked || top[0] == TYPE_NUMBER || top[-1] == TYPE_NUMBER;
+  backend.stackDepth--;
+  top[-1] = number ? TYPE_NUMBER : TYPE_UNKNOWN;
+}
+
+// an intrinsic checks its operands itself and always gives a double, so
+// there is only the one opcode for each
+static void emitIntrinsic(uint8_t opcode, int arity) {
+  emitByte(opcode);
+  backend.stackDepth -= arity - 1;
+  backend.stackTypes[backend.stackDepth - 1] = TYPE_NUMBER;
+}
+
+static void lowerNode(Node node) {
+  switch (node.kind) {
+  case NODE_NUMBER:
+  case NODE_INTEGER:
+  case NODE_LONG_INTEGER:
+  case NODE_STRING:
+    emitLiteral(node);
+    break;
+  case NODE_NEGATE:
+    emitUnary(OP_NEGATE, OP_NEGATE_UNCHECKED, OP_NEGATE_INT);
+    break;
+  // these two give a bool, which none of the typed instructions take
+  case NODE_NOT:
+    emitByte(OP_NOT);
+    backend.stackTypes[backend.stackDepth - 1] = TYPE_UNKNOWN;
+    break;
+  case NODE_EQUAL:
+    emitByte(OP_EQUAL);
+    backend.stackDepth--;
+    backend.stackTypes[backend.stackDepth - 1] = TYPE_UNKNOWN;
+    break;
+  case NODE_ADD:
+    emitBinary(OP_ADD, OP_ADD_UNCHECKED, OP_ADD_INT);
+    break;
+  case NODE_SUBTRACT:
+    emitBinary(OP_SUBTRACT, OP_SUBTRACT_UNCHECKED, OP_SUBTRACT_INT);
+    break;
+  case NODE_MULTIPLY:
+    emitBinary(OP_MULTIPLY, OP_MULTIPLY_UNCHECKED, OP_MULTIPLY_INT);
+    break;
+  case NODE_DIVIDE:
+    emitBinary(OP_DIVIDE, OP_DIVIDE_UNCHECKED, OP_DIVIDE);
+    break;
+  case NODE_SQRT:
+    emitIntrinsic(OP_SQRT, 1);
+    break;
+  case NODE_ABS:
+    emitIntrinsic(OP_ABS, 1);
+    break;
+  case NODE_FLOOR:
+    emitIntrinsic(OP_FLOOR, 1);
+    break;
+  case NODE_EXP:
+    emitIntrinsic(OP_EXP, 1);
+    break;
+  case NODE_MIN:
+    emitIntrinsic(OP_MIN, 2);
+    break;
+  case NODE_MAX:
+    emitIntrinsic(OP_MAX, 2);
+    break;
+  case NODE_POW:
+    emitIntrinsic(OP_POW, 2);
+    break;
+  // a global can hold anything. Setting one leaves the value, and its type,
+  // on the stack
+  case NODE_GET_GLOBAL:
+  case NODE_SET_GLOBAL:
+  case NODE_DEFINE_GLOBAL: {
+    uint8_t opcode = node.kind == NODE_GET_GLOBAL   ? OP_GET_GLOBAL
+                     : node.kind == NODE_SET_GLOBAL ? OP_SET_GLOBAL
+                                                    : OP_DEFINE_GLOBAL;
+    emitByte(opcode);
+    emitBytes(node.operand & 0xff, node.operand >> 8);
+    if (node.kind == NODE_GET_GLOBAL) {
+      pushType(TYPE_UNKNOWN);
+    } else if (node.kind == NODE_DEFINE_GLOBAL) {
+      backend.stackDepth--;
+    }
+    break;
+  }
+  case NODE_POP:
+    emitByte(OP_POP);
+    backend.stackDepth--;
+    break;
+  case NODE_PICK: {
+    // the copy has the type of the original
+    int distance = backend.stackDepth - 1 - (int)node.operand;
+    if (distance == 0) {
+      emitByte(OP_DUP);
+    } else {
+      emitBytes(OP_PICK, (uint8_t)distance);
+    }
+    pushType(backend.stackTypes[node.operand]);
+    break;
+  }
+  case NODE_TUCK: {
+    // everything from the slot up moves up one, types included
+    int distance = backend.stackDepth - (int)node.operand;
+    emitBytes(OP_TUCK, (uint8_t)distance);
+    StaticType top = backend.stackTypes[backend.stackDepth - 1];
+    pushType(top);
+    StaticType *slot = &backend.stackTypes[node.operand];
+    memmove(slot + 1, slot, distance * sizeof(StaticType));
+    *slot = top;
+    break;
+  }
+  case NODE_DEAD:
+    break;
+  }
+}
+
+// lines are walked alongside the nodes: line is the index of the NodeLine the
+// node at index `node` falls under
+static int nextLine(int node, int line) {
+  while (line + 1 < ir.lineCount && ir.lines[line + 1].node <= node) {
+    line++;
+  }
+  return line;
+}
+
+// returnLine is where the final OP_RETURN is blamed, the end of the source
+//
+// no node turns into more bytes than the node itself takes up, so by the time
+// a node is lowered, the code so far still ends before it. That means the
+// code can be written right over the nodes that have already been lowered,
+// and then the node array is turned into the chunk's block. Building the IR
+// first then costs hardly any memory on top of the chunk itself
+static void lower(int returnLine) {
+  // first walk: the exact size of everything
+  int codeCount = 1;
+  int constantCount = 0;
+  int lineCount = 0;
+  int lastLine = -1;
+  int depth = 0;
+  bool pure = true;
+  for (int i = 0, line = 0; i < ir.count; i++) {
+    Node node = ir.nodes[i];
+    if (node.kind == NODE_DEAD)
+      continue;
+    if (node.kind == NODE_SET_GLOBAL || node.kind == NODE_DEFINE_GLOBAL)
+      pure = false;
+    line = nextLine(i, line);
+    if (ir.lines[line].line != lastLine) {
+      lastLine = ir.lines[line].line;
+      lineCount++;
+    }
+    codeCount += nodeLength(node, constantCount, depth);
+    if (needsConstant(node))
+      constantCount++;
+    depth += stackEffect(node);
+  }
+  if (returnLine != lastLine)
+    lineCount++;
+
+  // the OP_RETURN at the end may need one more node's worth of room, and
+  // its line one more NodeLine
+  if ((size_t)ir.capacity * sizeof(Node) < (size_t)codeCount) {
+    ir.nodes = GROW_ARRAY(Node, ir.nodes, ir.capacity, ir.capacity + 1);
+    ir.capacity++;
+  }
+  if (ir.lineCapacity < lineCount) {
+    ir.lines = GROW_ARRAY(NodeLine, ir.lines, ir.lineCapacity, lineCount);
+    ir.lineCapacity = lineCount;
+  }
+  backend.code = (uint8_t *)ir.nodes;
+  backend.codeCount = 0;
+  // the same goes for the lines: a LineStart is the size of a NodeLine, and
+  // the chunk never has more lines than the IR, or gets to a line before the
+  // IR does
+  backend.lines = (LineStart *)ir.lines;
+  backend.lineCount = 0;
+  backend.constants = GROW_ARRAY(Value, NULL, 0, constantCount);
+  backend.constantCount = 0;
+  backend.stackDepth = 0;
+
+  // second walk: the code
+  for (int i = 0, line = 0; i < ir.count; i++) {
+    // read the node before its code overwrites it
+    Node node = ir.nodes[i];
+    if (node.kind == NODE_DEAD)
+      continue;
+    line = nextLine(i, line);
+    emitLine(ir.lines[line].line);
+    lowerNode(node);
+  }
+  emitLine(returnLine);
+  emitByte(OP_RETURN);
+  backend.stackDepth--;
+
+  // the literals are all in the constants now. Letting go of them before the
+  // block is made keeps the peak memory down
+  FREE_ARRAY(double, ir.numbers, ir.numberCapacity);
+  ir.numbers = NULL;
+  ir.numberCapacity = 0;
+  FREE_ARRAY(int64_t, ir.integers, ir.integerCapacity);
+  ir.integers = NULL;
+  ir.integerCapacity = 0;
+  FREE_ARRAY(ObjString *, ir.strings, ir.stringCapacity);
+  ir.strings = NULL;
+  ir.stringCapacity = 0;
+
+  // the chunk takes over the node array
+  adoptChunk(currentChunk(), backend.code, ir.capacity * sizeof(Node),
+             backend.codeCount, backend.lines, backend.lineCount,
+             backend.constants, backend.constantCount);
+  currentChunk()->pure = pure;
+  ir.nodes = NULL;
+  ir.capacity = 0;
+  ir.count = 0;
+
+  FREE_ARRAY(Value, backend.constants, constantCount);
+  FREE_ARRAY(StaticType, backend.stackTypes, backend.stackTypesCapacity);
+  backend.stackTypes = NULL;
+  backend.stackTypesCapacity = 0;
+#ifdef DEBUG_PRINT_CODE
+  disassembleChunk(currentChunk(), "code");
+#endif
+}
+
+// a scan of the whole source by itself, before the real one that runs along
+// with the parser (see phases.h for why). start is from before the encoding
+// was checked, which counts as part of scanning
+static void timeScanner(const char *source, PhaseTimes *times,
+                        uint64_t start) {
   initScanner(source);
+  int tokens = 0;
+  while (scanToken().type != TOKEN_EOF) {
+    tokens++;
+  }
+  times->scan = phaseClock() - start;
+  times->tokens = tokens;
+  times->bytes = strlen(source);
+}
+
+// reports the first byte of source that isn't part of a valid UTF-8
+// character, if there is one, like any other compile error
+static bool checkEncoding(const char *source) {
+  size_t invalid;
+  if (validateUtf8(source, strlen(source), &invalid))
+    return true;
+  Token token;
+  token.type = TOKEN_ERROR;
+  token.start = "Source is not valid UTF-8.";
+  token.length = (int)strlen(token.start);
+  token.line = 1;
+  for (size_t i = 0; i < invalid; i++) {
+    token.line += source[i] == '\n';
+  }
+  parser.panicMode = false;
+  errorAt(&token, token.start);
+  return false;
+}
+
+bool compile(const char *source, Chunk *chunk) {
+  PhaseTimes *times = phaseTimes;
+  uint64_t start = times != NULL ? phaseClock() : 0;
+  // the scanner counts on this, see utf8.h
+  if (!checkEncoding(source))
+    return false;
+  if (times != NULL) {
+    timeScanner(source, times, start);
+    start = phaseClock();
+  }
+  // timing the parser means timing it without a second thread doing part of
+  // its work
+  pipelined = times == NULL && pipelineCompile && startPipeline(source);
+  if (!pipelined) {
+    initScanner(source);
+  }
   compilingChunk = chunk;
+  initIr(&ir);
   parser.hadError = false;
   parser.panicMode = false;
   advance();
-  expression();
-  consume(TOKEN_EOF, "Expect end of expression.");
-  endCompiler();
+  bool ended = false;
+  while (!ended && !check(TOKEN_EOF)) {
+    ended = declaration();
+  }
+  if (!ended) {
+    // a program that is only statements has no value to give
+    errorAtCurrent("Expect expression.");
+  }
+  if (pipelined) {
+    stopPipeline();
+    pipelined = false;
+  }
+  if (times != NULL) {
+    uint64_t now = phaseClock();
+    // the scanner ran along with the parser. What the scan took on its own
+    // was measured already, the rest is the parser's
+    uint64_t parsing = now - start;
+    times->parse = parsing > times->scan ? parsing - times->scan : 0;
+    start = now;
+  }
+
+  // only a complete IR can be optimized and lowered. The chunk comes out of
+  // lowering already packed into its final allocation (see adoptChunk())
+  if (!parser.hadError) {
+    optimizeIr(&ir);
+    if (times != NULL) {
+      uint64_t now = phaseClock();
+      times->optimize = now - start;
+      start = now;
+    }
+    lower(parser.previous.line);
+    if (times != NULL) {
+      times->emit = phaseClock() - start;
+    }
+  }
+  freeIr(&ir);
   // return false if error occurred (if error, hadError is true, so then !true
   // is false)
   return !parser.hadError;
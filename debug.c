@@ -1,8 +1,13 @@
 #include "debug.h"
 #include "chunk.h"
+#include "dtoa.h"
+#include "object.h"
 #include "value.h"
+#include "verify.h"
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 void disassembleChunk(Chunk *chunk, const char *name) {
   printf("== %s ==\n", name);
@@ -44,6 +49,12 @@ static int longConstantInstruction(const char *name, Chunk *chunk, int offset) {
   return offset + 4;
 }
 
+// the small integer is right there in the instruction, `size` bytes of it
+static int immediateInstruction(const char *name, Chunk *chunk, int offset,
+                                int size) {
+  return offset + 1 + size;
+}
+
 int disassembleInstruction(Chunk *chunk, int offset) {
   // print the byte offset of the given instruction
   // indicates where in the chunk this instruction is
@@ -76,8 +87,443 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return longConstantInstruction("OP_CONSTANT_LONG", chunk, offset);
   case OP_NEGATE:
     return simpleInstruction("OP_NEGATE", offset);
+  case OP_ADD_NUMBER:
+    return simpleInstruction("OP_ADD_NUMBER", offset);
+  case OP_SUBTRACT_NUMBER:
+    return simpleInstruction("OP_SUBTRACT_NUMBER", offset);
+  case OP_MULTIPLY_NUMBER:
+    return simpleInstruction("OP_MULTIPLY_NUMBER", offset);
+  case OP_DIVIDE_NUMBER:
+    return simpleInstruction("OP_DIVIDE_NUMBER", offset);
+  case OP_NEGATE_NUMBER:
+    return simpleInstruction("OP_NEGATE_NUMBER", offset);
+  case OP_ADD_UNCHECKED:
+    return simpleInstruction("OP_ADD_UNCHECKED", offset);
+  case OP_SUBTRACT_UNCHECKED:
+    return simpleInstruction("OP_SUBTRACT_UNCHECKED", offset);
+  case OP_MULTIPLY_UNCHECKED:
+    return simpleInstruction("OP_MULTIPLY_UNCHECKED", offset);
+  case OP_DIVIDE_UNCHECKED:
+    return simpleInstruction("OP_DIVIDE_UNCHECKED", offset);
+  case OP_NEGATE_UNCHECKED:
+    return simpleInstruction("OP_NEGATE_UNCHECKED", offset);
+  case OP_ZERO:
+    return simpleInstruction("OP_ZERO", offset);
+  case OP_ONE:
+    return simpleInstruction("OP_ONE", offset);
+  case OP_SMALL_INT:
+    return immediateInstruction("OP_SMALL_INT", chunk, offset, 1);
+  case OP_SMALL_INT_LONG:
+    return immediateInstruction("OP_SMALL_INT_LONG", chunk, offset, 2);
+  case OP_DUP:
+    return simpleInstruction("OP_DUP", offset);
+  case OP_PICK:
+    // the operand is a stack distance rather than a number, but it is laid
+    // out the same way
+    return immediateInstruction("OP_PICK", chunk, offset, 1);
+  case OP_ADD_INT:
+    return simpleInstruction("OP_ADD_INT", offset);
+  case OP_SUBTRACT_INT:
+    return simpleInstruction("OP_SUBTRACT_INT", offset);
+  case OP_MULTIPLY_INT:
+    return simpleInstruction("OP_MULTIPLY_INT", offset);
+  case OP_NEGATE_INT:
+    return simpleInstruction("OP_NEGATE_INT", offset);
+  case OP_EQUAL:
+    return simpleInstruction("OP_EQUAL", offset);
+  case OP_NOT:
+    return simpleInstruction("OP_NOT", offset);
+  // the operand is a global's slot, laid out like a 16-bit immediate
+  case OP_DEFINE_GLOBAL:
+    return immediateInstruction("OP_DEFINE_GLOBAL", chunk, offset, 2);
+  case OP_GET_GLOBAL:
+    return immediateInstruction("OP_GET_GLOBAL", chunk, offset, 2);
+  case OP_SET_GLOBAL:
+    return immediateInstruction("OP_SET_GLOBAL", chunk, offset, 2);
+  case OP_POP:
+    return simpleInstruction("OP_POP", offset);
+  case OP_SQRT:
+    return simpleInstruction("OP_SQRT", offset);
+  case OP_ABS:
+    return simpleInstruction("OP_ABS", offset);
+  case OP_FLOOR:
+    return simpleInstruction("OP_FLOOR", offset);
+  case OP_EXP:
+    return simpleInstruction("OP_EXP", offset);
+  case OP_MIN:
+    return simpleInstruction("OP_MIN", offset);
+  case OP_MAX:
+    return simpleInstruction("OP_MAX", offset);
+  case OP_POW:
+    return simpleInstruction("OP_POW", offset);
+  case OP_TUCK:
+    return immediateInstruction("OP_TUCK", chunk, offset, 1);
   default:
     printf("Unknown opcode %d\n", instruction);
     return offset + 1;
   }
 }
+
+const char *opcodeName(uint8_t instruction) {
+  switch (instruction) {
+  case OP_CONSTANT:
+    return "OP_CONSTANT";
+  case OP_ADD:
+    return "OP_ADD";
+  case OP_SUBTRACT:
+    return "OP_SUBTRACT";
+  case OP_MULTIPLY:
+    return "OP_MULTIPLY";
+  case OP_DIVIDE:
+    return "OP_DIVIDE";
+  case OP_CONSTANT_LONG:
+    return "OP_CONSTANT_LONG";
+  case OP_NEGATE:
+    return "OP_NEGATE";
+  case OP_RETURN:
+    return "OP_RETURN";
+  case OP_ADD_NUMBER:
+    return "OP_ADD_NUMBER";
+  case OP_SUBTRACT_NUMBER:
+    return "OP_SUBTRACT_NUMBER";
+  case OP_MULTIPLY_NUMBER:
+    return "OP_MULTIPLY_NUMBER";
+  case OP_DIVIDE_NUMBER:
+    return "OP_DIVIDE_NUMBER";
+  case OP_NEGATE_NUMBER:
+    return "OP_NEGATE_NUMBER";
+  case OP_ADD_UNCHECKED:
+    return "OP_ADD_UNCHECKED";
+  case OP_SUBTRACT_UNCHECKED:
+    return "OP_SUBTRACT_UNCHECKED";
+  case OP_MULTIPLY_UNCHECKED:
+    return "OP_MULTIPLY_UNCHECKED";
+  case OP_DIVIDE_UNCHECKED:
+    return "OP_DIVIDE_UNCHECKED";
+  case OP_NEGATE_UNCHECKED:
+    return "OP_NEGATE_UNCHECKED";
+  case OP_ZERO:
+    return "OP_ZERO";
+  case OP_ONE:
+    return "OP_ONE";
+  case OP_SMALL_INT:
+    return "OP_SMALL_INT";
+  case OP_SMALL_INT_LONG:
+    return "OP_SMALL_INT_LONG";
+  case OP_DUP:
+    return "OP_DUP";
+  case OP_PICK:
+    return "OP_PICK";
+  case OP_ADD_INT:
+    return "OP_ADD_INT";
+  case OP_SUBTRACT_INT:
+    return "OP_SUBTRACT_INT";
+  case OP_MULTIPLY_INT:
+    return "OP_MULTIPLY_INT";
+  case OP_NEGATE_INT:
+    return "OP_NEGATE_INT";
+  case OP_EQUAL:
+    return "OP_EQUAL";
+  case OP_NOT:
+    return "OP_NOT";
+  case OP_DEFINE_GLOBAL:
+    return "OP_DEFINE_GLOBAL";
+  case OP_GET_GLOBAL:
+    return "OP_GET_GLOBAL";
+  case OP_SET_GLOBAL:
+    return "OP_SET_GLOBAL";
+  case OP_POP:
+    return "OP_POP";
+  case OP_SQRT:
+    return "OP_SQRT";
+  case OP_ABS:
+    return "OP_ABS";
+  case OP_FLOOR:
+    return "OP_FLOOR";
+  case OP_EXP:
+    return "OP_EXP";
+  case OP_MIN:
+    return "OP_MIN";
+  case OP_MAX:
+    return "OP_MAX";
+  case OP_POW:
+    return "OP_POW";
+  case OP_TUCK:
+    return "OP_TUCK";
+  default:
+    return "OP_UNKNOWN";
+  }
+}
+
+// exportChunk() builds its output in this buffer and hands it to the file in
+// large writes, instead of going through fprintf per field
+#define EXPORT_BUFFER_SIZE (64 * 1024)
+
+static char exportBuffer[EXPORT_BUFFER_SIZE];
+static int exportUsed;
+static FILE *exportFile;
+
+static void flushExport() {
+  fwrite(exportBuffer, 1, exportUsed, exportFile);
+  exportUsed = 0;
+}
+
+// make sure there is room for `length` more bytes. Nothing written in one go
+// is longer than a JSON record, so this never needs more than one flush
+static char *exportSpace(int length) {
+  if (exportUsed + length > EXPORT_BUFFER_SIZE) {
+    flushExport();
+  }
+  return exportBuffer + exportUsed;
+}
+
+static void exportString(const char *chars) {
+  int length = (int)strlen(chars);
+  memcpy(exportSpace(length), chars, length);
+  exportUsed += length;
+}
+
+// digits are written back to front into a small scratch buffer and then
+// copied, which beats snprintf by a wide margin
+static void exportUnsigned(uint32_t value) {
+  char digits[10];
+  int count = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  char *out = exportSpace(count);
+  for (int i = 0; i < count; i++) {
+    out[i] = digits[count - 1 - i];
+  }
+  exportUsed += count;
+}
+
+static void exportBytes(uint32_t value, int count) {
+  char *out = exportSpace(count);
+  for (int i = 0; i < count; i++) {
+    out[i] = (char)((value >> (8 * i)) & 0xff);
+  }
+  exportUsed += count;
+}
+
+// a string can be longer than the buffer, so it goes out a character at a
+// time. Quotes, backslashes and control characters are escaped, everything
+// else, UTF-8 included, is copied as it is. The 7 bytes of room are for the
+// longest escape and the '\0' snprintf() puts after it
+static void exportJsonString(ObjString *string) {
+  exportString("\"");
+  for (int i = 0; i < string->length; i++) {
+    uint8_t c = (uint8_t)string->chars[i];
+    char *out = exportSpace(7);
+    if (c == '"' || c == '\\') {
+      out[0] = '\\';
+      out[1] = (char)c;
+      exportUsed += 2;
+    } else if (c < 0x20) {
+      exportUsed += snprintf(out, 7, "\\u%04x", c);
+    } else {
+      out[0] = (char)c;
+      exportUsed++;
+    }
+  }
+  exportString("\"");
+}
+
+static void exportJsonValue(Value value) {
+  switch (value.type) {
+  case VAL_NUMBER: {
+    // JSON has no nan or inf
+    if (!isfinite(AS_NUMBER(value))) {
+      exportString("null");
+      break;
+    }
+    char *out = exportSpace(NUMBER_BUFFER_SIZE);
+    exportUsed += formatNumber(AS_NUMBER(value), out);
+    break;
+  }
+  case VAL_INT: {
+    // JSON itself has no limit on digits, though many readers turn numbers
+    // into doubles anyway
+    char *out = exportSpace(NUMBER_BUFFER_SIZE);
+    exportUsed += formatInteger(AS_INT(value), out);
+    break;
+  }
+  case VAL_BOOL:
+    exportString(AS_BOOL(value) ? "true" : "false");
+    break;
+  case VAL_NIL:
+    exportString("null");
+    break;
+  case VAL_OBJ:
+    exportJsonString(AS_STRING(value));
+    break;
+  }
+}
+
+// decodes the operand of the instruction at offset, if it has one
+static bool readOperand(Chunk *chunk, int offset, uint32_t *operand) {
+  switch (chunk->code[offset]) {
+  case OP_CONSTANT:
+    *operand = chunk->code[offset + 1];
+    return true;
+  case OP_CONSTANT_LONG:
+    *operand = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) |
+               (chunk->code[offset + 3] << 16);
+    return true;
+  case OP_SMALL_INT:
+  case OP_PICK:
+  case OP_TUCK:
+    *operand = chunk->code[offset + 1];
+    return true;
+  case OP_SMALL_INT_LONG:
+  case OP_DEFINE_GLOBAL:
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+    *operand = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// the size of the instruction at offset. Unknown opcodes count as one byte so
+// the export can carry on past them, and an instruction cut off by the end of
+// the chunk ends the export
+static int exportLength(Chunk *chunk, int offset) {
+  int length = instructionLength(chunk->code[offset]);
+  if (length == 0)
+    return 1;
+  return offset + length <= chunk->count ? length : chunk->count - offset;
+}
+
+// the instruction's constant, for instructions that load one
+static bool operandConstant(Chunk *chunk, uint8_t instruction,
+                            uint32_t operand, Value *value) {
+  if ((instruction != OP_CONSTANT && instruction != OP_CONSTANT_LONG) ||
+      operand >= (uint32_t)chunk->constants.count)
+    return false;
+  *value = chunk->constants.values[operand];
+  return true;
+}
+
+static void exportJson(Chunk *chunk) {
+  exportString("{\"code\": ");
+  exportUnsigned(chunk->count);
+  exportString(", \"constants\": [");
+  for (int i = 0; i < chunk->constants.count; i++) {
+    if (i > 0)
+      exportString(", ");
+    exportJsonValue(chunk->constants.values[i]);
+  }
+  exportString("], \"instructions\": [");
+
+  // line walks along with offset. LineStarts are ordered by offset, so it
+  // only ever moves forward
+  int line = 0;
+  for (int offset = 0; offset < chunk->count;) {
+    while (line + 1 < chunk->lineCount &&
+           chunk->lines[line + 1].offset <= offset) {
+      line++;
+    }
+    uint8_t instruction = chunk->code[offset];
+
+    exportString(offset == 0 ? "\n{\"offset\": " : ",\n{\"offset\": ");
+    exportUnsigned(offset);
+    exportString(", \"line\": ");
+    exportUnsigned(chunk->lineCount > 0 ? chunk->lines[line].line : 0);
+    exportString(", \"op\": \"");
+    exportString(opcodeName(instruction));
+    exportString("\"");
+
+    uint32_t operand;
+    if (exportLength(chunk, offset) == instructionLength(instruction) &&
+        readOperand(chunk, offset, &operand)) {
+      exportString(", \"operand\": ");
+      exportUnsigned(operand);
+      Value value;
+      if (operandConstant(chunk, instruction, operand, &value)) {
+        exportString(", \"value\": ");
+        exportJsonValue(value);
+      }
+    }
+    exportString("}");
+    offset += exportLength(chunk, offset);
+  }
+  exportString("\n]}\n");
+}
+
+static void exportBinary(Chunk *chunk) {
+  // the header has the number of instructions, which takes a quick walk over
+  // the opcodes to find out
+  uint32_t instructions = 0;
+  for (int offset = 0; offset < chunk->count;
+       offset += exportLength(chunk, offset)) {
+    instructions++;
+  }
+
+  memcpy(exportSpace(4), EXPORT_MAGIC, 4);
+  exportUsed += 4;
+  exportBytes(EXPORT_VERSION, 4);
+  exportBytes(chunk->count, 4);
+  exportBytes(chunk->constants.count, 4);
+  exportBytes(instructions, 4);
+
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value value = chunk->constants.values[i];
+    double number = 0;
+    if (value.type == VAL_NUMBER) {
+      number = AS_NUMBER(value);
+    } else if (value.type == VAL_BOOL) {
+      number = AS_BOOL(value) ? 1 : 0;
+    }
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    if (value.type == VAL_INT) {
+      bits = (uint64_t)AS_INT(value);
+    } else if (value.type == VAL_OBJ) {
+      bits = (uint64_t)AS_STRING(value)->length;
+    }
+    exportBytes(value.type, 1);
+    exportBytes((uint32_t)bits, 4);
+    exportBytes((uint32_t)(bits >> 32), 4);
+    if (value.type == VAL_OBJ) {
+      ObjString *string = AS_STRING(value);
+      for (int j = 0; j < string->length; j++) {
+        *exportSpace(1) = string->chars[j];
+        exportUsed++;
+      }
+    }
+  }
+
+  int line = 0;
+  for (int offset = 0; offset < chunk->count;) {
+    while (line + 1 < chunk->lineCount &&
+           chunk->lines[line + 1].offset <= offset) {
+      line++;
+    }
+    uint8_t instruction = chunk->code[offset];
+    uint32_t operand = 0;
+    if (exportLength(chunk, offset) == instructionLength(instruction)) {
+      readOperand(chunk, offset, &operand);
+    }
+
+    exportBytes(offset, 4);
+    exportBytes(chunk->lineCount > 0 ? chunk->lines[line].line : 0, 4);
+    exportBytes(instruction, 1);
+    exportBytes(operand, 3);
+    offset += exportLength(chunk, offset);
+  }
+}
+
+void exportChunk(Chunk *chunk, ExportFormat format, FILE *out) {
+  exportFile = out;
+  exportUsed = 0;
+  if (format == EXPORT_JSON) {
+    exportJson(chunk);
+  } else {
+    exportBinary(chunk);
+  }
+  flushExport();
+  fflush(out);
+}
@@ -2,8 +2,37 @@
 #define clox_debug_h
 
 #include "chunk.h"
+#include <stdio.h>
+
+// the formats exportChunk() can write
+// EXPORT_JSON:   {"code": <bytes>, "constants": [...], "instructions": [
+//                  {"offset": 0, "line": 1, "op": "OP_CONSTANT",
+//                   "operand": 0, "value": 1.5}, ...]}
+//                operand and value are only there for instructions that have
+//                them
+// EXPORT_BINARY: everything little-endian. A 20 byte header: the magic "CLXD",
+//                the format version (2), the number of code bytes, the number
+//                of constants and the number of instructions. Then one 9 byte
+//                entry per constant: the ValueType, then the number as a
+//                double (0 for true/false/nil, 1 for true), or as a two's
+//                complement integer for VAL_INT. A VAL_OBJ is a string: its
+//                length in place of the number, followed by that many bytes
+//                of characters. Version 1 had no strings. Then one 12 byte
+//                record per instruction: offset (u32), line (u32), opcode
+//                (u8) and operand (u24, 0 when there is none)
+typedef enum { EXPORT_JSON, EXPORT_BINARY } ExportFormat;
+
+#define EXPORT_MAGIC "CLXD"
+#define EXPORT_VERSION 2
 
 void disassembleChunk(Chunk *chunk, const char *name);
 int disassembleInstruction(Chunk *chunk, int offset);
+// the name of an opcode, e.g. "OP_ADD", for reports and exports
+const char *opcodeName(uint8_t instruction);
+// writes the whole chunk out for other tools to analyze. Unlike
+// disassembleChunk() this is one pass over the code and the lines together
+// instead of a getLine() search per instruction, so it stays fast on chunks
+// with millions of instructions
+void exportChunk(Chunk *chunk, ExportFormat format, FILE *out);
 
 #endif
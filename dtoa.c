@@ -0,0 +1,451 @@
+#include "dtoa.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// this is Florian Loitsch's Grisu3 algorithm ("Printing Floating-Point
+// Numbers Quickly and Accurately with Integers", 2010), on the tables and
+// helpers Milo Yip's Grisu2 for RapidJSON uses. It only needs 64-bit integer
+// arithmetic and a small table of powers of ten, where printf goes through
+// arbitrary precision arithmetic and the locale. It gives the shortest
+// digits that read back as the same double, and of those the closest to it,
+// or says it can't be sure. For the one value in a hundred or so where it
+// can't, printf works them out instead
+
+// a "do it yourself floating point" number: f * 2^e with a 64-bit f
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK 0x7FF0000000000000ull
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFull
+#define DP_HIDDEN_BIT 0x0010000000000000ull
+
+// normalized 64-bit approximations of 10^k for k = -348, -340, ..., 340
+static const DiyFp cachedPowers[] = {
+    {0xfa8fd5a0081c0288ull, -1220},
+    {0xbaaee17fa23ebf76ull, -1193},
+    {0x8b16fb203055ac76ull, -1166},
+    {0xcf42894a5dce35eaull, -1140},
+    {0x9a6bb0aa55653b2dull, -1113},
+    {0xe61acf033d1a45dfull, -1087},
+    {0xab70fe17c79ac6caull, -1060},
+    {0xff77b1fcbebcdc4full, -1034},
+    {0xbe5691ef416bd60cull, -1007},
+    {0x8dd01fad907ffc3cull, -980},
+    {0xd3515c2831559a83ull, -954},
+    {0x9d71ac8fada6c9b5ull, -927},
+    {0xea9c227723ee8bcbull, -901},
+    {0xaecc49914078536dull, -874},
+    {0x823c12795db6ce57ull, -847},
+    {0xc21094364dfb5637ull, -821},
+    {0x9096ea6f3848984full, -794},
+    {0xd77485cb25823ac7ull, -768},
+    {0xa086cfcd97bf97f4ull, -741},
+    {0xef340a98172aace5ull, -715},
+    {0xb23867fb2a35b28eull, -688},
+    {0x84c8d4dfd2c63f3bull, -661},
+    {0xc5dd44271ad3cdbaull, -635},
+    {0x936b9fcebb25c996ull, -608},
+    {0xdbac6c247d62a584ull, -582},
+    {0xa3ab66580d5fdaf6ull, -555},
+    {0xf3e2f893dec3f126ull, -529},
+    {0xb5b5ada8aaff80b8ull, -502},
+    {0x87625f056c7c4a8bull, -475},
+    {0xc9bcff6034c13053ull, -449},
+    {0x964e858c91ba2655ull, -422},
+    {0xdff9772470297ebdull, -396},
+    {0xa6dfbd9fb8e5b88full, -369},
+    {0xf8a95fcf88747d94ull, -343},
+    {0xb94470938fa89bcfull, -316},
+    {0x8a08f0f8bf0f156bull, -289},
+    {0xcdb02555653131b6ull, -263},
+    {0x993fe2c6d07b7facull, -236},
+    {0xe45c10c42a2b3b06ull, -210},
+    {0xaa242499697392d3ull, -183},
+    {0xfd87b5f28300ca0eull, -157},
+    {0xbce5086492111aebull, -130},
+    {0x8cbccc096f5088ccull, -103},
+    {0xd1b71758e219652cull, -77},
+    {0x9c40000000000000ull, -50},
+    {0xe8d4a51000000000ull, -24},
+    {0xad78ebc5ac620000ull, 3},
+    {0x813f3978f8940984ull, 30},
+    {0xc097ce7bc90715b3ull, 56},
+    {0x8f7e32ce7bea5c70ull, 83},
+    {0xd5d238a4abe98068ull, 109},
+    {0x9f4f2726179a2245ull, 136},
+    {0xed63a231d4c4fb27ull, 162},
+    {0xb0de65388cc8ada8ull, 189},
+    {0x83c7088e1aab65dbull, 216},
+    {0xc45d1df942711d9aull, 242},
+    {0x924d692ca61be758ull, 269},
+    {0xda01ee641a708deaull, 295},
+    {0xa26da3999aef774aull, 322},
+    {0xf209787bb47d6b85ull, 348},
+    {0xb454e4a179dd1877ull, 375},
+    {0x865b86925b9bc5c2ull, 402},
+    {0xc83553c5c8965d3dull, 428},
+    {0x952ab45cfa97a0b3ull, 455},
+    {0xde469fbd99a05fe3ull, 481},
+    {0xa59bc234db398c25ull, 508},
+    {0xf6c69a72a3989f5cull, 534},
+    {0xb7dcbf5354e9beceull, 561},
+    {0x88fcf317f22241e2ull, 588},
+    {0xcc20ce9bd35c78a5ull, 614},
+    {0x98165af37b2153dfull, 641},
+    {0xe2a0b5dc971f303aull, 667},
+    {0xa8d9d1535ce3b396ull, 694},
+    {0xfb9b7cd9a4a7443cull, 720},
+    {0xbb764c4ca7a44410ull, 747},
+    {0x8bab8eefb6409c1aull, 774},
+    {0xd01fef10a657842cull, 800},
+    {0x9b10a4e5e9913129ull, 827},
+    {0xe7109bfba19c0c9dull, 853},
+    {0xac2820d9623bf429ull, 880},
+    {0x80444b5e7aa7cf85ull, 907},
+    {0xbf21e44003acdd2dull, 933},
+    {0x8e679c2f5e44ff8full, 960},
+    {0xd433179d9c8cb841ull, 986},
+    {0x9e19db92b4e31ba9ull, 1013},
+    {0xeb96bf6ebadf77d9ull, 1039},
+    {0xaf87023b9bf0ee6bull, 1066},
+};
+
+static const uint32_t powersOf10[] = {1,         10,        100,     1000,
+                                      10000,     100000,    1000000, 10000000,
+                                      100000000, 1000000000};
+
+static DiyFp fromDouble(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int biased = (int)((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+  uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+  DiyFp result;
+  if (biased != 0) {
+    result.f = significand + DP_HIDDEN_BIT;
+    result.e = biased - DP_EXPONENT_BIAS;
+  } else {
+    // subnormal
+    result.f = significand;
+    result.e = DP_MIN_EXPONENT + 1;
+  }
+  return result;
+}
+
+static DiyFp normalize(DiyFp x) {
+  int shift = __builtin_clzll(x.f);
+  x.f <<= shift;
+  x.e -= shift;
+  return x;
+}
+
+// the product rounded to its upper 64 bits
+static DiyFp multiply(DiyFp x, DiyFp y) {
+  unsigned __int128 product = (unsigned __int128)x.f * y.f;
+  uint64_t high = (uint64_t)(product >> 64);
+  uint64_t low = (uint64_t)product;
+  if (low & (1ull << 63))
+    high++;
+  DiyFp result = {high, x.e + y.e + 64};
+  return result;
+}
+
+// the neighbours halfway to the next smaller and next larger double. Any
+// digits between them read back as value
+static void boundaries(DiyFp v, DiyFp *minus, DiyFp *plus) {
+  DiyFp upper = {(v.f << 1) + 1, v.e - 1};
+  while (!(upper.f & (DP_HIDDEN_BIT << 1))) {
+    upper.f <<= 1;
+    upper.e--;
+  }
+  upper.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+  upper.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+
+  // at a power of two the next smaller double is only half as far away
+  DiyFp lower;
+  if (v.f == DP_HIDDEN_BIT) {
+    lower.f = (v.f << 2) - 1;
+    lower.e = v.e - 2;
+  } else {
+    lower.f = (v.f << 1) - 1;
+    lower.e = v.e - 1;
+  }
+  lower.f <<= lower.e - upper.e;
+  lower.e = upper.e;
+
+  *minus = lower;
+  *plus = upper;
+}
+
+// picks the cached power of ten c = 10^-k that brings e into the range the
+// digit generation works in
+static DiyFp cachedPower(int e, int *k) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int rounded = (int)dk;
+  if (dk - rounded > 0.0)
+    rounded++;
+  unsigned index = (unsigned)((rounded >> 3) + 1);
+  *k = -(-348 + (int)(index << 3));
+  return cachedPowers[index];
+}
+
+static int countDigits(uint32_t n) {
+  int digits = 1;
+  while (digits < 10 && n >= powersOf10[digits])
+    digits++;
+  return digits;
+}
+
+// nudges the last digit down while that brings the digits closer to w, and
+// then says whether the digits are sure to be the closest ones. w and the
+// boundaries are only known to within unit either way: the digits have to be
+// the closest for every w in that range, and inside the boundaries for the
+// narrowest ones. distance is how far the upper boundary (plus unit) is from
+// w and rest how far it is from the digits, both in the same units as
+// tenKappa, the weight of the last digit
+static bool roundWeed(char *buffer, int length, uint64_t distance,
+                      uint64_t unsafe, uint64_t rest, uint64_t tenKappa,
+                      uint64_t unit) {
+  uint64_t smallDistance = distance - unit;
+  uint64_t bigDistance = distance + unit;
+  while (rest < smallDistance && unsafe - rest >= tenKappa &&
+         (rest + tenKappa < smallDistance ||
+          smallDistance - rest >= rest + tenKappa - smallDistance)) {
+    buffer[length - 1]--;
+    rest += tenKappa;
+  }
+  // one digit lower could still be closer to the largest w there may be
+  if (rest < bigDistance && unsafe - rest >= tenKappa &&
+      (rest + tenKappa < bigDistance ||
+       bigDistance - rest > rest + tenKappa - bigDistance))
+    return false;
+  return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+// generates the digits of the upper boundary until they are inside the
+// boundaries, which makes them the shortest digits that still identify the
+// value. The boundaries are widened by the error of the multiplications
+// first, and returns false if that error leaves it open whether the digits
+// are the shortest and closest ones
+static bool generateDigits(DiyFp lower, DiyFp w, DiyFp upper, char *buffer,
+                           int *length, int *k) {
+  uint64_t unit = 1;
+  uint64_t tooLow = lower.f - unit;
+  uint64_t tooHigh = upper.f + unit;
+  uint64_t unsafe = tooHigh - tooLow;
+  DiyFp one = {1ull << -w.e, w.e};
+  uint32_t integral = (uint32_t)(tooHigh >> -one.e);
+  uint64_t fractional = tooHigh & (one.f - 1);
+  int kappa = countDigits(integral);
+  *length = 0;
+
+  while (kappa > 0) {
+    uint32_t divisor = powersOf10[kappa - 1];
+    uint32_t digit = integral / divisor;
+    integral %= divisor;
+    if (digit != 0 || *length != 0)
+      buffer[(*length)++] = (char)('0' + digit);
+    kappa--;
+    uint64_t rest = ((uint64_t)integral << -one.e) + fractional;
+    if (rest < unsafe) {
+      *k += kappa;
+      return roundWeed(buffer, *length, tooHigh - w.f, unsafe, rest,
+                       (uint64_t)divisor << -one.e, unit);
+    }
+  }
+
+  // each digit after the point makes everything ten times bigger, the error
+  // included
+  for (;;) {
+    fractional *= 10;
+    unit *= 10;
+    unsafe *= 10;
+    char digit = (char)(fractional >> -one.e);
+    if (digit != 0 || *length != 0)
+      buffer[(*length)++] = (char)('0' + digit);
+    fractional &= one.f - 1;
+    kappa--;
+    if (fractional < unsafe) {
+      *k += kappa;
+      return roundWeed(buffer, *length, (tooHigh - w.f) * unit, unsafe,
+                       fractional, one.f, unit);
+    }
+  }
+}
+
+// the shortest digits the hard way, for the few values Grisu3 can't decide:
+// printf rounds correctly, so the first precision whose digits read back as
+// value gives the shortest digits, and the closest ones of that length
+static int exactDigits(double value, char *buffer, int *k) {
+  char text[32];
+  for (int precision = 1;; precision++) {
+    snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+    if (precision == 17 || strtod(text, NULL) == value)
+      break;
+  }
+  // d.ddde[+-]x
+  int length = 0;
+  const char *c = text;
+  for (; *c != 'e'; c++) {
+    if (*c != '.')
+      buffer[length++] = *c;
+  }
+  while (length > 1 && buffer[length - 1] == '0') {
+    length--;
+  }
+  *k = atoi(c + 1) - (length - 1);
+  return length;
+}
+
+// value must be positive and finite. Writes the digits and returns the
+// decimal exponent through k: value ~= digits * 10^k
+static int shortestDigits(double value, char *buffer, int *k) {
+  DiyFp v = fromDouble(value);
+  DiyFp minus, plus;
+  boundaries(v, &minus, &plus);
+
+  DiyFp power = cachedPower(plus.e, k);
+  DiyFp w = multiply(normalize(v), power);
+  DiyFp upper = multiply(plus, power);
+  DiyFp lower = multiply(minus, power);
+
+  int length;
+  if (!generateDigits(lower, w, upper, buffer, &length, k))
+    return exactDigits(value, buffer, k);
+  return length;
+}
+
+static int writeExponent(int exponent, char *buffer) {
+  char *start = buffer;
+  *buffer++ = 'e';
+  if (exponent < 0) {
+    *buffer++ = '-';
+    exponent = -exponent;
+  } else {
+    *buffer++ = '+';
+  }
+  if (exponent >= 100) {
+    *buffer++ = (char)('0' + exponent / 100);
+    exponent %= 100;
+    *buffer++ = (char)('0' + exponent / 10);
+  } else if (exponent >= 10) {
+    *buffer++ = (char)('0' + exponent / 10);
+  }
+  *buffer++ = (char)('0' + exponent % 10);
+  return (int)(buffer - start);
+}
+
+int formatNumber(double value, char *buffer) {
+  char *start = buffer;
+  if (signbit(value)) {
+    *buffer++ = '-';
+    value = -value;
+  }
+  if (isnan(value)) {
+    memcpy(buffer, "nan", 3);
+    return (int)(buffer - start) + 3;
+  }
+  if (isinf(value)) {
+    memcpy(buffer, "inf", 3);
+    return (int)(buffer - start) + 3;
+  }
+  if (value == 0) {
+    *buffer++ = '0';
+    return (int)(buffer - start);
+  }
+
+  char digits[20];
+  int k;
+  int length = shortestDigits(value, digits, &k);
+  // the decimal point goes after the first `point` digits
+  int point = length + k;
+
+  if (length <= point && point <= 21) {
+    // an integer: 1234e2 -> 123400
+    memcpy(buffer, digits, length);
+    memset(buffer + length, '0', point - length);
+    buffer += point;
+  } else if (0 < point && point <= 21) {
+    // 1234e-2 -> 12.34
+    memcpy(buffer, digits, point);
+    buffer[point] = '.';
+    memcpy(buffer + point + 1, digits + point, length - point);
+    buffer += length + 1;
+  } else if (-6 < point && point <= 0) {
+    // 1234e-6 -> 0.001234
+    buffer[0] = '0';
+    buffer[1] = '.';
+    memset(buffer + 2, '0', -point);
+    memcpy(buffer + 2 - point, digits, length);
+    buffer += 2 - point + length;
+  } else {
+    // too big or too small for that, use scientific notation: 1.234e+30
+    *buffer++ = digits[0];
+    if (length > 1) {
+      *buffer++ = '.';
+      memcpy(buffer, digits + 1, length - 1);
+      buffer += length - 1;
+    }
+    buffer += writeExponent(point - 1, buffer);
+  }
+  return (int)(buffer - start);
+}
+
+int formatInteger(int64_t value, char *buffer) {
+  char *start = buffer;
+  // the magnitude as unsigned, so that INT64_MIN doesn't overflow
+  uint64_t magnitude = (uint64_t)value;
+  if (value < 0) {
+    *buffer++ = '-';
+    magnitude = -magnitude;
+  }
+  // the digits come out backwards
+  char digits[20];
+  int length = 0;
+  do {
+    digits[length++] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+  for (int i = 0; i < length; i++) {
+    buffer[i] = digits[length - 1 - i];
+  }
+  return (int)(buffer - start) + length;
+}
+
+// if all the digits together make an integer of at most 2^53 and there are
+// no more than 22 of them after the point, then that integer and the power
+// of ten are both exact doubles, and dividing one by the other rounds
+// correctly, to the same double strtod would give
+double parseNumber(const char *start, int length) {
+  static const double powersOfTen[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  uint64_t digits = 0;
+  int fraction = -1;
+  for (int i = 0; i < length; i++) {
+    if (start[i] == '.') {
+      fraction = 0;
+      continue;
+    }
+    // past 2^53 the digits can't be exact anymore
+    if (digits > ((1ull << 53) - 9) / 10)
+      return strtod(start, NULL);
+    digits = digits * 10 + (start[i] - '0');
+    if (fraction >= 0)
+      fraction++;
+  }
+  if (fraction <= 0)
+    return (double)digits;
+  if (fraction > 22)
+    return strtod(start, NULL);
+  return (double)digits / powersOfTen[fraction];
+}
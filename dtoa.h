@@ -0,0 +1,25 @@
+#ifndef clox_dtoa_h
+#define clox_dtoa_h
+
+#include <stdint.h>
+
+// the longest text formatNumber() can produce, with room to spare
+#define NUMBER_BUFFER_SIZE 32
+
+// writes the shortest decimal text that reads back as exactly the same double
+// into buffer (which needs NUMBER_BUFFER_SIZE bytes) and returns its length.
+// Nothing is null-terminated. Numbers print like JavaScript prints them:
+// plain decimals from 1e-6 up to 1e21 (0.001, 12.5, 100) and scientific
+// notation outside of that (1e+21, 1.5e-7)
+int formatNumber(double value, char *buffer);
+// the same for an integer, which is just its digits. It fits in the same
+// buffer size
+int formatInteger(int64_t value, char *buffer);
+
+// the double that a number literal says: digits with an optional fraction,
+// like 12 or 0.25. Most of them are converted without strtod, which the rest
+// are handed to. strtod reads on until the number ends, so the text has to
+// be followed by something that can't continue it, like ',' or '\0'
+double parseNumber(const char *start, int length);
+
+#endif
@@ -0,0 +1,527 @@
+#include "emitc.h"
+#include "chunk.h"
+#include "value.h"
+#include "verify.h"
+#include "vm.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// the emitted code is straight-line: there are no jumps in our bytecode, so
+// we can follow the stack depth while translating and give every stack slot
+// its own local variable (s0, s1, ...). The C compiler can then keep them in
+// registers and, since the constants are right there too, fold away most of
+// the type checks
+
+static const char *prelude =
+    "#include <math.h>\n"
+    "#include <stdio.h>\n"
+    "\n"
+    "#ifndef CLOX_EMITTED_PRELUDE\n"
+    "#define CLOX_EMITTED_PRELUDE\n"
+    "// CLOX_UNDEFINED is a global that hasn't been declared\n"
+    "typedef enum {\n"
+    "  CLOX_BOOL,\n"
+    "  CLOX_NIL,\n"
+    "  CLOX_NUMBER,\n"
+    "  CLOX_INT,\n"
+    "  CLOX_UNDEFINED\n"
+    "} clox_type;\n"
+    "typedef struct {\n"
+    "  clox_type type;\n"
+    "  union {\n"
+    "    double number;\n"
+    "    long long integer;\n"
+    "  };\n"
+    "} clox_value;\n"
+    "\n"
+    "static int clox_runtime_error(const char *message, int line) {\n"
+    "  fprintf(stderr, \"%s\\n[line %d] in script\\n\", message, line);\n"
+    "  return 2;\n"
+    "}\n"
+    "\n"
+    "static int clox_is_numeric(clox_value value) {\n"
+    "  return value.type == CLOX_NUMBER || value.type == CLOX_INT;\n"
+    "}\n"
+    "\n"
+    "static double clox_to_number(clox_value value) {\n"
+    "  return value.type == CLOX_INT ? (double)value.integer : value.number;\n"
+    "}\n"
+    "\n"
+    "// two integers stay an integer unless that overflows, then and for\n"
+    "// everything else it's done in doubles\n"
+    "#define CLOX_ARITHMETIC(name, op, overflows)                      \\\n"
+    "  static void name(clox_value *a, clox_value b) {                  \\\n"
+    "    long long integer;                                             \\\n"
+    "    if (a->type == CLOX_INT && b.type == CLOX_INT &&               \\\n"
+    "        !overflows(a->integer, b.integer, &integer)) {             \\\n"
+    "      a->integer = integer;                                        \\\n"
+    "      return;                                                      \\\n"
+    "    }                                                              \\\n"
+    "    double number = clox_to_number(*a) op clox_to_number(b);       \\\n"
+    "    *a = (clox_value){CLOX_NUMBER, {number}};                      \\\n"
+    "  }\n"
+    "CLOX_ARITHMETIC(clox_add, +, __builtin_add_overflow)\n"
+    "CLOX_ARITHMETIC(clox_subtract, -, __builtin_sub_overflow)\n"
+    "CLOX_ARITHMETIC(clox_multiply, *, __builtin_mul_overflow)\n"
+    "\n"
+    "static void clox_divide(clox_value *a, clox_value b) {\n"
+    "  double number = clox_to_number(*a) / clox_to_number(b);\n"
+    "  *a = (clox_value){CLOX_NUMBER, {number}};\n"
+    "}\n"
+    "\n"
+    "static void clox_negate(clox_value *a) {\n"
+    "  if (a->type != CLOX_INT)\n"
+    "    a->number = -a->number;\n"
+    "  else if (a->integer == -9223372036854775807LL - 1)\n"
+    "    *a = (clox_value){CLOX_NUMBER, {9223372036854775808.0}};\n"
+    "  else\n"
+    "    a->integer = -a->integer;\n"
+    "}\n"
+    "\n"
+    "// like minNumber() and maxNumber() in value.h\n"
+    "static double clox_min(double a, double b) {\n"
+    "  if (isnan(a) || isnan(b))\n"
+    "    return isnan(a) ? a : b;\n"
+    "  if (a == b)\n"
+    "    return signbit(a) ? a : b;\n"
+    "  return a < b ? a : b;\n"
+    "}\n"
+    "\n"
+    "static double clox_max(double a, double b) {\n"
+    "  if (isnan(a) || isnan(b))\n"
+    "    return isnan(a) ? a : b;\n"
+    "  if (a == b)\n"
+    "    return signbit(a) ? b : a;\n"
+    "  return a > b ? a : b;\n"
+    "}\n"
+    "\n"
+    "// bools keep their value in number, as 0 or 1\n"
+    "static int clox_is_falsey(clox_value value) {\n"
+    "  return value.type == CLOX_NIL ||\n"
+    "         (value.type == CLOX_BOOL && value.number == 0);\n"
+    "}\n"
+    "\n"
+    "static void clox_not(clox_value *a) {\n"
+    "  *a = (clox_value){CLOX_BOOL, {clox_is_falsey(*a)}};\n"
+    "}\n"
+    "\n"
+    "// an integer and a double are equal if they are exactly the same number\n"
+    "static int clox_same_number(long long integer, double number) {\n"
+    "  return (double)integer == number && number >= -0x1p63 &&\n"
+    "         number < 0x1p63 && (long long)number == integer;\n"
+    "}\n"
+    "\n"
+    "static void clox_equal(clox_value *a, clox_value b) {\n"
+    "  int equal;\n"
+    "  if (a->type == CLOX_INT && b.type == CLOX_INT)\n"
+    "    equal = a->integer == b.integer;\n"
+    "  else if (a->type == CLOX_INT && b.type == CLOX_NUMBER)\n"
+    "    equal = clox_same_number(a->integer, b.number);\n"
+    "  else if (a->type == CLOX_NUMBER && b.type == CLOX_INT)\n"
+    "    equal = clox_same_number(b.integer, a->number);\n"
+    "  else\n"
+    "    equal = a->type == b.type &&\n"
+    "            (a->type == CLOX_NIL || a->number == b.number);\n"
+    "  *a = (clox_value){CLOX_BOOL, {equal}};\n"
+    "}\n"
+    "#endif\n";
+
+static void emitNumber(FILE *out, double number) {
+  // hex floats are exact, so the constant the C compiler sees is bit for bit
+  // the one in our constant pool
+  if (isnan(number)) {
+    fprintf(out, "NAN");
+  } else if (isinf(number)) {
+    fprintf(out, number < 0 ? "-INFINITY" : "INFINITY");
+  } else {
+    fprintf(out, "%a", number);
+  }
+}
+
+static void emitValue(FILE *out, Value value) {
+  switch (value.type) {
+  case VAL_BOOL:
+    fprintf(out, "{CLOX_BOOL, %d}", AS_BOOL(value) ? 1 : 0);
+    break;
+  case VAL_NIL:
+    fprintf(out, "{CLOX_NIL, 0}");
+    break;
+  case VAL_NUMBER:
+    fprintf(out, "{CLOX_NUMBER, {");
+    emitNumber(out, AS_NUMBER(value));
+    fprintf(out, "}}");
+    break;
+  case VAL_INT:
+    // the smallest one can't be written as a literal, its magnitude is too
+    // big for a long long
+    if (AS_INT(value) == INT64_MIN) {
+      fprintf(out, "{CLOX_INT, {.integer = -9223372036854775807LL - 1}}");
+    } else {
+      fprintf(out, "{CLOX_INT, {.integer = %lldLL}}", (long long)AS_INT(value));
+    }
+    break;
+  case VAL_OBJ:
+    // scanChunk() turns away chunks with strings, so this never happens
+    fprintf(out, "{CLOX_NIL, 0}");
+    break;
+  }
+}
+
+static uint32_t readConstantIndex(Chunk *chunk, int offset) {
+  if (chunk->code[offset] == OP_CONSTANT) {
+    return chunk->code[offset + 1];
+  }
+  return chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) |
+         (chunk->code[offset + 3] << 16);
+}
+
+// the integer an OP_ZERO, OP_ONE, OP_SMALL_INT or OP_SMALL_INT_LONG pushes
+static uint32_t readImmediate(Chunk *chunk, int offset) {
+  switch (chunk->code[offset]) {
+  case OP_ZERO:
+    return 0;
+  case OP_ONE:
+    return 1;
+  case OP_SMALL_INT:
+    return chunk->code[offset + 1];
+  default:
+    return chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+  }
+}
+
+// the _UNCHECKED instructions were proven to get doubles by the compiler, so
+// they are emitted without the check and as plain C arithmetic. The _INT ones
+// get integers but still need the prelude's function for the overflow.
+// Everything else checks the types and calls that function
+static void emitBinary(FILE *out, int depth, const char *op,
+                       const char *function, int line, uint8_t instruction) {
+  int a = depth - 2;
+  int b = depth - 1;
+  bool unchecked = instruction == OP_ADD_UNCHECKED ||
+                   instruction == OP_SUBTRACT_UNCHECKED ||
+                   instruction == OP_MULTIPLY_UNCHECKED ||
+                   instruction == OP_DIVIDE_UNCHECKED;
+  bool integers = instruction == OP_ADD_INT ||
+                  instruction == OP_SUBTRACT_INT ||
+                  instruction == OP_MULTIPLY_INT;
+  // the VM's + also takes strings, and says so
+  bool add = instruction == OP_ADD || instruction == OP_ADD_NUMBER;
+  if (unchecked) {
+    fprintf(out, "  s%d.number = s%d.number %s s%d.number;\n", a, a, op, b);
+    return;
+  }
+  if (!integers) {
+    fprintf(
+        out,
+        "  if (!clox_is_numeric(s%d) || !clox_is_numeric(s%d))\n"
+        "    return clox_runtime_error(\"%s\", %d);\n",
+        b, a,
+        add ? "Operands must be two numbers or two strings."
+            : "Operands must be numbers.",
+        line);
+  }
+  fprintf(out, "  %s(&s%d, s%d);\n", function, a, b);
+}
+
+// the function an intrinsic calls, or NULL for other instructions
+static const char *intrinsicFunction(uint8_t instruction) {
+  switch (instruction) {
+  case OP_SQRT:
+    return "sqrt";
+  case OP_ABS:
+    return "fabs";
+  case OP_FLOOR:
+    return "floor";
+  case OP_EXP:
+    return "exp";
+  case OP_MIN:
+    return "clox_min";
+  case OP_MAX:
+    return "clox_max";
+  case OP_POW:
+    return "pow";
+  default:
+    return NULL;
+  }
+}
+
+// an intrinsic checks its operands like the VM does and calls the function.
+// The code needs -lm to link
+static void emitIntrinsic(FILE *out, int depth, int line,
+                          uint8_t instruction) {
+  const char *function = intrinsicFunction(instruction);
+  if (instruction == OP_MIN || instruction == OP_MAX ||
+      instruction == OP_POW) {
+    int a = depth - 2;
+    int b = depth - 1;
+    fprintf(out,
+            "  if (!clox_is_numeric(s%d) || !clox_is_numeric(s%d))\n"
+            "    return clox_runtime_error(\"Operands must be numbers.\", "
+            "%d);\n"
+            "  s%d = (clox_value){CLOX_NUMBER, "
+            "{%s(clox_to_number(s%d), clox_to_number(s%d))}};\n",
+            b, a, line, a, function, a, b);
+    return;
+  }
+  int a = depth - 1;
+  fprintf(out,
+          "  if (!clox_is_numeric(s%d))\n"
+          "    return clox_runtime_error(\"Operand must be a number.\", "
+          "%d);\n"
+          "  s%d = (clox_value){CLOX_NUMBER, {%s(clox_to_number(s%d))}};\n",
+          a, line, a, function, a);
+}
+
+// walks the chunk once to check that we can translate every instruction and
+// to find out how many stack slots the function needs
+static bool scanChunk(Chunk *chunk, int *maxDepth) {
+  int depth = 0;
+  Value constant;
+  *maxDepth = 0;
+  for (int offset = 0; offset < chunk->count;) {
+    switch (chunk->code[offset]) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+      // the emitted code has no heap to put strings on
+      constant = chunk->constants.values[readConstantIndex(chunk, offset)];
+      if (IS_OBJ(constant)) {
+        fprintf(stderr, "Cannot translate strings to C.\n");
+        return false;
+      }
+      depth++;
+      offset += instructionLength(chunk->code[offset]);
+      break;
+    case OP_ZERO:
+    case OP_ONE:
+      depth++;
+      offset++;
+      break;
+    case OP_SMALL_INT:
+      depth++;
+      offset += 2;
+      break;
+    case OP_SMALL_INT_LONG:
+      depth++;
+      offset += 3;
+      break;
+    case OP_DUP:
+      depth++;
+      offset++;
+      break;
+    case OP_PICK:
+    case OP_TUCK:
+      depth++;
+      offset += 2;
+      break;
+    case OP_GET_GLOBAL:
+      depth++;
+      offset += 3;
+      break;
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_ADD_NUMBER:
+    case OP_SUBTRACT_NUMBER:
+    case OP_MULTIPLY_NUMBER:
+    case OP_DIVIDE_NUMBER:
+    case OP_ADD_UNCHECKED:
+    case OP_SUBTRACT_UNCHECKED:
+    case OP_MULTIPLY_UNCHECKED:
+    case OP_DIVIDE_UNCHECKED:
+    case OP_RETURN:
+      depth--;
+      offset++;
+      break;
+    case OP_ADD_INT:
+    case OP_SUBTRACT_INT:
+    case OP_MULTIPLY_INT:
+    case OP_EQUAL:
+    case OP_MIN:
+    case OP_MAX:
+    case OP_POW:
+      depth--;
+      offset++;
+      break;
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_NEGATE_NUMBER:
+    case OP_NEGATE_UNCHECKED:
+    case OP_NEGATE_INT:
+    case OP_SQRT:
+    case OP_ABS:
+    case OP_FLOOR:
+    case OP_EXP:
+      offset++;
+      break;
+    default:
+      fprintf(stderr, "Cannot translate opcode %d to C.\n",
+              chunk->code[offset]);
+      return false;
+    }
+    if (depth > *maxDepth)
+      *maxDepth = depth;
+  }
+  return true;
+}
+
+bool emitC(Chunk *chunk, const char *name, FILE *out) {
+  int maxDepth;
+  if (!scanChunk(chunk, &maxDepth))
+    return false;
+
+  fprintf(out, "// generated by clox --emit-c. Do not edit\n");
+  fprintf(out, "%s\n", prelude);
+  fprintf(out, "int %s(clox_value *result, const clox_value *globals) {\n",
+          name);
+
+  if (chunk->constants.count > 0) {
+    fprintf(out, "  static const clox_value constants[] = {\n");
+    for (int i = 0; i < chunk->constants.count; i++) {
+      fprintf(out, "      ");
+      emitValue(out, chunk->constants.values[i]);
+      fprintf(out, ",\n");
+    }
+    fprintf(out, "  };\n");
+  }
+  for (int i = 0; i < maxDepth; i++) {
+    fprintf(out, "  clox_value s%d;\n", i);
+  }
+
+  int depth = 0;
+  for (int offset = 0; offset < chunk->count;) {
+    int line = getLine(chunk, offset);
+    uint8_t instruction = chunk->code[offset];
+    switch (instruction) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+      fprintf(out, "  s%d = constants[%u];\n", depth,
+              readConstantIndex(chunk, offset));
+      depth++;
+      offset += instruction == OP_CONSTANT ? 2 : 4;
+      break;
+    case OP_ZERO:
+    case OP_ONE:
+    case OP_SMALL_INT:
+    case OP_SMALL_INT_LONG:
+      fprintf(out, "  s%d = (clox_value){CLOX_INT, {.integer = %u}};\n", depth,
+              readImmediate(chunk, offset));
+      depth++;
+      offset += instructionLength(instruction);
+      break;
+    case OP_DUP:
+    case OP_PICK: {
+      // a copy of the slot `distance` below the top, which is a plain
+      // assignment between the locals
+      int distance = instruction == OP_PICK ? chunk->code[offset + 1] : 0;
+      fprintf(out, "  s%d = s%d;\n", depth, depth - 1 - distance);
+      depth++;
+      offset += instructionLength(instruction);
+      break;
+    }
+    case OP_TUCK: {
+      // every local from the slot up moves up one
+      int slot = depth - chunk->code[offset + 1];
+      for (int i = depth; i > slot; i--) {
+        fprintf(out, "  s%d = s%d;\n", i, i - 1);
+      }
+      fprintf(out, "  s%d = s%d;\n", slot, depth);
+      depth++;
+      offset += 2;
+      break;
+    }
+    case OP_GET_GLOBAL: {
+      // the guard is the one the VM has, the arithmetic checks the type
+      int slot = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+      fprintf(out,
+              "  if (globals[%d].type == CLOX_UNDEFINED)\n"
+              "    return clox_runtime_error(\"Undefined variable '%s'.\", "
+              "%d);\n"
+              "  s%d = globals[%d];\n",
+              slot, globalName(slot), line, depth, slot);
+      depth++;
+      offset += 3;
+      break;
+    }
+    case OP_ADD:
+    case OP_ADD_NUMBER:
+    case OP_ADD_UNCHECKED:
+    case OP_ADD_INT:
+      emitBinary(out, depth--, "+", "clox_add", line, instruction);
+      offset++;
+      break;
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_NUMBER:
+    case OP_SUBTRACT_UNCHECKED:
+    case OP_SUBTRACT_INT:
+      emitBinary(out, depth--, "-", "clox_subtract", line, instruction);
+      offset++;
+      break;
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_NUMBER:
+    case OP_MULTIPLY_UNCHECKED:
+    case OP_MULTIPLY_INT:
+      emitBinary(out, depth--, "*", "clox_multiply", line, instruction);
+      offset++;
+      break;
+    case OP_DIVIDE:
+    case OP_DIVIDE_NUMBER:
+    case OP_DIVIDE_UNCHECKED:
+      emitBinary(out, depth--, "/", "clox_divide", line, instruction);
+      offset++;
+      break;
+    case OP_NEGATE:
+    case OP_NEGATE_NUMBER:
+    case OP_NEGATE_UNCHECKED:
+    case OP_NEGATE_INT:
+      if (instruction == OP_NEGATE_UNCHECKED) {
+        fprintf(out, "  s%d.number = -s%d.number;\n", depth - 1, depth - 1);
+        offset++;
+        break;
+      }
+      if (instruction != OP_NEGATE_INT) {
+        fprintf(out,
+                "  if (!clox_is_numeric(s%d))\n"
+                "    return clox_runtime_error(\"Operand must be a number.\", "
+                "%d);\n",
+                depth - 1, line);
+      }
+      fprintf(out, "  clox_negate(&s%d);\n", depth - 1);
+      offset++;
+      break;
+    case OP_SQRT:
+    case OP_ABS:
+    case OP_FLOOR:
+    case OP_EXP:
+      emitIntrinsic(out, depth, line, instruction);
+      offset++;
+      break;
+    case OP_MIN:
+    case OP_MAX:
+    case OP_POW:
+      emitIntrinsic(out, depth--, line, instruction);
+      offset++;
+      break;
+    case OP_EQUAL:
+      fprintf(out, "  clox_equal(&s%d, s%d);\n", depth - 2, depth - 1);
+      depth--;
+      offset++;
+      break;
+    case OP_NOT:
+      fprintf(out, "  clox_not(&s%d);\n", depth - 1);
+      offset++;
+      break;
+    case OP_RETURN:
+      // whatever the last instruction left behind, a number or a bool, is
+      // what gets returned
+      fprintf(out, "  *result = s%d;\n  return 0;\n", depth - 1);
+      depth--;
+      offset++;
+      break;
+    }
+  }
+
+  fprintf(out, "}\n");
+  return true;
+}
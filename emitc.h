@@ -0,0 +1,24 @@
+#ifndef clox_emitc_h
+#define clox_emitc_h
+
+#include "chunk.h"
+#include "common.h"
+#include <stdio.h>
+
+// ahead-of-time translation of a compiled chunk into C source code
+// the output is a single standalone function
+//   int <name>(clox_value *result, const clox_value *globals);
+// that computes the same thing run() would, including the runtime errors. It
+// returns 0 (INTERPRET_OK) and stores the value in *result, or it reports the
+// error on stderr exactly like the VM does and returns 2
+// (INTERPRET_RUNTIME_ERROR). clox_value is declared by the code itself, it's
+// a double or an integer like Value in value.h
+// globals holds the values of the global variables the code reads, by their
+// slot in vm.globals (see globalSlot()), with CLOX_UNDEFINED for one that
+// isn't declared. It can be NULL if the code reads none
+// the code only depends on the C standard library, so it can be compiled
+// straight into another program
+// returns false if the chunk uses something the translator can't handle
+bool emitC(Chunk *chunk, const char *name, FILE *out);
+
+#endif
@@ -0,0 +1,125 @@
+#include "ir.h"
+#include "memory.h"
+
+void initIr(Ir *ir) {
+  ir->count = 0;
+  ir->capacity = 0;
+  ir->nodes = NULL;
+  ir->numberCount = 0;
+  ir->numberCapacity = 0;
+  ir->numbers = NULL;
+  ir->integerCount = 0;
+  ir->integerCapacity = 0;
+  ir->integers = NULL;
+  ir->stringCount = 0;
+  ir->stringCapacity = 0;
+  ir->strings = NULL;
+  ir->lineCount = 0;
+  ir->lineCapacity = 0;
+  ir->lines = NULL;
+}
+
+void freeIr(Ir *ir) {
+  FREE_ARRAY(Node, ir->nodes, ir->capacity);
+  FREE_ARRAY(double, ir->numbers, ir->numberCapacity);
+  FREE_ARRAY(int64_t, ir->integers, ir->integerCapacity);
+  // only the array, the strings belong to the VM
+  FREE_ARRAY(ObjString *, ir->strings, ir->stringCapacity);
+  FREE_ARRAY(NodeLine, ir->lines, ir->lineCapacity);
+  initIr(ir);
+}
+
+int addNode(Ir *ir, NodeKind kind, uint32_t operand, int line) {
+  if (ir->capacity < ir->count + 1) {
+    int oldCapacity = ir->capacity;
+    ir->capacity = GROW_CAPACITY(oldCapacity);
+    ir->nodes = GROW_ARRAY(Node, ir->nodes, oldCapacity, ir->capacity);
+  }
+  ir->nodes[ir->count].kind = kind;
+  ir->nodes[ir->count].operand = operand;
+
+  // lines are run-length encoded the same way the chunk does it
+  if (ir->lineCount == 0 || ir->lines[ir->lineCount - 1].line != line) {
+    if (ir->lineCapacity < ir->lineCount + 1) {
+      int oldCapacity = ir->lineCapacity;
+      ir->lineCapacity = GROW_CAPACITY(oldCapacity);
+      ir->lines =
+          GROW_ARRAY(NodeLine, ir->lines, oldCapacity, ir->lineCapacity);
+    }
+    ir->lines[ir->lineCount].node = ir->count;
+    ir->lines[ir->lineCount].line = line;
+    ir->lineCount++;
+  }
+  return ir->count++;
+}
+
+// fills in node as a literal double, see addNumberNode()
+static bool numberNode(Ir *ir, double number, Node *node) {
+  if (ir->numberCount > NODE_OPERAND_MAX)
+    return false;
+  if (ir->numberCapacity < ir->numberCount + 1) {
+    int oldCapacity = ir->numberCapacity;
+    ir->numberCapacity = GROW_CAPACITY(oldCapacity);
+    ir->numbers =
+        GROW_ARRAY(double, ir->numbers, oldCapacity, ir->numberCapacity);
+  }
+  ir->numbers[ir->numberCount] = number;
+  node->kind = NODE_NUMBER;
+  node->operand = ir->numberCount++;
+  return true;
+}
+
+bool addNumberNode(Ir *ir, double number, int line) {
+  Node node;
+  if (!numberNode(ir, number, &node))
+    return false;
+  addNode(ir, node.kind, node.operand, line);
+  return true;
+}
+
+bool addIntegerNode(Ir *ir, int64_t integer, int line) {
+  if (integer >= 0 && integer <= NODE_OPERAND_MAX) {
+    addNode(ir, NODE_INTEGER, (uint32_t)integer, line);
+    return true;
+  }
+
+  if (ir->integerCount > NODE_OPERAND_MAX)
+    return false;
+  if (ir->integerCapacity < ir->integerCount + 1) {
+    int oldCapacity = ir->integerCapacity;
+    ir->integerCapacity = GROW_CAPACITY(oldCapacity);
+    ir->integers =
+        GROW_ARRAY(int64_t, ir->integers, oldCapacity, ir->integerCapacity);
+  }
+  ir->integers[ir->integerCount] = integer;
+  addNode(ir, NODE_LONG_INTEGER, ir->integerCount++, line);
+  return true;
+}
+
+bool addStringNode(Ir *ir, ObjString *string, int line) {
+  if (ir->stringCount > NODE_OPERAND_MAX)
+    return false;
+  if (ir->stringCapacity < ir->stringCount + 1) {
+    int oldCapacity = ir->stringCapacity;
+    ir->stringCapacity = GROW_CAPACITY(oldCapacity);
+    ir->strings = GROW_ARRAY(ObjString *, ir->strings, oldCapacity,
+                             ir->stringCapacity);
+  }
+  ir->strings[ir->stringCount] = string;
+  addNode(ir, NODE_STRING, ir->stringCount++, line);
+  return true;
+}
+
+bool setNumberNode(Ir *ir, int index, double number) {
+  return numberNode(ir, number, &ir->nodes[index]);
+}
+
+int64_t integerValue(Ir *ir, Node node) {
+  return node.kind == NODE_LONG_INTEGER ? ir->integers[node.operand]
+                                        : (int64_t)node.operand;
+}
+
+double numberValue(Ir *ir, Node node) {
+  return node.kind == NODE_NUMBER ? ir->numbers[node.operand]
+                                  : (double)integerValue(ir, node);
+}
@@ -0,0 +1,131 @@
+#ifndef clox_ir_h
+#define clox_ir_h
+
+#include "common.h"
+#include "value.h"
+#include <stdint.h>
+
+// the compiler's intermediate representation. The parser doesn't emit
+// bytecode directly anymore, it appends a node per literal and operator to a
+// flat array, and the backend in compiler.c lowers that array to bytecode
+// afterwards. In between, optimization passes can look at the whole
+// expression at once
+//
+// nodes are in post-order: an operator comes right after its operands, which
+// is exactly the order a stack machine runs them in. So the operands don't
+// need to be stored: the right operand of a binary node is the subtree ending
+// right before it and the left operand is the subtree before that. Lowering is
+// then a single walk from the first node to the last
+//
+// the parser builds a tree per statement and one for the final expression.
+// A statement's tree ends in a node that takes its value off the stack again
+// (NODE_DEFINE_GLOBAL or NODE_POP). Passes may put more trees in front of
+// them, whose values stay on the stack underneath for NODE_PICKs to copy. The
+// value of the last tree is the value of the program
+//
+// a node is 4 bytes, the same ballpark as the bytecode it turns into, so
+// building the IR first doesn't cost much memory even for huge expressions
+
+typedef enum {
+  // a literal double, operand is its index in Ir.numbers
+  NODE_NUMBER,
+  // a literal integer small enough to be the operand itself
+  NODE_INTEGER,
+  // a literal integer that isn't, operand is its index in Ir.integers
+  NODE_LONG_INTEGER,
+  // a literal string, operand is its index in Ir.strings
+  NODE_STRING,
+  NODE_NEGATE,
+  NODE_NOT,
+  NODE_ADD,
+  NODE_SUBTRACT,
+  NODE_MULTIPLY,
+  NODE_DIVIDE,
+  NODE_EQUAL,
+  // the intrinsics, see intrinsicCall() in compiler.c. The first four take
+  // one operand, the last three two, like the binary operators
+  NODE_SQRT,
+  NODE_ABS,
+  NODE_FLOOR,
+  NODE_EXP,
+  NODE_MIN,
+  NODE_MAX,
+  NODE_POW,
+  // global variables, operand is the variable's slot (see VM.globals).
+  // NODE_SET_GLOBAL takes the value from its operand subtree and leaves it,
+  // NODE_DEFINE_GLOBAL takes it and leaves nothing
+  NODE_GET_GLOBAL,
+  NODE_SET_GLOBAL,
+  NODE_DEFINE_GLOBAL,
+  // drops the value of an expression statement
+  NODE_POP,
+  // a copy of a value that is already on the stack. operand is its slot,
+  // counted from the bottom of the stack. Only passes add these (see
+  // optimize.h), lowering turns them into OP_DUP or OP_PICK
+  NODE_PICK,
+  // keeps the value of the subtree before it for NODE_PICKs further on: a
+  // copy of it goes to the stack slot operand, counted like NODE_PICK's, and
+  // the value itself stays where it is. Lowering turns it into OP_TUCK
+  NODE_TUCK,
+  // a node a pass removed. Lowering skips it. Passes replace nodes with
+  // NODE_DEAD instead of deleting them, so no other node has to move
+  NODE_DEAD,
+} NodeKind;
+
+// the largest value an operand can hold
+#define NODE_OPERAND_MAX 0xffffff
+
+typedef struct {
+  uint32_t kind : 8;
+  uint32_t operand : 24;
+} Node;
+
+// like LineStart in chunk.h: which node a new source line starts at
+typedef struct {
+  int node;
+  int line;
+} NodeLine;
+
+typedef struct {
+  int count;
+  int capacity;
+  Node *nodes;
+  // the literals that don't fit in an operand
+  int numberCount;
+  int numberCapacity;
+  double *numbers;
+  int integerCount;
+  int integerCapacity;
+  int64_t *integers;
+  // already interned, so the same literal twice is the same pointer
+  int stringCount;
+  int stringCapacity;
+  ObjString **strings;
+  int lineCount;
+  int lineCapacity;
+  NodeLine *lines;
+} Ir;
+
+void initIr(Ir *ir);
+void freeIr(Ir *ir);
+// appends a node and returns its index. line is the source line the code for
+// it should be blamed on
+int addNode(Ir *ir, NodeKind kind, uint32_t operand, int line);
+// appends a literal double. Returns false if there are too many literals for
+// an operand to address
+bool addNumberNode(Ir *ir, double number, int line);
+// appends a literal integer, picking NODE_INTEGER when it fits. Returns false
+// like addNumberNode()
+bool addIntegerNode(Ir *ir, int64_t integer, int line);
+// appends a literal string. Returns false like addNumberNode()
+bool addStringNode(Ir *ir, ObjString *string, int line);
+// turns the node at index into a literal double. Returns false, and leaves
+// the node alone, if there are too many literals
+bool setNumberNode(Ir *ir, int index, double number);
+// the value of a NODE_INTEGER or NODE_LONG_INTEGER
+int64_t integerValue(Ir *ir, Node node);
+// the value of any literal as a double, the way the VM converts an integer
+// that meets a double
+double numberValue(Ir *ir, Node node);
+
+#endif
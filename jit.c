@@ -0,0 +1,546 @@
+#include "jit.h"
+#include "chunk.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the machine code is collected in a normal dynamic array first and only
+// copied into executable memory once we know how big it is and that the whole
+// chunk could be translated
+typedef struct {
+  int count;
+  int capacity;
+  uint8_t *code;
+  // offsets of the rel32 operands of the jumps to the bail-out path. We only
+  // know where that path is once everything else has been emitted, so we go
+  // back and fill them in at the end
+  int patchCount;
+  int patchCapacity;
+  int *patches;
+  // the type of every value on the stack at this point in the code. It is
+  // always known here: constants are guarded, and integer arithmetic that
+  // would overflow bails out instead of turning into a double
+  int typeCount;
+  int typeCapacity;
+  ValueType *types;
+} Assembler;
+
+static void emit(Assembler *as, uint8_t byte) {
+  if (as->capacity < as->count + 1) {
+    int oldCapacity = as->capacity;
+    as->capacity = GROW_CAPACITY(oldCapacity);
+    as->code = GROW_ARRAY(uint8_t, as->code, oldCapacity, as->capacity);
+  }
+  as->code[as->count++] = byte;
+}
+
+static void emitAll(Assembler *as, const uint8_t *bytes, int length) {
+  for (int i = 0; i < length; i++) {
+    emit(as, bytes[i]);
+  }
+}
+
+// x86 is little-endian, so immediates are written lowest byte first
+static void emitImmediate(Assembler *as, uint64_t value, int size) {
+  for (int i = 0; i < size; i++) {
+    emit(as, (uint8_t)((value >> (8 * i)) & 0xff));
+  }
+}
+
+static void pushType(Assembler *as, ValueType type) {
+  if (as->typeCapacity < as->typeCount + 1) {
+    int oldCapacity = as->typeCapacity;
+    as->typeCapacity = GROW_CAPACITY(oldCapacity);
+    as->types =
+        GROW_ARRAY(ValueType, as->types, oldCapacity, as->typeCapacity);
+  }
+  as->types[as->typeCount++] = type;
+}
+
+static ValueType popType(Assembler *as) { return as->types[--as->typeCount]; }
+
+// the condition codes of the two jumps we need
+#define NOT_EQUAL 0x85
+#define OVERFLOW 0x80
+
+static void emitBailJump(Assembler *as, uint8_t condition) {
+  // jne/jo rel32
+  emit(as, 0x0f);
+  emit(as, condition);
+  if (as->patchCapacity < as->patchCount + 1) {
+    int oldCapacity = as->patchCapacity;
+    as->patchCapacity = GROW_CAPACITY(oldCapacity);
+    as->patches = GROW_ARRAY(int, as->patches, oldCapacity, as->patchCapacity);
+  }
+  as->patches[as->patchCount++] = as->count;
+  emitImmediate(as, 0, 4);
+}
+
+// the operand stack lives on the machine stack: every push in the bytecode
+// becomes a real push of the 8 bytes of the double or integer
+// a constant is loaded from the chunk's constant pool at run time (and not
+// baked into the code) and its type tag is checked first. That check is our
+// type guard. It expects the type the constant has now, so the code after it
+// knows whether it deals with a double or an integer
+static bool emitConstant(Assembler *as, Value *constant) {
+  if (constant->type != VAL_NUMBER && constant->type != VAL_INT)
+    return false;
+  // mov rax, imm64 -- address of the constant
+  emit(as, 0x48);
+  emit(as, 0xb8);
+  emitImmediate(as, (uint64_t)(uintptr_t)constant, 8);
+  // cmp dword [rax + offsetof(type)], type
+  emit(as, 0x83);
+  emit(as, 0x78);
+  emit(as, (uint8_t)offsetof(Value, type));
+  emit(as, (uint8_t)constant->type);
+  // jne bail
+  emitBailJump(as, NOT_EQUAL);
+  // push qword [rax + offsetof(as)]
+  emit(as, 0xff);
+  emit(as, 0x70);
+  emit(as, (uint8_t)offsetof(Value, as));
+  pushType(as, constant->type);
+  return true;
+}
+
+// a global is guarded the same way, expecting the type it has now. Its value
+// is read when the code runs, from wherever vm.globals keeps the values by
+// then, since the array moves when it grows. vm is per thread, which is fine:
+// a chunk only ever runs on the thread that translated it (see copyChunk())
+// an undefined global is a nil, so reading one always bails out and leaves the
+// error to the interpreter
+static bool emitGlobal(Assembler *as, int slot) {
+  ValueType type = vm.globals.values[slot].type;
+  if (type != VAL_NUMBER && type != VAL_INT)
+    return false;
+  // mov rax, imm64 -- address of vm.globals.values
+  emit(as, 0x48);
+  emit(as, 0xb8);
+  emitImmediate(as, (uint64_t)(uintptr_t)&vm.globals.values, 8);
+  // mov rax, [rax]
+  static const uint8_t load[] = {0x48, 0x8b, 0x00};
+  emitAll(as, load, sizeof(load));
+  // cmp dword [rax + disp32], type
+  uint32_t value = (uint32_t)(slot * sizeof(Value));
+  emit(as, 0x83);
+  emit(as, 0xb8);
+  emitImmediate(as, value + offsetof(Value, type), 4);
+  emit(as, (uint8_t)type);
+  // jne bail
+  emitBailJump(as, NOT_EQUAL);
+  // push qword [rax + disp32]
+  emit(as, 0xff);
+  emit(as, 0xb0);
+  emitImmediate(as, value + offsetof(Value, as), 4);
+  pushType(as, type);
+  return true;
+}
+
+// mov rax, [rsp + offset] (0x8b) or mov [rsp + offset], rax (0x89)
+static void emitStackMove(Assembler *as, uint8_t opcode, int offset) {
+  emit(as, 0x48);
+  emit(as, opcode);
+  if (offset <= INT8_MAX) {
+    emit(as, 0x44);
+    emit(as, 0x24);
+    emit(as, (uint8_t)offset);
+  } else {
+    emit(as, 0x84);
+    emit(as, 0x24);
+    emitImmediate(as, (uint32_t)offset, 4);
+  }
+}
+
+// an integer the bytecode carries in the instruction is known at translation
+// time, so it is baked into the code and needs no guard
+static void emitInteger(Assembler *as, int64_t integer) {
+  // mov rax, imm64
+  emit(as, 0x48);
+  emit(as, 0xb8);
+  emitImmediate(as, (uint64_t)integer, 8);
+  // push rax
+  emit(as, 0x50);
+  pushType(as, VAL_INT);
+}
+
+// loads the stack slot at [rsp] into xmm0 (reg 0) or xmm1 (reg 1), converting
+// an integer to a double on the way
+static void emitLoadDouble(Assembler *as, ValueType type, uint8_t reg) {
+  if (type == VAL_INT) {
+    // cvtsi2sd xmm, qword [rsp]
+    static const uint8_t convert[] = {0xf2, 0x48, 0x0f, 0x2a};
+    emitAll(as, convert, sizeof(convert));
+  } else {
+    // movsd xmm, [rsp]
+    static const uint8_t load[] = {0xf2, 0x0f, 0x10};
+    emitAll(as, load, sizeof(load));
+  }
+  emit(as, (uint8_t)(0x04 | reg << 3));
+  emit(as, 0x24);
+}
+
+// two integers are added, subtracted or multiplied as integers. If that
+// overflows, the code bails out and the interpreter redoes the arithmetic in
+// doubles, so an integer result stays an integer here
+static void emitIntegerBinary(Assembler *as, uint8_t instruction) {
+  emit(as, 0x58); // pop rax
+  if (instruction == OP_MULTIPLY_INT) {
+    static const uint8_t multiply[] = {
+        0x48, 0x0f, 0xaf, 0x04, 0x24, // imul rax, [rsp]
+        0x48, 0x89, 0x04, 0x24,       // mov [rsp], rax
+    };
+    emitAll(as, multiply, sizeof(multiply));
+  } else {
+    // add/sub [rsp], rax
+    emit(as, 0x48);
+    emit(as, instruction == OP_ADD_INT ? 0x01 : 0x29);
+    emit(as, 0x04);
+    emit(as, 0x24);
+  }
+  emitBailJump(as, OVERFLOW);
+  pushType(as, VAL_INT);
+}
+
+// the operands are already known to be numbers, either because they came from
+// a guarded constant or because they came out of another arithmetic
+// instruction, so binary operators don't need guards of their own. Which
+// code they get depends on their types. integerInstruction is what OP_ADD and
+// friends turn into for two integers, or 0 for OP_DIVIDE
+static void emitBinary(Assembler *as, uint8_t sseOpcode,
+                       uint8_t integerInstruction) {
+  ValueType right = popType(as);
+  ValueType left = popType(as);
+  if (integerInstruction != 0 && left == VAL_INT && right == VAL_INT) {
+    emitIntegerBinary(as, integerInstruction);
+    return;
+  }
+  emitLoadDouble(as, right, 1);
+  static const uint8_t pop[] = {
+      0x48, 0x83, 0xc4, 0x08, // add rsp, 8
+  };
+  emitAll(as, pop, sizeof(pop));
+  emitLoadDouble(as, left, 0);
+  // addsd/subsd/mulsd/divsd xmm0, xmm1
+  emit(as, 0xf2);
+  emit(as, 0x0f);
+  emit(as, sseOpcode);
+  emit(as, 0xc1);
+  static const uint8_t store[] = {
+      0xf2, 0x0f, 0x11, 0x04, 0x24, // movsd [rsp], xmm0
+  };
+  emitAll(as, store, sizeof(store));
+  pushType(as, VAL_NUMBER);
+}
+
+static bool translate(Chunk *chunk, Assembler *as) {
+  static const uint8_t prologue[] = {
+      0x55,             // push rbp
+      0x48, 0x89, 0xe5, // mov rbp, rsp
+  };
+  emitAll(as, prologue, sizeof(prologue));
+
+  Value *constants = chunk->constants.values;
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t instruction = chunk->code[offset];
+    switch (instruction) {
+    case OP_CONSTANT:
+      if (!emitConstant(as, &constants[chunk->code[offset + 1]]))
+        return false;
+      offset += 2;
+      break;
+    case OP_CONSTANT_LONG: {
+      uint32_t index = chunk->code[offset + 1] |
+                       (chunk->code[offset + 2] << 8) |
+                       (chunk->code[offset + 3] << 16);
+      if (!emitConstant(as, &constants[index]))
+        return false;
+      offset += 4;
+      break;
+    }
+    case OP_ZERO:
+      emitInteger(as, 0);
+      offset++;
+      break;
+    case OP_ONE:
+      emitInteger(as, 1);
+      offset++;
+      break;
+    case OP_SMALL_INT:
+      emitInteger(as, chunk->code[offset + 1]);
+      offset += 2;
+      break;
+    case OP_SMALL_INT_LONG:
+      emitInteger(as,
+                  chunk->code[offset + 1] | (chunk->code[offset + 2] << 8));
+      offset += 3;
+      break;
+    case OP_DUP:
+    case OP_PICK: {
+      // push qword [rsp + 8 * distance]. The stack slots are 8 bytes each, so
+      // the value `distance` pushes back is that many qwords up
+      int distance = instruction == OP_PICK ? chunk->code[offset + 1] : 0;
+      emit(as, 0xff);
+      if (distance == 0) {
+        emit(as, 0x34);
+        emit(as, 0x24);
+      } else if (distance * 8 <= INT8_MAX) {
+        emit(as, 0x74);
+        emit(as, 0x24);
+        emit(as, (uint8_t)(distance * 8));
+      } else {
+        emit(as, 0xb4);
+        emit(as, 0x24);
+        emitImmediate(as, (uint32_t)(distance * 8), 4);
+      }
+      pushType(as, as->types[as->typeCount - 1 - distance]);
+      offset += instruction == OP_PICK ? 2 : 1;
+      break;
+    }
+    case OP_TUCK: {
+      // make room, move the top `distance` values down into it one by one,
+      // and put the copy in the slot they left
+      int distance = chunk->code[offset + 1];
+      static const uint8_t grow[] = {
+          0x48, 0x83, 0xec, 0x08, // sub rsp, 8
+      };
+      emitAll(as, grow, sizeof(grow));
+      for (int i = 0; i < distance; i++) {
+        emitStackMove(as, 0x8b, 8 * (i + 1));
+        emitStackMove(as, 0x89, 8 * i);
+      }
+      emitStackMove(as, 0x8b, 0);
+      emitStackMove(as, 0x89, 8 * distance);
+      ValueType top = as->types[as->typeCount - 1];
+      pushType(as, top);
+      ValueType *slot = &as->types[as->typeCount - 1 - distance];
+      memmove(slot + 1, slot, distance * sizeof(ValueType));
+      *slot = top;
+      offset += 2;
+      break;
+    }
+    case OP_GET_GLOBAL:
+      if (!emitGlobal(as, chunk->code[offset + 1] |
+                              (chunk->code[offset + 2] << 8)))
+        return false;
+      offset += 3;
+      break;
+    case OP_ADD:
+    case OP_ADD_NUMBER:
+    case OP_ADD_UNCHECKED:
+    case OP_ADD_INT:
+      emitBinary(as, 0x58, OP_ADD_INT);
+      offset++;
+      break;
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_NUMBER:
+    case OP_SUBTRACT_UNCHECKED:
+    case OP_SUBTRACT_INT:
+      emitBinary(as, 0x5c, OP_SUBTRACT_INT);
+      offset++;
+      break;
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_NUMBER:
+    case OP_MULTIPLY_UNCHECKED:
+    case OP_MULTIPLY_INT:
+      emitBinary(as, 0x59, OP_MULTIPLY_INT);
+      offset++;
+      break;
+    case OP_DIVIDE:
+    case OP_DIVIDE_NUMBER:
+    case OP_DIVIDE_UNCHECKED:
+      emitBinary(as, 0x5e, 0);
+      offset++;
+      break;
+    case OP_NEGATE:
+    case OP_NEGATE_NUMBER:
+    case OP_NEGATE_UNCHECKED:
+    case OP_NEGATE_INT:
+      if (as->types[as->typeCount - 1] == VAL_INT) {
+        // neg qword [rsp]. Only the smallest integer overflows, and its
+        // negation is a double the interpreter works out
+        static const uint8_t negate[] = {0x48, 0xf7, 0x1c, 0x24};
+        emitAll(as, negate, sizeof(negate));
+        emitBailJump(as, OVERFLOW);
+      } else {
+        // flip the sign bit of the double on top of the stack. This is
+        // exactly what C's unary minus does too
+        static const uint8_t negate[] = {
+            0x80, 0x74, 0x24, 0x07, 0x80, // xor byte [rsp + 7], 0x80
+        };
+        emitAll(as, negate, sizeof(negate));
+      }
+      offset++;
+      break;
+    // the two intrinsics that are a single instruction, and exact, so they
+    // give the bits libm does. The ones that would have to call into libm
+    // leave the chunk to the interpreter
+    case OP_SQRT: {
+      emitLoadDouble(as, popType(as), 0);
+      static const uint8_t squareRoot[] = {
+          0xf2, 0x0f, 0x51, 0xc0,       // sqrtsd xmm0, xmm0
+          0xf2, 0x0f, 0x11, 0x04, 0x24, // movsd [rsp], xmm0
+      };
+      emitAll(as, squareRoot, sizeof(squareRoot));
+      pushType(as, VAL_NUMBER);
+      offset++;
+      break;
+    }
+    case OP_ABS: {
+      if (as->types[as->typeCount - 1] == VAL_INT) {
+        emitLoadDouble(as, VAL_INT, 0);
+        static const uint8_t store[] = {
+            0xf2, 0x0f, 0x11, 0x04, 0x24, // movsd [rsp], xmm0
+        };
+        emitAll(as, store, sizeof(store));
+        as->types[as->typeCount - 1] = VAL_NUMBER;
+      }
+      // clear the sign bit, which is all fabs() does
+      static const uint8_t clear[] = {
+          0x80, 0x64, 0x24, 0x07, 0x7f, // and byte [rsp + 7], 0x7f
+      };
+      emitAll(as, clear, sizeof(clear));
+      offset++;
+      break;
+    }
+    case OP_RETURN: {
+      static const uint8_t load[] = {
+          0x48, 0x8b, 0x04, 0x24, // mov rax, [rsp]
+          0x48, 0x89, 0x47,       // mov [rdi + offsetof(as)], rax
+      };
+      emitAll(as, load, sizeof(load));
+      emit(as, (uint8_t)offsetof(Value, as));
+      // mov dword [rdi + offsetof(type)], type
+      emit(as, 0xc7);
+      emit(as, 0x47);
+      emit(as, (uint8_t)offsetof(Value, type));
+      emitImmediate(as, as->types[as->typeCount - 1], 4);
+      static const uint8_t ret[] = {
+          0xb8, 0x01, 0x00, 0x00, 0x00, // mov eax, 1
+          0xc9,                         // leave
+          0xc3,                         // ret
+      };
+      emitAll(as, ret, sizeof(ret));
+      offset++;
+      break;
+    }
+    default:
+      // an instruction we don't have a template for
+      return false;
+    }
+  }
+
+  // every guard jumps here. leave also throws away whatever the code had
+  // pushed onto the machine stack so far
+  int bail = as->count;
+  static const uint8_t epilogue[] = {
+      0x31, 0xc0, // xor eax, eax
+      0xc9,       // leave
+      0xc3,       // ret
+  };
+  emitAll(as, epilogue, sizeof(epilogue));
+
+  for (int i = 0; i < as->patchCount; i++) {
+    int at = as->patches[i];
+    // rel32 is relative to the end of the jump instruction, which is where the
+    // 4 byte operand ends
+    int32_t rel = bail - (at + 4);
+    memcpy(&as->code[at], &rel, sizeof(rel));
+  }
+  return true;
+}
+
+// perf looks for /tmp/perf-<pid>.map to find names for addresses that aren't
+// part of any binary or shared library. Each line is "start size name" in hex
+static void writePerfMap(JitCode *jit) {
+  static FILE *perfMap = NULL;
+  static int functionCount = 0;
+  if (perfMap == NULL) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    perfMap = fopen(path, "a");
+    if (perfMap == NULL)
+      return;
+  }
+  fprintf(perfMap, "%lx %zx clox_jit_chunk_%d\n", (unsigned long)jit->memory,
+          jit->size, functionCount++);
+  fflush(perfMap);
+}
+
+static void install(JitCode *jit, Assembler *as) {
+  long pageSize = sysconf(_SC_PAGESIZE);
+  size_t size = ((size_t)as->count + pageSize - 1) / pageSize * pageSize;
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    return;
+  memcpy(memory, as->code, as->count);
+  // never writable and executable at the same time
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return;
+  }
+
+  jit->memory = memory;
+  jit->size = size;
+  jit->entry = (JitFn)memory;
+  writePerfMap(jit);
+}
+
+JitCode *compileJit(Chunk *chunk) {
+  if (chunk->jit != NULL)
+    return chunk->jit;
+
+  JitCode *jit = GROW_ARRAY(JitCode, NULL, 0, 1);
+  jit->entry = NULL;
+  jit->memory = NULL;
+  jit->size = 0;
+  chunk->jit = jit;
+
+  Assembler as = {0};
+  if (translate(chunk, &as)) {
+    install(jit, &as);
+  }
+  FREE_ARRAY(uint8_t, as.code, as.capacity);
+  FREE_ARRAY(int, as.patches, as.patchCapacity);
+  FREE_ARRAY(ValueType, as.types, as.typeCapacity);
+  return jit;
+}
+
+void freeJit(JitCode *jit) {
+  if (jit == NULL)
+    return;
+  if (jit->memory != NULL) {
+    munmap(jit->memory, jit->size);
+  }
+  FREE_ARRAY(JitCode, jit, 1);
+}
+
+#else
+
+// there is only an x86-64 backend. Everywhere else every chunk is interpreted
+JitCode *compileJit(Chunk *chunk) {
+  if (chunk->jit == NULL) {
+    chunk->jit = GROW_ARRAY(JitCode, NULL, 0, 1);
+    chunk->jit->entry = NULL;
+    chunk->jit->memory = NULL;
+    chunk->jit->size = 0;
+  }
+  return chunk->jit;
+}
+
+void freeJit(JitCode *jit) {
+  if (jit != NULL) {
+    FREE_ARRAY(JitCode, jit, 1);
+  }
+}
+
+#endif
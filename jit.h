@@ -0,0 +1,34 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+// a baseline "template" JIT: every bytecode instruction is replaced by a fixed
+// snippet of x86-64 machine code, one after another, so the dispatch loop in
+// run() disappears completely. It only knows about the instructions that make
+// up our arithmetic expressions, and reads of global variables. Anything else
+// makes the translation fail and the chunk is simply interpreted by run()
+// instead
+
+// the translated code returns true and stores the result in *result, or
+// returns false if one of its type guards failed. In that case nothing has
+// happened yet that anyone could notice, so the VM just runs the chunk again
+// in the interpreter which takes care of reporting the error
+typedef bool (*JitFn)(Value *result);
+
+typedef struct JitCode {
+  // NULL if the chunk could not be translated
+  JitFn entry;
+  // the mmap'd block of executable memory holding the code
+  void *memory;
+  size_t size;
+} JitCode;
+
+// translate the chunk and remember the result in chunk->jit so that running
+// the same chunk again doesn't translate it again
+JitCode *compileJit(Chunk *chunk);
+void freeJit(JitCode *jit);
+
+#endif
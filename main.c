@@ -1,9 +1,34 @@
+#include "chunk.h"
 #include "common.h"
+#include "compiler.h"
+#include "debug.h"
+#include "emitc.h"
+#include "optimize.h"
+#include "output.h"
+#include "phases.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "rows.h"
+#include "server.h"
+#include "stats.h"
 #include "vm.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static void repl() {
+// for --time-phases: interpret() with the phase times written to stderr after
+// the result, read being how long the source took to get
+static InterpretResult interpretReporting(const char *source, uint64_t read) {
+  PhaseTimes times;
+  InterpretResult result = interpretTimed(source, &times);
+  times.read = read;
+  flushOutput();
+  writePhaseTimes(&times, stderr);
+  return result;
+}
+
+static void repl(bool timed) {
   char line[1024];
   for (;;) {
     printf("> ");
@@ -13,7 +38,14 @@ static void repl() {
       break;
     }
 
-    interpret(line);
+    // the time spent waiting for the line to be typed isn't worth reporting
+    if (timed) {
+      interpretReporting(line, 0);
+    } else {
+      interpret(line);
+    }
+    // show the result before the next prompt
+    flushOutput();
   }
 }
 
@@ -52,9 +84,12 @@ static char *readFile(const char *path) {
   return buffer;
 }
 
-static void runFile(const char *path) {
+static void runFile(const char *path, bool timed) {
+  uint64_t start = phaseClock();
   char *source = readFile(path);
-  InterpretResult result = interpret(source);
+  uint64_t read = phaseClock() - start;
+  InterpretResult result =
+      timed ? interpretReporting(source, read) : interpret(source);
   free(source);
 
   if (result == INTERPRET_COMPILE_ERROR)
@@ -63,16 +98,230 @@ static void runFile(const char *path) {
     exit(70);
 }
 
+// run the script under the sampling profiler. The flat profile goes to stderr
+// and the folded stacks to clox.folded, ready for flamegraph.pl
+static void profileFile(const char *path) {
+  char *source = readFile(path);
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk)) {
+    exit(65);
+  }
+
+  // the profiler samples vm.ip, which doesn't move while JIT'd code runs
+  vm.useJit = false;
+  startProfiler(&chunk);
+  Value value;
+  InterpretResult result = interpretChunk(&chunk, &value);
+  stopProfiler();
+  if (result == INTERPRET_OK) {
+    writeValue(value);
+    writeOutput("\n", 1);
+  }
+
+  writeFlatProfile(stderr);
+  FILE *folded = fopen("clox.folded", "w");
+  if (folded == NULL) {
+    fprintf(stderr, "Could not open file \"clox.folded\".\n");
+  } else {
+    writeFoldedProfile(folded, path);
+    fclose(folded);
+  }
+
+  freeProfiler();
+  freeChunk(&chunk);
+  free(source);
+  if (result == INTERPRET_COMPILE_ERROR)
+    exit(65);
+  if (result == INTERPRET_RUNTIME_ERROR)
+    exit(70);
+}
+
+// compile the script and print it as a C function instead of running it
+// the function is named after the script, so rules.lox becomes clox_rules()
+static void emitFile(const char *path) {
+  char *source = readFile(path);
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk)) {
+    exit(65);
+  }
+
+  char name[256] = "clox_";
+  const char *base = strrchr(path, '/');
+  base = base == NULL ? path : base + 1;
+  size_t length = strlen(name);
+  for (; *base != '\0' && *base != '.' && length < sizeof(name) - 1; base++) {
+    name[length++] = isalnum((unsigned char)*base) ? *base : '_';
+  }
+  name[length] = '\0';
+
+  bool emitted = emitC(&chunk, name, stdout);
+  freeChunk(&chunk);
+  free(source);
+  if (!emitted)
+    exit(65);
+}
+
+// compile the script and write out its bytecode for analysis tools (see
+// exportChunk() in debug.h) instead of running it
+static void exportFile(const char *path, ExportFormat format) {
+  char *source = readFile(path);
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk)) {
+    exit(65);
+  }
+  exportChunk(&chunk, format, stdout);
+  freeChunk(&chunk);
+  free(source);
+}
+
+// run the script over every row of the input instead of once (see rows.h)
+static int rowsFile(const char *path, const char *input,
+                    const RowOptions *options) {
+  char *source = readFile(path);
+  int status = runRows(source, input, options);
+  free(source);
+  return status;
+}
+
+#ifdef DEBUG_STATS
+static void reportStats() { writeStats(stderr); }
+static void reportStatsJson() { writeStatsJson(stderr); }
+#endif
+
+static void usage() {
+  fprintf(stderr, "Usage: clox [--jit] [path]\n"
+                  "       clox --emit-c path\n"
+                  "       clox --profile path\n"
+                  "       clox --serve socket\n"
+                  "       clox --export=json|bin path\n"
+                  "       clox --rows=csv|f64 [--columns=a,b]"
+                  " [--threads=n] path [input]\n"
+                  "options: --jit, --no-algebra, --fast-math, --no-cse,\n"
+                  "         --pipeline, --time-phases,\n"
+                  "         --stats, --stats=json\n");
+  exit(64);
+}
+
 int main(int argc, const char *argv[]) {
   initVM();
-  if (argc == 1) {
-    repl();
-  } else if (argc == 2) {
-    runFile(argv[1]);
-  } else {
-    fprintf(stderr, "Usage: clox [path]\n");
+  // results are buffered (see output.h). This makes sure they get out on
+  // every way the process can end, including exit() after an error
+  atexit(flushOutput);
+
+  // options come first and start with "--". Whatever is left is the script
+  const char *path = NULL;
+  bool toC = false;
+  bool profile = false;
+  // for --serve, the path is the socket to listen on instead of a script
+  bool server = false;
+  // -1 unless --export asked for one of the ExportFormats
+  int export = -1;
+  // 0 for no report, 1 for the text one, 2 for JSON
+  int stats = 0;
+  bool timed = false;
+  // for --rows, the format, and where the rows come from. stdin unless there
+  // is a second path
+  int rows = -1;
+  const char *input = NULL;
+  RowOptions rowOptions = {ROWS_CSV, NULL, 0};
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--jit") == 0) {
+      vm.useJit = true;
+    } else if (strcmp(argv[i], "--emit-c") == 0) {
+      toC = true;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      profile = true;
+    } else if (strcmp(argv[i], "--serve") == 0) {
+      server = true;
+    } else if (strcmp(argv[i], "--export=json") == 0) {
+      export = EXPORT_JSON;
+    } else if (strcmp(argv[i], "--export=bin") == 0) {
+      export = EXPORT_BINARY;
+    } else if (strcmp(argv[i], "--no-algebra") == 0) {
+      optimizeOptions.algebra = false;
+    } else if (strcmp(argv[i], "--fast-math") == 0) {
+      optimizeOptions.fastMath = true;
+    } else if (strcmp(argv[i], "--no-cse") == 0) {
+      optimizeOptions.cse = false;
+    } else if (strcmp(argv[i], "--pipeline") == 0) {
+      pipelineCompile = true;
+    } else if (strcmp(argv[i], "--time-phases") == 0) {
+      timed = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = 1;
+    } else if (strcmp(argv[i], "--stats=json") == 0) {
+      stats = 2;
+    } else if (strcmp(argv[i], "--rows=csv") == 0) {
+      rows = ROWS_CSV;
+    } else if (strcmp(argv[i], "--rows=f64") == 0) {
+      rows = ROWS_F64;
+    } else if (strncmp(argv[i], "--columns=", 10) == 0) {
+      rowOptions.columns = argv[i] + 10;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      rowOptions.threads = atoi(argv[i] + 10);
+      if (rowOptions.threads < 1)
+        usage();
+    } else if (strncmp(argv[i], "--", 2) == 0) {
+      usage();
+    } else if (path != NULL && rows != -1 && input == NULL) {
+      input = argv[i];
+    } else if (path != NULL) {
+      usage();
+    } else {
+      path = argv[i];
+    }
+  }
+
+#ifdef DEBUG_STATS
+  // the report is written at exit so that it also covers runs that end the
+  // process with an error
+  if (stats == 1) {
+    atexit(reportStats);
+  } else if (stats == 2) {
+    atexit(reportStatsJson);
+  }
+#else
+  if (stats != 0) {
+    fprintf(stderr, "--stats needs a build with DEBUG_STATS "
+                    "(make clox-stats).\n");
     exit(64);
   }
+#endif
+
+  if (toC) {
+    if (path == NULL)
+      usage();
+    emitFile(path);
+  } else if (export != -1) {
+    if (path == NULL)
+      usage();
+    exportFile(path, (ExportFormat)export);
+  } else if (profile) {
+    if (path == NULL)
+      usage();
+    profileFile(path);
+  } else if (rows != -1) {
+    // raw doubles don't say what the columns are called
+    if (path == NULL || (rows == ROWS_F64 && rowOptions.columns == NULL))
+      usage();
+    rowOptions.format = (RowFormat)rows;
+    int status = rowsFile(path, input, &rowOptions);
+    freeVM();
+    return status;
+  } else if (server) {
+    if (path == NULL)
+      usage();
+    int status = serve(path);
+    freeVM();
+    return status;
+  } else if (path == NULL) {
+    repl(timed);
+  } else {
+    runFile(path, timed);
+  }
 
   freeVM();
   return 0;
@@ -0,0 +1,149 @@
+#include "memo.h"
+#include "chunk.h"
+#include "memory.h"
+#include "verify.h"
+#include "vm.h"
+#include <string.h>
+
+MemoOptions memoOptions = {false, 256, 1 << 20};
+_Thread_local MemoStats memoStats;
+
+// a value as 64 bits that are the same exactly when the values are. Numbers
+// go by their bits, so 0 and -0 are different inputs, as they have to be
+// (1 / x tells them apart), and a nan is the same input as itself
+static uint64_t inputBits(Value value) {
+  switch (value.type) {
+  case VAL_NUMBER: {
+    uint64_t bits;
+    memcpy(&bits, &value.as.number, sizeof(bits));
+    return bits;
+  }
+  case VAL_BOOL:
+    return value.as.boolean;
+  case VAL_OBJ:
+    return (uint64_t)(uintptr_t)value.as.obj;
+  case VAL_NIL:
+  case VAL_INT:
+    // a nil's payload tells an undefined global from nil (see vm.c)
+    return (uint64_t)value.as.integer;
+  }
+  return 0;
+}
+
+static size_t tableSize(int capacity, int inputCount) {
+  return sizeof(Value) * capacity * (1 + inputCount) + sizeof(bool) * capacity;
+}
+
+// the globals chunk reads, from its OP_GET_GLOBALs, and a table for them
+static Memo *newMemo(Chunk *chunk) {
+  Memo *memo = (Memo *)reallocate(NULL, 0, sizeof(Memo));
+  memo->inputCount = 0;
+  memo->capacity = 0;
+  memo->entries = NULL;
+  memo->filled = NULL;
+
+  for (int offset = 0; offset < chunk->count;
+       offset += instructionLength(chunk->code[offset])) {
+    if (chunk->code[offset] != OP_GET_GLOBAL)
+      continue;
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] |
+                               (chunk->code[offset + 2] << 8));
+    bool seen = false;
+    for (int i = 0; i < memo->inputCount; i++) {
+      seen |= memo->inputs[i] == slot;
+    }
+    if (seen)
+      continue;
+    if (memo->inputCount == MEMO_MAX_INPUTS)
+      return memo;
+    memo->inputs[memo->inputCount++] = slot;
+  }
+
+  // with no inputs there is only ever one result
+  int capacity = memo->inputCount == 0 ? 1 : memoOptions.entries;
+  size_t size = tableSize(capacity, memo->inputCount);
+  if (memoStats.bytes + size > memoOptions.maxBytes)
+    return memo;
+  memo->capacity = capacity;
+  memo->entries =
+      GROW_ARRAY(Value, NULL, 0, capacity * (1 + memo->inputCount));
+  memo->filled = GROW_ARRAY(bool, NULL, 0, capacity);
+  memset(memo->filled, 0, sizeof(bool) * capacity);
+  memoStats.bytes += size;
+  return memo;
+}
+
+// the splitmix64 finalizer. Every bit of the result depends on every bit of
+// x, which matters here: the numbers people use, like 12.5, have nothing but
+// zeros in the low bits of the mantissa
+static uint64_t mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// the entry for the inputs as they are now
+static Value *findEntry(Memo *memo, int *index) {
+  uint64_t hash = 0;
+  for (int i = 0; i < memo->inputCount; i++) {
+    Value input = vm.globals.values[memo->inputs[i]];
+    hash = mix(hash ^ mix(inputBits(input) + input.type));
+  }
+  *index = (int)(hash & (uint64_t)(memo->capacity - 1));
+  return &memo->entries[(size_t)*index * (1 + memo->inputCount)];
+}
+
+bool memoLookup(Chunk *chunk, Value *result) {
+  if (chunk->memo == NULL) {
+    chunk->memo = newMemo(chunk);
+  }
+  Memo *memo = chunk->memo;
+  if (memo->capacity == 0)
+    return false;
+
+  int index;
+  Value *entry = findEntry(memo, &index);
+  if (memo->filled[index]) {
+    bool same = true;
+    for (int i = 0; i < memo->inputCount && same; i++) {
+      Value input = vm.globals.values[memo->inputs[i]];
+      same = entry[1 + i].type == input.type &&
+             inputBits(entry[1 + i]) == inputBits(input);
+    }
+    if (same) {
+      memoStats.hits++;
+      *result = entry[0];
+      return true;
+    }
+  }
+  memoStats.misses++;
+  return false;
+}
+
+void memoStore(Chunk *chunk, Value result) {
+  Memo *memo = chunk->memo;
+  if (memo == NULL || memo->capacity == 0)
+    return;
+
+  int index;
+  Value *entry = findEntry(memo, &index);
+  if (memo->filled[index]) {
+    memoStats.evictions++;
+  }
+  memo->filled[index] = true;
+  entry[0] = result;
+  for (int i = 0; i < memo->inputCount; i++) {
+    entry[1 + i] = vm.globals.values[memo->inputs[i]];
+  }
+}
+
+void freeMemo(Memo *memo) {
+  if (memo == NULL)
+    return;
+  if (memo->capacity > 0) {
+    FREE_ARRAY(Value, memo->entries, memo->capacity * (1 + memo->inputCount));
+    FREE_ARRAY(bool, memo->filled, memo->capacity);
+    memoStats.bytes -= tableSize(memo->capacity, memo->inputCount);
+  }
+  reallocate(memo, sizeof(Memo), 0);
+}
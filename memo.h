@@ -0,0 +1,75 @@
+#ifndef clox_memo_h
+#define clox_memo_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+// result memoization for chunks that are run over and over, like a rule an
+// embedder evaluates for every record. A chunk the compiler marked pure (see
+// Chunk.pure) can't change anything; all it does is compute a value out of
+// its constants and the globals it reads. So once it has run for a set of
+// values of those globals, running it for the same ones again gives the same
+// value, and interpretChunk() can hand that back without running anything
+//
+// each chunk gets a table of its own, made the first time it runs with
+// memoOptions.enabled, so a chunk's identity is part of the key without
+// being stored anywhere and freeChunk() throws its results away with it.
+// The table is direct-mapped: an entry is picked by the hash of the inputs,
+// and a new result takes the place of whatever was there. Only runs that
+// succeed are stored, so a run that fails fails again and reports its error
+
+// the most globals a chunk can read and still be memoized. Comparing more
+// inputs than this costs about as much as running the chunk
+#define MEMO_MAX_INPUTS 16
+
+typedef struct {
+  // off by default. Nothing is looked up or stored while it is off
+  bool enabled;
+  // entries in each chunk's table, a power of two
+  int entries;
+  // the most memory the tables of one thread's chunks can take together. A
+  // chunk whose table doesn't fit any more isn't memoized
+  size_t maxBytes;
+} MemoOptions;
+
+// shared by all threads, so it has to be set before any of them runs a chunk
+extern MemoOptions memoOptions;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  // results that took the place of another one
+  uint64_t evictions;
+  // what the tables take right now
+  size_t bytes;
+} MemoStats;
+
+// each thread has its own, like it has its own VM and its own copy of the
+// chunks it runs (see rows.h), so the counts and the bytes checked against
+// memoOptions.maxBytes are the ones of this thread's tables
+extern _Thread_local MemoStats memoStats;
+
+typedef struct Memo {
+  // the slots of the globals the chunk reads, each once
+  int inputCount;
+  uint16_t inputs[MEMO_MAX_INPUTS];
+  // a power of two. 0 if the chunk isn't memoized after all: it reads too
+  // many globals, or its table didn't fit under memoOptions.maxBytes
+  int capacity;
+  // capacity entries of 1 + inputCount values each: the result, then the
+  // inputs it is the result for
+  Value *entries;
+  // which entries hold a result
+  bool *filled;
+} Memo;
+
+// the stored result of running chunk with its inputs as they are now, in
+// *result. Returns false if there isn't one
+bool memoLookup(Chunk *chunk, Value *result);
+// remembers result as what running chunk with its inputs as they are now
+// gives
+void memoStore(Chunk *chunk, Value result);
+void freeMemo(Memo *memo);
+
+#endif
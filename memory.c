@@ -1,7 +1,18 @@
 #include "memory.h"
 #include <stdlib.h>
 
+_Thread_local size_t bytesAllocated = 0;
+_Thread_local size_t peakBytesAllocated = 0;
+_Thread_local size_t allocationCount = 0;
+
 void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
+  // this relies on every caller passing the real old size, which the
+  // GROW_ARRAY and FREE_ARRAY macros do
+  bytesAllocated += newSize - oldSize;
+  if (bytesAllocated > peakBytesAllocated) {
+    peakBytesAllocated = bytesAllocated;
+  }
+
   // cases to handle:
 
   // oldSize, newSize, operation
@@ -16,6 +27,7 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
     return NULL;
   }
 
+  allocationCount++;
   // realloc conveniently supports the other three aspects of our policy
   // when oldSize is zero, realloc is equivalent to malloc
   void *result = realloc(pointer, newSize);
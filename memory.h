@@ -18,4 +18,14 @@
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
 
+// how many bytes are allocated through reallocate() right now, and the most
+// there have ever been at once. The benchmarks use them to measure memory.
+// Each thread counts its own, so they are only exact for memory a thread
+// frees itself
+extern _Thread_local size_t bytesAllocated;
+extern _Thread_local size_t peakBytesAllocated;
+// how many times reallocate() has been asked for a block or for a new size,
+// everything but frees. Each one is a call into malloc, and often a copy
+extern _Thread_local size_t allocationCount;
+
 #endif
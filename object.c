@@ -0,0 +1,94 @@
+#include "object.h"
+#include "memory.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+#include <stdio.h>
+#include <string.h>
+
+// the size of a string's allocation: the header, the characters and the '\0'
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
+// FNV-1a. Its state is the hash itself, so hashing more characters can carry
+// on from the hash of the ones before
+static uint32_t hashMore(uint32_t hash, const char *chars, int length) {
+  for (int i = 0; i < length; i++) {
+    hash ^= (uint8_t)chars[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+#define HASH_START 2166136261u
+
+// a new string of length characters, which the caller fills in. It goes on
+// the VM's list of objects but isn't interned yet
+static ObjString *allocateString(int length) {
+  ObjString *string =
+      (ObjString *)reallocate(NULL, 0, STRING_SIZE(length));
+  string->obj.type = OBJ_STRING;
+  string->obj.next = vm.objects;
+  vm.objects = (Obj *)string;
+  string->length = length;
+  string->chars[length] = '\0';
+  return string;
+}
+
+static ObjString *intern(ObjString *string) {
+  // the value isn't used, the table is only a set of strings
+  tableSet(&vm.strings, string, NIL_VAL);
+  return string;
+}
+
+ObjString *copyString(const char *chars, int length) {
+  uint32_t hash = hashMore(HASH_START, chars, length);
+  ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+  if (interned != NULL)
+    return interned;
+
+  ObjString *string = allocateString(length);
+  memcpy(string->chars, chars, length);
+  string->hash = hash;
+  return intern(string);
+}
+
+ObjString *concatenateStrings(ObjString *a, ObjString *b) {
+  int length = a->length + b->length;
+  ObjString *string = allocateString(length);
+  memcpy(string->chars, a->chars, a->length);
+  memcpy(string->chars + a->length, b->chars, b->length);
+  // the hash of a is where hashing the whole string would be after a
+  string->hash = hashMore(a->hash, b->chars, b->length);
+
+  ObjString *interned =
+      tableFindString(&vm.strings, string->chars, length, string->hash);
+  if (interned == NULL)
+    return intern(string);
+  // it was just put at the head of the list, so taking it back off is easy
+  vm.objects = string->obj.next;
+  reallocate(string, STRING_SIZE(length), 0);
+  return interned;
+}
+
+static void freeObject(Obj *object) {
+  switch (object->type) {
+  case OBJ_STRING: {
+    ObjString *string = (ObjString *)object;
+    reallocate(object, STRING_SIZE(string->length), 0);
+    break;
+  }
+  }
+}
+
+void freeObjects() {
+  Obj *object = vm.objects;
+  while (object != NULL) {
+    Obj *next = object->next;
+    freeObject(object);
+    object = next;
+  }
+  vm.objects = NULL;
+  // the interned strings were all on the list, so the table only has dangling
+  // pointers left
+  freeTable(&vm.strings);
+}
@@ -0,0 +1,59 @@
+#ifndef clox_object_h
+#define clox_object_h
+
+#include "common.h"
+#include "value.h"
+
+// values that are too big to fit in a Value live on the heap, and the Value
+// only holds a pointer to them. Every kind of heap object starts with an Obj,
+// so a pointer to any of them can be cast to an Obj* and back (C lays out the
+// first field of a struct at the struct's own address)
+
+#define OBJ_TYPE(value) (AS_OBJ(value)->type)
+
+#define IS_STRING(value) isObjType(value, OBJ_STRING)
+
+#define AS_STRING(value) ((ObjString *)AS_OBJ(value))
+#define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+
+typedef enum {
+  OBJ_STRING,
+} ObjType;
+
+struct Obj {
+  ObjType type;
+  // every object is on the VM's list, so freeObjects() can find them all
+  struct Obj *next;
+};
+
+// strings are interned: the VM keeps exactly one ObjString per distinct
+// sequence of characters (see vm.strings), so two strings are equal if and
+// only if they are the same object. Comparing them is a pointer compare, no
+// matter how long they are
+// the characters are in the same allocation as the header, right behind it,
+// with a '\0' after them so they can be handed to C functions as they are
+struct ObjString {
+  Obj obj;
+  int length;
+  // computed once when the string is made. The intern table and every
+  // Table lookup use it instead of hashing the characters again
+  uint32_t hash;
+  char chars[];
+};
+
+// the interned string with these characters, made if there isn't one yet
+ObjString *copyString(const char *chars, int length);
+// the interned string a followed by b
+ObjString *concatenateStrings(ObjString *a, ObjString *b);
+// frees every object there is, and with them the interned strings. There is
+// no garbage collector, so objects live until this is called: by freeVM(),
+// and by the server after each request. The names of the globals are strings
+// too, so freeGlobals() has to come first
+void freeObjects();
+
+// a function and not a macro because value is used twice
+static inline bool isObjType(Value value, ObjType type) {
+  return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+#endif
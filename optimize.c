@@ -0,0 +1,1210 @@
+#include "optimize.h"
+#include "memory.h"
+#include "object.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+OptimizeOptions optimizeOptions = {true, false, true};
+
+void optimizeIr(Ir *ir) {
+  // simplifying first leaves CSE fewer nodes to hash, and can turn subtrees
+  // that were written differently into the same one
+  if (optimizeOptions.algebra) {
+    simplifyAlgebra(ir);
+  }
+  if (optimizeOptions.cse) {
+    eliminateCommonSubexpressions(ir);
+  }
+}
+
+// algebraic simplification
+//
+// a rewrite is only safe if the new code gives the same bits as the old one
+// for every operand, which is a lot stricter than the algebra from school:
+//  - x * 1, 1 * x, x / 1 and x - 0 are x. Multiplying by one and dividing
+//    by one round to x itself, nan included, and -0 - 0 is still -0
+//  - -(-x) is x. Negation only flips the sign bit, so twice puts it back,
+//    nan included
+//  - x / c is x * (1 / c) if c is a power of two whose reciprocal is also a
+//    normal number. 1 / c is then exact, and both compute the same real
+//    number and round it the same way, even when the result is subnormal.
+//    A multiply is a lot cheaper than a divide, in the VM and even more so in
+//    the code the JIT and clox --emit-c produce
+//
+// it also has to give the same kind of number. 2.5 * 1.0 is 2.5, but 2 * 1.0
+// is the double 2 and not the integer. So each subtree's type is tracked
+// the way the compiler does it, and x * 1.0, x / 1 and x - 0.0 are only
+// rewritten when x is known to be a double. x * 1 and x - 0 with integer
+// literals are fine either way. -(-x) is only rewritten for doubles and
+// literals, the integer -2^63 has no negative and turns into a double
+//
+// the ones that aren't exact only happen with optimizeOptions.fastMath:
+//  - x + 0 and 0 + x are x, except -0 + 0 is 0
+//  - x * 0 and 0 * x are 0, except for -0 when x is negative and nan when
+//    it's infinite or nan
+//  - 0 - x is -x, except 0 - 0 is 0
+//  - x * -1, -1 * x and x / -1 are -x, x - -y is x + y, x + -y is x - y and
+//    -x * -y and -x / -y are x * y and x / y. Those are the same numbers,
+//    but when one of the operands is nan, the sign of the nan the CPU hands
+//    back depends on the order, and clox prints it
+//  - x / c is x * (1 / c) for any c whose reciprocal is finite, which can be
+//    off by a rounding
+// these may change the value, but never whether it's a double or an integer
+//
+// none of this holds for values that aren't numbers. "a" + 0 is a runtime
+// error and not "a", so an operand that might be a string or a bool is never
+// dropped or rewritten. And x * 0 only drops x if nothing in it can fail
+//
+// nothing is moved, a rewrite only turns nodes into NODE_DEAD or into other
+// operators in place
+
+// what kind of number a subtree gives, like StaticType in compiler.c
+typedef enum {
+  // an integer, or a double if the integer arithmetic overflowed
+  TERM_EITHER,
+  TERM_DOUBLE,
+  TERM_INTEGER,
+  // maybe not a number at all: a string, a bool, or + of strings
+  TERM_ANY,
+} TermType;
+
+// one subtree on the walk's stack, like the operands in the CSE walk below
+typedef struct {
+  // its first and last node
+  int start;
+  int root;
+  TermType type;
+  // if root is a NODE_NEGATE, the last node of its operand and its type.
+  // Otherwise inner is -1
+  int inner;
+  TermType innerType;
+} Term;
+
+// how many reciprocals the pass remembers, see setReciprocal()
+#define RECIPROCALS 16
+
+typedef struct {
+  Ir *ir;
+  Term *stack;
+  int stackCount;
+  int stackCapacity;
+  // where in Ir.numbers the reciprocals added last are, -1 for none
+  double reciprocals[RECIPROCALS];
+  int reciprocalIndexes[RECIPROCALS];
+} Simplifier;
+
+static Simplifier simplifier;
+
+static Node *termNode(Term term) { return &simplifier.ir->nodes[term.root]; }
+
+static bool isLiteral(Node node) {
+  return node.kind == NODE_NUMBER || node.kind == NODE_INTEGER ||
+         node.kind == NODE_LONG_INTEGER;
+}
+
+static bool isDouble(Term term) { return term.type == TERM_DOUBLE; }
+
+static bool isNumeric(Term term) { return term.type != TERM_ANY; }
+
+static bool isIntegerLiteral(Term term) {
+  Node node = *termNode(term);
+  return node.kind == NODE_INTEGER || node.kind == NODE_LONG_INTEGER;
+}
+
+// whether a term is the literal value, where 0 and -0 are different. The
+// parser only makes literals of positive numbers, -1 is a negated 1
+static bool isValue(Term term, double value) {
+  Node node = *termNode(term);
+  if (!isLiteral(node))
+    return false;
+  double number = numberValue(simplifier.ir, node);
+  return number == value && signbit(number) == signbit(value);
+}
+
+// whether x + c, x - c and x * c have the type of x itself, for a literal c
+// that leaves x alone. They do for integer literals, and for double literals
+// only if x is a double already. x has to be a number either way
+static bool keepsType(Term x, Term literal) {
+  return (isIntegerLiteral(literal) && isNumeric(x)) || isDouble(x);
+}
+
+static bool isNegated(Term term) { return termNode(term)->kind == NODE_NEGATE; }
+
+// the operand of a negation
+static Term negated(Term term) {
+  // a negated negation is simplified away (see simplifyNegate()), so there is
+  // no negation in here to keep track of
+  return (Term){term.start, term.inner, term.innerType, -1, TERM_EITHER};
+}
+
+// whether what the negations left and right negate are numbers. Otherwise
+// dropping the negations changes which error the VM stops with
+static bool bothNumeric(Term left, Term right) {
+  return isNumeric(negated(left)) && isNumeric(negated(right));
+}
+
+static bool isMinusOne(Term term) {
+  return isNegated(term) && isValue(negated(term), 1);
+}
+
+// if the operand isn't a number the VM stops, so whatever comes out is one
+static TermType negateType(TermType operand) {
+  return operand == TERM_DOUBLE ? TERM_DOUBLE : TERM_EITHER;
+}
+
+// only + takes strings, and gives one for two of them
+static TermType binaryType(NodeKind kind, Term left, Term right) {
+  if (kind == NODE_DIVIDE || isDouble(left) || isDouble(right))
+    return TERM_DOUBLE;
+  if (kind == NODE_ADD && (!isNumeric(left) || !isNumeric(right)))
+    return TERM_ANY;
+  return TERM_EITHER;
+}
+
+// whether a subtree is only numbers and arithmetic, which never stops with a
+// runtime error. Anything with a string or a bool in it might
+static bool cannotFail(Term term) {
+  for (int i = term.start; i <= term.root; i++) {
+    switch (simplifier.ir->nodes[i].kind) {
+    case NODE_STRING:
+    case NODE_NOT:
+    case NODE_EQUAL:
+    case NODE_PICK:
+    case NODE_TUCK:
+    case NODE_GET_GLOBAL:
+    case NODE_SET_GLOBAL:
+      return false;
+    default:
+      break;
+    }
+  }
+  return true;
+}
+
+static void killNode(int index) {
+  simplifier.ir->nodes[index].kind = NODE_DEAD;
+}
+
+static void killTerm(Term term) {
+  for (int i = term.start; i <= term.root; i++) {
+    killNode(i);
+  }
+}
+
+// whether x / divisor always gives the same bits as x * (1 / divisor)
+static bool hasExactReciprocal(double divisor) {
+  int exponent;
+  // divisor is mantissa * 2^exponent with the mantissa from 0.5 up to 1, so
+  // a power of two has a mantissa of 0.5. Normal numbers go from 2^-1022 to
+  // just under 2^1024, so for both the number and its reciprocal to be
+  // normal, exponent - 1 has to be between -1022 and 1022
+  double mantissa = frexp(divisor, &exponent);
+  return mantissa == 0.5 && exponent - 1 >= -1022 && exponent - 1 <= 1022;
+}
+
+// makes the node at index the literal reciprocal. The parser adds a number
+// to Ir.numbers for every literal, but doing that here would add a new 0.25
+// for every x / 4 in the expression. Literals can share an entry just as
+// well, so the reciprocals the pass added last are looked up first, by their
+// exponent
+static bool setReciprocal(int index, double reciprocal) {
+  Ir *ir = simplifier.ir;
+  uint64_t bits;
+  memcpy(&bits, &reciprocal, sizeof(bits));
+  int slot = (bits >> 52) & (RECIPROCALS - 1);
+  int cached = simplifier.reciprocalIndexes[slot];
+  if (cached >= 0 && memcmp(&simplifier.reciprocals[slot], &reciprocal,
+                            sizeof(reciprocal)) == 0) {
+    ir->nodes[index].kind = NODE_NUMBER;
+    ir->nodes[index].operand = cached;
+    return true;
+  }
+  if (!setNumberNode(ir, index, reciprocal))
+    return false;
+  simplifier.reciprocals[slot] = reciprocal;
+  simplifier.reciprocalIndexes[slot] = ir->nodes[index].operand;
+  return true;
+}
+
+// turns x / c into x * (1 / c) if that is allowed, where the divisor is
+// either a literal or a negated one. Dividing turns an integer x into a double
+// first, and so does multiplying it by the reciprocal, which is always a
+// double literal
+static bool divideByReciprocal(int index, Term *divisor) {
+  bool negative = isNegated(*divisor);
+  Term literal = negative ? negated(*divisor) : *divisor;
+  Node node = *termNode(literal);
+  if (!isLiteral(node))
+    return false;
+  double value = numberValue(simplifier.ir, node);
+  double reciprocal = 1 / value;
+  bool allowed = hasExactReciprocal(value) ||
+                 (optimizeOptions.fastMath && value != 0 && isfinite(value) &&
+                  isfinite(reciprocal));
+  if (!allowed || !setReciprocal(literal.root, reciprocal))
+    return false;
+  simplifier.ir->nodes[index].kind = NODE_MULTIPLY;
+  divisor->type = TERM_DOUBLE;
+  divisor->innerType = TERM_DOUBLE;
+  return true;
+}
+
+static Term simplifyNegate(int index, Term operand) {
+  if (isNegated(operand) &&
+      (isDouble(operand) || isLiteral(*termNode(negated(operand))))) {
+    killNode(operand.root);
+    killNode(index);
+    return negated(operand);
+  }
+  return (Term){operand.start, index, negateType(operand.type), operand.root,
+                operand.type};
+}
+
+// what's left of a binary node starting at start once all but one of its
+// operands are gone
+static Term keep(int index, int start, Term kept) {
+  killNode(index);
+  kept.start = start;
+  return kept;
+}
+
+// turns the binary node at index into a negation of operand
+static Term toNegate(int index, Term dropped, Term operand) {
+  killTerm(dropped);
+  simplifier.ir->nodes[index].kind = NODE_NEGATE;
+  Term term = simplifyNegate(index, operand);
+  term.start = dropped.start < operand.start ? dropped.start : operand.start;
+  return term;
+}
+
+static Term simplifyBinary(int index, Term left, Term right) {
+  Node *node = &simplifier.ir->nodes[index];
+  bool fastMath = optimizeOptions.fastMath;
+  Term whole = {left.start, index, binaryType(node->kind, left, right), -1,
+                TERM_EITHER};
+
+  switch (node->kind) {
+  case NODE_ADD:
+    if (fastMath && isValue(right, 0) && keepsType(left, right)) {
+      killTerm(right);
+      return keep(index, left.start, left);
+    }
+    if (fastMath && isValue(left, 0) && keepsType(right, left)) {
+      killTerm(left);
+      return keep(index, left.start, right);
+    }
+    if (fastMath && isNegated(right) && isNumeric(left) &&
+        isNumeric(negated(right)) && whole.type == TERM_DOUBLE) {
+      killNode(right.root);
+      node->kind = NODE_SUBTRACT;
+      return simplifyBinary(index, left, negated(right));
+    }
+    break;
+  case NODE_SUBTRACT:
+    if (isValue(right, 0) && keepsType(left, right)) {
+      killTerm(right);
+      return keep(index, left.start, left);
+    }
+    if (fastMath && isValue(left, 0) && keepsType(right, left)) {
+      return toNegate(index, left, right);
+    }
+    if (fastMath && isNegated(right) && isNumeric(left) &&
+        isNumeric(negated(right)) && whole.type == TERM_DOUBLE) {
+      killNode(right.root);
+      node->kind = NODE_ADD;
+      return simplifyBinary(index, left, negated(right));
+    }
+    break;
+  case NODE_MULTIPLY:
+    if (isValue(right, 1) && keepsType(left, right)) {
+      killTerm(right);
+      return keep(index, left.start, left);
+    }
+    if (isValue(left, 1) && keepsType(right, left)) {
+      killTerm(left);
+      return keep(index, left.start, right);
+    }
+    // the zero decides the type: a double zero makes the product a double
+    // anyway, an integer one only an integer if the other one is one too
+    if (fastMath && isValue(right, 0) && cannotFail(left) &&
+        (isDouble(right) || left.type == TERM_INTEGER)) {
+      killTerm(left);
+      return keep(index, left.start, right);
+    }
+    if (fastMath && isValue(left, 0) && cannotFail(right) &&
+        (isDouble(left) || right.type == TERM_INTEGER)) {
+      killTerm(right);
+      return keep(index, left.start, left);
+    }
+    if (fastMath && isMinusOne(right) && keepsType(left, negated(right))) {
+      return toNegate(index, right, left);
+    }
+    if (fastMath && isMinusOne(left) && keepsType(right, negated(left))) {
+      return toNegate(index, left, right);
+    }
+    if (fastMath && isNegated(left) && isNegated(right) &&
+        bothNumeric(left, right) && whole.type == TERM_DOUBLE) {
+      killNode(left.root);
+      killNode(right.root);
+      return simplifyBinary(index, negated(left), negated(right));
+    }
+    break;
+  case NODE_DIVIDE:
+    if (isValue(right, 1) && isDouble(left)) {
+      killTerm(right);
+      return keep(index, left.start, left);
+    }
+    if (divideByReciprocal(index, &right))
+      return simplifyBinary(index, left, right);
+    // x / -1 is a double, like -x only is for a double x
+    if (fastMath && isMinusOne(right) && isDouble(left)) {
+      return toNegate(index, right, left);
+    }
+    if (fastMath && isNegated(left) && isNegated(right) &&
+        bothNumeric(left, right)) {
+      killNode(left.root);
+      killNode(right.root);
+      return simplifyBinary(index, negated(left), negated(right));
+    }
+    break;
+  default:
+    break;
+  }
+  return whole;
+}
+
+void simplifyAlgebra(Ir *ir) {
+  simplifier.ir = ir;
+  simplifier.stackCount = 0;
+  for (int i = 0; i < RECIPROCALS; i++) {
+    simplifier.reciprocalIndexes[i] = -1;
+  }
+  for (int i = 0; i < ir->count; i++) {
+    Node node = ir->nodes[i];
+    Term term = {i, i, TERM_EITHER, -1, TERM_EITHER};
+    switch (node.kind) {
+    case NODE_DEAD:
+      continue;
+    case NODE_NUMBER:
+      term.type = TERM_DOUBLE;
+      break;
+    case NODE_INTEGER:
+    case NODE_LONG_INTEGER:
+      term.type = TERM_INTEGER;
+      break;
+    case NODE_STRING:
+      term.type = TERM_ANY;
+      break;
+    case NODE_NEGATE:
+      term = simplifyNegate(i, simplifier.stack[--simplifier.stackCount]);
+      break;
+    case NODE_NOT:
+      // a bool, and nothing to simplify: !!x is a bool and not x
+      term.start = simplifier.stack[--simplifier.stackCount].start;
+      term.type = TERM_ANY;
+      break;
+    case NODE_ADD:
+    case NODE_SUBTRACT:
+    case NODE_MULTIPLY:
+    case NODE_DIVIDE: {
+      Term right = simplifier.stack[--simplifier.stackCount];
+      Term left = simplifier.stack[--simplifier.stackCount];
+      term = simplifyBinary(i, left, right);
+      break;
+    }
+    case NODE_EQUAL:
+      simplifier.stackCount--;
+      term.start = simplifier.stack[--simplifier.stackCount].start;
+      term.type = TERM_ANY;
+      break;
+    // the intrinsics always give a double, and aren't rewritten
+    case NODE_SQRT:
+    case NODE_ABS:
+    case NODE_FLOOR:
+    case NODE_EXP:
+      term.start = simplifier.stack[--simplifier.stackCount].start;
+      term.type = TERM_DOUBLE;
+      break;
+    case NODE_MIN:
+    case NODE_MAX:
+    case NODE_POW:
+      simplifier.stackCount--;
+      term.start = simplifier.stack[--simplifier.stackCount].start;
+      term.type = TERM_DOUBLE;
+      break;
+    case NODE_PICK:
+      // could be anything, CSE doesn't keep track
+      term.type = TERM_ANY;
+      break;
+    case NODE_TUCK:
+      // the value has to stay as it is for the NODE_PICKs that copy it
+      term.start = simplifier.stack[--simplifier.stackCount].start;
+      term.type = TERM_ANY;
+      break;
+    case NODE_GET_GLOBAL:
+      term.type = TERM_ANY;
+      break;
+    case NODE_SET_GLOBAL:
+      // the value it sets is what it gives, but assignments are left alone
+      term.start = simplifier.stack[--simplifier.stackCount].start;
+      term.type = TERM_ANY;
+      break;
+    case NODE_DEFINE_GLOBAL:
+    case NODE_POP:
+      // the end of a statement, which leaves nothing
+      simplifier.stackCount--;
+      continue;
+    }
+    if (simplifier.stackCapacity < simplifier.stackCount + 1) {
+      int oldCapacity = simplifier.stackCapacity;
+      simplifier.stackCapacity = GROW_CAPACITY(oldCapacity);
+      simplifier.stack = GROW_ARRAY(Term, simplifier.stack, oldCapacity,
+                                    simplifier.stackCapacity);
+    }
+    simplifier.stack[simplifier.stackCount++] = term;
+  }
+  FREE_ARRAY(Term, simplifier.stack, simplifier.stackCapacity);
+  simplifier.stack = NULL;
+  simplifier.stackCapacity = 0;
+}
+
+// common subexpression elimination
+//
+// two subtrees are the same expression if their nodes are the same, one for
+// one. Comparing every subtree with every other one would take forever on big
+// expressions, so each subtree gets a hash made from its operator and the
+// hashes of its operands, and subtrees are told apart by that
+//
+// the pass walks the IR three times:
+//  1. hash every operator node and put the hash in a Bloom filter. A hash
+//     that is already in it goes into a second filter, of hashes that
+//     (probably) occur more than once. Most subtrees in a big expression are
+//     unique, and this way they only cost a few bits each
+//  2. hash everything again and count the hashes that passed the second
+//     filter in a hash table. A false positive just ends up with a count of 1
+//  3. if any subtree occurs often enough, rewrite the IR: the first place
+//     each repeated subtree occurs is followed by a NODE_TUCK that keeps its
+//     value at the bottom of the stack, and every place after that is
+//     replaced by a NODE_PICK
+//
+// the counts only decide what's worth keeping, so two different subtrees with
+// the same hash can only make that decision worse. Before an occurrence is
+// actually replaced, its nodes are compared with the ones of the subtree that
+// was kept, one for one
+//
+// a repeated subtree is still computed where it first occurs, so everything
+// runs in the same order as before, and the first runtime error, like the one
+// "a" - 1 stops with, is still the first. A copy only runs where the original
+// already ran without failing. What can't be shared is something that may
+// give a different value the second time: an assignment, which isPure()
+// rules out, and a read of a global that is assigned in between. Reads are
+// only shared within a statement, and only if the statement assigns no
+// global at all. The NODE_DEFINE_GLOBAL that ends a statement comes after all
+// of its reads, so that one is fine
+
+// one subtree on the walk's stack. The walk goes through the nodes the way the
+// VM would run them, so the operands of a node are the top entries
+typedef struct {
+  uint64_t hash;
+  // the first node of the subtree
+  int start;
+  // where the subtree starts in cse.dest, while copyNodes() copies it
+  int newStart;
+  // whether it can be shared, see isPure()
+  bool pure;
+  // whether it reads a global, which makes it the statement's alone
+  bool global;
+} Operand;
+
+// a subtree that occurs more than once, as far as the filter can tell
+typedef struct {
+  uint64_t hash;
+  // the nodes of the first place it occurs. root is -1 for an empty entry
+  int start;
+  int root;
+  // the statement it first occurs in, and how many values the walk had on
+  // the stack there, counting its own
+  int statement;
+  int depth;
+  // how many places it occurs in. Once it's decided which subtrees are kept,
+  // how many are left of those that aren't
+  int count;
+  // the stack slot it's kept in, or -1 if it isn't
+  int slot;
+  // where its copy is in cse.copies
+  int copyStart;
+  int copyCount;
+} Subtree;
+
+// an operator node whose hash is yet to be looked up in a filter
+typedef struct {
+  uint64_t hash;
+  int start;
+  int root;
+  int statement;
+  int depth;
+} Pending;
+
+#define PENDING_MAX 32
+
+// the most subtrees kept on the stack, see rewrite()
+#define MOVED_MAX 128
+#define MOVED_TABLE 256
+
+typedef struct {
+  Ir *ir;
+  Operand *stack;
+  int stackCount;
+  int stackCapacity;
+  // the statement the walk is in, counted from 0, and which statements
+  // assign a global
+  int statement;
+  bool *assigns;
+  int statementCount;
+  // hashes waiting to be looked up in a filter, see pend()
+  Pending pending[PENDING_MAX];
+  // the two Bloom filters and their sizes in words, see filterBits()
+  uint64_t *seen;
+  size_t seenWords;
+  uint64_t *repeated;
+  size_t repeatedWords;
+  // hash table of the subtrees that made it through the second filter, with
+  // linear probing
+  Subtree *subtrees;
+  int subtreeCount;
+  int subtreeCapacity;
+  // the subtrees rewrite() keeps on the stack, see findMoved(), and the
+  // same in the order they first occur
+  Subtree *moved[MOVED_TABLE];
+  Subtree **order;
+  // a copy of each kept subtree the way every later occurrence of it looks
+  // once the kept subtrees inside it are NODE_PICKs, see findMoved()
+  Ir copies;
+  // where copyNodes() copies to
+  Ir *dest;
+} Cse;
+
+static Cse cse;
+
+// the finalizer of MurmurHash3, which spreads every input bit over the whole
+// hash
+static uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+// the hash of an operator from the hashes of its operands. This runs for
+// every node in a walk, so it's a single multiply. That leaves the low bits
+// of the result poorly mixed, which is why the filters and the table take
+// their bits from the top
+static uint64_t combine(uint64_t kind, uint64_t left, uint64_t right) {
+  return ((left << 23 | left >> 41) ^ right ^ kind) * 0x9e3779b97f4a7c15ull;
+}
+
+// whether a node gives the same value every time it runs, so running it once
+// can stand in for running it again. Not assignments, and a read of a global
+// only as long as nothing assigns it, see step()
+static bool isPure(NodeKind kind) {
+  switch (kind) {
+  case NODE_NUMBER:
+  case NODE_INTEGER:
+  case NODE_LONG_INTEGER:
+  case NODE_STRING:
+  case NODE_NEGATE:
+  case NODE_NOT:
+  case NODE_ADD:
+  case NODE_SUBTRACT:
+  case NODE_MULTIPLY:
+  case NODE_DIVIDE:
+  case NODE_EQUAL:
+  case NODE_SQRT:
+  case NODE_ABS:
+  case NODE_FLOOR:
+  case NODE_EXP:
+  case NODE_MIN:
+  case NODE_MAX:
+  case NODE_POW:
+  case NODE_PICK:
+  case NODE_GET_GLOBAL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool isOperator(NodeKind kind) {
+  return kind == NODE_NEGATE || kind == NODE_NOT || kind == NODE_ADD ||
+         kind == NODE_SUBTRACT || kind == NODE_MULTIPLY ||
+         kind == NODE_DIVIDE || kind == NODE_EQUAL || kind == NODE_SQRT ||
+         kind == NODE_ABS || kind == NODE_FLOOR || kind == NODE_EXP ||
+         kind == NODE_MIN || kind == NODE_MAX || kind == NODE_POW;
+}
+
+static void pushOperand(Operand operand) {
+  if (cse.stackCapacity < cse.stackCount + 1) {
+    int oldCapacity = cse.stackCapacity;
+    cse.stackCapacity = GROW_CAPACITY(oldCapacity);
+    cse.stack =
+        GROW_ARRAY(Operand, cse.stack, oldCapacity, cse.stackCapacity);
+  }
+  cse.stack[cse.stackCount++] = operand;
+}
+
+// one step of a walk: replaces the operands of the node at index i on the
+// stack with the subtree the node is the root of and returns that. Returns
+// NULL for dead nodes, which are skipped, and for the end of a statement,
+// which leaves nothing on the stack
+static Operand *step(int i) {
+  Node node = cse.ir->nodes[i];
+  uint64_t kind = (uint64_t)node.kind << 56;
+  Operand result = {0, i, cse.dest != NULL ? cse.dest->count : 0,
+                    isPure(node.kind), false};
+  switch (node.kind) {
+  case NODE_NUMBER: {
+    // by value, since the same number can be in Ir.numbers more than once
+    uint64_t bits;
+    memcpy(&bits, &cse.ir->numbers[node.operand], sizeof(bits));
+    result.hash = mix(kind ^ mix(bits));
+    break;
+  }
+  case NODE_LONG_INTEGER:
+    // the same goes for Ir.integers
+    result.hash = mix(kind ^ mix((uint64_t)cse.ir->integers[node.operand]));
+    break;
+  case NODE_STRING:
+    // strings are interned, so the same string is the same hash
+    result.hash = mix(kind ^ cse.ir->strings[node.operand]->hash);
+    break;
+  case NODE_GET_GLOBAL:
+    // the same read in another statement is another subtree
+    result.hash = mix(kind ^ node.operand ^ (uint64_t)cse.statement << 24);
+    result.pure = !cse.assigns[cse.statement];
+    result.global = true;
+    break;
+  case NODE_INTEGER:
+  case NODE_PICK:
+    result.hash = mix(kind ^ node.operand);
+    break;
+  case NODE_TUCK:
+    // the value stays, but it isn't shared a second time
+    cse.stack[cse.stackCount - 1].pure = false;
+    return &cse.stack[cse.stackCount - 1];
+  case NODE_NEGATE:
+  case NODE_NOT:
+  case NODE_SQRT:
+  case NODE_ABS:
+  case NODE_FLOOR:
+  case NODE_EXP:
+  case NODE_SET_GLOBAL: {
+    Operand operand = cse.stack[--cse.stackCount];
+    result.hash = combine(kind ^ node.operand, operand.hash, 0);
+    result.start = operand.start;
+    result.newStart = operand.newStart;
+    result.pure = result.pure && operand.pure;
+    result.global = operand.global;
+    break;
+  }
+  case NODE_ADD:
+  case NODE_SUBTRACT:
+  case NODE_MULTIPLY:
+  case NODE_DIVIDE:
+  case NODE_EQUAL:
+  case NODE_MIN:
+  case NODE_MAX:
+  case NODE_POW: {
+    Operand right = cse.stack[--cse.stackCount];
+    Operand left = cse.stack[--cse.stackCount];
+    // the rotation in combine() makes a - b and b - a different
+    result.hash = combine(kind, left.hash, right.hash);
+    result.start = left.start;
+    result.newStart = left.newStart;
+    result.pure = result.pure && left.pure && right.pure;
+    result.global = left.global || right.global;
+    break;
+  }
+  case NODE_DEFINE_GLOBAL:
+  case NODE_POP:
+    // the end of a statement, there is nothing left to be a subtree
+    cse.stackCount--;
+    cse.statement++;
+    return NULL;
+  case NODE_DEAD:
+    return NULL;
+  }
+  pushOperand(result);
+  return &cse.stack[cse.stackCount - 1];
+}
+
+// whether a node could be replaced by an earlier copy of its subtree at all
+static bool isCandidate(int i, Operand *operand) {
+  return operand != NULL && operand->pure &&
+         isOperator(cse.ir->nodes[i].kind);
+}
+
+// a filter is "blocked": all of a hash's bits are in the same 64-bit word,
+// which the top bits of the hash pick (see filterWord()). That makes a lookup
+// one cache miss instead of one per bit, and those misses are most of what
+// the first two walks cost on big expressions
+static uint64_t filterBits(uint64_t hash) {
+  return 1ull << (hash >> 8 & 63) | 1ull << (hash >> 14 & 63) |
+         1ull << (hash >> 20 & 63);
+}
+
+// the index a hash goes to in a table of size entries, a power of two of at
+// least 2. It's the top bits, see combine()
+static uint64_t topBits(uint64_t hash, uint64_t size) {
+  return hash >> (64 - __builtin_ctzll(size));
+}
+
+// the word of a filter of size words a hash goes to. Filters can be any size:
+// this scales the top 32 bits of the hash down to the range instead
+static uint64_t *filterWord(uint64_t *filter, size_t size, uint64_t hash) {
+  return &filter[((hash >> 32) * size) >> 32];
+}
+
+// adds hash to filter and returns whether it was in there already
+static bool addToFilter(uint64_t *filter, size_t size, uint64_t hash) {
+  uint64_t *word = filterWord(filter, size, hash);
+  uint64_t bits = filterBits(hash);
+  bool present = (*word & bits) == bits;
+  *word |= bits;
+  return present;
+}
+
+static bool inFilter(uint64_t *filter, size_t size, uint64_t hash) {
+  uint64_t bits = filterBits(hash);
+  return (*filterWord(filter, size, hash) & bits) == bits;
+}
+
+// the first two walks don't look a hash up in the filter right away. They
+// ask for the filter's word to be loaded and put the hash aside, and only when
+// there are PENDING_MAX of them are they looked up, in the same order. By then
+// the words are in the cache, and the walk never waits for the loads one by one
+static void pend(uint64_t *filter, size_t size, uint64_t hash, int start,
+                 int root, int *count) {
+  __builtin_prefetch(filterWord(filter, size, hash));
+  cse.pending[(*count)++] =
+      (Pending){hash, start, root, cse.statement, cse.stackCount};
+}
+
+static bool sameNode(Node a, Node b) {
+  if (a.kind != b.kind)
+    return false;
+  if (a.kind == NODE_NUMBER) {
+    // bit for bit, so that -0 isn't taken for 0
+    return memcmp(&cse.ir->numbers[a.operand], &cse.ir->numbers[b.operand],
+                  sizeof(double)) == 0;
+  }
+  if (a.kind == NODE_LONG_INTEGER) {
+    return cse.ir->integers[a.operand] == cse.ir->integers[b.operand];
+  }
+  if (a.kind == NODE_STRING) {
+    return cse.ir->strings[a.operand] == cse.ir->strings[b.operand];
+  }
+  return a.operand == b.operand;
+}
+
+// the entry for hash. If there isn't one yet, adds one for the subtree the
+// pending node is the root of when there is one, and returns NULL otherwise
+static Subtree *findSubtree(uint64_t hash, Pending *add);
+
+static void growSubtrees() {
+  Subtree *old = cse.subtrees;
+  int oldCapacity = cse.subtreeCapacity;
+  cse.subtreeCapacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+  cse.subtrees = GROW_ARRAY(Subtree, NULL, 0, cse.subtreeCapacity);
+  for (int i = 0; i < cse.subtreeCapacity; i++) {
+    cse.subtrees[i].root = -1;
+  }
+  for (int i = 0; i < oldCapacity; i++) {
+    if (old[i].root != -1) {
+      Pending add = {old[i].hash, old[i].start, old[i].root, 0, 0};
+      *findSubtree(old[i].hash, &add) = old[i];
+    }
+  }
+  FREE_ARRAY(Subtree, old, oldCapacity);
+}
+
+static Subtree *findSubtree(uint64_t hash, Pending *add) {
+  if (add != NULL && (cse.subtreeCount + 1) * 4 > cse.subtreeCapacity * 3) {
+    growSubtrees();
+  }
+  if (cse.subtreeCapacity == 0)
+    return NULL;
+  uint64_t mask = cse.subtreeCapacity - 1;
+  for (uint64_t index = topBits(hash, cse.subtreeCapacity);;
+       index = (index + 1) & mask) {
+    Subtree *subtree = &cse.subtrees[index];
+    if (subtree->root == -1) {
+      if (add == NULL)
+        return NULL;
+      *subtree = (Subtree){
+          hash, add->start, add->root, add->statement, add->depth, 0, -1, 0, 0};
+      cse.subtreeCount++;
+      return subtree;
+    }
+    if (subtree->hash == hash)
+      return subtree;
+  }
+}
+
+// the entry for the subtree ending at node i, if it has one
+static Subtree *lookUp(int i, Operand *operand) {
+  if (!isCandidate(i, operand) ||
+      !inFilter(cse.repeated, cse.repeatedWords, operand->hash))
+    return NULL;
+  return findSubtree(operand->hash, NULL);
+}
+
+// the kept subtree the subtree ending at node i is a copy of, if there is
+// one that is already on the stack below base. The kept subtrees have a
+// small table of their own, which stays in the cache while the last walk
+// looks up every node in it
+//
+// the nodes are compared as they are in the new IR: the kept subtree's in
+// cse.copies, and node i's operands where they have just been copied to.
+// Subtrees inside both of them have been replaced by the same NODE_PICKs, if
+// any, so a copy still looks exactly like the original
+static Subtree *findMoved(int i, Operand *operand, int base) {
+  if (!isCandidate(i, operand))
+    return NULL;
+  Subtree *moved;
+  for (uint64_t index = topBits(operand->hash, MOVED_TABLE);;
+       index = (index + 1) & (MOVED_TABLE - 1)) {
+    moved = cse.moved[index];
+    if (moved == NULL)
+      return NULL;
+    if (moved->hash == operand->hash)
+      break;
+  }
+  if (moved->slot >= base ||
+      (operand->global && moved->statement != cse.statement))
+    return NULL;
+
+  Node *copy = &cse.copies.nodes[moved->copyStart];
+  Node *operands = &cse.dest->nodes[operand->newStart];
+  int operandCount = cse.dest->count - operand->newStart;
+  if (operandCount != moved->copyCount - 1 ||
+      !sameNode(copy[operandCount], cse.ir->nodes[i]))
+    return NULL;
+  for (int j = 0; j < operandCount; j++) {
+    if (!sameNode(copy[j], operands[j]))
+      return NULL;
+  }
+  return moved;
+}
+
+static void addMoved(Subtree *subtree) {
+  uint64_t index = topBits(subtree->hash, MOVED_TABLE);
+  while (cse.moved[index] != NULL) {
+    index = (index + 1) & (MOVED_TABLE - 1);
+  }
+  cse.moved[index] = subtree;
+}
+
+// biggest first, and in the order they occur among the same size
+static int compareBySize(const void *a, const void *b) {
+  const Subtree *x = *(Subtree *const *)a;
+  const Subtree *y = *(Subtree *const *)b;
+  int xSize = x->root - x->start;
+  int ySize = y->root - y->start;
+  if (xSize != ySize)
+    return ySize - xSize;
+  return x->root - y->root;
+}
+
+static int compareByRoot(const void *a, const void *b) {
+  const Subtree *x = *(Subtree *const *)a;
+  const Subtree *y = *(Subtree *const *)b;
+  return x->root - y->root;
+}
+
+// the index of the NodeLine node i falls under
+static int lineIndex(int i) {
+  int low = 0;
+  int high = cse.ir->lineCount - 1;
+  while (low < high) {
+    int middle = (low + high + 1) / 2;
+    if (cse.ir->lines[middle].node <= i) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return low;
+}
+
+// copies nodes from to to into cse.dest. base is how many values the kept
+// subtrees before it have left on the stack: those in slots below base are
+// copied from there, the others are computed again where they are. With
+// tuck, the kept subtrees that first occur in between are followed by a
+// NODE_TUCK, which adds them to the ones below base as it goes
+static void copyNodes(int from, int to, int base, int keptCount, bool tuck) {
+  Ir *ir = cse.ir;
+  Ir *out = cse.dest;
+  cse.stackCount = 0;
+  int line = lineIndex(from);
+  for (int i = from; i <= to; i++) {
+    while (line + 1 < ir->lineCount && ir->lines[line + 1].node <= i) {
+      line++;
+    }
+    Node node = ir->nodes[i];
+    Operand *operand = step(i);
+    if (node.kind == NODE_DEAD)
+      continue;
+    // the end of a statement is copied as it is
+    Subtree *moved = operand == NULL ? NULL : findMoved(i, operand, base);
+    if (moved != NULL) {
+      // the value is in moved->slot. OP_PICK counts from the top instead,
+      // from what will be under the copy
+      int depth = base + cse.stackCount - 1;
+      if (depth - 1 - moved->slot <= UINT8_MAX) {
+        // take back the operands that were already copied
+        out->count = operand->newStart;
+        while (out->lineCount > 0 &&
+               out->lines[out->lineCount - 1].node >= out->count) {
+          out->lineCount--;
+        }
+        addNode(out, NODE_PICK, moved->slot, ir->lines[line].line);
+        continue;
+      }
+      // too far down for OP_PICK to reach, compute it again
+    }
+    addNode(out, node.kind, node.operand, ir->lines[line].line);
+    // the kept subtrees are in slot order, so the next one to first occur is
+    // the one that goes in slot base
+    if (tuck && base < keptCount && cse.order[base]->root == i) {
+      addNode(out, NODE_TUCK, base, ir->lines[line].line);
+      base++;
+    }
+  }
+}
+
+// computing a subtree of n nodes in c places takes n * c instructions, and
+// n + c when it is computed once and then copied c times. A copy is two bytes
+// of code, about what a node costs, so that goes for the size too
+static int saving(Subtree *subtree) {
+  int size = subtree->root - subtree->start + 1;
+  return (subtree->count - 1) * (size - 1) - 1;
+}
+
+// most saved first
+static int compareBySaving(const void *a, const void *b) {
+  int x = saving(*(Subtree *const *)a);
+  int y = saving(*(Subtree *const *)b);
+  return x != y ? y - x : compareByRoot(a, b);
+}
+
+// walk 3 and deciding what to keep, see the top of the section
+static void rewrite(Subtree **found, int foundCount) {
+  // a subtree inside a subtree that is kept only occurs once for all of the
+  // copies of the bigger one, so the biggest ones are taken first and their
+  // insides are counted again. OP_TUCK can't put a value further down than
+  // 255 slots either, so a subtree that first occurs deeper than that can't
+  // be kept
+  qsort(found, foundCount, sizeof(Subtree *), compareBySize);
+  int movedCount = 0;
+  for (int i = 0; i < foundCount; i++) {
+    Subtree *subtree = found[i];
+    if (saving(subtree) <= 0 || subtree->depth > UINT8_MAX)
+      continue;
+    found[movedCount++] = subtree;
+
+    int gone = subtree->count - 1;
+    cse.stackCount = 0;
+    cse.statement = subtree->statement;
+    for (int node = subtree->start; node < subtree->root; node++) {
+      Subtree *inner = lookUp(node, step(node));
+      if (inner != NULL) {
+        inner->count -= gone;
+      }
+    }
+  }
+  if (movedCount == 0)
+    return;
+
+  // every kept subtree takes a stack slot for the rest of the program, and
+  // OP_PICK can't reach further down than 255 slots. Past MOVED_MAX of them,
+  // only the ones that save the most are kept. The others are computed every
+  // time, and still copy what's inside them from the ones that were kept
+  if (movedCount > MOVED_MAX) {
+    qsort(found, movedCount, sizeof(Subtree *), compareBySaving);
+    movedCount = MOVED_MAX;
+  }
+
+  // the subtrees in the order they first occur, which is the order they go
+  // into their slots in. One inside another occurs before it, so by the time
+  // a kept subtree is computed, everything it could copy from is already on
+  // the stack
+  qsort(found, movedCount, sizeof(Subtree *), compareByRoot);
+  memset(cse.moved, 0, sizeof(cse.moved));
+  for (int i = 0; i < movedCount; i++) {
+    found[i]->slot = i;
+    addMoved(found[i]);
+  }
+  cse.order = found;
+
+  // the copies to compare with are made first, while the IR is still as it
+  // was
+  initIr(&cse.copies);
+  cse.dest = &cse.copies;
+  for (int i = 0; i < movedCount; i++) {
+    found[i]->copyStart = cse.copies.count;
+    cse.statement = found[i]->statement;
+    copyNodes(found[i]->start, found[i]->root, i, movedCount, false);
+    found[i]->copyCount = cse.copies.count - found[i]->copyStart;
+  }
+
+  // then the program is written right over the IR. Every node turns into at
+  // most one node, and each kept subtree adds a NODE_TUCK. With the nodes
+  // moved up by that many first, the copy of a node never lands on one that
+  // hasn't been read yet. A NODE_TUCK has the line of the node before it, so
+  // the lines are never more than there were, and they stay where they are
+  Ir *ir = cse.ir;
+  int count = ir->count;
+  if (ir->capacity < count + movedCount) {
+    ir->nodes =
+        GROW_ARRAY(Node, ir->nodes, ir->capacity, count + movedCount);
+    ir->capacity = count + movedCount;
+  }
+  memmove(ir->nodes + movedCount, ir->nodes, count * sizeof(Node));
+  Ir input = *ir;
+  input.nodes += movedCount;
+  Ir body = *ir;
+  body.count = 0;
+  body.lineCount = 0;
+  cse.ir = &input;
+  cse.dest = &body;
+  cse.statement = 0;
+  copyNodes(0, count - 1, 0, movedCount, true);
+
+  ir->count = body.count;
+  ir->lineCount = body.lineCount;
+  freeIr(&cse.copies);
+  cse.ir = ir;
+  cse.dest = NULL;
+  cse.order = NULL;
+}
+
+// which statements assign a global, see isPure(). The value of the program
+// counts as the last statement
+static void findAssignments() {
+  Ir *ir = cse.ir;
+  cse.statementCount = 1;
+  for (int i = 0; i < ir->count; i++) {
+    if (ir->nodes[i].kind == NODE_POP ||
+        ir->nodes[i].kind == NODE_DEFINE_GLOBAL)
+      cse.statementCount++;
+  }
+  cse.assigns = GROW_ARRAY(bool, NULL, 0, cse.statementCount);
+  memset(cse.assigns, 0, cse.statementCount * sizeof(bool));
+  int statement = 0;
+  for (int i = 0; i < ir->count; i++) {
+    NodeKind kind = ir->nodes[i].kind;
+    if (kind == NODE_SET_GLOBAL) {
+      cse.assigns[statement] = true;
+    } else if (kind == NODE_POP || kind == NODE_DEFINE_GLOBAL) {
+      statement++;
+    }
+  }
+}
+
+void eliminateCommonSubexpressions(Ir *ir) {
+  if (ir->count == 0)
+    return;
+  cse.ir = ir;
+  cse.stackCount = 0;
+  cse.statement = 0;
+  cse.dest = NULL;
+  findAssignments();
+
+  // the first filter gets 8 bits per node, so about 16 per operator. With
+  // three bits set per subtree, that lets around one in a hundred unique ones
+  // through. The second one only sees those and the ones that do repeat, which
+  // in an expression with a lot of repeats are mostly the same few over and
+  // over, so it can be a quarter of the size
+  cse.seenWords = ir->count / 8 + 1;
+  cse.repeatedWords = ir->count / 32 + 1;
+  cse.seen = GROW_ARRAY(uint64_t, NULL, 0, cse.seenWords);
+  cse.repeated = GROW_ARRAY(uint64_t, NULL, 0, cse.repeatedWords);
+  memset(cse.seen, 0, cse.seenWords * sizeof(uint64_t));
+  memset(cse.repeated, 0, cse.repeatedWords * sizeof(uint64_t));
+
+  // walk 1: the filters
+  bool anyRepeated = false;
+  int pendingCount = 0;
+  for (int i = 0; i < ir->count; i++) {
+    Operand *operand = step(i);
+    if (isCandidate(i, operand)) {
+      pend(cse.seen, cse.seenWords, operand->hash, operand->start, i,
+           &pendingCount);
+    }
+    if (pendingCount == PENDING_MAX || i == ir->count - 1) {
+      for (int j = 0; j < pendingCount; j++) {
+        uint64_t hash = cse.pending[j].hash;
+        if (addToFilter(cse.seen, cse.seenWords, hash)) {
+          addToFilter(cse.repeated, cse.repeatedWords, hash);
+          anyRepeated = true;
+        }
+      }
+      pendingCount = 0;
+    }
+  }
+  FREE_ARRAY(uint64_t, cse.seen, cse.seenWords);
+  cse.seen = NULL;
+
+  // walk 2: the counts
+  if (anyRepeated) {
+    cse.stackCount = 0;
+    cse.statement = 0;
+    for (int i = 0; i < ir->count; i++) {
+      Operand *operand = step(i);
+      if (isCandidate(i, operand)) {
+        pend(cse.repeated, cse.repeatedWords, operand->hash, operand->start,
+             i, &pendingCount);
+      }
+      if (pendingCount == PENDING_MAX || i == ir->count - 1) {
+        for (int j = 0; j < pendingCount; j++) {
+          Pending *pending = &cse.pending[j];
+          if (inFilter(cse.repeated, cse.repeatedWords, pending->hash)) {
+            findSubtree(pending->hash, pending)->count++;
+          }
+        }
+        pendingCount = 0;
+      }
+    }
+  }
+
+  Subtree **found = NULL;
+  int foundCount = 0;
+  if (cse.subtreeCount > 0) {
+    found = GROW_ARRAY(Subtree *, NULL, 0, cse.subtreeCount);
+    for (int i = 0; i < cse.subtreeCapacity; i++) {
+      if (cse.subtrees[i].root != -1 && cse.subtrees[i].count > 1) {
+        found[foundCount++] = &cse.subtrees[i];
+      }
+    }
+  }
+  if (foundCount > 0) {
+    rewrite(found, foundCount);
+  }
+
+  FREE_ARRAY(Subtree *, found, cse.subtreeCount);
+  FREE_ARRAY(bool, cse.assigns, cse.statementCount);
+  FREE_ARRAY(uint64_t, cse.repeated, cse.repeatedWords);
+  FREE_ARRAY(Subtree, cse.subtrees, cse.subtreeCapacity);
+  FREE_ARRAY(Operand, cse.stack, cse.stackCapacity);
+  cse.assigns = NULL;
+  cse.repeated = NULL;
+  cse.subtrees = NULL;
+  cse.subtreeCount = 0;
+  cse.subtreeCapacity = 0;
+  cse.stack = NULL;
+  cse.stackCapacity = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef clox_optimize_h
+#define clox_optimize_h
+
+#include "common.h"
+#include "ir.h"
+
+// the passes compile() runs over the IR between parsing and lowering. What
+// comes out of a pass still follows the rules in ir.h, so passes can run in
+// any order and lowering doesn't need to know which of them ran
+
+typedef struct {
+  // algebraic simplification, see simplifyAlgebra()
+  bool algebra;
+  // lets simplifyAlgebra() make rewrites that can change the result
+  bool fastMath;
+  // common subexpression elimination, see eliminateCommonSubexpressions()
+  bool cse;
+} OptimizeOptions;
+
+// which passes compile() runs. All of them by default, clox --no-algebra and
+// --no-cse turn them off. The rewrites that aren't exact need --fast-math
+extern OptimizeOptions optimizeOptions;
+
+// runs the passes optimizeOptions asks for
+void optimizeIr(Ir *ir);
+
+// rewrites arithmetic into cheaper arithmetic, like x / 2 into x * 0.5 and
+// -(-x) into x. By default only rewrites that give exactly the same bits for
+// every operand, including nan, infinities and -0. optimizeOptions.fastMath
+// adds ones like x * 0 into 0, which are only right for finite numbers
+void simplifyAlgebra(Ir *ir);
+
+// finds subexpressions that occur more than once, like the a*b+c in
+// (a*b+c) * 2 - (a*b+c) / 3, and computes each of them only once: where it
+// first occurs, followed by a NODE_TUCK that keeps a copy of its value at the
+// bottom of the stack. Every place after that copies it from there with a
+// NODE_PICK instead. A subexpression that reads a global is only shared
+// within a statement that assigns none
+void eliminateCommonSubexpressions(Ir *ir);
+
+#endif
@@ -0,0 +1,55 @@
+#include "output.h"
+#include "dtoa.h"
+#include "object.h"
+#include "value.h"
+#include <stdio.h>
+#include <string.h>
+
+static char buffer[OUTPUT_BUFFER_SIZE];
+static int used = 0;
+
+void flushOutput() {
+  if (used > 0) {
+    fwrite(buffer, 1, used, stdout);
+    used = 0;
+  }
+  fflush(stdout);
+}
+
+void writeOutput(const char *chars, int length) {
+  if (used + length > OUTPUT_BUFFER_SIZE) {
+    flushOutput();
+    // too big to be worth copying, hand it over directly
+    if (length > OUTPUT_BUFFER_SIZE) {
+      fwrite(chars, 1, length, stdout);
+      return;
+    }
+  }
+  memcpy(buffer + used, chars, length);
+  used += length;
+}
+
+void writeValue(Value value) {
+  // numbers are formatted straight into the buffer when there is room
+  if (used + NUMBER_BUFFER_SIZE > OUTPUT_BUFFER_SIZE) {
+    flushOutput();
+  }
+
+  switch (value.type) {
+  case VAL_NUMBER:
+    used += formatNumber(AS_NUMBER(value), buffer + used);
+    break;
+  case VAL_INT:
+    used += formatInteger(AS_INT(value), buffer + used);
+    break;
+  case VAL_BOOL:
+    writeOutput(AS_BOOL(value) ? "true" : "false", AS_BOOL(value) ? 4 : 5);
+    break;
+  case VAL_NIL:
+    writeOutput("nil", 3);
+    break;
+  case VAL_OBJ:
+    writeOutput(AS_CSTRING(value), AS_STRING(value)->length);
+    break;
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include "common.h"
+#include "value.h"
+
+// results are written through this layer instead of printf. It formats into
+// one large buffer and only hands that to stdout when the buffer is full or at
+// an explicit flush point, so printing a result costs a memcpy or two instead
+// of a trip through stdio's formatting machinery
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+void writeOutput(const char *chars, int length);
+// a value as the user sees it, e.g. 0.1, 1e+21 or nil
+void writeValue(Value value);
+// writes out whatever is buffered. Call it before anything else could write
+// to stdout or wait for input (the REPL prompt) and before exiting
+void flushOutput();
+
+#endif
@@ -0,0 +1,57 @@
+#include "phases.h"
+#include "common.h"
+#include "vm.h"
+#include <string.h>
+#include <time.h>
+
+_Thread_local PhaseTimes *phaseTimes = NULL;
+
+uint64_t phaseClock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+InterpretResult interpretTimed(const char *source, PhaseTimes *times) {
+  memset(times, 0, sizeof(PhaseTimes));
+  // put back whatever was there, so a timed call can happen inside another
+  PhaseTimes *outer = phaseTimes;
+  phaseTimes = times;
+  InterpretResult result = interpret(source);
+  phaseTimes = outer;
+  return result;
+}
+
+// count per second of ns, 0 when nothing was timed
+static double perSecond(double count, uint64_t ns) {
+  return ns == 0 ? 0 : count / ns * 1e9;
+}
+
+void writePhaseTimes(const PhaseTimes *times, FILE *out) {
+  const char *names[] = {"read",     "scan", "parse",
+                         "optimize", "emit", "execute"};
+  uint64_t ns[] = {times->read,     times->scan, times->parse,
+                   times->optimize, times->emit, times->execute};
+  uint64_t total = 0;
+  for (int i = 0; i < 6; i++) {
+    total += ns[i];
+  }
+
+  fprintf(out, "== phases ==\n");
+  fprintf(out, "%-13s %14s %7s\n", "phase", "ns", "%");
+  for (int i = 0; i < 6; i++) {
+    fprintf(out, "%-13s %14llu %6.2f%%\n", names[i], (unsigned long long)ns[i],
+            total == 0 ? 0 : 100.0 * ns[i] / total);
+  }
+  fprintf(out, "%-13s %14llu\n", "total", (unsigned long long)total);
+
+  uint64_t compiling = times->scan + times->parse + times->optimize +
+                       times->emit;
+  fprintf(out, "%-13s %14zu %14.1f MB/s\n", "bytes", times->bytes,
+          perSecond(times->bytes, compiling) / 1e6);
+  fprintf(out, "%-13s %14d %14.1f M/s\n", "tokens", times->tokens,
+          perSecond(times->tokens, compiling) / 1e6);
+  fprintf(out, "%-13s %14d %14.1f M/s\n", "instructions",
+          times->instructions,
+          perSecond(times->instructions, times->execute) / 1e6);
+}
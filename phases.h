@@ -0,0 +1,56 @@
+#ifndef clox_phases_h
+#define clox_phases_h
+
+#include "common.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// where the time of an interpret() call goes, phase by phase, for clox
+// --time-phases and for programs that embed clox. All times are nanoseconds
+// of the monotonic clock
+//
+// the scanner normally runs inside the parser, one token at a time. Timing
+// each call would cost more than most tokens take to scan, so while phases
+// are timed compile() scans the source once on its own first. The parse time
+// is what parsing took beyond that, and --pipeline is off
+typedef struct {
+  // reading the script in. interpret() gets the source as a string, so this
+  // is left for whoever reads it to fill in, like main() does
+  uint64_t read;
+  // checking the encoding (see utf8.h) and scanning
+  uint64_t scan;
+  // parsing into the IR (see ir.h)
+  uint64_t parse;
+  // the passes in optimize.h
+  uint64_t optimize;
+  // lowering the IR into the chunk
+  uint64_t emit;
+  // interpretChunk(): verifying, the JIT if it is on, and running
+  uint64_t execute;
+
+  // what went through the phases: the length of the source, the tokens in
+  // it (TOKEN_EOF not counted) and the instructions that ran. There are no
+  // jumps, so a run goes through the chunk's instructions in order, all of
+  // them or up to the one that failed
+  size_t bytes;
+  int tokens;
+  int instructions;
+} PhaseTimes;
+
+// where compile() and interpret() put their times. NULL, the default, when
+// nothing is being timed, and then they don't look at the clock at all. Each
+// thread has its own, like it has its own VM, so what runs on one thread
+// never lands in another thread's times
+extern _Thread_local PhaseTimes *phaseTimes;
+
+// the monotonic clock in nanoseconds
+uint64_t phaseClock();
+// interpret(), with the times of everything but read in *times
+InterpretResult interpretTimed(const char *source, PhaseTimes *times);
+// a table of the phases and their share of the total, then the throughput:
+// bytes and tokens per second of compiling (scan to emit) and instructions
+// per second of executing
+void writePhaseTimes(const PhaseTimes *times, FILE *out);
+
+#endif
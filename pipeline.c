@@ -0,0 +1,171 @@
+#include "pipeline.h"
+#include "common.h"
+#include "scanner.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// tokens the ring holds. A power of two, so an index is a position in it
+// with the top bits masked off. Tokens are 24 bytes, so this is 96KB, enough
+// for the scanner to get well ahead of a parser that is busy with a long
+// expression without the ring getting too big for the cache
+#define RING_SIZE 4096
+#define RING_MASK (RING_SIZE - 1)
+// each side publishes its index after this many tokens instead of after every
+// one, so the cache line it is on doesn't bounce between the cores all the
+// time. Before waiting, a side always publishes what it has
+#define BATCH 64
+// how often a waiting side checks again before it gives its core away
+#define SPINS 100
+
+// the head and the tail are on cache lines of their own, so the scanner
+// writing the tail doesn't take the line away from the parser writing the
+// head and the other way around
+// the indices only ever count up (and wrap around at 2^32, which the
+// subtractions don't mind). tail - head is how many tokens are in the ring
+typedef struct {
+  // the next token the parser takes. Only the parser writes it
+  _Alignas(64) _Atomic uint32_t head;
+  // the next free slot. Only the scanner thread writes it
+  _Alignas(64) _Atomic uint32_t tail;
+  // set by stopPipeline() to tell the scanner thread the parser is done
+  _Alignas(64) _Atomic bool stop;
+  _Alignas(64) Token tokens[RING_SIZE];
+} Ring;
+
+bool pipelineCompile = false;
+
+static Ring ring;
+static pthread_t scannerThread;
+
+// the parser's side. Only the parser thread touches this
+static struct {
+  uint32_t head;
+  // the tail as it was last read. Until the parser catches up with it, the
+  // tokens up to it can be taken without looking at the real tail
+  uint32_t tail;
+  // set once TOKEN_EOF has been taken, and the token, to hand out again
+  bool ended;
+  Token eof;
+} consumer;
+
+// a waiting side spins for a while, since the other side is usually only a
+// few tokens away, and then yields its core. On a machine with fewer cores
+// than threads, spinning would only keep the other side from running
+static void backOff(int *spins) {
+  if (++*spins < SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    return;
+  }
+  *spins = 0;
+  sched_yield();
+}
+
+// the scanner thread. It runs scanToken() over the whole source, and
+// everything that happens to the global scanner happens here. The parser
+// doesn't touch it until stopPipeline() has joined this thread
+static void *scanAhead(void *unused) {
+  (void)unused;
+  uint32_t tail = 0;
+  // the head as it was last read. There is room in the ring up to it
+  uint32_t head = 0;
+  uint32_t published = 0;
+  for (;;) {
+    Token token = scanToken();
+
+    int spins = 0;
+    while (tail - head == RING_SIZE) {
+      // the ring is full as far as this thread knows. The parser might be
+      // waiting for the tokens that haven't been published yet, so they go
+      // out before anything else
+      if (published != tail) {
+        atomic_store_explicit(&ring.tail, tail, memory_order_release);
+        published = tail;
+      }
+      head = atomic_load_explicit(&ring.head, memory_order_acquire);
+      if (tail - head < RING_SIZE)
+        break;
+      // the parser can stop before the end, after a syntax error. Then it
+      // won't take anything more and this thread has to stop by itself
+      if (atomic_load_explicit(&ring.stop, memory_order_relaxed))
+        return NULL;
+      backOff(&spins);
+    }
+
+    ring.tokens[tail & RING_MASK] = token;
+    tail++;
+    // the release makes the token stores visible to the parser before it
+    // sees the new tail
+    if (token.type == TOKEN_EOF) {
+      atomic_store_explicit(&ring.tail, tail, memory_order_release);
+      return NULL;
+    }
+    if (tail - published >= BATCH) {
+      atomic_store_explicit(&ring.tail, tail, memory_order_release);
+      published = tail;
+      // a stopped parser is noticed here as well, so the thread doesn't go on
+      // scanning a long source nobody is going to read
+      if (atomic_load_explicit(&ring.stop, memory_order_relaxed))
+        return NULL;
+    }
+  }
+}
+
+bool startPipeline(const char *source) {
+  // strnlen() only looks as far as it has to, so a short source is found
+  // out without walking a long one
+  if (strnlen(source, PIPELINE_MIN_SOURCE) < PIPELINE_MIN_SOURCE)
+    return false;
+
+  initScanner(source);
+  atomic_store_explicit(&ring.head, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring.tail, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring.stop, false, memory_order_relaxed);
+  consumer.head = 0;
+  consumer.tail = 0;
+  consumer.ended = false;
+  // pthread_create() makes everything stored before it visible to the thread
+  return pthread_create(&scannerThread, NULL, scanAhead, NULL) == 0;
+}
+
+Token takeToken() {
+  if (consumer.head == consumer.tail) {
+    // nothing comes after TOKEN_EOF, so there is nothing to wait for
+    if (consumer.ended)
+      return consumer.eof;
+    // the ring is empty as far as the parser knows. The scanner might be
+    // waiting for room, so the head goes out before waiting for it
+    atomic_store_explicit(&ring.head, consumer.head, memory_order_release);
+    int spins = 0;
+    for (;;) {
+      consumer.tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+      if (consumer.tail != consumer.head)
+        break;
+      backOff(&spins);
+    }
+  }
+
+  Token token = ring.tokens[consumer.head & RING_MASK];
+  consumer.head++;
+  // the release makes sure the token has been read before the scanner can
+  // see its slot as free and write over it
+  if ((consumer.head & (BATCH - 1)) == 0) {
+    atomic_store_explicit(&ring.head, consumer.head, memory_order_release);
+  }
+  if (token.type == TOKEN_EOF) {
+    consumer.ended = true;
+    consumer.eof = token;
+  }
+  return token;
+}
+
+void stopPipeline() {
+  atomic_store_explicit(&ring.stop, true, memory_order_relaxed);
+  // the scanner may be waiting for room that will only come once it sees
+  // that the parser is done with the ring
+  atomic_store_explicit(&ring.head, consumer.head, memory_order_release);
+  pthread_join(scannerThread, NULL);
+}
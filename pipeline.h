@@ -0,0 +1,39 @@
+#ifndef clox_pipeline_h
+#define clox_pipeline_h
+
+#include "common.h"
+#include "scanner.h"
+
+// pipelined compiling: a second thread runs the scanner ahead of the parser
+// and hands it the tokens through a ring buffer, so on a big source scanning
+// and parsing overlap instead of taking turns on one core. The tokens, error
+// tokens included, are exactly the ones scanToken() would give, in the same
+// order, so the compiler can't tell the difference
+//
+// the ring has one producer (the scanner thread) and one consumer (the
+// parser), and then it needs no locks: each side only writes its own index
+// and reads the other's. When the ring is full the scanner waits for the
+// parser, and when it is empty the parser waits for the scanner
+
+// sources shorter than this are scanned the usual way. Starting a thread
+// costs more than overlapping a few thousand tokens saves
+#define PIPELINE_MIN_SOURCE (64 * 1024)
+
+// whether compile() pipelines big sources. Off by default, clox --pipeline
+// turns it on. It only pays with a core free for the scanner thread: on one
+// core the two threads take turns anyway, and handing tokens over makes it
+// slower than scanning in place
+extern bool pipelineCompile;
+
+// starts the scanner thread on source. Returns false, with nothing started,
+// if the source is too short for it or the thread can't be made, and then
+// the caller scans the usual way with initScanner() and scanToken()
+bool startPipeline(const char *source);
+// the next token, waiting for the scanner thread if it isn't there yet. Once
+// TOKEN_EOF has come, it keeps coming, like it does from scanToken()
+Token takeToken();
+// stops the scanner thread, also when the parser stopped before TOKEN_EOF,
+// and waits for it to end
+void stopPipeline();
+
+#endif
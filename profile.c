@@ -0,0 +1,201 @@
+#include "profile.h"
+#include "chunk.h"
+#include "debug.h"
+#include "memory.h"
+#include "verify.h"
+#include "vm.h"
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// samples[n] counts how often the handler found vm.ip at code + n. ip is
+// advanced past an instruction's opcode and operands as soon as they are read,
+// so while an instruction runs ip points just past it. That means an
+// instruction starting at offset s with length l owns samples[s + 1 .. s + l]
+// everything here is set up before the timer starts, the handler only ever
+// increments counters
+static uint32_t *samples = NULL;
+static int sampleCount = 0;
+static Chunk *profiled = NULL;
+static uint8_t *codeStart = NULL;
+// samples taken while the VM wasn't running the profiled chunk: compiling,
+// printing, ...
+static uint32_t outside = 0;
+static struct sigaction previousAction;
+
+// what the report is built from: one entry per instruction
+typedef struct {
+  int offset;
+  int line;
+  uint8_t instruction;
+  uint32_t samples;
+} ProfileEntry;
+
+static void sample(int signal) {
+  (void)signal;
+  // vm.ip is read without any synchronization. At worst a sample lands on a
+  // neighbouring instruction, which is fine for a statistical profile
+  uint8_t *ip = vm.ip;
+  if (vm.chunk == profiled && ip >= codeStart &&
+      ip < codeStart + sampleCount) {
+    samples[ip - codeStart]++;
+  } else {
+    outside++;
+  }
+}
+
+void startProfiler(Chunk *chunk) {
+  freeProfiler();
+  profiled = chunk;
+  codeStart = chunk->code;
+  // one more than the code size because ip can point one past the last byte
+  sampleCount = chunk->count + 1;
+  samples = GROW_ARRAY(uint32_t, NULL, 0, sampleCount);
+  memset(samples, 0, sizeof(uint32_t) * sampleCount);
+  outside = 0;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = sample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, &previousAction);
+
+  // ITIMER_PROF counts CPU time the process spends, both in user space and in
+  // the kernel on its behalf, and sends SIGPROF every time it runs out
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / PROFILE_HZ;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void stopProfiler() {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  sigaction(SIGPROF, &previousAction, NULL);
+}
+
+// walk the instructions and the line table side by side, so this is one
+// linear pass instead of a getLine() call per instruction
+static ProfileEntry *collect(int *count, int *capacity) {
+  Chunk *chunk = profiled;
+  ProfileEntry *entries = NULL;
+  *count = 0;
+  *capacity = 0;
+
+  int lineIndex = 0;
+  for (int offset = 0; offset < chunk->count;) {
+    while (lineIndex + 1 < chunk->lineCount &&
+           chunk->lines[lineIndex + 1].offset <= offset) {
+      lineIndex++;
+    }
+    int length = instructionLength(chunk->code[offset]);
+    if (length == 0)
+      length = 1;
+
+    if (*capacity < *count + 1) {
+      int oldCapacity = *capacity;
+      *capacity = GROW_CAPACITY(oldCapacity);
+      entries = GROW_ARRAY(ProfileEntry, entries, oldCapacity, *capacity);
+    }
+    ProfileEntry *entry = &entries[(*count)++];
+    entry->offset = offset;
+    entry->line = chunk->lines[lineIndex].line;
+    entry->instruction = chunk->code[offset];
+    entry->samples = 0;
+    for (int i = 1; i <= length && offset + i < sampleCount; i++) {
+      entry->samples += samples[offset + i];
+    }
+    // before the first instruction is read, ip points at it
+    if (offset == 0) {
+      entry->samples += samples[0];
+    }
+    offset += length;
+  }
+  return entries;
+}
+
+static int byLine(const void *a, const void *b) {
+  return ((const ProfileEntry *)a)->line - ((const ProfileEntry *)b)->line;
+}
+
+static int bySamples(const void *a, const void *b) {
+  uint32_t left = ((const ProfileEntry *)a)->samples;
+  uint32_t right = ((const ProfileEntry *)b)->samples;
+  return left < right ? 1 : left > right ? -1 : 0;
+}
+
+void writeFlatProfile(FILE *out) {
+  int count, capacity;
+  ProfileEntry *entries = collect(&count, &capacity);
+  uint64_t total = outside;
+  for (int i = 0; i < count; i++) {
+    total += entries[i].samples;
+  }
+  double percent = total > 0 ? 100.0 / total : 0;
+
+  fprintf(out, "== profile: %llu samples at %d Hz ==\n",
+          (unsigned long long)total, PROFILE_HZ);
+
+  qsort(entries, count, sizeof(ProfileEntry), bySamples);
+  fprintf(out, "-- by instruction --\n");
+  fprintf(out, "%8s %7s %6s %6s  %s\n", "samples", "%", "line", "offset",
+          "opcode");
+  for (int i = 0; i < count && entries[i].samples > 0; i++) {
+    fprintf(out, "%8u %6.2f%% %6d %6d  %s\n", entries[i].samples,
+            entries[i].samples * percent, entries[i].line, entries[i].offset,
+            opcodeName(entries[i].instruction));
+  }
+
+  // add up the instructions of each line. Sorting by line first puts them
+  // next to each other, then they get merged into the first one
+  qsort(entries, count, sizeof(ProfileEntry), byLine);
+  int lines = 0;
+  for (int i = 0; i < count; i++) {
+    if (lines > 0 && entries[lines - 1].line == entries[i].line) {
+      entries[lines - 1].samples += entries[i].samples;
+    } else {
+      entries[lines++] = entries[i];
+    }
+  }
+  qsort(entries, lines, sizeof(ProfileEntry), bySamples);
+  fprintf(out, "-- by line --\n");
+  fprintf(out, "%8s %7s %6s\n", "samples", "%", "line");
+  for (int i = 0; i < lines && entries[i].samples > 0; i++) {
+    fprintf(out, "%8u %6.2f%% %6d\n", entries[i].samples,
+            entries[i].samples * percent, entries[i].line);
+  }
+  if (outside > 0) {
+    fprintf(out, "%8u %6.2f%%  (outside the bytecode)\n", outside,
+            outside * percent);
+  }
+
+  FREE_ARRAY(ProfileEntry, entries, capacity);
+}
+
+void writeFoldedProfile(FILE *out, const char *name) {
+  int count, capacity;
+  ProfileEntry *entries = collect(&count, &capacity);
+  for (int i = 0; i < count; i++) {
+    if (entries[i].samples > 0) {
+      fprintf(out, "%s;line %d;%s %u\n", name, entries[i].line,
+              opcodeName(entries[i].instruction), entries[i].samples);
+    }
+  }
+  if (outside > 0) {
+    fprintf(out, "%s;[outside bytecode] %u\n", name, outside);
+  }
+  FREE_ARRAY(ProfileEntry, entries, capacity);
+}
+
+void freeProfiler() {
+  FREE_ARRAY(uint32_t, samples, sampleCount);
+  samples = NULL;
+  sampleCount = 0;
+  profiled = NULL;
+  codeStart = NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include "chunk.h"
+#include <stdio.h>
+
+// a statistical sampling profiler. Instead of instrumenting run() (which is
+// what makes DEBUG_TRACE_EXECUTION so slow), a SIGPROF timer interrupts the
+// VM about PROFILE_HZ times per second of CPU time and the signal handler
+// notes where vm.ip is. Afterwards the samples are mapped back to
+// instructions and, through the chunk's line table, to source lines
+
+#define PROFILE_HZ 1000
+
+// start sampling the given chunk. Only one chunk can be profiled at a time
+void startProfiler(Chunk *chunk);
+void stopProfiler();
+// a flat profile, by source line and by instruction, sorted by samples
+void writeFlatProfile(FILE *out);
+// "folded stacks", one line per stack with its sample count, which is what
+// flamegraph.pl and similar tools read
+void writeFoldedProfile(FILE *out, const char *name);
+// throw the samples away once the reports have been written
+void freeProfiler();
+
+#endif
@@ -0,0 +1,687 @@
+#include "rows.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "dtoa.h"
+#include "memory.h"
+#include "object.h"
+#include "output.h"
+#include "table.h"
+#include "verify.h"
+#include "vm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// how much of the input is read at a time
+#define READ_SIZE (1024 * 1024)
+// batches for each worker: the one it is running, and one that is ready for
+// it while the main thread waits to write out an older one
+#define BATCHES_PER_WORKER 2
+
+typedef enum {
+  ROWS_OK,
+  // a CSV line that isn't one number for each column
+  ROWS_BAD_ROW,
+  ROWS_RUNTIME_ERROR,
+} BatchStatus;
+
+typedef struct {
+  // the rows as they were read: whole CSV lines, each ending in '\n', or
+  // one double for each column
+  char *input;
+  size_t inputCount;
+  size_t inputCapacity;
+  int rowCount;
+  // the number of the first row, counting from 1 (a CSV header isn't a row)
+  int64_t firstRow;
+  // the input ended partway through the row after the last one
+  bool cutOff;
+
+  // the results, a line each
+  char *output;
+  size_t outputCount;
+  size_t outputCapacity;
+  // ROWS_OK unless a row failed. Then failedRow is the one, counting from 0,
+  // and only the rows before it have results in output
+  BatchStatus status;
+  int failedRow;
+  // the columns of the failed row, so that the main thread can run it again
+  // to report the error (workers don't report any, see VM.quiet)
+  Value *failedColumns;
+  // set by the worker once it is finished with the batch
+  bool done;
+} Batch;
+
+typedef struct {
+  int fd;
+  // what is in bytes from start to end hasn't been handed out yet
+  char *bytes;
+  size_t start;
+  size_t end;
+  size_t capacity;
+  bool eof;
+  // for errors
+  const char *name;
+} Reader;
+
+static Reader reader;
+static RowFormat format;
+static int columnCount;
+// the global slot of each column
+static int *columnSlots;
+static Chunk script;
+// the main thread's VM, which the workers take the globals and the strings
+// from
+static VM *mainVM;
+
+// the batches are a ring, batch n is batches[n % batchCount]. The main thread
+// fills them in order, the workers take them in that order and the main
+// thread writes them out in that order. The counts only ever go up
+static Batch *batches;
+static int batchCount;
+static int64_t batchesFilled;
+static int64_t batchesTaken;
+// no batches are coming anymore, the workers stop once they run out
+static bool finished;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batchFilled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batchDone = PTHREAD_COND_INITIALIZER;
+
+// reads more of the input, after what is left of it. Only ever grows the
+// buffer for a CSV line longer than all of it
+static void refill() {
+  if (reader.start > 0) {
+    memmove(reader.bytes, reader.bytes + reader.start,
+            reader.end - reader.start);
+    reader.end -= reader.start;
+    reader.start = 0;
+  }
+  if (reader.end == reader.capacity) {
+    size_t oldCapacity = reader.capacity;
+    reader.capacity = GROW_CAPACITY(oldCapacity);
+    reader.bytes = GROW_ARRAY(char, reader.bytes, oldCapacity,
+                              reader.capacity);
+  }
+
+  ssize_t bytesRead;
+  do {
+    bytesRead = read(reader.fd, reader.bytes + reader.end,
+                     reader.capacity - reader.end);
+  } while (bytesRead < 0 && errno == EINTR);
+  if (bytesRead < 0) {
+    fprintf(stderr, "Could not read \"%s\".\n", reader.name);
+    exit(74);
+  }
+  if (bytesRead == 0) {
+    reader.eof = true;
+  }
+  reader.end += bytesRead;
+}
+
+static void appendInput(Batch *batch, const char *bytes, size_t length) {
+  if (length == 0)
+    return;
+  if (batch->inputCount + length > batch->inputCapacity) {
+    size_t oldCapacity = batch->inputCapacity;
+    size_t capacity = GROW_CAPACITY(oldCapacity);
+    while (capacity < batch->inputCount + length) {
+      capacity = GROW_CAPACITY(capacity);
+    }
+    batch->input = GROW_ARRAY(char, batch->input, oldCapacity, capacity);
+    batch->inputCapacity = capacity;
+  }
+  memcpy(batch->input + batch->inputCount, bytes, length);
+  batch->inputCount += length;
+}
+
+// the next ROWS_PER_BATCH lines, or as many as there are left. All the lines
+// that are in the buffer already are found before any of them are copied
+static void fillCsv(Batch *batch) {
+  for (;;) {
+    size_t from = reader.start;
+    while (batch->rowCount < ROWS_PER_BATCH) {
+      char *newline = memchr(reader.bytes + reader.start, '\n',
+                             reader.end - reader.start);
+      if (newline == NULL)
+        break;
+      reader.start = newline + 1 - reader.bytes;
+      batch->rowCount++;
+    }
+    appendInput(batch, reader.bytes + from, reader.start - from);
+    if (batch->rowCount == ROWS_PER_BATCH)
+      return;
+
+    if (reader.eof) {
+      // a last line without a newline. It gets one, so that every row ends
+      // the same way
+      if (reader.start < reader.end) {
+        appendInput(batch, reader.bytes + reader.start,
+                    reader.end - reader.start);
+        appendInput(batch, "\n", 1);
+        reader.start = reader.end;
+        batch->rowCount++;
+      }
+      return;
+    }
+    refill();
+  }
+}
+
+static void fillF64(Batch *batch) {
+  size_t rowSize = sizeof(double) * columnCount;
+  for (;;) {
+    size_t rows = (reader.end - reader.start) / rowSize;
+    if (rows > (size_t)(ROWS_PER_BATCH - batch->rowCount)) {
+      rows = ROWS_PER_BATCH - batch->rowCount;
+    }
+    appendInput(batch, reader.bytes + reader.start, rows * rowSize);
+    reader.start += rows * rowSize;
+    batch->rowCount += (int)rows;
+    if (batch->rowCount == ROWS_PER_BATCH)
+      return;
+
+    if (reader.eof) {
+      batch->cutOff = reader.start < reader.end;
+      reader.start = reader.end;
+      return;
+    }
+    refill();
+  }
+}
+
+// reads the batch starting at row firstRow. Returns false if there was
+// nothing left to read
+static bool fillBatch(Batch *batch, int64_t firstRow) {
+  batch->inputCount = 0;
+  batch->rowCount = 0;
+  batch->firstRow = firstRow;
+  batch->cutOff = false;
+  if (format == ROWS_CSV) {
+    fillCsv(batch);
+  } else {
+    fillF64(batch);
+  }
+  return batch->rowCount > 0 || batch->cutOff;
+}
+
+// a field of a CSV line, and *c moved past it. Plain decimals like 12.5 take
+// the compiler's shortcut, anything else (exponents, inf, nan) goes through
+// strtod
+static bool parseField(const char **c, double *value) {
+  const char *start = *c;
+  // an empty field. strtod would skip the newline and read the next line
+  if (*start == ',' || *start == '\n' || *start == '\r')
+    return false;
+
+  const char *digits = start + (*start == '-' || *start == '+');
+  const char *end = digits;
+  int points = 0;
+  while ((*end >= '0' && *end <= '9') || *end == '.') {
+    points += *end == '.';
+    end++;
+  }
+  if (end - digits > points && points <= 1 &&
+      (*end == ',' || *end == '\n' || *end == '\r' || *end == ' ' ||
+       *end == '\t')) {
+    *value = parseNumber(digits, (int)(end - digits));
+    if (*start == '-') {
+      *value = -*value;
+    }
+    *c = end;
+    return true;
+  }
+
+  // strtod skips leading whitespace, newlines included, so a field that is
+  // nothing but whitespace would have it read the next line
+  char *parsed;
+  *value = strtod(start, &parsed);
+  if (parsed == start || memchr(start, '\n', parsed - start) != NULL)
+    return false;
+  *c = parsed;
+  return true;
+}
+
+// stores the numbers of the CSV line at *line in the column globals, and
+// moves *line on to the next line. Returns false if the line isn't a number
+// for each column
+static bool loadCsvRow(const char **line) {
+  const char *c = *line;
+  bool ok = true;
+  for (int i = 0; i < columnCount && ok; i++) {
+    while (*c == ' ' || *c == '\t') {
+      c++;
+    }
+    double value;
+    ok = parseField(&c, &value);
+    if (ok) {
+      vm.globals.values[columnSlots[i]] = NUMBER_VAL(value);
+    }
+    while (*c == ' ' || *c == '\t') {
+      c++;
+    }
+    // only a comma that is there is skipped, a row that has too few fields
+    // stops right at its '\n'
+    if (ok && i < columnCount - 1) {
+      ok = *c == ',';
+      if (ok) {
+        c++;
+      }
+    }
+  }
+  if (ok && *c == '\r') {
+    c++;
+  }
+  ok = ok && *c == '\n';
+
+  // every line ends in '\n' and nothing above went past it, so this stops at
+  // the end of this one whatever was wrong with it
+  while (*c != '\n') {
+    c++;
+  }
+  *line = c + 1;
+  return ok;
+}
+
+static void loadF64Row(const char *row) {
+  for (int i = 0; i < columnCount; i++) {
+    uint64_t bits;
+    memcpy(&bits, row + sizeof(double) * i, sizeof(bits));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = __builtin_bswap64(bits);
+#endif
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    vm.globals.values[columnSlots[i]] = NUMBER_VAL(value);
+  }
+}
+
+static void appendOutput(Batch *batch, const char *chars, size_t length) {
+  if (batch->outputCount + length > batch->outputCapacity) {
+    size_t oldCapacity = batch->outputCapacity;
+    size_t capacity = GROW_CAPACITY(oldCapacity);
+    while (capacity < batch->outputCount + length) {
+      capacity = GROW_CAPACITY(capacity);
+    }
+    batch->output = GROW_ARRAY(char, batch->output, oldCapacity, capacity);
+    batch->outputCapacity = capacity;
+  }
+  memcpy(batch->output + batch->outputCount, chars, length);
+  batch->outputCount += length;
+}
+
+// the result the way writeValue() prints it, and a newline
+static void appendResult(Batch *batch, Value value) {
+  char number[NUMBER_BUFFER_SIZE + 1];
+  switch (value.type) {
+  case VAL_NUMBER: {
+    int length = formatNumber(AS_NUMBER(value), number);
+    number[length] = '\n';
+    appendOutput(batch, number, length + 1);
+    return;
+  }
+  case VAL_INT: {
+    int length = formatInteger(AS_INT(value), number);
+    number[length] = '\n';
+    appendOutput(batch, number, length + 1);
+    return;
+  }
+  case VAL_BOOL:
+    appendOutput(batch, AS_BOOL(value) ? "true\n" : "false\n",
+                 AS_BOOL(value) ? 5 : 6);
+    return;
+  case VAL_NIL:
+    appendOutput(batch, "nil\n", 4);
+    return;
+  case VAL_OBJ:
+    appendOutput(batch, AS_CSTRING(value), AS_STRING(value)->length);
+    appendOutput(batch, "\n", 1);
+    return;
+  }
+}
+
+// parses each row of the batch into the column globals and runs chunk for
+// it, until a row fails
+static void runBatch(Batch *batch, Chunk *chunk) {
+  batch->outputCount = 0;
+  batch->status = ROWS_OK;
+  batch->failedRow = -1;
+  const char *line = batch->input;
+  for (int row = 0; row < batch->rowCount; row++) {
+    if (format == ROWS_CSV) {
+      if (!loadCsvRow(&line)) {
+        batch->status = ROWS_BAD_ROW;
+        batch->failedRow = row;
+        return;
+      }
+    } else {
+      loadF64Row(batch->input + sizeof(double) * columnCount * row);
+    }
+
+    Value result;
+    if (interpretChunk(chunk, &result) != INTERPRET_OK) {
+      batch->status = ROWS_RUNTIME_ERROR;
+      batch->failedRow = row;
+      for (int i = 0; i < columnCount; i++) {
+        batch->failedColumns[i] = vm.globals.values[columnSlots[i]];
+      }
+      return;
+    }
+    appendResult(batch, result);
+  }
+}
+
+// the main thread's interned strings, on this thread. A string the script
+// makes here then is the same object as an equal one among its constants,
+// which came from the main thread, and comparing them still works
+static void copyStrings() {
+  for (int i = 0; i < mainVM->strings.capacity; i++) {
+    Entry *entry = &mainVM->strings.entries[i];
+    if (entry->key != NULL) {
+      tableSet(&vm.strings, entry->key, NIL_VAL);
+    }
+  }
+}
+
+static void *runWorker(void *unused) {
+  (void)unused;
+  initVM();
+  vm.quiet = true;
+  vm.useJit = mainVM->useJit;
+  for (int i = 0; i < mainVM->globals.count; i++) {
+    writeValueArray(&vm.globals, mainVM->globals.values[i]);
+  }
+  copyStrings();
+  Chunk chunk;
+  initChunk(&chunk);
+  copyChunk(&chunk, &script);
+
+  for (;;) {
+    pthread_mutex_lock(&lock);
+    while (batchesTaken == batchesFilled && !finished) {
+      pthread_cond_wait(&batchFilled, &lock);
+    }
+    if (batchesTaken == batchesFilled) {
+      pthread_mutex_unlock(&lock);
+      break;
+    }
+    Batch *batch = &batches[batchesTaken++ % batchCount];
+    pthread_mutex_unlock(&lock);
+
+    runBatch(batch, &chunk);
+    // the script is pure, so the strings it made are gone with the results.
+    // Freeing them keeps memory from growing with the input
+    if (vm.objects != NULL) {
+      freeObjects();
+      copyStrings();
+    }
+
+    pthread_mutex_lock(&lock);
+    batch->done = true;
+    pthread_cond_broadcast(&batchDone);
+    pthread_mutex_unlock(&lock);
+  }
+
+  freeChunk(&chunk);
+  freeVM();
+  return NULL;
+}
+
+// writes out what the batch has and reports the row that failed, if one did.
+// A worker ran it if quietly is set, and then the row that failed has to run
+// again to report its error. Returns the exit code, 0 if nothing failed
+static int finishBatch(Batch *batch, bool quietly) {
+  if (batch->outputCount > 0) {
+    writeOutput(batch->output, (int)batch->outputCount);
+  }
+  int64_t row = batch->firstRow + batch->failedRow;
+  switch (batch->status) {
+  case ROWS_OK:
+    break;
+  case ROWS_BAD_ROW:
+    flushOutput();
+    fprintf(stderr, "[row %lld] Expected %d number%s separated by commas.\n",
+            (long long)row, columnCount, columnCount == 1 ? "" : "s");
+    return 65;
+  case ROWS_RUNTIME_ERROR:
+    flushOutput();
+    // the script is pure, so it fails the same way again
+    if (quietly) {
+      for (int i = 0; i < columnCount; i++) {
+        vm.globals.values[columnSlots[i]] = batch->failedColumns[i];
+      }
+      Value result;
+      interpretChunk(&script, &result);
+    }
+    fprintf(stderr, "[row %lld] in %s\n", (long long)row, reader.name);
+    return 70;
+  }
+
+  if (batch->cutOff) {
+    flushOutput();
+    fprintf(stderr, "[row %lld] The input ends partway through the row.\n",
+            (long long)(batch->firstRow + batch->rowCount));
+    return 65;
+  }
+  return 0;
+}
+
+static void initBatch(Batch *batch) {
+  batch->input = NULL;
+  batch->inputCount = 0;
+  batch->inputCapacity = 0;
+  batch->output = NULL;
+  batch->outputCount = 0;
+  batch->outputCapacity = 0;
+  batch->failedColumns = GROW_ARRAY(Value, NULL, 0, columnCount);
+}
+
+static void freeBatch(Batch *batch) {
+  FREE_ARRAY(char, batch->input, batch->inputCapacity);
+  FREE_ARRAY(char, batch->output, batch->outputCapacity);
+  FREE_ARRAY(Value, batch->failedColumns, columnCount);
+}
+
+// every row on the main thread, a batch at a time
+static int runHere() {
+  Batch batch;
+  initBatch(&batch);
+  int status = 0;
+  int64_t row = 1;
+  while (status == 0 && fillBatch(&batch, row)) {
+    runBatch(&batch, &script);
+    status = finishBatch(&batch, false);
+    row += batch.rowCount;
+  }
+  freeBatch(&batch);
+  return status;
+}
+
+// lets the workers run out of batches and waits for them
+static void stopWorkers(pthread_t *workers, int threads) {
+  pthread_mutex_lock(&lock);
+  finished = true;
+  pthread_cond_broadcast(&batchFilled);
+  pthread_mutex_unlock(&lock);
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+}
+
+static int runOnWorkers(int threads) {
+  batchCount = threads * BATCHES_PER_WORKER;
+  batches = GROW_ARRAY(Batch, NULL, 0, batchCount);
+  for (int i = 0; i < batchCount; i++) {
+    initBatch(&batches[i]);
+  }
+  batchesFilled = 0;
+  batchesTaken = 0;
+  finished = false;
+  mainVM = &vm;
+  pthread_t *workers = GROW_ARRAY(pthread_t, NULL, 0, threads);
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&workers[i], NULL, runWorker, NULL);
+  }
+
+  int status = 0;
+  bool stopped = false;
+  int64_t batchesWritten = 0;
+  int64_t row = 1;
+  bool inputLeft = true;
+  while (status == 0) {
+    // keep all the batches busy
+    while (inputLeft && batchesFilled - batchesWritten < batchCount) {
+      Batch *batch = &batches[batchesFilled % batchCount];
+      inputLeft = fillBatch(batch, row);
+      if (!inputLeft)
+        break;
+      row += batch->rowCount;
+      batch->done = false;
+      pthread_mutex_lock(&lock);
+      batchesFilled++;
+      pthread_cond_signal(&batchFilled);
+      pthread_mutex_unlock(&lock);
+    }
+    if (batchesWritten == batchesFilled)
+      break;
+
+    Batch *batch = &batches[batchesWritten++ % batchCount];
+    pthread_mutex_lock(&lock);
+    while (!batch->done) {
+      pthread_cond_wait(&batchDone, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    // running the failed row again on this thread can make strings, which
+    // the workers mustn't be copying from its VM at the same time
+    if (batch->status == ROWS_RUNTIME_ERROR) {
+      stopWorkers(workers, threads);
+      stopped = true;
+    }
+    status = finishBatch(batch, true);
+  }
+  if (!stopped) {
+    stopWorkers(workers, threads);
+  }
+
+  FREE_ARRAY(pthread_t, workers, threads);
+  for (int i = 0; i < batchCount; i++) {
+    freeBatch(&batches[i]);
+  }
+  FREE_ARRAY(Batch, batches, batchCount);
+  return status;
+}
+
+// gives each of the names, separated by commas, a column and a global slot.
+// Spaces around a name don't count
+static bool addColumns(const char *names, size_t length) {
+  const char *end = names + length;
+  const char *start = names;
+  for (;;) {
+    const char *comma = memchr(start, ',', end - start);
+    const char *nameEnd = comma == NULL ? end : comma;
+    while (start < nameEnd && (*start == ' ' || *start == '\t')) {
+      start++;
+    }
+    while (nameEnd > start &&
+           (nameEnd[-1] == ' ' || nameEnd[-1] == '\t' || nameEnd[-1] == '\r')) {
+      nameEnd--;
+    }
+    if (nameEnd == start) {
+      fprintf(stderr, "Column %d has no name.\n", columnCount + 1);
+      return false;
+    }
+
+    int slot = globalSlot(copyString(start, (int)(nameEnd - start)));
+    if (slot == -1) {
+      fprintf(stderr, "Too many columns.\n");
+      return false;
+    }
+    columnSlots = GROW_ARRAY(int, columnSlots, columnCount, columnCount + 1);
+    columnSlots[columnCount++] = slot;
+
+    if (comma == NULL)
+      return true;
+    start = comma + 1;
+  }
+}
+
+// the names of the columns out of the first line of the CSV
+static bool readHeader() {
+  for (;;) {
+    char *newline =
+        memchr(reader.bytes + reader.start, '\n', reader.end - reader.start);
+    if (newline != NULL || reader.eof) {
+      size_t end =
+          newline == NULL ? reader.end : (size_t)(newline - reader.bytes);
+      if (end == reader.start) {
+        fprintf(stderr, "\"%s\" has no header line naming the columns.\n",
+                reader.name);
+        return false;
+      }
+      bool ok = addColumns(reader.bytes + reader.start, end - reader.start);
+      reader.start = newline == NULL ? end : end + 1;
+      return ok;
+    }
+    refill();
+  }
+}
+
+int runRows(const char *source, const char *inputPath,
+            const RowOptions *options) {
+  reader.name = inputPath == NULL ? "stdin" : inputPath;
+  reader.fd = inputPath == NULL ? STDIN_FILENO : open(inputPath, O_RDONLY);
+  if (reader.fd < 0) {
+    fprintf(stderr, "Could not open file \"%s\".\n", inputPath);
+    return 74;
+  }
+  reader.capacity = READ_SIZE;
+  reader.bytes = GROW_ARRAY(char, NULL, 0, reader.capacity);
+  reader.start = 0;
+  reader.end = 0;
+  reader.eof = false;
+#ifdef POSIX_FADV_SEQUENTIAL
+  // the input is read once from start to end, so the kernel can read ahead
+  // as far as it likes
+  posix_fadvise(reader.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  format = options->format;
+  columnCount = 0;
+  columnSlots = NULL;
+  initChunk(&script);
+  bool ok = options->columns != NULL
+                ? addColumns(options->columns, strlen(options->columns))
+                : format == ROWS_CSV && readHeader();
+  int status = ok ? 0 : 65;
+  if (ok && !compile(source, &script)) {
+    status = 65;
+  } else if (ok && !verifyChunk(&script)) {
+    status = 65;
+  }
+
+  if (status == 0) {
+    script.verified = true;
+    // the workers copy it (see copyChunk()), which has to find it finished
+    finalizeChunk(&script);
+    int threads = options->threads;
+    if (threads == 0) {
+      threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#ifdef DEBUG_STATS
+    // the counters aren't meant to be shared between threads
+    threads = 1;
+#endif
+    status = threads > 1 && script.pure ? runOnWorkers(threads) : runHere();
+  }
+
+  freeChunk(&script);
+  FREE_ARRAY(int, columnSlots, columnCount);
+  FREE_ARRAY(char, reader.bytes, reader.capacity);
+  if (inputPath != NULL) {
+    close(reader.fd);
+  }
+  return status;
+}
@@ -0,0 +1,52 @@
+#ifndef clox_rows_h
+#define clox_rows_h
+
+#include "common.h"
+
+// clox --rows=csv|f64 path [input]: runs the script once for every row of a
+// table of numbers and prints a line with the result for each row, in the
+// order of the rows. Each column is a global variable the script reads, so
+// over the columns price and quantity, `price * quantity` prints the total of
+// every row. The input is stdin unless a path to it is given. It is streamed:
+// however big it is, only a few batches of rows are in memory at any time
+//
+// the formats:
+//   csv  lines of numbers separated by commas. The first line names the
+//        columns, unless --columns already did
+//   f64  raw little-endian doubles, a row of them after the other, with
+//        --columns naming them
+//
+// the main thread reads the input in large blocks and hands it out in
+// batches of ROWS_PER_BATCH rows to worker threads. Each worker has a VM of
+// its own (see vm.h) and its own copy of the chunk, parses the rows and runs
+// the chunk for each one. The main thread writes out the results of a batch
+// once it and all the batches before it are done
+//
+// workers can only run a pure script (see Chunk.pure), since each of them
+// has its own globals. A script that assigns globals runs on the main thread
+// instead, one row after the other, so that every row sees what the ones
+// before it left behind
+
+#define ROWS_PER_BATCH 4096
+
+typedef enum {
+  ROWS_CSV,
+  ROWS_F64,
+} RowFormat;
+
+typedef struct {
+  RowFormat format;
+  // the names of the columns separated by commas, or NULL to take them from
+  // the first line of the CSV
+  const char *columns;
+  // worker threads. 0 for one per core, 1 to run on the main thread only
+  int threads;
+} RowOptions;
+
+// returns the exit code for main: 0, 65 if the script doesn't compile or the
+// input isn't rows of numbers, 70 for a row the script fails on and 74 if
+// the input can't be read
+int runRows(const char *source, const char *inputPath,
+            const RowOptions *options);
+
+#endif
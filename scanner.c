@@ -21,8 +21,71 @@ void initScanner(const char *source) {
   scanner.line = 1;
 }
 
-static bool isAlpha(char c) {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+// characters past ASCII that can't be in an identifier: the spaces, dashes,
+// quotes, operators and other symbols that get pasted into code, so that
+// a − b or a + b is an error instead of a name. Not every punctuation
+// character there is, but the blocks of them people actually run into
+static const struct {
+  uint32_t first;
+  uint32_t last;
+} notAlpha[] = {
+    // Latin-1 controls, NBSP and punctuation, except ª, µ and º
+    {0x80, 0xa9},
+    {0xab, 0xb4},
+    {0xb6, 0xb9},
+    {0xbb, 0xbf},
+    // × and ÷
+    {0xd7, 0xd7},
+    {0xf7, 0xf7},
+    {0x1680, 0x1680},
+    {0x180e, 0x180e},
+    // general punctuation, U+2000 to U+200A spaces, dashes, quotes, U+2028
+    // and U+2029, and currency symbols
+    {0x2000, 0x20cf},
+    // arrows and mathematical operators, U+2212 minus among them
+    {0x2190, 0x22ff},
+    {0x27c0, 0x27ef},
+    {0x2980, 0x2aff},
+    {0x2e00, 0x2e7f},
+    // ideographic space and CJK punctuation
+    {0x3000, 0x3003},
+    {0x3008, 0x3020},
+    {0xfe30, 0xfe6f},
+    // U+FEFF zero width no-break space
+    {0xfeff, 0xfeff},
+    // fullwidth punctuation
+    {0xff01, 0xff0f},
+    {0xff1a, 0xff20},
+    {0xff3b, 0xff40},
+    {0xff5b, 0xff65},
+    {0xfff0, 0xffff},
+};
+
+// how many bytes the character at c takes if it can be in an identifier, 0
+// if it can't. Past ASCII that is every character but the ones in notAlpha,
+// so π and größe are names. compile() has made sure the source is valid
+// UTF-8 (see utf8.h), so these bytes always come as whole characters
+static int alphaLength(const char *c) {
+  unsigned char byte = (unsigned char)*c;
+  if ((byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') ||
+      byte == '_')
+    return 1;
+  if (byte < 0x80)
+    return 0;
+
+  // the lead byte says how many continuation bytes follow, each with six
+  // more bits
+  int length = byte >= 0xf0 ? 4 : byte >= 0xe0 ? 3 : 2;
+  uint32_t codePoint = byte & (0x7f >> length);
+  for (int i = 1; i < length; i++) {
+    codePoint = codePoint << 6 | ((unsigned char)c[i] & 0x3f);
+  }
+  int rangeCount = sizeof(notAlpha) / sizeof(notAlpha[0]);
+  for (int i = 0; i < rangeCount; i++) {
+    if (codePoint >= notAlpha[i].first && codePoint <= notAlpha[i].last)
+      return 0;
+  }
+  return length;
 }
 
 static bool isDigit(char c) { return c >= '0' && c <= '9'; }
@@ -180,8 +243,11 @@ static TokenType identifierType() {
 }
 
 static Token identifier() {
-  while (isAlpha(peek()) || isDigit(peek())) {
-    advance();
+  for (;;) {
+    int length = isDigit(peek()) ? 1 : alphaLength(scanner.current);
+    if (length == 0)
+      break;
+    scanner.current += length;
   }
 
   return makeToken(identifierType());
@@ -235,10 +301,13 @@ Token scanToken() {
   if (isAtEnd())
     return makeToken(TOKEN_EOF);
 
-  char c = advance();
-
-  if (isAlpha(c))
+  int length = alphaLength(scanner.current);
+  if (length > 0) {
+    scanner.current += length;
     return identifier();
+  }
+
+  char c = advance();
 
   if (isDigit(c))
     return number();
@@ -267,7 +336,7 @@ Token scanToken() {
   case '*':
     return makeToken(TOKEN_STAR);
   case '!':
-    return makeToken(match('=') ? TOKEN_EQUAL : TOKEN_BANG);
+    return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
   case '=':
     return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
   case '<':
@@ -278,5 +347,10 @@ Token scanToken() {
     return string();
   }
 
+  // a character past ASCII that can't be in a name. The rest of its bytes
+  // go with it, so that the next token starts at the next character
+  while (((unsigned char)peek() & 0xc0) == 0x80) {
+    advance();
+  }
   return errorToken("Unexpected character.");
 }
@@ -0,0 +1,468 @@
+#include "server.h"
+#include "chunk.h"
+#include "common.h"
+#include "compiler.h"
+#include "dtoa.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+// how much is read from a socket at a time
+#define READ_SIZE (64 * 1024)
+// how many requests a connection gets answered before the others get their
+// turn, so that one client pipelining lots of them can't hold up the rest
+#define REQUESTS_PER_TURN 64
+// a connection with more responses than this waiting to be sent isn't read
+// from until the client has taken some of them, so that a client that sends
+// without reading can't make the server buffer without end
+#define MAX_PENDING_OUTPUT (1024 * 1024)
+
+// a growable byte buffer. Everything before start has already been consumed
+// (parsed for input, sent for output), so it is compacted away lazily
+typedef struct {
+  uint8_t *bytes;
+  int start;
+  int count;
+  int capacity;
+} Buffer;
+
+typedef struct Connection Connection;
+
+struct Connection {
+  int fd;
+  Buffer in;
+  Buffer out;
+  // whether epoll waits for the socket to become readable, which it doesn't
+  // while there are more than MAX_PENDING_OUTPUT bytes to send
+  bool waitingToRead;
+  // whether epoll is also waiting for the socket to become writable, which
+  // is only the case while a response didn't fit into the socket
+  bool waitingToWrite;
+  // whether the connection is in the backlog, see below
+  bool backlogged;
+  Connection *nextBacklogged;
+};
+
+static int epollFd = -1;
+// connections that have requests left in their input buffer after their
+// turn. epoll won't report them again if the socket has nothing more to read,
+// so the event loop takes them up again itself
+static Connection *backlog = NULL;
+// compile and runtime errors are printed here instead of to stderr, so they
+// can go into the response (see VM.errors)
+static FILE *errors = NULL;
+static char *errorText = NULL;
+static size_t errorSize = 0;
+// set from the signal handler, the event loop checks it when epoll_wait is
+// interrupted
+static volatile sig_atomic_t stopping = 0;
+
+static void onStopSignal(int signal) {
+  (void)signal;
+  stopping = 1;
+}
+
+// make room for at least `length` more bytes at the end of the buffer
+static void reserve(Buffer *buffer, int length) {
+  // slide the unconsumed bytes back to the front before growing
+  if (buffer->start > 0) {
+    memmove(buffer->bytes, buffer->bytes + buffer->start,
+            buffer->count - buffer->start);
+    buffer->count -= buffer->start;
+    buffer->start = 0;
+  }
+  if (buffer->count + length > buffer->capacity) {
+    int oldCapacity = buffer->capacity;
+    int capacity = GROW_CAPACITY(oldCapacity);
+    while (capacity < buffer->count + length) {
+      capacity = GROW_CAPACITY(capacity);
+    }
+    buffer->bytes = GROW_ARRAY(uint8_t, buffer->bytes, oldCapacity, capacity);
+    buffer->capacity = capacity;
+  }
+}
+
+static void freeBuffer(Buffer *buffer) {
+  FREE_ARRAY(uint8_t, buffer->bytes, buffer->capacity);
+}
+
+static void addToBacklog(Connection *connection) {
+  if (connection->backlogged)
+    return;
+  connection->backlogged = true;
+  connection->nextBacklogged = backlog;
+  backlog = connection;
+}
+
+static void closeConnection(Connection *connection) {
+  if (connection->backlogged) {
+    Connection **link = &backlog;
+    while (*link != connection) {
+      link = &(*link)->nextBacklogged;
+    }
+    *link = connection->nextBacklogged;
+  }
+  // closing the fd also takes it out of the epoll set
+  close(connection->fd);
+  freeBuffer(&connection->in);
+  freeBuffer(&connection->out);
+  reallocate(connection, sizeof(Connection), 0);
+}
+
+// the result as the REPL would print it, without the newline. Strings can be
+// any length, they don't go through here but are copied straight into the
+// response
+static int formatValue(Value value, char *buffer) {
+  switch (value.type) {
+  case VAL_NUMBER:
+    return formatNumber(AS_NUMBER(value), buffer);
+  case VAL_INT:
+    return formatInteger(AS_INT(value), buffer);
+  case VAL_BOOL:
+    memcpy(buffer, AS_BOOL(value) ? "true" : "false", AS_BOOL(value) ? 4 : 5);
+    return AS_BOOL(value) ? 4 : 5;
+  case VAL_NIL:
+    memcpy(buffer, "nil", 3);
+    return 3;
+  case VAL_OBJ:
+    break;
+  }
+  return 0;
+}
+
+static void writeLength(uint8_t *bytes, uint32_t length) {
+  bytes[0] = length & 0xff;
+  bytes[1] = (length >> 8) & 0xff;
+  bytes[2] = (length >> 16) & 0xff;
+  bytes[3] = (length >> 24) & 0xff;
+}
+
+static uint32_t readLength(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+         (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+// compile and run one request and queue the response. The VM is the same one
+// for every request, its stack is already allocated and sized from earlier
+// requests, so a request costs a compile and a run and nothing else
+static void evaluate(Connection *connection, const uint8_t *source,
+                     uint32_t length) {
+  // the compiler wants a string. The bytes after the request in the input
+  // buffer belong to the next one, so copy it out
+  char *string = GROW_ARRAY(char, NULL, 0, length + 1);
+  memcpy(string, source, length);
+  string[length] = '\0';
+
+  Chunk chunk;
+  initChunk(&chunk);
+  InterpretResult result = INTERPRET_COMPILE_ERROR;
+  Value value;
+  rewind(errors);
+  if (compile(string, &chunk)) {
+    result = interpretChunk(&chunk, &value);
+  }
+  freeChunk(&chunk);
+  FREE_ARRAY(char, string, length + 1);
+
+  char buffer[NUMBER_BUFFER_SIZE];
+  const char *text = buffer;
+  int textLength = 0;
+  if (result == INTERPRET_OK && IS_STRING(value)) {
+    text = AS_CSTRING(value);
+    textLength = AS_STRING(value)->length;
+  } else if (result == INTERPRET_OK) {
+    textLength = formatValue(value, buffer);
+  } else {
+    // the messages the way clox prints them, but without the last newline.
+    // The stream is rewound for every request and the size is where it is
+    // now, so nothing an earlier request printed is left in it
+    fflush(errors);
+    text = errorText;
+    textLength = (int)errorSize;
+    if (textLength > 0 && text[textLength - 1] == '\n') {
+      textLength--;
+    }
+  }
+
+  Buffer *out = &connection->out;
+  reserve(out, 4 + 1 + textLength);
+  writeLength(out->bytes + out->count, 1 + textLength);
+  out->bytes[out->count + 4] = (uint8_t)result;
+  memcpy(out->bytes + out->count + 5, text, textLength);
+  out->count += 4 + 1 + textLength;
+
+  // there is no garbage collector, and nothing a request makes is needed by
+  // the next one, so once the response has its copy, all the strings the
+  // request made (and interned) go. So do its globals: every request starts
+  // without any, and their names are among those strings
+  freeGlobals();
+  freeObjects();
+}
+
+static bool outputFull(Connection *connection) {
+  return connection->out.count - connection->out.start > MAX_PENDING_OUTPUT;
+}
+
+// evaluate the complete requests in the input buffer, up to REQUESTS_PER_TURN
+// of them and only while the output isn't full. Returns false if the client
+// sent something we won't accept
+static bool handleRequests(Connection *connection) {
+  Buffer *in = &connection->in;
+  int handled = 0;
+  while (in->count - in->start >= 4 && !outputFull(connection)) {
+    // there may be more, which wait for the connection's next turn
+    if (handled == REQUESTS_PER_TURN) {
+      addToBacklog(connection);
+      break;
+    }
+    uint32_t length = readLength(in->bytes + in->start);
+    if (length > SERVER_MAX_REQUEST) {
+      fprintf(stderr, "Request of %u bytes is too large.\n", length);
+      return false;
+    }
+    // wait for the rest of it
+    if ((uint32_t)(in->count - in->start - 4) < length)
+      break;
+    evaluate(connection, in->bytes + in->start + 4, length);
+    in->start += 4 + length;
+    handled++;
+  }
+  return true;
+}
+
+static bool watch(Connection *connection, bool readable, bool writable) {
+  if (readable == connection->waitingToRead &&
+      writable == connection->waitingToWrite)
+    return true;
+  struct epoll_event event;
+  event.events = (readable ? EPOLLIN : 0) | (writable ? EPOLLOUT : 0);
+  event.data.ptr = connection;
+  if (epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event) < 0) {
+    perror("epoll_ctl");
+    return false;
+  }
+  // requests that came in while the output was full can be answered now
+  if (readable && !connection->waitingToRead &&
+      connection->in.start < connection->in.count) {
+    addToBacklog(connection);
+  }
+  connection->waitingToRead = readable;
+  connection->waitingToWrite = writable;
+  return true;
+}
+
+// send as much of the queued responses as the socket takes. Whatever is left
+// goes out once epoll says the socket is writable again. Returns false if the
+// connection is gone
+static bool flushResponses(Connection *connection) {
+  Buffer *out = &connection->out;
+  while (out->start < out->count) {
+    // MSG_NOSIGNAL: a client that went away shows up as EPIPE instead of a
+    // SIGPIPE killing the server
+    ssize_t sent = send(connection->fd, out->bytes + out->start,
+                        out->count - out->start, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return false;
+    }
+    out->start += (int)sent;
+  }
+
+  if (out->start == out->count) {
+    out->start = out->count = 0;
+  }
+  return watch(connection, !outputFull(connection), out->count > 0);
+}
+
+// answer the requests left from the connection's last turn, then read what
+// the socket has and answer requests as they complete, until the turn or the
+// output is used up. Returns false if the connection should be closed
+static bool readRequests(Connection *connection) {
+  Buffer *in = &connection->in;
+  if (!handleRequests(connection))
+    return false;
+  while (!connection->backlogged && !outputFull(connection)) {
+    reserve(in, READ_SIZE);
+    ssize_t received = recv(connection->fd, in->bytes + in->count,
+                            in->capacity - in->count, 0);
+    if (received < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return false;
+    }
+    // the client closed its end
+    if (received == 0)
+      return false;
+    in->count += (int)received;
+    if (!handleRequests(connection))
+      return false;
+  }
+
+  if (in->start == in->count) {
+    in->start = in->count = 0;
+  }
+  return flushResponses(connection);
+}
+
+static void acceptConnections(int listenFd) {
+  for (;;) {
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("accept");
+      }
+      return;
+    }
+    // the event loop must never block on a client
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    Connection *connection = reallocate(NULL, 0, sizeof(Connection));
+    connection->fd = fd;
+    connection->in = (Buffer){NULL, 0, 0, 0};
+    connection->out = (Buffer){NULL, 0, 0, 0};
+    connection->waitingToRead = true;
+    connection->waitingToWrite = false;
+    connection->backlogged = false;
+    connection->nextBacklogged = NULL;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      perror("epoll_ctl");
+      closeConnection(connection);
+    }
+  }
+}
+
+static int openSocket(const char *socketPath) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(socketPath) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path \"%s\" is too long.\n", socketPath);
+    return -1;
+  }
+  strcpy(address.sun_path, socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  // a socket file left behind by an earlier server would make bind fail
+  unlink(socketPath);
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    fprintf(stderr, "Could not listen on \"%s\": %s.\n", socketPath,
+            strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int serve(const char *socketPath) {
+  int listenFd = openSocket(socketPath);
+  if (listenFd < 0)
+    return 74;
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) {
+    perror("epoll_create1");
+    close(listenFd);
+    unlink(socketPath);
+    return 74;
+  }
+  // the listening socket is told apart from connections by its NULL pointer
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+  // no SA_RESTART, so that epoll_wait returns with EINTR and we get to clean
+  // up the socket file
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onStopSignal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  errors = open_memstream(&errorText, &errorSize);
+  vm.errors = errors;
+
+  fprintf(stderr, "Listening on %s\n", socketPath);
+  struct epoll_event events[MAX_EVENTS];
+  while (!stopping) {
+    // with a backlog, only look for what else is ready without waiting
+    int ready = epoll_wait(epollFd, events, MAX_EVENTS, backlog ? 0 : -1);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      Connection *connection = events[i].data.ptr;
+      if (connection == NULL) {
+        acceptConnections(listenFd);
+        continue;
+      }
+
+      bool open = true;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        open = readRequests(connection);
+      }
+      if (open && (events[i].events & EPOLLOUT)) {
+        open = flushResponses(connection);
+      }
+      if (!open) {
+        closeConnection(connection);
+      }
+    }
+
+    // every backlogged connection gets another turn. Those that still have
+    // requests left afterwards go into the next backlog
+    Connection *connection = backlog;
+    backlog = NULL;
+    while (connection != NULL) {
+      Connection *next = connection->nextBacklogged;
+      connection->backlogged = false;
+      if (!readRequests(connection)) {
+        closeConnection(connection);
+      }
+      connection = next;
+    }
+  }
+
+  // connections still open at this point are simply dropped, the process is
+  // about to exit anyway
+  vm.errors = stderr;
+  fclose(errors);
+  free(errorText);
+  close(epollFd);
+  close(listenFd);
+  unlink(socketPath);
+  return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef clox_server_h
+#define clox_server_h
+
+// clox --serve <socket>: an evaluation server on a Unix domain socket, so that
+// clients don't pay for starting a process (and a VM) per expression
+// a single thread runs an epoll event loop over all connections and
+// evaluates requests with the one VM as they arrive. Requests and responses
+// are framed the same way:
+//   4 bytes  little-endian length of what follows
+//   request:  the source code
+//   response: 1 byte InterpretResult, then the result as text if it is
+//             INTERPRET_OK, otherwise the error messages as clox would
+//             print them
+// a connection can send any number of requests, also without waiting for the
+// responses, which come back in order. Connections take turns, each getting
+// a bounded number of requests answered per turn, and one whose client
+// leaves too many responses unread isn't read from until it catches up
+
+// the largest request the server accepts. A client sending more is
+// disconnected
+#define SERVER_MAX_REQUEST (16 * 1024 * 1024)
+
+// runs until SIGINT or SIGTERM. Returns the exit code for main
+int serve(const char *socketPath);
+
+#endif
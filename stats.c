@@ -0,0 +1,111 @@
+#include "stats.h"
+
+#ifdef DEBUG_STATS
+
+#include "debug.h"
+
+#ifdef DEBUG_STATS_CYCLES
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define READ_CYCLES() __rdtsc()
+#else
+// no time stamp counter, nanoseconds are the next best thing
+#include <time.h>
+static uint64_t readNanoseconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#define READ_CYCLES() readNanoseconds()
+#endif
+#endif
+
+VMStats vmStats;
+
+// called at the top of the dispatch loop, right before the instruction runs
+void statsInstruction(uint8_t instruction, int stackDepth) {
+#ifdef DEBUG_STATS_CYCLES
+  uint64_t now = READ_CYCLES();
+  // whatever happened since the last call belongs to the last instruction
+  if (vmStats.started != 0) {
+    vmStats.cycles[vmStats.current] += now - vmStats.started;
+  }
+  vmStats.started = now;
+#endif
+  vmStats.current = instruction;
+  vmStats.executed[instruction]++;
+  if (stackDepth > vmStats.stackHighWater) {
+    vmStats.stackHighWater = stackDepth;
+  }
+}
+
+// the last instruction of a run (OP_RETURN or the one that failed) has no
+// next instruction to close it off, so that happens here
+void statsRunEnd() {
+#ifdef DEBUG_STATS_CYCLES
+  if (vmStats.started != 0) {
+    vmStats.cycles[vmStats.current] += READ_CYCLES() - vmStats.started;
+    vmStats.started = 0;
+  }
+#endif
+}
+
+static uint64_t totalExecuted() {
+  uint64_t total = 0;
+  for (int i = 0; i < 256; i++) {
+    total += vmStats.executed[i];
+  }
+  return total;
+}
+
+void writeStats(FILE *out) {
+  uint64_t total = totalExecuted();
+  fprintf(out, "== stats ==\n");
+  fprintf(out, "runs:             %llu\n", (unsigned long long)vmStats.runs);
+  fprintf(out, "runtime errors:   %llu\n",
+          (unsigned long long)vmStats.runtimeErrors);
+  fprintf(out, "stack high-water: %d\n", vmStats.stackHighWater);
+  fprintf(out, "instructions:     %llu\n", (unsigned long long)total);
+#ifdef DEBUG_STATS_CYCLES
+  fprintf(out, "%-24s %14s %7s %14s %10s\n", "opcode", "executed", "%",
+          "cycles", "cycles/op");
+#else
+  fprintf(out, "%-24s %14s %7s\n", "opcode", "executed", "%");
+#endif
+  for (int i = 0; i < 256; i++) {
+    if (vmStats.executed[i] == 0)
+      continue;
+    fprintf(out, "%-24s %14llu %6.2f%%", opcodeName((uint8_t)i),
+            (unsigned long long)vmStats.executed[i],
+            100.0 * vmStats.executed[i] / total);
+#ifdef DEBUG_STATS_CYCLES
+    fprintf(out, " %14llu %10.1f", (unsigned long long)vmStats.cycles[i],
+            (double)vmStats.cycles[i] / vmStats.executed[i]);
+#endif
+    fprintf(out, "\n");
+  }
+}
+
+void writeStatsJson(FILE *out) {
+  fprintf(out, "{\"runs\": %llu, \"runtimeErrors\": %llu, ",
+          (unsigned long long)vmStats.runs,
+          (unsigned long long)vmStats.runtimeErrors);
+  fprintf(out, "\"stackHighWater\": %d, \"instructions\": %llu, ",
+          vmStats.stackHighWater, (unsigned long long)totalExecuted());
+  fprintf(out, "\"opcodes\": {");
+  bool first = true;
+  for (int i = 0; i < 256; i++) {
+    if (vmStats.executed[i] == 0)
+      continue;
+    fprintf(out, "%s\"%s\": {\"executed\": %llu", first ? "" : ", ",
+            opcodeName((uint8_t)i), (unsigned long long)vmStats.executed[i]);
+#ifdef DEBUG_STATS_CYCLES
+    fprintf(out, ", \"cycles\": %llu", (unsigned long long)vmStats.cycles[i]);
+#endif
+    fprintf(out, "}");
+    first = false;
+  }
+  fprintf(out, "}}\n");
+}
+
+#endif
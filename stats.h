@@ -0,0 +1,52 @@
+#ifndef clox_stats_h
+#define clox_stats_h
+
+#include "common.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// execution statistics for deciding which instructions are worth
+// specializing or fusing. With DEBUG_STATS defined, run() counts how often
+// each opcode executes, how deep the stack gets and how many runs end in a
+// runtime error. With DEBUG_STATS_CYCLES defined as well, it also adds up the
+// time stamp counter cycles spent in each opcode
+// without DEBUG_STATS all of the STATS_ macros below are empty, so the
+// interpreter is exactly what it is without them
+
+#ifdef DEBUG_STATS
+
+typedef struct {
+  uint64_t executed[256];
+  uint64_t cycles[256];
+  uint64_t runs;
+  uint64_t runtimeErrors;
+  int stackHighWater;
+  // the opcode that is running and when it started, so that its cycles can be
+  // added up once the next one starts
+  uint8_t current;
+  uint64_t started;
+} VMStats;
+
+extern VMStats vmStats;
+
+void statsInstruction(uint8_t instruction, int stackDepth);
+void statsRunEnd();
+void writeStats(FILE *out);
+void writeStatsJson(FILE *out);
+
+#define STATS_INSTRUCTION(instruction, stackDepth)                             \
+  statsInstruction(instruction, stackDepth)
+#define STATS_RUN_BEGIN() (vmStats.runs++)
+#define STATS_RUN_END() statsRunEnd()
+#define STATS_RUNTIME_ERROR() (vmStats.runtimeErrors++)
+
+#else
+
+#define STATS_INSTRUCTION(instruction, stackDepth)
+#define STATS_RUN_BEGIN()
+#define STATS_RUN_END()
+#define STATS_RUNTIME_ERROR()
+
+#endif
+
+#endif
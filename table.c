@@ -0,0 +1,96 @@
+#include "table.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include <stdlib.h>
+#include <string.h>
+
+// the table grows once it is three quarters full. Past that, linear probing
+// runs into long clusters of taken entries
+#define TABLE_MAX_LOAD 0.75
+
+void initTable(Table *table) {
+  table->count = 0;
+  table->capacity = 0;
+  table->entries = NULL;
+}
+
+void freeTable(Table *table) {
+  FREE_ARRAY(Entry, table->entries, table->capacity);
+  initTable(table);
+}
+
+// the entry key is in, or the empty one it would go in. There always is an
+// empty one, the load factor sees to that
+static Entry *findEntry(Entry *entries, int capacity, ObjString *key) {
+  uint32_t mask = (uint32_t)capacity - 1;
+  for (uint32_t index = key->hash & mask;; index = (index + 1) & mask) {
+    Entry *entry = &entries[index];
+    if (entry->key == key || entry->key == NULL)
+      return entry;
+  }
+}
+
+static void adjustCapacity(Table *table, int capacity) {
+  Entry *entries = GROW_ARRAY(Entry, NULL, 0, capacity);
+  for (int i = 0; i < capacity; i++) {
+    entries[i].key = NULL;
+    entries[i].hash = 0;
+    entries[i].value = NIL_VAL;
+  }
+
+  // the index depends on the capacity, so every entry has to be put in again
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->key == NULL)
+      continue;
+    *findEntry(entries, capacity, entry->key) = *entry;
+  }
+
+  FREE_ARRAY(Entry, table->entries, table->capacity);
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+bool tableGet(Table *table, ObjString *key, Value *value) {
+  if (table->count == 0)
+    return false;
+  Entry *entry = findEntry(table->entries, table->capacity, key);
+  if (entry->key == NULL)
+    return false;
+  *value = entry->value;
+  return true;
+}
+
+bool tableSet(Table *table, ObjString *key, Value value) {
+  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+    adjustCapacity(table, GROW_CAPACITY(table->capacity));
+  }
+
+  Entry *entry = findEntry(table->entries, table->capacity, key);
+  bool isNewKey = entry->key == NULL;
+  if (isNewKey)
+    table->count++;
+  entry->key = key;
+  entry->hash = key->hash;
+  entry->value = value;
+  return isNewKey;
+}
+
+ObjString *tableFindString(Table *table, const char *chars, int length,
+                           uint32_t hash) {
+  if (table->count == 0)
+    return NULL;
+
+  uint32_t mask = (uint32_t)table->capacity - 1;
+  for (uint32_t index = hash & mask;; index = (index + 1) & mask) {
+    Entry *entry = &table->entries[index];
+    if (entry->key == NULL)
+      return NULL;
+    // the hash is right there in the entry. Only when it matches is the key
+    // itself looked at
+    if (entry->hash == hash && entry->key->length == length &&
+        memcmp(entry->key->chars, chars, length) == 0)
+      return entry->key;
+  }
+}
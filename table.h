@@ -0,0 +1,41 @@
+#ifndef clox_table_h
+#define clox_table_h
+
+#include "common.h"
+#include "value.h"
+
+// a hash table from strings to values, with open addressing and linear
+// probing. Keys are interned strings (see object.h), so a key matches when it
+// is the same pointer and the characters never have to be compared, except
+// by tableFindString() which is how strings get interned in the first place
+//
+// every entry keeps a copy of its key's hash. A probe then compares hashes
+// that are already in the entry array it is walking, and only follows the
+// key pointer into the string when they match
+typedef struct {
+  // NULL for an empty entry
+  ObjString *key;
+  uint32_t hash;
+  Value value;
+} Entry;
+
+typedef struct {
+  int count;
+  // always a power of two, so the index is the hash with the top bits masked
+  // off instead of a division
+  int capacity;
+  Entry *entries;
+} Table;
+
+void initTable(Table *table);
+void freeTable(Table *table);
+// returns false, and leaves *value alone, if key isn't in the table
+bool tableGet(Table *table, ObjString *key, Value *value);
+// returns true if key is new to the table
+bool tableSet(Table *table, ObjString *key, Value value);
+// the key in the table with these characters and hash, or NULL if there is
+// none
+ObjString *tableFindString(Table *table, const char *chars, int length,
+                           uint32_t hash);
+
+#endif
@@ -0,0 +1,246 @@
+#include "utf8.h"
+#include "common.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UTF8_SSSE3
+#include <immintrin.h>
+#endif
+
+bool validateUtf8Scalar(const char *bytes, size_t length, size_t *invalid) {
+  const uint8_t *in = (const uint8_t *)bytes;
+  size_t i = 0;
+  while (i < length) {
+    // eight ASCII bytes at once. None of them has the high bit set
+    if (length - i >= 8) {
+      uint64_t word;
+      memcpy(&word, in + i, 8);
+      if ((word & 0x8080808080808080ull) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+
+    uint8_t c = in[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+
+    // the continuation bytes are 0x80 to 0xbf, except for the first one after
+    // the leads below. Those are narrowed so that there is only one way to
+    // encode each character (no overlong forms), no surrogates (U+D800 to
+    // U+DFFF) and nothing past U+10FFFF (RFC 3629)
+    int continuations;
+    uint8_t low = 0x80;
+    uint8_t high = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) {
+      continuations = 1;
+    } else if (c == 0xe0) {
+      continuations = 2;
+      low = 0xa0;
+    } else if (c == 0xed) {
+      continuations = 2;
+      high = 0x9f;
+    } else if (c >= 0xe1 && c <= 0xef) {
+      continuations = 2;
+    } else if (c == 0xf0) {
+      continuations = 3;
+      low = 0x90;
+    } else if (c == 0xf4) {
+      continuations = 3;
+      high = 0x8f;
+    } else if (c >= 0xf1 && c <= 0xf3) {
+      continuations = 3;
+    } else {
+      // a continuation byte without a lead, or a byte that never occurs
+      *invalid = i;
+      return false;
+    }
+
+    if (length - i <= (size_t)continuations) {
+      *invalid = i;
+      return false;
+    }
+    for (int j = 1; j <= continuations; j++) {
+      uint8_t next = in[i + j];
+      if (next < low || next > high) {
+        *invalid = i;
+        return false;
+      }
+      low = 0x80;
+      high = 0xbf;
+    }
+    i += continuations + 1;
+  }
+  return true;
+}
+
+#ifdef UTF8_SSSE3
+
+// what can be wrong with a pair of bytes. A table entry has a bit for each
+// error the pair might be, and an error is only real if all three tables
+// agree on it
+enum {
+  // a lead not followed by a continuation
+  TOO_SHORT = 1 << 0,
+  // a continuation after ASCII
+  TOO_LONG = 1 << 1,
+  // 0xe0 followed by 0x80 to 0x9f
+  OVERLONG_3 = 1 << 2,
+  // past U+10FFFF
+  TOO_LARGE = 1 << 3,
+  // 0xed followed by 0xa0 to 0xbf
+  SURROGATE = 1 << 4,
+  // 0xc0 or 0xc1
+  OVERLONG_2 = 1 << 5,
+  // 0xf0 followed by 0x80 to 0x8f, or a lead past 0xf4 followed by the same
+  OVERLONG_4 = 1 << 6,
+  TOO_LARGE_1000 = 1 << 6,
+  // a continuation after a continuation. Right for the third and fourth
+  // bytes of a character, which are checked for separately
+  TWO_CONTS = 1 << 7,
+  // in every entry of the low half table, the errors that don't depend on it
+  CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS,
+};
+
+#define B(bits) ((char)(bits))
+
+// the high half of the first byte
+#define BYTE_1_HIGH                                                            \
+  _mm_setr_epi8(B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),            \
+                B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),            \
+                B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS),        \
+                B(TOO_SHORT | OVERLONG_2), B(TOO_SHORT),                       \
+                B(TOO_SHORT | OVERLONG_3 | SURROGATE),                         \
+                B(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4))
+
+// the low half of the first byte
+#define BYTE_1_LOW                                                             \
+  _mm_setr_epi8(B(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),               \
+                B(CARRY | OVERLONG_2), B(CARRY), B(CARRY),                     \
+                B(CARRY | TOO_LARGE), B(CARRY | TOO_LARGE | TOO_LARGE_1000),   \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000),                         \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000),                         \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000),                         \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000),                         \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000),                         \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000),                         \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000),                         \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),             \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000),                         \
+                B(CARRY | TOO_LARGE | TOO_LARGE_1000))
+
+// the high half of the second byte
+#define BYTE_2_HIGH                                                            \
+  _mm_setr_epi8(                                                               \
+      B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),    \
+      B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),                                \
+      B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |      \
+        OVERLONG_4),                                                           \
+      B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),           \
+      B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),            \
+      B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),            \
+      B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT))
+
+// each byte of bytes looked up in table by its high or low four bits
+#define HIGH_HALF(table, bytes)                                                \
+  _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 4),              \
+                                        _mm_set1_epi8(0x0f)))
+#define LOW_HALF(table, bytes)                                                 \
+  _mm_shuffle_epi8(table, _mm_and_si128(bytes, _mm_set1_epi8(0x0f)))
+
+__attribute__((target("ssse3"))) static bool validSsse3(const uint8_t *in,
+                                                        size_t length) {
+  const __m128i byte1High = BYTE_1_HIGH;
+  const __m128i byte1Low = BYTE_1_LOW;
+  const __m128i byte2High = BYTE_2_HIGH;
+  // a byte over these, in the last three places of a block, is a lead whose
+  // character goes on into the next block
+  const __m128i lastLeads =
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    B(0xf0 - 1), B(0xe0 - 1), B(0xc0 - 1));
+  const __m128i zero = _mm_setzero_si128();
+  __m128i previous = zero;
+  __m128i error = zero;
+  // nonzero where the previous block ended in the middle of a character
+  __m128i incomplete = zero;
+
+  size_t i = 0;
+  for (;;) {
+    // most of a script is ASCII, and 64 bytes of it take one test. Only when
+    // the block before left no character unfinished, since nothing after it
+    // is checked
+    while (length - i > 64 &&
+           _mm_movemask_epi8(_mm_cmpeq_epi8(incomplete, zero)) == 0xffff) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+      __m128i b = _mm_loadu_si128((const __m128i *)(in + i + 16));
+      __m128i c = _mm_loadu_si128((const __m128i *)(in + i + 32));
+      __m128i d = _mm_loadu_si128((const __m128i *)(in + i + 48));
+      if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b),
+                                         _mm_or_si128(c, d))) != 0)
+        break;
+      previous = d;
+      i += 64;
+    }
+
+    __m128i input;
+    if (length - i >= 16) {
+      input = _mm_loadu_si128((const __m128i *)(in + i));
+    } else {
+      // the last few bytes, with zeros after them. A character that is cut
+      // off is then followed by ASCII, which is an error of its own
+      uint8_t last[16] = {0};
+      memcpy(last, in + i, length - i);
+      input = _mm_loadu_si128((const __m128i *)last);
+    }
+
+    if (_mm_movemask_epi8(input) == 0) {
+      // all ASCII. The only thing that can be wrong is a character from the
+      // block before that never got finished
+      error = _mm_or_si128(error, incomplete);
+      incomplete = zero;
+    } else {
+      // each byte next to the one, two and three bytes before it, which for
+      // the first bytes of the block are the last ones of the previous block
+      __m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+      __m128i special = _mm_and_si128(
+          _mm_and_si128(HIGH_HALF(byte1High, prev1),
+                        LOW_HALF(byte1Low, prev1)),
+          HIGH_HALF(byte2High, input));
+      // three bytes after a lead of 0xf0 or more, or two after one of 0xe0
+      // or more, there has to be a continuation. Those are the only places
+      // TWO_CONTS is not an error, and where it must be one
+      __m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+      __m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+      __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(B(0xe0 - 0x80)));
+      __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(B(0xf0 - 0x80)));
+      __m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth),
+                                     _mm_set1_epi8(B(0x80)));
+      error = _mm_or_si128(error, _mm_xor_si128(must23, special));
+      incomplete = _mm_subs_epu8(input, lastLeads);
+    }
+    previous = input;
+
+    if (length - i <= 16)
+      break;
+    i += 16;
+  }
+
+  error = _mm_or_si128(error, incomplete);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) == 0xffff;
+}
+
+#endif
+
+bool validateUtf8(const char *bytes, size_t length, size_t *invalid) {
+#ifdef UTF8_SSSE3
+  if (__builtin_cpu_supports("ssse3")) {
+    if (validSsse3((const uint8_t *)bytes, length))
+      return true;
+    // the blocks only say that something is wrong, not where
+    return validateUtf8Scalar(bytes, length, invalid);
+  }
+#endif
+  return validateUtf8Scalar(bytes, length, invalid);
+}
@@ -0,0 +1,29 @@
+#ifndef clox_utf8_h
+#define clox_utf8_h
+
+#include "common.h"
+
+// source code is UTF-8. compile() checks all of it up front, so the scanner
+// can go on looking at single bytes and never has to check an encoding: a
+// byte from 0x80 up is always part of a valid multi-byte character. Most of
+// those can be in an identifier, all of them in a string
+//
+// the check runs over 16 bytes at a time with SSSE3 where the CPU has it.
+// Each byte is looked up in three small tables, by the high and low half of
+// the byte before it and by its own high half, and the results AND'd
+// together are only nonzero when the pair of bytes can't occur in UTF-8
+// ("Validating UTF-8 In Less Than One Instruction Per Byte", Keiser and
+// Lemire). Everything else, like a character that is cut off or a third byte
+// that is missing, comes out of the same few instructions. Blocks of only
+// ASCII, which is most of a script, are skipped with a single test
+
+// true if the length bytes at bytes are valid UTF-8. If they aren't,
+// *invalid is the offset of the first byte that isn't part of a valid
+// character
+bool validateUtf8(const char *bytes, size_t length, size_t *invalid);
+// the same one character at a time, and eight bytes at a time through runs
+// of ASCII. validateUtf8() falls back on it on CPUs without SSSE3, and uses
+// it to find where the error is once it knows there is one
+bool validateUtf8Scalar(const char *bytes, size_t length, size_t *invalid);
+
+#endif
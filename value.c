@@ -1,7 +1,40 @@
 #include "value.h"
+#include "dtoa.h"
 #include "memory.h"
+#include "object.h"
 #include <stdio.h>
 
+// whether the double is exactly the integer. Converting the integer to a
+// double can round, so the double is converted back as well, where it is in
+// range for that
+static bool sameNumber(int64_t integer, double number) {
+  return (double)integer == number && number >= -9223372036854775808.0 &&
+         number < 9223372036854775808.0 && (int64_t)number == integer;
+}
+
+bool valuesEqual(Value a, Value b) {
+  if (a.type != b.type) {
+    if (IS_INT(a) && IS_NUMBER(b))
+      return sameNumber(AS_INT(a), AS_NUMBER(b));
+    if (IS_NUMBER(a) && IS_INT(b))
+      return sameNumber(AS_INT(b), AS_NUMBER(a));
+    return false;
+  }
+  switch (a.type) {
+  case VAL_BOOL:
+    return AS_BOOL(a) == AS_BOOL(b);
+  case VAL_NIL:
+    return true;
+  case VAL_NUMBER:
+    return AS_NUMBER(a) == AS_NUMBER(b);
+  case VAL_INT:
+    return AS_INT(a) == AS_INT(b);
+  case VAL_OBJ:
+    return AS_OBJ(a) == AS_OBJ(b);
+  }
+  return false;
+}
+
 void initValueArray(ValueArray *array) {
   array->values = NULL;
   array->capacity = 0;
@@ -26,5 +59,20 @@ void freeValueArray(ValueArray *array) {
 }
 
 void printValue(Value value) {
-  printf("value-of-constant: '%g'", AS_NUMBER(value));
+  if (IS_STRING(value)) {
+    printf("value-of-constant: '%s'", AS_CSTRING(value));
+    return;
+  }
+  if (IS_BOOL(value) || IS_NIL(value)) {
+    printf("value-of-constant: '%s'", IS_NIL(value)     ? "nil"
+                                      : AS_BOOL(value) ? "true"
+                                                       : "false");
+    return;
+  }
+  // %g would round to 6 significant digits, formatNumber() prints exactly
+  // the digits it takes to get the same double back
+  char number[NUMBER_BUFFER_SIZE];
+  int length = IS_INT(value) ? formatInteger(AS_INT(value), number)
+                             : formatNumber(AS_NUMBER(value), number);
+  printf("value-of-constant: '%.*s'", length, number);
 }
@@ -2,16 +2,35 @@
 #define clox_value_h
 
 #include "common.h"
+#include <math.h>
+
+// the heap objects, see object.h
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
 
 // a tagged union
 // value contains two parts: a type "tag" and a paylod for the actual value
 // below is the kind of value the VM supports -- the VM's notion of type, not
 // necessarily the user's notion of type
 // for example, every instance of a class is just type "instance" to the VM
+// VAL_NUMBER comes first so that its tag is zero. The VM's quickened number
+// instructions use that to check two operands at once: the tags OR'd together
+// are only zero when both are numbers
+// the language has two kinds of numbers: VAL_NUMBER is a double and VAL_INT a
+// 64-bit integer. A literal without a decimal point is an integer. Integer
+// arithmetic stays exact and only turns into a double when it would overflow
+// (see run() in vm.c). VAL_INT comes last so the tags that were already in
+// exported chunks (see debug.h) keep their values. As 3 it also has every bit
+// of the other tags set, so two tags AND'd together are only VAL_INT when both
+// are integers
+// VAL_OBJ is for everything that lives on the heap, like strings. As 4 it
+// shares no bits with VAL_INT, so the AND above still works
 typedef enum {
+  VAL_NUMBER,
   VAL_BOOL,
   VAL_NIL,
-  VAL_NUMBER,
+  VAL_INT,
+  VAL_OBJ,
 } ValueType;
 
 // here is the tagged union
@@ -32,10 +51,12 @@ typedef enum {
 typedef struct {
   // type tag -- type of the value
   ValueType type;
-  // value so far can be a bool or double
+  // value so far can be a bool, a double, an integer or a heap object
   union {
     bool boolean;
     double number;
+    int64_t integer;
+    Obj *obj;
   } as;
 } Value;
 
@@ -45,6 +66,10 @@ typedef struct {
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_INT(value) ((value).type == VAL_INT)
+#define IS_OBJ(value) ((value).type == VAL_OBJ)
+// either kind of number
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
 
 // takes a C value of the appropriate type and produces a Value that has the
 // correct type tag and contains the underlying value
@@ -56,11 +81,39 @@ typedef struct {
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = value}})
+#define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj *)object}})
 
 // to do anything with a Value, we need to unpack it and get the C value back
 // returns true if the Value has that type
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
+#define AS_INT(value) ((value).as.integer)
+#define AS_OBJ(value) ((value).as.obj)
+// either kind of number as a double, which is what arithmetic on a double and
+// an integer is done in. Looks at value twice, so don't hand it a pop()
+#define TO_NUMBER(value)                                                       \
+  (IS_INT(value) ? (double)AS_INT(value) : AS_NUMBER(value))
+
+// min() and max() in the language. C's fmin and fmax may give either zero for
+// 0 and -0, and which one depends on whether the C compiler inlined the call,
+// so folding and running could disagree. These are pinned down: a nan gives
+// that nan, and -0 counts as less than 0
+static inline double minNumber(double a, double b) {
+  if (isnan(a) || isnan(b))
+    return isnan(a) ? a : b;
+  if (a == b)
+    return signbit(a) ? a : b;
+  return a < b ? a : b;
+}
+
+static inline double maxNumber(double a, double b) {
+  if (isnan(a) || isnan(b))
+    return isnan(a) ? a : b;
+  if (a == b)
+    return signbit(a) ? b : a;
+  return a > b ? a : b;
+}
 
 // constant pool is a dynamic array of values
 typedef struct {
@@ -69,6 +122,10 @@ typedef struct {
   Value *values;
 } ValueArray;
 
+// == in the language. An integer and a double are equal if they are the same
+// number. Strings are interned, so two of them are equal if they are the same
+// object
+bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray *array);
 void writeValueArray(ValueArray *array, Value value);
 void freeValueArray(ValueArray *array);
@@ -0,0 +1,295 @@
+#include "verify.h"
+#include "chunk.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+int instructionLength(uint8_t instruction) {
+  switch (instruction) {
+  case OP_CONSTANT:
+    return 2;
+  case OP_CONSTANT_LONG:
+    return 4;
+  case OP_SMALL_INT:
+  case OP_PICK:
+  case OP_TUCK:
+    return 2;
+  case OP_SMALL_INT_LONG:
+  case OP_DEFINE_GLOBAL:
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+    return 3;
+  case OP_ZERO:
+  case OP_ONE:
+  case OP_DUP:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_NEGATE:
+  case OP_RETURN:
+  case OP_ADD_NUMBER:
+  case OP_SUBTRACT_NUMBER:
+  case OP_MULTIPLY_NUMBER:
+  case OP_DIVIDE_NUMBER:
+  case OP_NEGATE_NUMBER:
+  case OP_ADD_UNCHECKED:
+  case OP_SUBTRACT_UNCHECKED:
+  case OP_MULTIPLY_UNCHECKED:
+  case OP_DIVIDE_UNCHECKED:
+  case OP_NEGATE_UNCHECKED:
+  case OP_ADD_INT:
+  case OP_SUBTRACT_INT:
+  case OP_MULTIPLY_INT:
+  case OP_NEGATE_INT:
+  case OP_EQUAL:
+  case OP_NOT:
+  case OP_POP:
+  case OP_SQRT:
+  case OP_ABS:
+  case OP_FLOOR:
+  case OP_EXP:
+  case OP_MIN:
+  case OP_MAX:
+  case OP_POW:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// the message goes where compile and runtime errors go, so that in the
+// server it reaches the client too (see VM.errors)
+static bool fail(int offset, const char *message) {
+  fprintf(vm.errors, "Invalid bytecode at offset %d: %s\n", offset,
+          message);
+  return false;
+}
+
+// since there are no jumps, one pass from the first instruction to the last
+// sees every path through the chunk. Along the way we keep an abstract copy of
+// the stack that only records whether each slot is sure to hold a number, a
+// double that is. Integers don't count, the unchecked instructions would read
+// their bits as a double
+bool verifyChunk(Chunk *chunk) {
+  int capacity = chunk->maxStack;
+  bool *isNumber = GROW_ARRAY(bool, NULL, 0, capacity);
+  int depth = 0;
+  bool ok = true;
+
+  int offset = 0;
+  uint8_t instruction = OP_RETURN;
+  while (ok && offset < chunk->count) {
+    instruction = chunk->code[offset];
+    int length = instructionLength(instruction);
+    if (length == 0) {
+      ok = fail(offset, "unknown opcode.");
+      break;
+    }
+    if (offset + length > chunk->count) {
+      ok = fail(offset, "operand runs past the end of the chunk.");
+      break;
+    }
+
+    switch (instruction) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG: {
+      uint32_t index = chunk->code[offset + 1];
+      if (instruction == OP_CONSTANT_LONG) {
+        index |=
+            (chunk->code[offset + 2] << 8) | (chunk->code[offset + 3] << 16);
+      }
+      if (index >= (uint32_t)chunk->constants.count) {
+        ok = fail(offset, "constant index out of range.");
+      } else if (depth + 1 > capacity) {
+        ok = fail(offset, "stack deeper than the chunk's maxStack.");
+      } else {
+        isNumber[depth++] = IS_NUMBER(chunk->constants.values[index]);
+      }
+      break;
+    }
+
+    case OP_ZERO:
+    case OP_ONE:
+    case OP_SMALL_INT:
+    case OP_SMALL_INT_LONG:
+      if (depth + 1 > capacity) {
+        ok = fail(offset, "stack deeper than the chunk's maxStack.");
+      } else {
+        isNumber[depth++] = false;
+      }
+      break;
+
+    case OP_DUP:
+    case OP_PICK: {
+      int distance = instruction == OP_PICK ? chunk->code[offset + 1] : 0;
+      if (distance >= depth) {
+        ok = fail(offset, "stack underflow.");
+      } else if (depth + 1 > capacity) {
+        ok = fail(offset, "stack deeper than the chunk's maxStack.");
+      } else {
+        // the copy is whatever the original is
+        isNumber[depth] = isNumber[depth - 1 - distance];
+        depth++;
+      }
+      break;
+    }
+
+    case OP_TUCK: {
+      int distance = chunk->code[offset + 1];
+      if (distance < 1 || distance > depth) {
+        ok = fail(offset, "stack underflow.");
+      } else if (depth + 1 > capacity) {
+        ok = fail(offset, "stack deeper than the chunk's maxStack.");
+      } else {
+        memmove(&isNumber[depth - distance + 1], &isNumber[depth - distance],
+                distance * sizeof(bool));
+        isNumber[depth - distance] = isNumber[depth];
+        depth++;
+      }
+      break;
+    }
+
+    case OP_ADD_UNCHECKED:
+    case OP_SUBTRACT_UNCHECKED:
+    case OP_MULTIPLY_UNCHECKED:
+    case OP_DIVIDE_UNCHECKED:
+      if (depth >= 2 && (!isNumber[depth - 1] || !isNumber[depth - 2])) {
+        ok = fail(offset, "unchecked operator on a non-number.");
+        break;
+      }
+      // fall through
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_ADD_NUMBER:
+    case OP_SUBTRACT_NUMBER:
+    case OP_MULTIPLY_NUMBER:
+    case OP_DIVIDE_NUMBER:
+    case OP_ADD_INT:
+    case OP_SUBTRACT_INT:
+    case OP_MULTIPLY_INT:
+      if (depth < 2) {
+        ok = fail(offset, "stack underflow.");
+      } else {
+        // if it wasn't two numbers, the VM would have stopped with an error.
+        // It's a double unless both could be integers, and dividing always
+        // gives one. (The quickened instructions turn back into the generic
+        // ones when their operands change, so they go by the same rules)
+        depth--;
+        isNumber[depth - 1] = instruction == OP_DIVIDE ||
+                              instruction == OP_DIVIDE_NUMBER ||
+                              instruction == OP_DIVIDE_UNCHECKED ||
+                              isNumber[depth - 1] || isNumber[depth];
+      }
+      break;
+
+    case OP_NEGATE_UNCHECKED:
+      if (depth >= 1 && !isNumber[depth - 1]) {
+        ok = fail(offset, "unchecked operator on a non-number.");
+        break;
+      }
+      // fall through
+    case OP_NEGATE:
+    case OP_NEGATE_NUMBER:
+    case OP_NEGATE_INT:
+      // a negated double is a double, and a negated integer an integer, or a
+      // double if it overflowed
+      if (depth < 1) {
+        ok = fail(offset, "stack underflow.");
+      }
+      break;
+
+    // they check their operands and always give a double
+    case OP_SQRT:
+    case OP_ABS:
+    case OP_FLOOR:
+    case OP_EXP:
+      if (depth < 1) {
+        ok = fail(offset, "stack underflow.");
+      } else {
+        isNumber[depth - 1] = true;
+      }
+      break;
+
+    case OP_MIN:
+    case OP_MAX:
+    case OP_POW:
+      if (depth < 2) {
+        ok = fail(offset, "stack underflow.");
+      } else {
+        depth--;
+        isNumber[depth - 1] = true;
+      }
+      break;
+
+    case OP_EQUAL:
+      if (depth < 2) {
+        ok = fail(offset, "stack underflow.");
+      } else {
+        // a bool
+        depth--;
+        isNumber[depth - 1] = false;
+      }
+      break;
+
+    case OP_NOT:
+      if (depth < 1) {
+        ok = fail(offset, "stack underflow.");
+      } else {
+        isNumber[depth - 1] = false;
+      }
+      break;
+
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL: {
+      // the compiler made the slot before the chunk could run
+      uint32_t slot = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+      if (slot >= (uint32_t)vm.globals.count) {
+        ok = fail(offset, "global slot out of range.");
+      } else if (instruction == OP_GET_GLOBAL) {
+        if (depth + 1 > capacity) {
+          ok = fail(offset, "stack deeper than the chunk's maxStack.");
+        } else {
+          isNumber[depth++] = false;
+        }
+      } else if (depth < 1) {
+        ok = fail(offset, "stack underflow.");
+      } else if (instruction == OP_DEFINE_GLOBAL) {
+        depth--;
+      }
+      break;
+    }
+
+    case OP_POP:
+      if (depth < 1) {
+        ok = fail(offset, "stack underflow.");
+      } else {
+        depth--;
+      }
+      break;
+
+    case OP_RETURN:
+      if (depth < 1) {
+        ok = fail(offset, "stack underflow.");
+      } else {
+        depth--;
+      }
+      break;
+    }
+
+    offset += length;
+  }
+
+  if (ok && (chunk->count == 0 || instruction != OP_RETURN)) {
+    ok = fail(offset, "chunk doesn't end with OP_RETURN.");
+  }
+
+  FREE_ARRAY(bool, isNumber, capacity);
+  return ok;
+}
@@ -0,0 +1,25 @@
+#ifndef clox_verify_h
+#define clox_verify_h
+
+#include "chunk.h"
+#include "common.h"
+
+// the bytecode verifier. run() trusts the bytecode completely: it never checks
+// whether a push still fits on the stack, whether there is anything to pop or
+// whether a constant index is inside the constant pool. Instead, every chunk
+// is checked once before it runs the first time. A chunk passes if
+// - every opcode is known and its operands are inside the chunk
+// - every constant index is inside the constant pool
+// - every global slot is one the VM has (see VM.globals)
+// - no instruction pops more than is on the stack
+// - the stack never gets deeper than chunk->maxStack
+// - the _UNCHECKED instructions only ever see numbers
+// - it ends with OP_RETURN, so ip can't run off the end
+// reports the first problem on stderr and returns false
+bool verifyChunk(Chunk *chunk);
+
+// the size of an instruction in bytes, opcode included. 0 for an unknown
+// opcode
+int instructionLength(uint8_t instruction);
+
+#endif
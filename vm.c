@@ -3,38 +3,104 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "jit.h"
+#include "memo.h"
+#include "memory.h"
+#include "object.h"
+#include "output.h"
+#include "phases.h"
+#include "stats.h"
 #include "value.h"
+#include "verify.h"
+#include <math.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 // declare a global VM object instead of passing a pointer to the VM to all the
-// functions. We only need one anyway
-VM vm;
+// functions. We only need one per thread anyway
+_Thread_local VM vm;
 
 static void resetStack() { vm.stackTop = vm.stack; }
 
 static void runtimeError(const char *format, ...) {
+  if (vm.quiet) {
+    resetStack();
+    return;
+  }
   // va_list and the ... let us pass an arbitrary number of arguments to this
   // function
   va_list args;
   va_start(args, format);
-  vfprintf(stderr, format, args);
+  vfprintf(vm.errors, format, args);
   va_end(args);
-  fputs("\n", stderr);
+  fputs("\n", vm.errors);
 
   // the interpreter advances past each instruction before executing it. So to
   // find the failing line we need to look into the current bytecode instruction
-  // index minus one
+  // index minus one. lines only has an entry where a new line starts, so we
+  // ask getLine() to find the one covering that instruction
   size_t instruction = vm.ip - vm.chunk->code - 1;
-  int line = vm.chunk->lines[instruction].line;
-  fprintf(stderr, "[line %d] in script\n", line);
+  int line = getLine(vm.chunk, (int)instruction);
+  fprintf(vm.errors, "[line %d] in script\n", line);
+  resetStack();
+  STATS_RUNTIME_ERROR();
+}
+
+// an undeclared global. It is a nil with a payload no real nil has, so it
+// can't be mistaken for one, and it never gets onto the stack
+#define UNDEFINED_VAL ((Value){VAL_NIL, {.integer = 1}})
+#define IS_UNDEFINED(value) (IS_NIL(value) && (value).as.integer == 1)
+
+void initVM() {
+  vm.stack = GROW_ARRAY(Value, NULL, 0, STACK_MAX);
+  vm.stackCapacity = STACK_MAX;
   resetStack();
+  vm.useJit = false;
+  vm.quiet = false;
+  vm.errors = stderr;
+  vm.objects = NULL;
+  initTable(&vm.strings);
+  initTable(&vm.globalNames);
+  initValueArray(&vm.globals);
 }
 
-void initVM() { resetStack(); }
+void freeVM() {
+  FREE_ARRAY(Value, vm.stack, vm.stackCapacity);
+  vm.stack = NULL;
+  vm.stackCapacity = 0;
+  // the names are strings, so they go first
+  freeGlobals();
+  freeObjects();
+}
+
+int globalSlot(ObjString *name) {
+  Value slot;
+  if (tableGet(&vm.globalNames, name, &slot))
+    return (int)AS_INT(slot);
+  if (vm.globals.count == GLOBALS_MAX)
+    return -1;
+  tableSet(&vm.globalNames, name, INT_VAL(vm.globals.count));
+  writeValueArray(&vm.globals, UNDEFINED_VAL);
+  return vm.globals.count - 1;
+}
+
+void freeGlobals() {
+  freeTable(&vm.globalNames);
+  freeValueArray(&vm.globals);
+}
 
-void freeVM() {}
+// only errors and --emit-c need it, so a walk over the table is fast enough
+// and saves keeping the names by slot as well
+const char *globalName(int slot) {
+  for (int i = 0; i < vm.globalNames.capacity; i++) {
+    Entry *entry = &vm.globalNames.entries[i];
+    if (entry->key != NULL && AS_INT(entry->value) == slot)
+      return entry->key->chars;
+  }
+  return "?";
+}
 
 void push(Value value) {
   *vm.stackTop = value;
@@ -53,7 +119,12 @@ Value pop() {
 // 1 is one slot down, etc
 static Value peek(int distance) { return vm.stackTop[-1 - distance]; }
 
-static InterpretResult run() {
+// nil and false are falsey, everything else, 0 included, is truthy
+static bool isFalsey(Value value) {
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static InterpretResult run(Value *result) {
 // these macros are only used in run, so we define them in run()
 
 // ip advances as soon as we read the opcode, before the instruction has been
@@ -77,15 +148,114 @@ static InterpretResult run() {
 // pop 1
 // pop 3
 // push (3-1)
-#define BINARY_OP(valueType, op)                                               \
+// once the operands turned out to be numbers, the instruction is quickened:
+// we overwrite its opcode in the chunk with the number-only version so that
+// the next time this chunk runs it takes the fast path below
+// a double and an integer are done in doubles. That happens with the generic
+// instruction every time, only two doubles are worth quickening for
+#define BINARY_OP(op, quickened)                                               \
   do {                                                                         \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
+    if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {                        \
       runtimeError("Operands must be numbers.");                               \
       return INTERPRET_RUNTIME_ERROR;                                          \
     }                                                                          \
-    double b = AS_NUMBER(pop());                                               \
-    double a = AS_NUMBER(pop());                                               \
-    push(valueType(a op b));                                                   \
+    if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {                            \
+      vm.ip[-1] = quickened;                                                   \
+    }                                                                          \
+    Value b = pop();                                                           \
+    Value a = pop();                                                           \
+    push(NUMBER_VAL(TO_NUMBER(a) op TO_NUMBER(b)));                            \
+  } while (false)
+
+// integer arithmetic on the top two values, which the caller made sure are
+// integers. overflows is the compiler builtin that does the operation and
+// tells whether it overflowed. If it did, the operation is done again in
+// doubles, as if the operands had been doubles to begin with, and the result
+// is a double
+#define INT_ARITHMETIC(op, overflows)                                          \
+  do {                                                                         \
+    int64_t a = vm.stackTop[-2].as.integer;                                    \
+    int64_t b = vm.stackTop[-1].as.integer;                                    \
+    int64_t result;                                                            \
+    if (overflows(a, b, &result)) {                                            \
+      vm.stackTop[-2] = NUMBER_VAL((double)a op (double)b);                    \
+    } else {                                                                   \
+      vm.stackTop[-2].as.integer = result;                                     \
+    }                                                                          \
+    vm.stackTop--;                                                             \
+  } while (false)
+
+// + - and * check for two integers first and quicken to the integer version
+#define ARITHMETIC_OP(op, overflows, quickenedInt, quickened)                  \
+  do {                                                                         \
+    if (IS_INT(peek(0)) && IS_INT(peek(1))) {                                  \
+      vm.ip[-1] = quickenedInt;                                                \
+      INT_ARITHMETIC(op, overflows);                                           \
+      break;                                                                   \
+    }                                                                          \
+    BINARY_OP(op, quickened);                                                  \
+  } while (false)
+
+// the quickened instructions only need one cheap guard: VAL_NUMBER is zero, so
+// OR-ing the two tags together gives zero only if both are numbers
+// the result replaces the left operand in place, it already has the right tag
+// if the guard fails, the instruction is turned back into the generic one and
+// we step ip back so that the generic one runs next and deals with it. (The
+// break only leaves the do while, the one after the macro leaves the switch)
+#define NUMBER_OP(op, generic)                                                 \
+  do {                                                                         \
+    if ((vm.stackTop[-1].type | vm.stackTop[-2].type) != VAL_NUMBER) {         \
+      vm.ip[-1] = generic;                                                     \
+      vm.ip--;                                                                 \
+      break;                                                                   \
+    }                                                                          \
+    vm.stackTop[-2].as.number = vm.stackTop[-2].as.number op                   \
+                                vm.stackTop[-1].as.number;                     \
+    vm.stackTop--;                                                             \
+  } while (false)
+
+// the same for two integers. VAL_INT has both bits set that the other tags
+// use, so AND-ing the tags gives VAL_INT only if both are integers. An
+// overflow doesn't turn the instruction back, it's a matter of the values and
+// not of their types
+#define INT_OP(op, overflows, generic)                                         \
+  do {                                                                         \
+    if ((vm.stackTop[-1].type & vm.stackTop[-2].type) != VAL_INT) {            \
+      vm.ip[-1] = generic;                                                     \
+      vm.ip--;                                                                 \
+      break;                                                                   \
+    }                                                                          \
+    INT_ARITHMETIC(op, overflows);                                             \
+  } while (false)
+
+// the compiler proved that both operands are numbers, nothing to check
+#define UNCHECKED_OP(op)                                                       \
+  do {                                                                         \
+    vm.stackTop[-2].as.number = vm.stackTop[-2].as.number op                   \
+                                vm.stackTop[-1].as.number;                     \
+    vm.stackTop--;                                                             \
+  } while (false)
+
+// the intrinsics: a number, or two, in and a double out. The result goes
+// right where the (left) operand was
+#define MATH_OP(function)                                                      \
+  do {                                                                         \
+    if (!IS_NUMERIC(peek(0))) {                                                \
+      runtimeError("Operand must be a number.");                               \
+      return INTERPRET_RUNTIME_ERROR;                                          \
+    }                                                                          \
+    vm.stackTop[-1] = NUMBER_VAL(function(TO_NUMBER(vm.stackTop[-1])));        \
+  } while (false)
+
+#define MATH_OP2(function)                                                     \
+  do {                                                                         \
+    if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {                        \
+      runtimeError("Operands must be numbers.");                               \
+      return INTERPRET_RUNTIME_ERROR;                                          \
+    }                                                                          \
+    vm.stackTop[-2] = NUMBER_VAL(                                              \
+        function(TO_NUMBER(vm.stackTop[-2]), TO_NUMBER(vm.stackTop[-1])));     \
+    vm.stackTop--;                                                             \
   } while (false)
 
   for (;;) {
@@ -107,6 +277,7 @@ static InterpretResult run() {
     // where the first byte is to get the offset
     disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
 #endif
+    STATS_INSTRUCTION(*vm.ip, (int)(vm.stackTop - vm.stack));
     uint8_t instruction;
     switch (instruction = READ_BYTE()) {
     case OP_CONSTANT: {
@@ -115,23 +286,88 @@ static InterpretResult run() {
       break;
     }
 
+    case OP_CONSTANT_LONG: {
+      // the index is 24 bits, lowest byte first
+      uint32_t index = vm.ip[0] | (vm.ip[1] << 8) | (vm.ip[2] << 16);
+      vm.ip += 3;
+      push(vm.chunk->constants.values[index]);
+      break;
+    }
+
+    case OP_ZERO:
+      push(INT_VAL(0));
+      break;
+
+    case OP_ONE:
+      push(INT_VAL(1));
+      break;
+
+    case OP_SMALL_INT:
+      push(INT_VAL(READ_BYTE()));
+      break;
+
+    case OP_SMALL_INT_LONG: {
+      uint16_t integer = vm.ip[0] | (vm.ip[1] << 8);
+      vm.ip += 2;
+      push(INT_VAL(integer));
+      break;
+    }
+
+    case OP_DUP:
+      push(peek(0));
+      break;
+
+    case OP_PICK:
+      push(peek(READ_BYTE()));
+      break;
+
+    case OP_TUCK: {
+      int distance = READ_BYTE();
+      Value *slot = vm.stackTop - distance;
+      memmove(slot + 1, slot, distance * sizeof(Value));
+      *slot = *vm.stackTop;
+      vm.stackTop++;
+      break;
+    }
+
     case OP_ADD:
-      BINARY_OP(NUMBER_VAL, +);
+      // + also joins two strings. That never gets quickened, the work of
+      // making the new string dwarfs the checks
+      if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+        ObjString *b = AS_STRING(pop());
+        ObjString *a = AS_STRING(pop());
+        push(OBJ_VAL(concatenateStrings(a, b)));
+        break;
+      }
+      if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {
+        runtimeError("Operands must be two numbers or two strings.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ARITHMETIC_OP(+, __builtin_add_overflow, OP_ADD_INT, OP_ADD_NUMBER);
       break;
 
     case OP_SUBTRACT:
-      BINARY_OP(NUMBER_VAL, -);
+      ARITHMETIC_OP(-, __builtin_sub_overflow, OP_SUBTRACT_INT,
+                    OP_SUBTRACT_NUMBER);
       break;
 
     case OP_MULTIPLY:
-      BINARY_OP(NUMBER_VAL, *);
+      ARITHMETIC_OP(*, __builtin_mul_overflow, OP_MULTIPLY_INT,
+                    OP_MULTIPLY_NUMBER);
       break;
 
     case OP_DIVIDE:
-      BINARY_OP(NUMBER_VAL, /);
+      // even two integers give a double
+      BINARY_OP(/, OP_DIVIDE_NUMBER);
       break;
 
     case OP_NEGATE:
+      // the integer version takes care of the integers
+      if (IS_INT(peek(0))) {
+        vm.ip[-1] = OP_NEGATE_INT;
+        vm.ip--;
+        break;
+      }
       // first check if the Value on top of the stack is a number
       if (!IS_NUMBER(peek(0))) {
         runtimeError("Operand must be a number.");
@@ -141,12 +377,157 @@ static InterpretResult run() {
       // get the value to operate on with the pop
       // negate the value
       // push it back onto the stack for later instructions
+      vm.ip[-1] = OP_NEGATE_NUMBER;
       push(NUMBER_VAL(-AS_NUMBER(pop())));
       break;
 
+    case OP_ADD_NUMBER:
+      NUMBER_OP(+, OP_ADD);
+      break;
+
+    case OP_SUBTRACT_NUMBER:
+      NUMBER_OP(-, OP_SUBTRACT);
+      break;
+
+    case OP_MULTIPLY_NUMBER:
+      NUMBER_OP(*, OP_MULTIPLY);
+      break;
+
+    case OP_DIVIDE_NUMBER:
+      NUMBER_OP(/, OP_DIVIDE);
+      break;
+
+    case OP_NEGATE_NUMBER:
+      if (vm.stackTop[-1].type != VAL_NUMBER) {
+        vm.ip[-1] = OP_NEGATE;
+        vm.ip--;
+        break;
+      }
+      vm.stackTop[-1].as.number = -vm.stackTop[-1].as.number;
+      break;
+
+    case OP_ADD_UNCHECKED:
+      UNCHECKED_OP(+);
+      break;
+
+    case OP_SUBTRACT_UNCHECKED:
+      UNCHECKED_OP(-);
+      break;
+
+    case OP_MULTIPLY_UNCHECKED:
+      UNCHECKED_OP(*);
+      break;
+
+    case OP_DIVIDE_UNCHECKED:
+      UNCHECKED_OP(/);
+      break;
+
+    case OP_NEGATE_UNCHECKED:
+      vm.stackTop[-1].as.number = -vm.stackTop[-1].as.number;
+      break;
+
+    case OP_ADD_INT:
+      INT_OP(+, __builtin_add_overflow, OP_ADD);
+      break;
+
+    case OP_SUBTRACT_INT:
+      INT_OP(-, __builtin_sub_overflow, OP_SUBTRACT);
+      break;
+
+    case OP_MULTIPLY_INT:
+      INT_OP(*, __builtin_mul_overflow, OP_MULTIPLY);
+      break;
+
+    case OP_NEGATE_INT:
+      if (vm.stackTop[-1].type != VAL_INT) {
+        vm.ip[-1] = OP_NEGATE;
+        vm.ip--;
+        break;
+      }
+      // the one integer without a negative counterpart
+      if (vm.stackTop[-1].as.integer == INT64_MIN) {
+        vm.stackTop[-1] = NUMBER_VAL(-(double)INT64_MIN);
+      } else {
+        vm.stackTop[-1].as.integer = -vm.stackTop[-1].as.integer;
+      }
+      break;
+
+    case OP_SQRT:
+      MATH_OP(sqrt);
+      break;
+
+    case OP_ABS:
+      MATH_OP(fabs);
+      break;
+
+    case OP_FLOOR:
+      MATH_OP(floor);
+      break;
+
+    case OP_EXP:
+      MATH_OP(exp);
+      break;
+
+    case OP_MIN:
+      MATH_OP2(minNumber);
+      break;
+
+    case OP_MAX:
+      MATH_OP2(maxNumber);
+      break;
+
+    case OP_POW:
+      MATH_OP2(pow);
+      break;
+
+    case OP_EQUAL: {
+      Value b = pop();
+      Value a = pop();
+      push(BOOL_VAL(valuesEqual(a, b)));
+      break;
+    }
+
+    case OP_NOT:
+      push(BOOL_VAL(isFalsey(pop())));
+      break;
+
+    case OP_DEFINE_GLOBAL: {
+      uint16_t slot = vm.ip[0] | (vm.ip[1] << 8);
+      vm.ip += 2;
+      vm.globals.values[slot] = pop();
+      break;
+    }
+
+    case OP_GET_GLOBAL: {
+      uint16_t slot = vm.ip[0] | (vm.ip[1] << 8);
+      vm.ip += 2;
+      Value value = vm.globals.values[slot];
+      if (IS_UNDEFINED(value)) {
+        runtimeError("Undefined variable '%s'.", globalName(slot));
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      push(value);
+      break;
+    }
+
+    case OP_SET_GLOBAL: {
+      uint16_t slot = vm.ip[0] | (vm.ip[1] << 8);
+      vm.ip += 2;
+      // assigning doesn't declare the variable
+      if (IS_UNDEFINED(vm.globals.values[slot])) {
+        runtimeError("Undefined variable '%s'.", globalName(slot));
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      vm.globals.values[slot] = peek(0);
+      break;
+    }
+
+    case OP_POP:
+      pop();
+      break;
+
     case OP_RETURN: {
-      printValue(pop());
-      printf("\n");
+      *result = pop();
       return INTERPRET_OK;
     }
     }
@@ -155,6 +536,28 @@ static InterpretResult run() {
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef BINARY_OP
+#undef INT_ARITHMETIC
+#undef ARITHMETIC_OP
+#undef NUMBER_OP
+#undef INT_OP
+#undef MATH_OP
+#undef MATH_OP2
+#undef UNCHECKED_OP
+}
+
+// how many instructions a run of chunk went through, for phaseTimes. There
+// are no jumps, so that is every instruction when it finished, and those up to
+// and including the one that failed when it didn't. ip still points past
+// that one (the JIT never leaves a run with an error, see jit.h)
+static int instructionsRun(Chunk *chunk, InterpretResult result) {
+  if (result == INTERPRET_COMPILE_ERROR)
+    return 0;
+  int end = result == INTERPRET_OK ? chunk->count : (int)(vm.ip - chunk->code);
+  int count = 0;
+  for (int offset = 0; offset < end; count++) {
+    offset += instructionLength(chunk->code[offset]);
+  }
+  return count;
 }
 
 InterpretResult interpret(const char *source) {
@@ -166,11 +569,70 @@ InterpretResult interpret(const char *source) {
     return INTERPRET_COMPILE_ERROR;
   }
 
-  vm.chunk = &chunk;
-  vm.ip = vm.chunk->code;
-
-  InterpretResult result = run();
+  Value value;
+  uint64_t start = phaseTimes != NULL ? phaseClock() : 0;
+  InterpretResult result = interpretChunk(&chunk, &value);
+  if (phaseTimes != NULL) {
+    phaseTimes->execute = phaseClock() - start;
+    phaseTimes->instructions = instructionsRun(&chunk, result);
+  }
+  if (result == INTERPRET_OK) {
+    writeValue(value);
+    writeOutput("\n", 1);
+  }
 
   freeChunk(&chunk);
   return result;
 }
+
+// runs a verified chunk, through the JIT if it is on and the interpreter
+// if it has to
+static InterpretResult execute(Chunk *chunk, Value *result) {
+  if (vm.useJit) {
+    JitCode *jit = compileJit(chunk);
+    // if the chunk couldn't be translated or one of the type guards fails, we
+    // fall through to the interpreter
+    if (jit->entry != NULL && jit->entry(result)) {
+      return INTERPRET_OK;
+    }
+  }
+
+  // make sure the deepest the chunk's stack can get fits. After this, pushes
+  // in run() can't overflow
+  if (vm.stackCapacity < chunk->maxStack) {
+    int oldCapacity = vm.stackCapacity;
+    vm.stackCapacity = chunk->maxStack;
+    vm.stack = GROW_ARRAY(Value, vm.stack, oldCapacity, vm.stackCapacity);
+  }
+  resetStack();
+
+  vm.chunk = chunk;
+  vm.ip = vm.chunk->code;
+  STATS_RUN_BEGIN();
+  InterpretResult status = run(result);
+  STATS_RUN_END();
+  return status;
+}
+
+InterpretResult interpretChunk(Chunk *chunk, Value *result) {
+  // nothing below checks the bytecode, so it has to be checked here before it
+  // runs for the first time
+  if (!chunk->verified) {
+    if (!verifyChunk(chunk))
+      return INTERPRET_COMPILE_ERROR;
+    chunk->verified = true;
+  }
+
+  // a hit doesn't run anything at all
+  if (memoOptions.enabled && chunk->pure) {
+    if (memoLookup(chunk, result))
+      return INTERPRET_OK;
+    InterpretResult status = execute(chunk, result);
+    if (status == INTERPRET_OK) {
+      memoStore(chunk, *result);
+    }
+    return status;
+  }
+
+  return execute(chunk, result);
+}
@@ -2,10 +2,16 @@
 #define clox_vm_h
 
 #include "chunk.h"
+#include "table.h"
 #include "value.h"
+#include <stdio.h>
 
+// how many slots the stack starts out with. It grows if a chunk needs more
 #define STACK_MAX 256
 
+// the most global variables there can be, the operand is 16 bits
+#define GLOBALS_MAX (UINT16_MAX + 1)
+
 typedef struct {
   Chunk *chunk;
   // a byte pointer
@@ -13,13 +19,37 @@ typedef struct {
   // instead of an integer index because it's faster to dereference a pointer
   // than look up an element in an array by index
   uint8_t *ip; // instruction pointer (aka program counter)
-  Value stack[STACK_MAX];
+  // the stack is sized before a chunk runs, using the chunk's maxStack, so
+  // run() itself never has to check for overflow
+  Value *stack;
+  int stackCapacity;
   // points to the slot __after__ the top item in the stack
   // in other words, it points to where the next value to be pushed will go
   // we can indicate that the stack is empty by pointing at element zero in the
   // array If pointed to the top element, then for an empty stack, we'd need to
   // point at element -1 which is undefined in C
   Value *stackTop;
+  // translate chunks to machine code with the JIT before running them (see
+  // jit.h). Off unless main turns it on
+  bool useJit;
+  // every string there is, so that each one exists only once (see object.h)
+  Table strings;
+  // the head of the list of all heap objects
+  Obj *objects;
+  // global variables. Each name gets a slot the first time the compiler sees
+  // it (see globalSlot()), and the code only refers to the slot, so getting
+  // or setting a global is indexing an array instead of looking up its name
+  // globalNames maps each name to its slot, as an integer
+  Table globalNames;
+  // the values, by slot. A slot whose variable hasn't been declared yet
+  // holds UNDEFINED_VAL
+  ValueArray globals;
+  // set on threads whose errors someone else reports (see rows.h). A
+  // runtime error still ends the run, it just isn't printed
+  bool quiet;
+  // where compile and runtime errors are printed. stderr, except in the
+  // server, which sends them back to the client instead (see server.h)
+  FILE *errors;
 } VM;
 
 typedef enum {
@@ -28,9 +58,26 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
+// each thread has a VM of its own. Only the main thread compiles, and the
+// others run copies of its chunks (see rows.h)
+extern _Thread_local VM vm;
+
 void initVM();
 void freeVM();
 InterpretResult interpret(const char *source);
+// run a chunk that has already been compiled. Instead of printing the value
+// the chunk returns, it is stored in *result. A chunk can be run any number of
+// times this way. With memoOptions.enabled, a pure chunk run again with the
+// same inputs isn't run at all (see memo.h)
+InterpretResult interpretChunk(Chunk *chunk, Value *result);
+// the slot of the global variable with this name, which gets one if it
+// doesn't have one yet. Returns -1 if there are more globals than an
+// instruction can address
+int globalSlot(ObjString *name);
+// the name of the global variable in a slot
+const char *globalName(int slot);
+// forgets every global variable, names and values
+void freeGlobals();
 void push(Value value);
 Value pop();
 